@@ -16,11 +16,17 @@ type LLMCache struct {
 	Threshold float64
 }
 
-const CacheScoreThreshold = 0.95
+const (
+	CacheScoreThreshold = 0.95
+
+	// Suggestions are fetched on every keystroke, so repeated prefixes are
+	// served from the ndb's query cache until the next insert or delete.
+	cacheQueryCacheSize = 1024
+)
 
 func NewLLMCache(modelBazaarDir, modelId string) (*LLMCache, error) {
 	cachePath := filepath.Join(modelBazaarDir, "models", modelId, "llm_cache", "llm_cache.ndb")
-	ndb, err := ndb.New(cachePath)
+	ndb, err := ndb.NewWithOptions(cachePath, ndb.Options{QueryCacheSize: cacheQueryCacheSize})
 	if err != nil {
 		return nil, fmt.Errorf("unable to construct LLM Cache: %v", err)
 	}
@@ -35,7 +41,7 @@ func (c *LLMCache) Close() {
 func (c *LLMCache) Suggestions(query string) ([]string, error) {
 	slog.Info("fetching cache suggestions", "query", query)
 
-	chunks, err := c.Ndb.Query(query, 5, nil)
+	chunks, err := c.Ndb.QueryFields(query, 5, nil, ndb.FieldText)
 	if err != nil {
 		return []string{}, fmt.Errorf("ndb query error: %v", err)
 	}
@@ -144,7 +150,7 @@ func getChunkMetadata(chunk ndb.Chunk) (string, []uint64, error) {
 func (c *LLMCache) Query(query string, expectedReferenceIds []uint64) (string, error) {
 	slog.Info("executing cache request", "query", query)
 
-	chunks, err := c.Ndb.Query(query, 5, nil)
+	chunks, err := c.Ndb.QueryFields(query, 5, nil, ndb.FieldText|ndb.FieldMetadata)
 	if err != nil {
 		return "", fmt.Errorf("ndb query error: %v", err)
 	}
@@ -71,10 +71,12 @@ func runApp() error {
 
 	reporter := deployment.Reporter{BaseClient: client.NewBaseClient(config.ModelBazaarEndpoint, env.JobToken), ModelId: config.ModelId.String()}
 
+	licenseStart := time.Now()
 	err = licensing.ActivateThirdAILicense(config.LicenseKey)
 	if err != nil {
 		return fmt.Errorf("could not activate thirdai license: %w", err)
 	}
+	licenseDuration := time.Since(licenseStart)
 
 	logFile, err := os.OpenFile(filepath.Join(config.ModelBazaarDir, "logs/", config.ModelId.String(), "deployment.log"), os.O_CREATE|os.O_APPEND|os.O_RDWR, 0666)
 	if err != nil {
@@ -87,6 +89,7 @@ func runApp() error {
 	defer logFile.Close()
 
 	deployment.InitLogging(logFile, config)
+	slog.Info("activated thirdai license", "duration", licenseDuration)
 
 	ndbrouter, err := deployment.NewNdbRouter(config, reporter)
 	if err != nil {
@@ -0,0 +1,69 @@
+package deployment
+
+import (
+	"sync"
+	"thirdai_platform/search/ndb"
+
+	"github.com/prometheus/client_golang/prometheus"
+)
+
+var (
+	ndbStageDurationDesc = prometheus.NewDesc(
+		"ndb_stage_duration_seconds", "Latency of the stages of NDB queries and inserts.", []string{"stage"}, nil,
+	)
+	ndbEventsDesc = prometheus.NewDesc(
+		"ndb_events_total", "Counters of the work done by NDB queries and inserts.", []string{"event"}, nil,
+	)
+)
+
+// ndbStatsCollector exports the stage latencies and counters recorded by the
+// ndb, which are read when metrics are scraped rather than observed per request.
+type ndbStatsCollector struct {
+	mu  sync.Mutex
+	ndb *ndb.NeuralDB
+}
+
+func newNdbStatsCollector(db *ndb.NeuralDB) *ndbStatsCollector {
+	return &ndbStatsCollector{ndb: db}
+}
+
+func (c *ndbStatsCollector) Describe(ch chan<- *prometheus.Desc) {
+	ch <- ndbStageDurationDesc
+	ch <- ndbEventsDesc
+}
+
+func (c *ndbStatsCollector) Collect(ch chan<- prometheus.Metric) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	if c.ndb == nil {
+		return
+	}
+	stats := c.ndb.Stats()
+
+	for stage, histogram := range stats.Stages {
+		// Prometheus buckets are cumulative, and the last bucket of the ndb
+		// histogram has no upper bound so it is only included in the count.
+		buckets := make(map[float64]uint64, len(histogram.Buckets)-1)
+		total := uint64(0)
+		for i := 0; i < len(histogram.Buckets)-1; i++ {
+			total += histogram.Buckets[i]
+			buckets[ndb.LatencyBucketBound(i).Seconds()] = total
+		}
+		ch <- prometheus.MustNewConstHistogram(
+			ndbStageDurationDesc, histogram.Count, histogram.Sum.Seconds(), buckets, stage,
+		)
+	}
+
+	for event, value := range stats.Counters {
+		ch <- prometheus.MustNewConstMetric(ndbEventsDesc, prometheus.CounterValue, float64(value), event)
+	}
+}
+
+// close stops the collector from reading the ndb, so that the ndb can be freed
+// even if a scrape is in progress.
+func (c *ndbStatsCollector) close() {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	c.ndb = nil
+}
@@ -56,6 +56,9 @@ type NdbRouter struct {
 	Permissions PermissionsInterface
 	LLMCache    *LLMCache
 	LLM         llm_generation.LLM
+
+	// Exports the ndb's stats on /metrics, nil if they are not exported.
+	stats *ndbStatsCollector
 }
 
 func InitLogging(logFile *os.File, config *config.DeployConfig) {
@@ -78,11 +81,18 @@ func InitLogging(logFile *os.File, config *config.DeployConfig) {
 
 func NewNdbRouter(config *config.DeployConfig, reporter Reporter) (*NdbRouter, error) {
 	ndbPath := filepath.Join(config.ModelBazaarDir, "models", config.ModelId.String(), "model", "model.ndb")
-	ndb, err := ndb.New(ndbPath)
+	// Replicas that only serve queries can open the model in place in read only
+	// mode, which avoids copying it and lets replicas on a node share it.
+	readOnly := config.Options["read_only"] == "true"
+	ndb, err := ndb.NewWithOptions(ndbPath, ndb.Options{ReadOnly: readOnly})
 	if err != nil {
 		slog.Error("failed to open ndb", "error", err, "code", logging.MODEL_INIT)
 		return nil, fmt.Errorf("failed to open ndb: %v", err)
 	}
+	timings := ndb.OpenTimings()
+	slog.Info("opened ndb", "read_only", readOnly, "total", timings.Total, "engine", timings.Engine,
+		"metadata_index", timings.MetadataIndex, "vector_index", timings.VectorIndex, "doc_catalog", timings.DocCatalog,
+		"chunk_store", timings.ChunkStore, "ingest_queue", timings.IngestQueue)
 
 	var llmCache *LLMCache
 	var llm llm_generation.LLM
@@ -102,17 +112,30 @@ func NewNdbRouter(config *config.DeployConfig, reporter Reporter) (*NdbRouter, e
 		}
 	}
 
-	return &NdbRouter{
+	router := &NdbRouter{
 		Ndb:         ndb,
 		Config:      config,
 		Reporter:    reporter,
 		Permissions: &Permissions{config.ModelBazaarEndpoint, config.ModelId},
 		LLMCache:    llmCache,
 		LLM:         llm,
-	}, nil
+	}
+
+	stats := newNdbStatsCollector(&router.Ndb)
+	if err := prometheus.Register(stats); err != nil {
+		slog.Warn("failed to register ndb stats metrics", "error", err)
+	} else {
+		router.stats = stats
+	}
+
+	return router, nil
 }
 
 func (s *NdbRouter) Close() {
+	if s.stats != nil {
+		prometheus.Unregister(s.stats)
+		s.stats.close()
+	}
 	s.Ndb.Free()
 	if s.LLMCache != nil {
 		s.LLMCache.Close()
@@ -23,9 +23,15 @@ var (
 )
 
 type DNDB struct {
+	// The ndb serializes updates internally and allows queries to run
+	// concurrently with all but deletions, so this lock only guards against the ndb being
+	// replaced and freed by Restore while it is in use.
 	sync.RWMutex
 
 	ndb ndb.NeuralDB
+	// The options the ndb is opened with, including when it is replaced by a
+	// snapshot.
+	ndbOptions ndb.Options
 
 	raft            *raft.Raft
 	lastUpdateIndex atomic.Uint64
@@ -45,6 +51,14 @@ type RaftConfig struct {
 	LogStore      raft.LogStore
 	StableStore   raft.StableStore
 	Bootstrap     bool
+
+	// Buffers feedback in the ndb of each replica instead of applying each
+	// feedback entry as it is committed, see ndb.Options.BufferFeedback. The
+	// feedback is applied in batches of FeedbackBatchSize, if it is not 0, and
+	// by ApplyPendingFeedback, which are cut at the same entries on every
+	// replica so that the replicas stay identical.
+	BufferFeedback    bool
+	FeedbackBatchSize int
 }
 
 func CreateTcpTransport(bindAddr string) (raft.Transport, error) {
@@ -78,6 +92,9 @@ func New(ndbPath string, localNdbStore string, config RaftConfig) (*DNDB, error)
 		bindAddr:      config.BindAddr,
 		localNdbStore: localNdbStore,
 		logger:        logger,
+		ndbOptions: ndb.Options{
+			BufferFeedback: config.BufferFeedback, FeedbackBatchSize: config.FeedbackBatchSize,
+		},
 	}
 
 	ra, err := raft.NewRaft(raftConfig, (*distributedNdbFSM)(dndb), config.LogStore, config.StableStore, config.SnapshotStore, config.Transport)
@@ -110,7 +127,7 @@ func New(ndbPath string, localNdbStore string, config RaftConfig) (*DNDB, error)
 		return nil, fmt.Errorf("error making replica of ndb: %w", err)
 	}
 
-	dndb.ndb, err = ndb.New(ndbCopyPath)
+	dndb.ndb, err = ndb.NewWithOptions(ndbCopyPath, dndb.ndbOptions)
 	if err != nil {
 		logger.Error("[DNDB]: error opening ndb", "error", err)
 		return nil, fmt.Errorf("error opening ndb: %w", err)
@@ -208,18 +225,16 @@ type UpdateResult struct {
 }
 
 func (dndb *DNDB) Insert(document, docId string, chunks []string, metadata []map[string]interface{}) (UpdateResult, error) {
-	// This is a little bit of a leaky abstraction but performing this check here is
-	// so that we don't have to wait for raft to apply the insert to find out if the
-	// args are valid.
-	if err := ndb.CheckInsertArgs(document, docId, chunks, metadata); err != nil {
+	// Encoding the document checks the args, so that we don't have to wait for
+	// raft to apply the insert to find out if they are valid.
+	encoded, err := ndb.EncodeDocuments([]ndb.Document{
+		{Document: document, DocId: docId, Chunks: chunks, Metadata: metadata},
+	})
+	if err != nil {
 		return UpdateResult{}, err
 	}
 
-	op := UpdateOp{
-		Insert: &InsertOp{
-			Document: document, DocId: docId, Chunks: chunks, Metadata: metadata,
-		},
-	}
+	op := UpdateOp{Insert: &InsertOp{Encoded: encoded}}
 
 	return dndb.applyUpdate(op)
 }
@@ -247,6 +262,46 @@ func (dndb *DNDB) Associate(source, target string, strength uint32) (UpdateResul
 	return dndb.applyUpdate(op)
 }
 
+// Finetune applies a batch of feedback, where each query can be associated
+// with several chunks, as a single update.
+func (dndb *DNDB) Finetune(queries []string, labels [][]uint64) (UpdateResult, error) {
+	if err := ndb.CheckFinetuneMultiLabelArgs(queries, labels); err != nil {
+		return UpdateResult{}, err
+	}
+
+	op := UpdateOp{
+		Finetune: &FinetuneOp{
+			Queries: queries, Labels: labels,
+		},
+	}
+
+	return dndb.applyUpdate(op)
+}
+
+// AssociateBatch applies a batch of associations as a single update.
+func (dndb *DNDB) AssociateBatch(sources, targets []string, strength uint32) (UpdateResult, error) {
+	if err := ndb.CheckAssociateArgs(sources, targets); err != nil {
+		return UpdateResult{}, err
+	}
+	if strength == 0 {
+		strength = ndb.DefaultAssociateStrength
+	}
+
+	op := UpdateOp{
+		AssociateBatch: &AssociateBatchOp{
+			Sources: sources, Targets: targets, Strength: strength,
+		},
+	}
+
+	return dndb.applyUpdate(op)
+}
+
+// ApplyPendingFeedback applies the feedback buffered by every replica, see
+// RaftConfig.BufferFeedback.
+func (dndb *DNDB) ApplyPendingFeedback() (UpdateResult, error) {
+	return dndb.applyUpdate(UpdateOp{ApplyFeedback: &ApplyFeedbackOp{}})
+}
+
 func (dndb *DNDB) Delete(docId string, keepLatestVersion bool) (UpdateResult, error) {
 	op := UpdateOp{
 		Delete: &DeleteOp{
@@ -296,19 +351,28 @@ func (dndb *DNDB) LastUpdateIndex() uint64 {
 }
 
 func (dndb *DNDB) Query(query string, topk int, constraints ndb.Constraints) ([]ndb.Chunk, error) {
-	dndb.RLock() // Prevent snapshots while reading from ndb
+	dndb.RLock() // Prevent the ndb from being replaced while reading from it
 	defer dndb.RUnlock()
 
 	return dndb.ndb.Query(query, topk, constraints)
 }
 
 func (dndb *DNDB) Sources() ([]ndb.Source, error) {
-	dndb.RLock() // Prevent snapshots while reading from ndb
+	dndb.RLock() // Prevent the ndb from being replaced while reading from it
 	defer dndb.RUnlock()
 
 	return dndb.ndb.Sources()
 }
 
+// PendingFeedback returns the number of pieces of feedback buffered by the ndb
+// of this replica, see RaftConfig.BufferFeedback.
+func (dndb *DNDB) PendingFeedback() int {
+	dndb.RLock() // Prevent the ndb from being replaced while reading from it
+	defer dndb.RUnlock()
+
+	return dndb.ndb.PendingFeedback()
+}
+
 // The FSM methods need to be public to be called by raft, but defining them on
 // a non exported type ensures that they cannot be called outside of this package.
 type distributedNdbFSM DNDB
@@ -322,11 +386,16 @@ func (dndb *distributedNdbFSM) Apply(raftLog *raft.Log) interface{} {
 		return err
 	}
 
-	dndb.RLock() // Prevent snapshots while applying entries
+	dndb.RLock() // Prevent the ndb from being replaced while applying entries
 	defer dndb.RUnlock()
 
 	if op.Insert != nil {
-		err := dndb.ndb.Insert(op.Insert.Document, op.Insert.DocId, op.Insert.Chunks, op.Insert.Metadata, nil)
+		var err error
+		if op.Insert.Encoded != nil {
+			err = dndb.ndb.InsertEncoded(op.Insert.Encoded)
+		} else {
+			err = dndb.ndb.Insert(op.Insert.Document, op.Insert.DocId, op.Insert.Chunks, op.Insert.Metadata, nil)
+		}
 		if err != nil {
 			dndb.logger.Error("[DNDB]: ndb insert failed", "index", raftLog.Index, "error", err)
 			return fmt.Errorf("ndb insert failed: %w", err)
@@ -357,6 +426,30 @@ func (dndb *distributedNdbFSM) Apply(raftLog *raft.Log) interface{} {
 		}
 	}
 
+	if op.Finetune != nil {
+		err := dndb.ndb.FinetuneMultiLabel(op.Finetune.Queries, op.Finetune.Labels)
+		if err != nil {
+			dndb.logger.Error("[DNDB]: ndb finetune failed", "index", raftLog.Index, "error", err)
+			return fmt.Errorf("ndb finetune failed: %w", err)
+		}
+	}
+
+	if op.AssociateBatch != nil {
+		err := dndb.ndb.Associate(op.AssociateBatch.Sources, op.AssociateBatch.Targets, op.AssociateBatch.Strength)
+		if err != nil {
+			dndb.logger.Error("[DNDB]: ndb associate failed", "index", raftLog.Index, "error", err)
+			return fmt.Errorf("ndb associate failed: %w", err)
+		}
+	}
+
+	if op.ApplyFeedback != nil {
+		err := dndb.ndb.ApplyPendingFeedback()
+		if err != nil {
+			dndb.logger.Error("[DNDB]: ndb apply feedback failed", "index", raftLog.Index, "error", err)
+			return fmt.Errorf("ndb apply feedback failed: %w", err)
+		}
+	}
+
 	dndb.lastUpdateIndex.Store(raftLog.Index)
 
 	dndb.logger.Info("[DNDB]: update applied to fsm", "index", raftLog.Index)
@@ -365,8 +458,10 @@ func (dndb *distributedNdbFSM) Apply(raftLog *raft.Log) interface{} {
 }
 
 func (dndb *distributedNdbFSM) Snapshot() (raft.FSMSnapshot, error) {
-	dndb.Lock()
-	defer dndb.Unlock()
+	// Saving is serialized with updates by the ndb and does not block queries,
+	// so this only needs to prevent the ndb from being replaced.
+	dndb.RLock()
+	defer dndb.RUnlock()
 
 	dndb.logger.Info("[DNDB]: fsm creating snapshot")
 
@@ -431,7 +526,7 @@ func (dndb *distributedNdbFSM) Restore(snapshotReader io.ReadCloser) error {
 		}
 	}
 
-	snapshotNdb, err := ndb.New(snapshotPath)
+	snapshotNdb, err := ndb.NewWithOptions(snapshotPath, dndb.ndbOptions)
 	if err != nil {
 		dndb.logger.Error("[DNDB]: error loading ndb from snapshot", "path", snapshotPath, "error", err)
 		return fmt.Errorf("error loading ndb from snapshot: %w", err)
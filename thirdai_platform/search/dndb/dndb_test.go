@@ -87,7 +87,19 @@ func createTransports(nNodes int) []*raft.InmemTransport {
 }
 
 func createCluster(t *testing.T, transports []*raft.InmemTransport, ndbPath string) []*dndb.DNDB {
-	leader, err := dndb.New(ndbPath, t.TempDir(), createConfig("node0", transports[0], true))
+	return createClusterWithConfig(t, transports, ndbPath, func(*dndb.RaftConfig) {})
+}
+
+// createClusterWithConfig creates a cluster whose replicas are configured by
+// configure after the config is created.
+func createClusterWithConfig(t *testing.T, transports []*raft.InmemTransport, ndbPath string, configure func(*dndb.RaftConfig)) []*dndb.DNDB {
+	config := func(id string, transport raft.Transport, bootstrap bool) dndb.RaftConfig {
+		config := createConfig(id, transport, bootstrap)
+		configure(&config)
+		return config
+	}
+
+	leader, err := dndb.New(ndbPath, t.TempDir(), config("node0", transports[0], true))
 	if err != nil {
 		t.Fatal(err)
 	}
@@ -98,7 +110,7 @@ func createCluster(t *testing.T, transports []*raft.InmemTransport, ndbPath stri
 
 	for i := 1; i < len(transports); i++ {
 		id := fmt.Sprintf("node%d", i)
-		follower, err := dndb.New(ndbPath, t.TempDir(), createConfig(id, transports[i], false))
+		follower, err := dndb.New(ndbPath, t.TempDir(), config(id, transports[i], false))
 		if err != nil {
 			t.Fatalf("error creating follower: %v", err)
 		}
@@ -525,3 +537,137 @@ func TestComplicatedUpdates(t *testing.T) {
 		}
 	}
 }
+
+// checkPendingFeedback checks that every node has the same number of pieces of
+// buffered feedback.
+func checkPendingFeedback(t *testing.T, cluster testCluster, expected int) {
+	for _, node := range cluster {
+		if pending := node.PendingFeedback(); pending != expected {
+			t.Fatalf("expected replica %s to have %d pending feedback, got %d", node.ReplicaID(), expected, pending)
+		}
+	}
+}
+
+// queryAll returns the results of the query on every node, after checking
+// that every node returns the same results.
+func queryAll(t *testing.T, cluster testCluster, query string) []ndb.Chunk {
+	var expected []ndb.Chunk
+	for i, node := range cluster {
+		results, err := node.Query(query, 5, nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if i == 0 {
+			expected = results
+			continue
+		}
+		if len(results) != len(expected) {
+			t.Fatalf("replica %s returned %v for %q, expected %v", node.ReplicaID(), results, query, expected)
+		}
+		for j := range results {
+			if results[j].Id != expected[j].Id || results[j].Score != expected[j].Score {
+				t.Fatalf("replica %s returned %v for %q, expected %v", node.ReplicaID(), results, query, expected)
+			}
+		}
+	}
+	return expected
+}
+
+func TestBufferedFeedbackReplication(t *testing.T) {
+	ndbPath := createSimpleNdb(t, true)
+
+	transports := createTransports(3)
+	cluster := createClusterWithConfig(t, transports, ndbPath, func(config *dndb.RaftConfig) {
+		config.BufferFeedback = true
+		config.FeedbackBatchSize = 4
+	})
+
+	leader := waitForLeader(t, 10*time.Second, cluster)
+
+	var updateIdx uint64
+	for i := 0; i < 10; i++ {
+		update, err := leader.Insert(fmt.Sprintf("doc-%d", i), fmt.Sprintf("id-%d", i), []string{fmt.Sprintf("a%d b%d", i, i), fmt.Sprintf("c%d d%d", i, i)}, nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+		updateIdx = update.Index
+	}
+	for _, node := range cluster {
+		waitForUpdate(t, 10*time.Second, node, updateIdx)
+	}
+
+	labels := make([]uint64, 10)
+	for i := range labels {
+		results := queryAll(t, cluster, fmt.Sprintf("c%d d%d", i, i))
+		if len(results) == 0 || results[0].Text != fmt.Sprintf("c%d d%d", i, i) {
+			t.Fatalf("unexpected results for chunk %d: %v", i, results)
+		}
+		labels[i] = results[0].Id
+	}
+
+	// Three pieces of feedback stay buffered on every replica.
+	if _, err := leader.Finetune([]string{"zz0", "zz1"}, [][]uint64{{labels[0]}, {labels[1]}}); err != nil {
+		t.Fatal(err)
+	}
+	update, err := leader.Upvote("zz2", labels[2])
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, node := range cluster {
+		waitForUpdate(t, 10*time.Second, node, update.Index)
+	}
+	checkPendingFeedback(t, cluster, 3)
+	for i := 0; i < 3; i++ {
+		if results := queryAll(t, cluster, fmt.Sprintf("zz%d", i)); len(results) != 0 {
+			t.Fatalf("expected buffered feedback to not be applied, got %v", results)
+		}
+	}
+
+	// The fourth piece of feedback fills the batch, which every replica
+	// applies at the same entry.
+	update, err = leader.AssociateBatch([]string{"zz3"}, []string{"c3 d3"}, 0)
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, node := range cluster {
+		waitForUpdate(t, 10*time.Second, node, update.Index)
+	}
+	checkPendingFeedback(t, cluster, 0)
+	for i := 0; i < 4; i++ {
+		results := queryAll(t, cluster, fmt.Sprintf("zz%d", i))
+		if len(results) == 0 || results[0].Id != labels[i] {
+			t.Fatalf("expected feedback for chunk %d to be applied, got %v", labels[i], results)
+		}
+	}
+
+	// Feedback that does not fill a batch is applied by ApplyPendingFeedback,
+	// and repeated feedback is only applied once.
+	for i := 4; i < 6; i++ {
+		if _, err := leader.Associate(fmt.Sprintf("zz%d", i), fmt.Sprintf("c%d d%d", i, i), 0); err != nil {
+			t.Fatal(err)
+		}
+	}
+	update, err = leader.Associate("zz5", "c5 d5", 0)
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, node := range cluster {
+		waitForUpdate(t, 10*time.Second, node, update.Index)
+	}
+	checkPendingFeedback(t, cluster, 3)
+
+	update, err = leader.ApplyPendingFeedback()
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, node := range cluster {
+		waitForUpdate(t, 10*time.Second, node, update.Index)
+	}
+	checkPendingFeedback(t, cluster, 0)
+	for i := 0; i < 6; i++ {
+		results := queryAll(t, cluster, fmt.Sprintf("zz%d", i))
+		if len(results) == 0 || results[0].Id != labels[i] {
+			t.Fatalf("expected feedback for chunk %d to be applied, got %v", labels[i], results)
+		}
+	}
+}
@@ -6,7 +6,12 @@ import (
 	"fmt"
 )
 
+// InsertOp holds the document in the binary encoding of ndb.EncodeDocuments,
+// which the leader encodes once and followers pass to the ndb as is. The other
+// fields are only set by entries written before the encoding was introduced.
 type InsertOp struct {
+	Encoded []byte
+
 	Document string
 	DocId    string
 	Chunks   []string
@@ -29,11 +34,32 @@ type AssociateOp struct {
 	Strength uint32
 }
 
+// FinetuneOp applies a batch of feedback in a single raft entry, where each
+// query can be associated with several chunks.
+type FinetuneOp struct {
+	Queries []string
+	Labels  [][]uint64
+}
+
+// AssociateBatchOp applies a batch of associations in a single raft entry.
+type AssociateBatchOp struct {
+	Sources  []string
+	Targets  []string
+	Strength uint32
+}
+
+// ApplyFeedbackOp applies the feedback buffered by the ndb of each replica, so
+// that every replica applies the same batch at the same entry.
+type ApplyFeedbackOp struct{}
+
 type UpdateOp struct {
-	Insert    *InsertOp
-	Delete    *DeleteOp
-	Upvote    *UpvoteOp
-	Associate *AssociateOp
+	Insert         *InsertOp
+	Delete         *DeleteOp
+	Upvote         *UpvoteOp
+	Associate      *AssociateOp
+	Finetune       *FinetuneOp
+	AssociateBatch *AssociateBatchOp
+	ApplyFeedback  *ApplyFeedbackOp
 }
 
 func (op *UpdateOp) Op() string {
@@ -46,6 +72,12 @@ func (op *UpdateOp) Op() string {
 		return "upvote"
 	case op.Associate != nil:
 		return "associate"
+	case op.Finetune != nil:
+		return "finetune"
+	case op.AssociateBatch != nil:
+		return "associate_batch"
+	case op.ApplyFeedback != nil:
+		return "apply_feedback"
 	default:
 		return "unknown"
 	}
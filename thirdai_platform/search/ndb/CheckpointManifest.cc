@@ -0,0 +1,176 @@
+#include "CheckpointManifest.h"
+#include "Serialization.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+constexpr uint32_t MANIFEST_VERSION = 1;
+
+// Hashes the first size bytes of the file, or the whole file if it has been
+// truncated to fewer bytes, and sets size to the number of bytes hashed.
+uint64_t hashFile(const std::filesystem::path &path, uint64_t &size) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("unable to open file '" + path.string() + "'");
+  }
+
+  std::vector<char> buffer(1 << 20);
+  uint64_t hash = FNV_OFFSET;
+  uint64_t hashed = 0;
+  while (file && hashed < size) {
+    file.read(buffer.data(), std::min<uint64_t>(buffer.size(), size - hashed));
+    hash = fnv1a(hash, buffer.data(), file.gcount());
+    hashed += file.gcount();
+  }
+  if (file.bad()) {
+    throw std::runtime_error("error reading file '" + path.string() + "'");
+  }
+  size = hashed;
+  return hash;
+}
+
+// RocksDB never modifies SST or blob files once they are written, and never
+// reuses their names, so their hashes can be cached by path and size.
+bool isImmutable(const std::filesystem::path &path) {
+  auto extension = path.extension();
+  return extension == ".sst" || extension == ".blob";
+}
+
+} // namespace
+
+CheckpointManifest::CheckpointManifest(std::vector<File> files)
+    : _files(std::move(files)) {
+  std::string data = serialize();
+  char id[17];
+  std::snprintf(id, sizeof(id), "%016llx",
+                static_cast<unsigned long long>(
+                    fnv1a(FNV_OFFSET, data.data(), data.size())));
+  _id = id;
+}
+
+CheckpointManifest CheckpointManifest::build(const std::string &checkpoint_path,
+                                             HashCache &cache) {
+  std::filesystem::path root(checkpoint_path);
+
+  // The files and their sizes are listed before any of them are hashed, and
+  // each file is hashed up to the size it was listed with, so that records
+  // appended to the logs of an ndb that is saved into its own directory while
+  // the manifest is built are not in the checkpoint, and the size and hash of
+  // each file describe the same bytes.
+  std::vector<File> files;
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator(root)) {
+    if (!entry.is_regular_file()) {
+      continue;
+    }
+
+    std::string path = entry.path().lexically_relative(root).generic_string();
+    if (path == FILENAME) {
+      continue;
+    }
+    files.push_back({std::move(path), entry.file_size(), 0});
+  }
+
+  HashCache used;
+  for (auto &file : files) {
+    auto full_path = root / file.path;
+    if (isImmutable(full_path)) {
+      std::string key = file.path + ":" + std::to_string(file.size);
+      auto it = cache.find(key);
+      file.hash =
+          it != cache.end() ? it->second : hashFile(full_path, file.size);
+      used.emplace(std::move(key), file.hash);
+    } else {
+      file.hash = hashFile(full_path, file.size);
+    }
+  }
+
+  std::sort(files.begin(), files.end(),
+            [](const File &a, const File &b) { return a.path < b.path; });
+
+  // Files that are not in this checkpoint have been compacted away and will
+  // not appear in later checkpoints, so they are dropped from the cache.
+  cache = std::move(used);
+
+  return CheckpointManifest(std::move(files));
+}
+
+CheckpointManifest CheckpointManifest::load(const std::string &manifest_path) {
+  std::string data = readFile(manifest_path);
+  BinaryReader reader(data);
+
+  uint32_t version = reader.readFixed<uint32_t>();
+  if (version != MANIFEST_VERSION) {
+    throw std::runtime_error("unsupported checkpoint manifest version " +
+                             std::to_string(version));
+  }
+
+  std::vector<File> files(reader.readVarint());
+  for (auto &file : files) {
+    file.path = reader.readString();
+    file.size = reader.readVarint();
+    file.hash = reader.readFixed<uint64_t>();
+  }
+
+  if (!reader.done()) {
+    throw std::runtime_error("unexpected data after checkpoint manifest");
+  }
+
+  return CheckpointManifest(std::move(files));
+}
+
+void CheckpointManifest::write(const std::string &checkpoint_path) const {
+  writeFile((std::filesystem::path(checkpoint_path) / FILENAME).string(),
+            serialize());
+}
+
+std::vector<std::string> CheckpointManifest::files() const {
+  std::vector<std::string> paths;
+  paths.reserve(_files.size());
+  for (const auto &file : _files) {
+    paths.push_back(file.path);
+  }
+  return paths;
+}
+
+std::vector<std::string>
+CheckpointManifest::delta(const CheckpointManifest &base) const {
+  std::unordered_map<std::string_view, const File *> base_files;
+  for (const auto &file : base._files) {
+    base_files.emplace(file.path, &file);
+  }
+
+  std::vector<std::string> changed;
+  for (const auto &file : _files) {
+    auto it = base_files.find(file.path);
+    if (it == base_files.end() || it->second->size != file.size ||
+        it->second->hash != file.hash) {
+      changed.push_back(file.path);
+    }
+  }
+  return changed;
+}
+
+std::string CheckpointManifest::serialize() const {
+  BinaryWriter writer;
+  writer.writeFixed<uint32_t>(MANIFEST_VERSION);
+  writer.writeVarint(_files.size());
+  for (const auto &file : _files) {
+    writer.writeString(file.path);
+    writer.writeVarint(file.size);
+    writer.writeFixed<uint64_t>(file.hash);
+  }
+  return std::move(writer.buffer());
+}
+
+} // namespace thirdai::search::ndb
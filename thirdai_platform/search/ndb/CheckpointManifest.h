@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+/**
+ * Lists the files of a saved ndb with their sizes and content hashes, so that
+ * a checkpoint can be transferred incrementally: the engine hard links its
+ * immutable SST files into every checkpoint, so consecutive checkpoints share
+ * most of their files, and only the files that are not in a checkpoint the
+ * receiver already has need to be transferred.
+ *
+ * The manifest is stored in the checkpoint directory as FILENAME, and is not
+ * itself listed in the manifest.
+ */
+class CheckpointManifest {
+public:
+  static constexpr const char *FILENAME = "checkpoint_manifest";
+
+  /**
+   * Hashes of immutable files keyed by their path and size. Passing the same
+   * cache to consecutive builds means that files shared by the checkpoints are
+   * only read and hashed once.
+   */
+  using HashCache = std::unordered_map<std::string, uint64_t>;
+
+  /**
+   * Builds the manifest of the checkpoint in checkpoint_path. Each file is
+   * described by its contents up to the size it had when the files of the
+   * checkpoint were listed, so a log that is appended to while the manifest is
+   * built, or after it is built, is described by the prefix that was written
+   * when the checkpoint was saved. Copies of such a log can be longer than
+   * its size in the manifest, and the records after that size are not part of
+   * the checkpoint.
+   */
+  static CheckpointManifest build(const std::string &checkpoint_path,
+                                  HashCache &cache);
+
+  /**
+   * Loads a manifest that was written to manifest_path, which need not be in
+   * the directory of the checkpoint it describes.
+   */
+  static CheckpointManifest load(const std::string &manifest_path);
+
+  /**
+   * Writes the manifest to FILENAME in checkpoint_path.
+   */
+  void write(const std::string &checkpoint_path) const;
+
+  /**
+   * An identifier derived from the contents of every file in the checkpoint.
+   */
+  const std::string &id() const { return _id; }
+
+  std::vector<std::string> files() const;
+
+  /**
+   * Returns the files in this checkpoint that do not have the same path and
+   * contents in base, which are the files that must be transferred to turn a
+   * copy of base into a copy of this checkpoint. Files in base that are not
+   * listed in this manifest are not part of this checkpoint.
+   */
+  std::vector<std::string> delta(const CheckpointManifest &base) const;
+
+private:
+  struct File {
+    std::string path;
+    uint64_t size;
+    uint64_t hash;
+  };
+
+  explicit CheckpointManifest(std::vector<File> files);
+
+  std::string serialize() const;
+
+  std::vector<File> _files;
+  std::string _id;
+};
+
+} // namespace thirdai::search::ndb
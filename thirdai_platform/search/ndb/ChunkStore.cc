@@ -0,0 +1,631 @@
+#include "ChunkStore.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+// The number of bytes a cursor reads from the chunks file at a time. A page
+// is larger if it has to hold a single chunk that is larger than this.
+constexpr size_t PAGE_BYTES = 1 << 20;
+
+enum class LogOp : uint8_t { Insert, DeleteDocVersion, DeleteDoc };
+
+std::string snapshotPath(const std::string &save_path) {
+  return (std::filesystem::path(save_path) / "chunk_store").string();
+}
+
+std::string logPath(const std::string &save_path) {
+  return (std::filesystem::path(save_path) / "chunk_store.log").string();
+}
+
+std::string chunksPath(const std::string &save_path, uint64_t generation) {
+  return (std::filesystem::path(save_path) /
+          ("chunk_store.chunks." + std::to_string(generation)))
+      .string();
+}
+
+uint32_t recordLen(const char *data) {
+  uint32_t len;
+  std::memcpy(&len, data, sizeof(len));
+  return len;
+}
+
+} // namespace
+
+ChunkCursor::ChunkCursor(const ChunkStore &store, uint64_t snapshot,
+                         ChunkId start_id,
+                         std::unique_ptr<CompiledConstraints> constraints,
+                         std::optional<std::vector<ChunkId>> doc_extents)
+    : _store(store), _snapshot(snapshot), _doc_extents(std::move(doc_extents)),
+      _constraints(std::move(constraints)), _next_id(start_id) {}
+
+ChunkCursor::~ChunkCursor() { _store.releaseCursor(_snapshot); }
+
+std::vector<Chunk> ChunkCursor::next(size_t max_chunks) {
+  std::vector<Chunk> chunks;
+  while (chunks.size() < max_chunks) {
+    if (_page_pos == _page.size() && !loadPage()) {
+      break;
+    }
+
+    BinaryReader in(std::string_view(_page).substr(_page_pos));
+    uint32_t len = in.readFixed<uint32_t>();
+    BinaryReader record(in.readBytes(len));
+    _page_pos += sizeof(uint32_t) + len;
+
+    ChunkId id = _page_id++;
+    if (id < _next_id) {
+      continue;
+    }
+    _next_id = id + 1;
+
+    Chunk chunk = decodeChunk(record, id);
+    if (_constraints && !_constraints->matches(chunk.metadata)) {
+      continue;
+    }
+    chunks.push_back(std::move(chunk));
+  }
+  return chunks;
+}
+
+bool ChunkCursor::loadPage() {
+  while (true) {
+    if (_extent && _extent_read < _extent->len) {
+      uint64_t offset = _extent->offset + _extent_read;
+      _page.resize(std::min<uint64_t>(_extent->len - _extent_read, PAGE_BYTES));
+      _store._chunks->read(_page.data(), _page.size(), offset);
+
+      // The page is cut after the last whole record, or extended to hold the
+      // first record if it does not fit.
+      size_t whole = 0;
+      while (whole + sizeof(uint32_t) <= _page.size()) {
+        size_t end = whole + sizeof(uint32_t) + recordLen(_page.data() + whole);
+        if (end > _page.size()) {
+          break;
+        }
+        whole = end;
+      }
+      if (whole == 0) {
+        whole = sizeof(uint32_t) + recordLen(_page.data());
+        _page.resize(whole);
+        _store._chunks->read(_page.data(), _page.size(), offset);
+      }
+
+      _page.resize(whole);
+      _page_pos = 0;
+      _extent_read += whole;
+      return true;
+    }
+
+    if (_extent) {
+      _next_id = std::max(_next_id, _extent->end);
+    }
+    _extent = nextExtent();
+    if (!_extent) {
+      return false;
+    }
+    _extent_read = 0;
+    _page_id = _extent->start;
+  }
+}
+
+std::optional<ChunkCursor::Extent> ChunkCursor::nextExtent() const {
+  std::shared_lock lock(_store._mutex);
+
+  auto usable = [&](auto it) {
+    return it->second.visibleAt(_snapshot) && it->second.end > _next_id;
+  };
+  auto extent = [](auto it) {
+    return Extent{it->first, it->second.end, it->second.offset,
+                  it->second.len};
+  };
+
+  const auto &extents = _store._extents;
+
+  if (_doc_extents) {
+    // The extents of the document cannot be removed while the cursor can see
+    // them.
+    for (ChunkId start : *_doc_extents) {
+      auto it = extents.find(start);
+      if (it != extents.end() && usable(it)) {
+        return extent(it);
+      }
+    }
+    return std::nullopt;
+  }
+
+  // The extent before the first extent that starts after _next_id may contain
+  // it.
+  auto it = extents.upper_bound(_next_id);
+  if (it != extents.begin() && usable(std::prev(it))) {
+    return extent(std::prev(it));
+  }
+  for (; it != extents.end(); ++it) {
+    if (usable(it)) {
+      return extent(it);
+    }
+  }
+  return std::nullopt;
+}
+
+ChunkStore::~ChunkStore() = default;
+
+std::unique_ptr<ChunkStore> ChunkStore::make(const std::string &save_path) {
+  std::unique_ptr<ChunkStore> store(new ChunkStore());
+
+  store->_save_path = save_path;
+  store->openChunks(/*read_only=*/false, /*truncate=*/true);
+  writeFile(snapshotPath(save_path), store->serialize());
+  store->_log = std::make_unique<AppendLog>(logPath(save_path));
+  store->_log->clear();
+
+  return store;
+}
+
+std::unique_ptr<ChunkStore> ChunkStore::open(const std::string &save_path,
+                                             bool read_only) {
+  if (!exists(save_path)) {
+    return nullptr;
+  }
+
+  auto store = deserialize(readFile(snapshotPath(save_path)));
+
+  AppendLog::readRecords(logPath(save_path), [&store](BinaryReader record) {
+    store->applyLogRecord(record);
+  });
+
+  store->_save_path = save_path;
+  store->openChunks(read_only);
+  if (read_only) {
+    return store;
+  }
+
+  uint64_t generation = store->_generation;
+  if (store->_chunks->size() - store->_live_bytes > store->_live_bytes) {
+    store->rebuild();
+  }
+  writeFile(snapshotPath(save_path), store->serialize());
+  store->_log = std::make_unique<AppendLog>(logPath(save_path));
+  store->_log->clear();
+  if (store->_generation != generation) {
+    std::filesystem::remove(chunksPath(save_path, generation));
+  }
+
+  return store;
+}
+
+bool ChunkStore::exists(const std::string &save_path) {
+  return std::filesystem::exists(snapshotPath(save_path));
+}
+
+std::vector<uint64_t> ChunkStore::encodeExtent(
+    BinaryWriter &out, const std::vector<std::string> &chunks,
+    const std::vector<MetadataMap> &metadata, const std::string &document,
+    const DocId &doc_id, uint32_t doc_version) {
+  static const MetadataMap no_metadata;
+
+  uint64_t start = out.buffer().size();
+  std::vector<uint64_t> records;
+  records.reserve(chunks.size());
+  BinaryWriter record;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    records.push_back(out.buffer().size() - start);
+    record.buffer().clear();
+    encodeChunk(record, chunks[i], document, doc_id, doc_version,
+                i < metadata.size() ? metadata[i] : no_metadata);
+    out.writeFixed<uint32_t>(record.buffer().size());
+    out.buffer().append(record.buffer());
+  }
+  return records;
+}
+
+void ChunkStore::insert(const InsertMetadata &inserted,
+                        const std::vector<std::string> &chunks,
+                        const std::vector<MetadataMap> &metadata,
+                        const std::string &document) {
+  if (chunks.empty()) {
+    return;
+  }
+
+  BinaryWriter data;
+  auto records = encodeExtent(data, chunks, metadata, document,
+                              inserted.doc_id, inserted.doc_version);
+
+  Extent extent{inserted.start_id + chunks.size(), inserted.doc_id,
+                inserted.doc_version, 0, data.buffer().size(),
+                std::move(records)};
+  appendExtents(data.buffer(), {{inserted.start_id, std::move(extent)}});
+}
+
+void ChunkStore::insertBatch(const std::vector<InsertMetadata> &inserted,
+                             const std::vector<NewDocument> &documents) {
+  // The chunks are encoded before the lock is taken, with offsets relative to
+  // the start of the batch.
+  BinaryWriter data;
+  std::vector<std::pair<ChunkId, Extent>> extents;
+  for (size_t i = 0; i < inserted.size(); i++) {
+    const auto &document = documents.at(i);
+    if (document.chunks.empty()) {
+      continue;
+    }
+    uint64_t offset = data.buffer().size();
+    auto records =
+        encodeExtent(data, document.chunks, document.metadata,
+                     document.document, inserted[i].doc_id,
+                     inserted[i].doc_version);
+    extents.emplace_back(inserted[i].start_id,
+                         Extent{inserted[i].start_id + document.chunks.size(),
+                                inserted[i].doc_id, inserted[i].doc_version,
+                                offset, data.buffer().size() - offset,
+                                std::move(records)});
+  }
+  if (extents.empty()) {
+    return;
+  }
+
+  appendExtents(data.buffer(), std::move(extents));
+}
+
+void ChunkStore::appendExtents(
+    const std::string &data, std::vector<std::pair<ChunkId, Extent>> extents) {
+  std::unique_lock lock(_mutex);
+
+  std::vector<std::string> records;
+  records.reserve(extents.size());
+  for (auto &[start, extent] : extents) {
+    extent.offset += _chunks->size();
+    records.push_back(insertRecord(start, extent));
+  }
+
+  // The chunks are written before the log records that refer to them, so a
+  // crash in between only leaves unreferenced bytes in the chunks file.
+  _chunks->append(data);
+  _log->append(records);
+
+  for (auto &[start, extent] : extents) {
+    insertImpl(start, std::move(extent));
+  }
+}
+
+std::string ChunkStore::insertRecord(ChunkId start, const Extent &extent) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::Insert));
+  record.writeVarint(start);
+  record.writeVarint(extent.end);
+  record.writeString(extent.doc_id);
+  record.writeVarint(extent.doc_version);
+  record.writeVarint(extent.offset);
+  record.writeVarint(extent.len);
+  writeRecords(record, extent);
+  return std::move(record.buffer());
+}
+
+void ChunkStore::writeRecords(BinaryWriter &out, const Extent &extent) {
+  // The offsets are written as the lengths of the records before the last,
+  // since there is one record per chunk and the first is at offset 0.
+  for (size_t i = 1; i < extent.records.size(); i++) {
+    out.writeVarint(extent.records[i] - extent.records[i - 1]);
+  }
+}
+
+void ChunkStore::readRecords(BinaryReader &in, ChunkId start, Extent &extent) {
+  if (extent.end <= start || extent.end - start > in.remaining() + 1) {
+    throw std::runtime_error("invalid extent in chunk store");
+  }
+  extent.records.resize(extent.end - start);
+  extent.records[0] = 0;
+  for (size_t i = 1; i < extent.records.size(); i++) {
+    extent.records[i] = extent.records[i - 1] + in.readVarint();
+  }
+}
+
+void ChunkStore::insertImpl(ChunkId start, Extent extent) {
+  _seq++;
+
+  auto &versions = _docs[extent.doc_id];
+  auto version = versions.find(extent.doc_version);
+  if (version != versions.end()) {
+    removeExtent(version->second);
+  }
+  versions[extent.doc_version] = start;
+
+  _num_chunks += extent.end - start;
+  _live_bytes += extent.len;
+  extent.inserted_seq = _seq;
+  _extents[start] = std::move(extent);
+}
+
+void ChunkStore::deleteDocVersion(const DocId &doc_id, uint32_t doc_version) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::DeleteDocVersion));
+  record.writeString(doc_id);
+  record.writeVarint(doc_version);
+
+  std::unique_lock lock(_mutex);
+  _log->append(record.buffer());
+  deleteVersionImpl(doc_id, doc_version);
+}
+
+void ChunkStore::deleteDoc(const DocId &doc_id, bool keep_latest_version) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::DeleteDoc));
+  record.writeString(doc_id);
+  record.writeFixed<uint8_t>(keep_latest_version);
+
+  std::unique_lock lock(_mutex);
+  _log->append(record.buffer());
+  deleteDocImpl(doc_id, keep_latest_version);
+}
+
+void ChunkStore::deleteVersionImpl(const DocId &doc_id, uint32_t doc_version) {
+  _seq++;
+
+  auto doc = _docs.find(doc_id);
+  if (doc == _docs.end()) {
+    return;
+  }
+  auto version = doc->second.find(doc_version);
+  if (version == doc->second.end()) {
+    return;
+  }
+
+  removeExtent(version->second);
+  doc->second.erase(version);
+  if (doc->second.empty()) {
+    _docs.erase(doc);
+  }
+}
+
+void ChunkStore::deleteDocImpl(const DocId &doc_id, bool keep_latest_version) {
+  _seq++;
+
+  auto doc = _docs.find(doc_id);
+  if (doc == _docs.end()) {
+    return;
+  }
+
+  auto &versions = doc->second;
+  auto end = keep_latest_version ? std::prev(versions.end()) : versions.end();
+  for (auto version = versions.begin(); version != end; ++version) {
+    removeExtent(version->second);
+  }
+  versions.erase(versions.begin(), end);
+  if (versions.empty()) {
+    _docs.erase(doc);
+  }
+}
+
+void ChunkStore::removeExtent(ChunkId start) {
+  auto it = _extents.find(start);
+  if (it == _extents.end() || it->second.deleted_seq != NOT_DELETED) {
+    return;
+  }
+
+  _num_chunks -= it->second.end - start;
+  _live_bytes -= it->second.len;
+
+  if (_cursors.empty()) {
+    _extents.erase(it);
+  } else {
+    it->second.deleted_seq = _seq;
+    _deleted.push_back(start);
+  }
+}
+
+void ChunkStore::purgeDeleted() const {
+  auto kept = _deleted.begin();
+  for (ChunkId start : _deleted) {
+    auto it = _extents.find(start);
+    // Cursors see the extent if their snapshot is before its deletion.
+    if (_cursors.empty() || it->second.deleted_seq <= *_cursors.begin()) {
+      _extents.erase(it);
+    } else {
+      *kept++ = start;
+    }
+  }
+  _deleted.erase(kept, _deleted.end());
+}
+
+std::unique_ptr<ChunkCursor>
+ChunkStore::cursor(ChunkCursorOptions options) const {
+  std::unique_ptr<CompiledConstraints> constraints;
+  if (!options.constraints.empty()) {
+    constraints = std::make_unique<CompiledConstraints>(options.constraints);
+  }
+
+  std::unique_lock lock(_mutex);
+
+  std::optional<std::vector<ChunkId>> doc_extents;
+  if (options.doc_id) {
+    doc_extents.emplace();
+    auto doc = _docs.find(*options.doc_id);
+    if (doc != _docs.end()) {
+      for (const auto &[_, start] : doc->second) {
+        doc_extents->push_back(start);
+      }
+    }
+    std::sort(doc_extents->begin(), doc_extents->end());
+  }
+
+  _cursors.insert(_seq);
+  return std::unique_ptr<ChunkCursor>(
+      new ChunkCursor(*this, _seq, options.start_id, std::move(constraints),
+                      std::move(doc_extents)));
+}
+
+void ChunkStore::releaseCursor(uint64_t snapshot) const {
+  std::unique_lock lock(_mutex);
+  auto it = _cursors.find(snapshot);
+  if (it != _cursors.end()) {
+    _cursors.erase(it);
+  }
+  purgeDeleted();
+}
+
+std::optional<Chunk> ChunkStore::read(ChunkId id) const {
+  std::shared_lock lock(_mutex);
+
+  auto it = _extents.upper_bound(id);
+  if (it == _extents.begin()) {
+    return std::nullopt;
+  }
+  --it;
+  const auto &[start, extent] = *it;
+  if (id >= extent.end || extent.deleted_seq != NOT_DELETED) {
+    return std::nullopt;
+  }
+
+  size_t index = id - start;
+  uint64_t offset = extent.records[index];
+  uint64_t end = index + 1 < extent.records.size() ? extent.records[index + 1]
+                                                  : extent.len;
+  std::string data(end - offset, '\0');
+  _chunks->read(data.data(), data.size(), extent.offset + offset);
+  lock.unlock();
+
+  BinaryReader in(data);
+  uint32_t len = in.readFixed<uint32_t>();
+  BinaryReader record(in.readBytes(len));
+  return decodeChunk(record, id);
+}
+
+size_t ChunkStore::numChunks() const {
+  std::shared_lock lock(_mutex);
+  return _num_chunks;
+}
+
+void ChunkStore::save(const std::string &save_path) const {
+  std::error_code error;
+  if (std::filesystem::equivalent(save_path, _save_path, error)) {
+    // The log is cleared with the snapshot written, so no update can be
+    // logged in between.
+    std::unique_lock lock(_mutex);
+    writeFile(snapshotPath(save_path), serialize());
+    if (_log) {
+      _log->clear();
+    }
+    return;
+  }
+
+  std::shared_lock lock(_mutex);
+  uint64_t generation = _generation;
+  uint64_t chunks_size = _chunks->size();
+  std::string snapshot = serialize();
+  lock.unlock();
+
+  // The chunks file is copied without blocking readers or writers. The chunks
+  // in the snapshot are never rewritten while the store is open, and chunks
+  // appended during the copy are past the copied size.
+  std::string chunks_path = chunksPath(save_path, generation);
+  std::filesystem::copy_file(chunksPath(_save_path, generation), chunks_path,
+                             std::filesystem::copy_options::overwrite_existing);
+  std::filesystem::resize_file(chunks_path, chunks_size);
+  writeFile(snapshotPath(save_path), snapshot);
+}
+
+void ChunkStore::applyLogRecord(BinaryReader &record) {
+  switch (LogOp(record.readFixed<uint8_t>())) {
+  case LogOp::Insert: {
+    ChunkId start = record.readVarint();
+    Extent extent;
+    extent.end = record.readVarint();
+    extent.doc_id = record.readString();
+    extent.doc_version = record.readVarint();
+    extent.offset = record.readVarint();
+    extent.len = record.readVarint();
+    readRecords(record, start, extent);
+    insertImpl(start, std::move(extent));
+    break;
+  }
+  case LogOp::DeleteDocVersion: {
+    DocId doc_id = record.readString();
+    deleteVersionImpl(doc_id, record.readVarint());
+    break;
+  }
+  case LogOp::DeleteDoc: {
+    DocId doc_id = record.readString();
+    deleteDocImpl(doc_id, record.readFixed<uint8_t>());
+    break;
+  }
+  default:
+    throw std::runtime_error("invalid record in chunk store log");
+  }
+}
+
+void ChunkStore::rebuild() {
+  auto old_chunks = std::move(_chunks);
+  _generation++;
+  openChunks(/*read_only=*/false, /*truncate=*/true);
+
+  BinaryWriter data;
+  for (auto &[_, extent] : _extents) {
+    size_t start = data.buffer().size();
+    data.buffer().resize(start + extent.len);
+    old_chunks->read(data.buffer().data() + start, extent.len, extent.offset);
+    extent.offset = start;
+  }
+  _chunks->append(data.buffer());
+}
+
+void ChunkStore::openChunks(bool read_only, bool truncate) {
+  _chunks = std::make_unique<ChunkFile>(chunksPath(_save_path, _generation),
+                                        read_only, truncate);
+}
+
+std::string ChunkStore::serialize() const {
+  BinaryWriter out;
+  out.writeVarint(SNAPSHOT_VERSION);
+  out.writeVarint(_generation);
+
+  // Extents that are only kept for open cursors are not part of the snapshot.
+  out.writeVarint(_extents.size() - _deleted.size());
+  for (const auto &[start, extent] : _extents) {
+    if (extent.deleted_seq != NOT_DELETED) {
+      continue;
+    }
+    out.writeVarint(start);
+    out.writeVarint(extent.end);
+    out.writeString(extent.doc_id);
+    out.writeVarint(extent.doc_version);
+    out.writeVarint(extent.offset);
+    out.writeVarint(extent.len);
+    writeRecords(out, extent);
+  }
+
+  return std::move(out.buffer());
+}
+
+std::unique_ptr<ChunkStore> ChunkStore::deserialize(const std::string &data) {
+  BinaryReader in(data);
+  uint32_t version = in.readVarint();
+  if (version != SNAPSHOT_VERSION) {
+    throw std::runtime_error("unsupported chunk store version");
+  }
+
+  std::unique_ptr<ChunkStore> store(new ChunkStore());
+  store->_generation = in.readVarint();
+
+  size_t num_extents = in.readVarint();
+  for (size_t i = 0; i < num_extents; i++) {
+    ChunkId start = in.readVarint();
+    Extent extent;
+    extent.end = in.readVarint();
+    extent.doc_id = in.readString();
+    extent.doc_version = in.readVarint();
+    extent.offset = in.readVarint();
+    extent.len = in.readVarint();
+    readRecords(in, start, extent);
+    store->insertImpl(start, std::move(extent));
+  }
+
+  return store;
+}
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,293 @@
+#pragma once
+
+#include "Chunk.h"
+#include "CompiledConstraints.h"
+#include "Constraints.h"
+#include "DocumentBatch.h"
+#include "NeuralDB.h"
+#include "Serialization.h"
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+class ChunkStore;
+
+struct ChunkCursorOptions {
+  // Only returns the chunks of every version of this document.
+  std::optional<DocId> doc_id;
+
+  // Only returns the chunks whose metadata satisfies the constraints.
+  QueryConstraints constraints;
+
+  // Only returns chunks with ids of at least start_id, so that an export that
+  // was interrupted can resume after the last chunk it received.
+  ChunkId start_id = 0;
+};
+
+/**
+ * Reads the chunks of a ChunkStore in order of id, a page of the chunks file
+ * at a time, so that the memory used by the cursor does not depend on the
+ * number of chunks. The cursor reads the store as it was when the cursor was
+ * created: chunks inserted after that are not returned, and chunks deleted
+ * after that are still returned. Not safe for concurrent use, and must not
+ * outlive the store.
+ */
+class ChunkCursor {
+public:
+  ChunkCursor(const ChunkCursor &) = delete;
+  ChunkCursor &operator=(const ChunkCursor &) = delete;
+
+  ~ChunkCursor();
+
+  /**
+   * Returns up to max_chunks of the next chunks, or no chunks once every
+   * chunk has been returned.
+   */
+  std::vector<Chunk> next(size_t max_chunks);
+
+private:
+  friend class ChunkStore;
+
+  // The location of the chunks of a document version in the chunks file.
+  struct Extent {
+    ChunkId start;
+    ChunkId end;
+    uint64_t offset;
+    uint64_t len;
+  };
+
+  ChunkCursor(const ChunkStore &store, uint64_t snapshot, ChunkId start_id,
+              std::unique_ptr<CompiledConstraints> constraints,
+              std::optional<std::vector<ChunkId>> doc_extents);
+
+  /**
+   * Reads the next page of the current extent into _page, moving to the next
+   * extent once the current one has been read. Returns false once there are
+   * no more extents to read.
+   */
+  bool loadPage();
+
+  std::optional<Extent> nextExtent() const;
+
+  const ChunkStore &_store;
+  uint64_t _snapshot;
+
+  // The starts of the extents of the document if there is a doc_id, which are
+  // fixed when the cursor is created.
+  std::optional<std::vector<ChunkId>> _doc_extents;
+  std::unique_ptr<CompiledConstraints> _constraints;
+
+  // Every chunk with a smaller id has been returned or skipped.
+  ChunkId _next_id;
+
+  std::optional<Extent> _extent;
+  // The bytes of the extent that have been read into pages.
+  uint64_t _extent_read = 0;
+
+  // Whole chunk records of the current extent, and the position and id of the
+  // next record to decode.
+  std::string _page;
+  size_t _page_pos = 0;
+  ChunkId _page_id = 0;
+};
+
+/**
+ * A copy of every chunk of the ndb, for reading the chunks back in order of
+ * id with a ChunkCursor, since the engine cannot look chunks up by id or
+ * iterate over them. The chunks are appended to a chunks file of their own,
+ * one contiguous extent per document version, and only the location of each
+ * extent and the offsets of its chunks are kept in memory, so that a single
+ * chunk can also be read back by id.
+ *
+ * Like the VectorIndex, the extents are stored next to the engine's files in
+ * the ndb directory as a snapshot plus a log of the updates applied since the
+ * snapshot was written, and the log is folded into the snapshot each time the
+ * store is opened. Deleted extents stay in the chunks file until a store that
+ * is not read only is opened with more deleted bytes than live bytes, when
+ * the file is rewritten without them.
+ *
+ * Every update advances a sequence number, and each extent records the
+ * updates that inserted and deleted it, so a cursor reads the store as of the
+ * sequence number it was created at. Deleted extents are kept in memory while
+ * a cursor that can still see them is open.
+ */
+class ChunkStore {
+public:
+  /**
+   * Creates an empty store in the ndb directory save_path.
+   */
+  static std::unique_ptr<ChunkStore> make(const std::string &save_path);
+
+  /**
+   * Opens the store in save_path, or returns nullptr if the ndb in save_path
+   * does not store its chunks. If read_only is true the files in save_path
+   * are not modified, and the store must not be updated.
+   */
+  static std::unique_ptr<ChunkStore> open(const std::string &save_path,
+                                          bool read_only = false);
+
+  static bool exists(const std::string &save_path);
+
+  ChunkStore(const ChunkStore &) = delete;
+  ChunkStore &operator=(const ChunkStore &) = delete;
+
+  ~ChunkStore();
+
+  void insert(const InsertMetadata &inserted,
+              const std::vector<std::string> &chunks,
+              const std::vector<MetadataMap> &metadata,
+              const std::string &document);
+
+  /**
+   * Stores the chunks of each document with a single append to the chunks
+   * file and a single log write. inserted[i] is the result of inserting
+   * documents[i].
+   */
+  void insertBatch(const std::vector<InsertMetadata> &inserted,
+                   const std::vector<NewDocument> &documents);
+
+  void deleteDocVersion(const DocId &doc_id, uint32_t doc_version);
+
+  void deleteDoc(const DocId &doc_id, bool keep_latest_version);
+
+  /**
+   * Returns a cursor over the chunks that are in the store now.
+   */
+  std::unique_ptr<ChunkCursor> cursor(ChunkCursorOptions options) const;
+
+  /**
+   * Returns the chunk with the id, or nullopt if it is not in the store or has
+   * been deleted.
+   */
+  std::optional<Chunk> read(ChunkId id) const;
+
+  /**
+   * The number of chunks that have not been deleted.
+   */
+  size_t numChunks() const;
+
+  /**
+   * Writes a snapshot of the store, and a copy of the chunks file, to the ndb
+   * directory save_path. Reads and writes are only blocked while the snapshot
+   * is taken, and not while the chunks file is copied.
+   */
+  void save(const std::string &save_path) const;
+
+private:
+  friend class ChunkCursor;
+
+  static constexpr uint64_t NOT_DELETED = std::numeric_limits<uint64_t>::max();
+
+  struct Extent {
+    ChunkId end;
+    DocId doc_id;
+    uint32_t doc_version;
+    uint64_t offset;
+    uint64_t len;
+    // The offset of each chunk record from the start of the extent.
+    std::vector<uint64_t> records;
+    // The sequence numbers of the updates that inserted and deleted the
+    // extent, which are only meaningful while the store is open.
+    uint64_t inserted_seq = 0;
+    uint64_t deleted_seq = NOT_DELETED;
+
+    bool visibleAt(uint64_t snapshot) const {
+      return inserted_seq <= snapshot && snapshot < deleted_seq;
+    }
+  };
+
+  ChunkStore() = default;
+
+  /**
+   * Encodes the chunks of a document version as the records of an extent,
+   * returning the offset of each record from the start of the extent.
+   */
+  static std::vector<uint64_t>
+  encodeExtent(BinaryWriter &out, const std::vector<std::string> &chunks,
+               const std::vector<MetadataMap> &metadata,
+               const std::string &document, const DocId &doc_id,
+               uint32_t doc_version);
+
+  /**
+   * Appends the encoded extents to the chunks file and logs their insertion.
+   * extents are the extents of the data with offsets relative to its start.
+   */
+  void appendExtents(const std::string &data,
+                     std::vector<std::pair<ChunkId, Extent>> extents);
+
+  static std::string insertRecord(ChunkId start, const Extent &extent);
+
+  static void writeRecords(BinaryWriter &out, const Extent &extent);
+
+  static void readRecords(BinaryReader &in, ChunkId start, Extent &extent);
+
+  void insertImpl(ChunkId start, Extent extent);
+
+  void deleteVersionImpl(const DocId &doc_id, uint32_t doc_version);
+
+  void deleteDocImpl(const DocId &doc_id, bool keep_latest_version);
+
+  /**
+   * Removes the extent, or marks it deleted if an open cursor can still see
+   * it.
+   */
+  void removeExtent(ChunkId start);
+
+  /**
+   * Removes the deleted extents that no open cursor can see.
+   */
+  void purgeDeleted() const;
+
+  void releaseCursor(uint64_t snapshot) const;
+
+  void applyLogRecord(BinaryReader &record);
+
+  /**
+   * Rewrites the chunks file without the deleted extents.
+   */
+  void rebuild();
+
+  std::string serialize() const;
+
+  static std::unique_ptr<ChunkStore> deserialize(const std::string &data);
+
+  /**
+   * Opens the chunks file of the current generation, creating it if the store
+   * is not read only.
+   */
+  void openChunks(bool read_only, bool truncate = false);
+
+  // Keyed by the id of the first chunk of the extent. Deleted extents are
+  // mutable so that closing a cursor can remove the ones it was keeping.
+  mutable std::map<ChunkId, Extent> _extents;
+  mutable std::vector<ChunkId> _deleted;
+  // The start of the extent of each version of each document.
+  std::unordered_map<DocId, std::map<uint32_t, ChunkId>> _docs;
+  size_t _num_chunks = 0;
+  uint64_t _live_bytes = 0;
+
+  uint64_t _seq = 0;
+  // The snapshots of the open cursors.
+  mutable std::multiset<uint64_t> _cursors;
+
+  std::string _save_path;
+  std::unique_ptr<AppendLog> _log;
+  // The file of stored chunks. The file is replaced by a file of the next
+  // generation when the store is rebuilt, so that the snapshot always refers
+  // to a complete chunks file.
+  uint64_t _generation = 0;
+  std::unique_ptr<ChunkFile> _chunks;
+
+  mutable std::shared_mutex _mutex;
+};
+
+} // namespace thirdai::search::ndb
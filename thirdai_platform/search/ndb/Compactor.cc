@@ -0,0 +1,116 @@
+#include "Compactor.h"
+#include <exception>
+#include <utility>
+
+namespace thirdai::search::ndb {
+
+Compactor::Compactor(Compact compact,
+                     std::optional<std::chrono::milliseconds> interval)
+    : _compact(std::move(compact)), _interval(interval),
+      _last_pass(std::chrono::steady_clock::now()) {}
+
+Compactor::~Compactor() {
+  {
+    std::lock_guard lock(_mutex);
+    _stopping = true;
+  }
+  _pending_cv.notify_one();
+
+  if (_worker.joinable()) {
+    _worker.join();
+  }
+}
+
+void Compactor::notifyDeletion() {
+  std::lock_guard lock(_mutex);
+  _stats.pending_deletions++;
+
+  if (_interval) {
+    startWorker();
+    _pending_cv.notify_one();
+  }
+}
+
+void Compactor::compactNow() {
+  std::unique_lock lock(_mutex);
+  runPass(lock);
+}
+
+CompactionStats Compactor::stats() const {
+  std::lock_guard lock(_mutex);
+  return _stats;
+}
+
+void Compactor::startWorker() {
+  if (!_worker.joinable()) {
+    _worker = std::thread([this]() { run(); });
+  }
+}
+
+void Compactor::run() {
+  std::unique_lock lock(_mutex);
+
+  while (true) {
+    _pending_cv.wait(
+        lock, [&]() { return _stats.pending_deletions > 0 || _stopping; });
+    if (_stopping) {
+      return;
+    }
+
+    // Passes are spaced by the interval so that compaction, which holds the
+    // ndb's write lock, cannot starve updates when deletions are frequent.
+    auto deadline = _last_pass + *_interval;
+    if (_pending_cv.wait_until(lock, deadline, [&]() { return _stopping; })) {
+      return;
+    }
+    if (_stats.pending_deletions == 0) {
+      continue;
+    }
+
+    try {
+      runPass(lock);
+    } catch (const std::exception &) {
+      // The failure is counted in the stats and the pass is retried after
+      // the interval.
+    }
+  }
+}
+
+void Compactor::runPass(std::unique_lock<std::mutex> &lock) {
+  _idle_cv.wait(lock, [&]() { return !_stats.running; });
+
+  uint64_t reclaiming = _stats.pending_deletions;
+  _stats.pending_deletions = 0;
+  _stats.running = true;
+  lock.unlock();
+
+  auto start = std::chrono::steady_clock::now();
+  std::exception_ptr error;
+  try {
+    _compact();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  lock.lock();
+  _stats.running = false;
+  _last_pass = end;
+  if (error) {
+    _stats.failures++;
+    _stats.pending_deletions += reclaiming;
+  } else {
+    double duration =
+        std::chrono::duration<double, std::milli>(end - start).count();
+    _stats.passes++;
+    _stats.last_duration_ms = duration;
+    _stats.total_duration_ms += duration;
+  }
+  _idle_cv.notify_all();
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+namespace thirdai::search::ndb {
+
+struct CompactionStats {
+  // The number of compaction passes that have completed, including passes
+  // run by calling compactNow.
+  uint64_t passes = 0;
+  // The number of passes that threw, the deletions they were meant to
+  // reclaim stay pending and are retried by the next pass.
+  uint64_t failures = 0;
+  // Deletions that have not been reclaimed by a completed pass yet.
+  uint64_t pending_deletions = 0;
+  // The duration of the most recent pass, and of all passes.
+  double last_duration_ms = 0;
+  double total_duration_ms = 0;
+  // Whether a pass is in progress.
+  bool running = false;
+};
+
+/**
+ * Reclaims the chunks left behind by deletions on a background thread. The
+ * ndb reports every deletion with notifyDeletion, and once deletions are
+ * pending the compactor waits for the interval to pass before running a
+ * pass, so bursts of deletions are reclaimed together and passes run at most
+ * once per interval.
+ *
+ * Pending deletions are not persisted. Chunks left behind by deletions that
+ * were not reclaimed when the ndb was closed are reclaimed by the first pass
+ * after the ndb is opened again, which runs after the next deletion.
+ */
+class Compactor {
+public:
+  using Compact = std::function<void()>;
+
+  /**
+   * Reclaims deleted chunks by calling compact. If interval is std::nullopt
+   * no background passes are run, and chunks are only reclaimed by
+   * compactNow.
+   */
+  Compactor(Compact compact,
+            std::optional<std::chrono::milliseconds> interval);
+
+  Compactor(const Compactor &) = delete;
+  Compactor &operator=(const Compactor &) = delete;
+
+  /**
+   * Stops the background thread, waiting for a pass that is in progress to
+   * finish. Pending deletions are left to be reclaimed later.
+   */
+  ~Compactor();
+
+  void notifyDeletion();
+
+  /**
+   * Runs a pass on the calling thread, after any pass that is in progress.
+   * Rethrows the error if the pass fails.
+   */
+  void compactNow();
+
+  CompactionStats stats() const;
+
+private:
+  void startWorker();
+
+  void run();
+
+  /**
+   * Runs a pass with _mutex held by lock, which is released while compact
+   * runs.
+   */
+  void runPass(std::unique_lock<std::mutex> &lock);
+
+  Compact _compact;
+  std::optional<std::chrono::milliseconds> _interval;
+
+  CompactionStats _stats;
+  std::chrono::steady_clock::time_point _last_pass;
+
+  bool _stopping = false;
+  std::thread _worker;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _pending_cv;
+  std::condition_variable _idle_cv;
+};
+
+} // namespace thirdai::search::ndb
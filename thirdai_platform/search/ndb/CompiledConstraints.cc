@@ -0,0 +1,389 @@
+#include "CompiledConstraints.h"
+#include "Serialization.h"
+#include <algorithm>
+#include <cmath>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+class CompiledKeyConstraint final : public Constraint {
+public:
+  CompiledKeyConstraint(const CompiledConstraints *constraints, uint32_t key_id)
+      : _constraints(constraints), _key_id(key_id) {}
+
+  bool matches(const MetadataValue &value) const final {
+    return _constraints->matchesKey(_key_id, value);
+  }
+
+private:
+  const CompiledConstraints *_constraints;
+  uint32_t _key_id;
+};
+
+template <typename T> int threeWay(const T &a, const T &b) {
+  return (b < a) - (a < b);
+}
+
+bool isNaN(const MetadataValue &value) {
+  return value.type() == MetadataType::Float && std::isnan(value.asFloat());
+}
+
+/**
+ * Returns the smallest string that is greater than every string with the given
+ * prefix, or std::nullopt if there is no such string.
+ */
+std::optional<std::string> prefixSuccessor(std::string_view prefix) {
+  std::string successor(prefix);
+  while (!successor.empty() && uint8_t(successor.back()) == 0xFF) {
+    successor.pop_back();
+  }
+  if (successor.empty()) {
+    return std::nullopt;
+  }
+  successor.back() = char(uint8_t(successor.back()) + 1);
+  return successor;
+}
+
+} // namespace
+
+CompiledConstraints::CompiledConstraints(const QueryConstraints &constraints) {
+  _keys.reserve(constraints.size());
+  for (const auto &[key, _] : constraints) {
+    _keys.push_back(key);
+  }
+  std::sort(_keys.begin(), _keys.end());
+
+  _key_offsets.reserve(_keys.size() + 1);
+  for (const auto &key : _keys) {
+    _key_offsets.push_back(_predicates.size());
+    addPredicate(constraints.at(key));
+  }
+  _key_offsets.push_back(_predicates.size());
+
+  for (uint32_t key_id = 0; key_id < _keys.size(); key_id++) {
+    _engine_constraints[_keys[key_id]] =
+        std::make_shared<CompiledKeyConstraint>(this, key_id);
+  }
+}
+
+void CompiledConstraints::addPredicate(
+    const std::shared_ptr<Constraint> &constraint) {
+  if (auto eq = std::dynamic_pointer_cast<EqualTo>(constraint)) {
+    addValuePredicate(PredicateOp::Eq, eq->value());
+  } else if (auto ne = std::dynamic_pointer_cast<NotEqual>(constraint)) {
+    addValuePredicate(PredicateOp::Ne, ne->value());
+  } else if (auto lt = std::dynamic_pointer_cast<LessThan>(constraint)) {
+    addValuePredicate(PredicateOp::Lt, lt->value());
+  } else if (auto gt = std::dynamic_pointer_cast<GreaterThan>(constraint)) {
+    addValuePredicate(PredicateOp::Gt, gt->value());
+  } else if (auto between = std::dynamic_pointer_cast<Between>(constraint)) {
+    addValuePredicate(PredicateOp::Ge, between->lower());
+    addValuePredicate(PredicateOp::Le, between->upper());
+  } else if (auto in = std::dynamic_pointer_cast<In>(constraint)) {
+    addSetPredicate(in->values());
+  } else if (auto prefix = std::dynamic_pointer_cast<StartsWith>(constraint)) {
+    addValuePredicate(PredicateOp::Prefix,
+                      MetadataValue::Str(prefix->prefix()));
+  } else if (auto all = std::dynamic_pointer_cast<AllOf>(constraint)) {
+    for (const auto &sub_constraint : all->constraints()) {
+      addPredicate(sub_constraint);
+    }
+  } else {
+    Predicate predicate{PredicateOp::Generic, MetadataType::Nil};
+    predicate.generic = constraint.get();
+    _predicates.push_back(predicate);
+    _generic.push_back(constraint);
+  }
+}
+
+CompiledConstraints::Predicate
+CompiledConstraints::makeValuePredicate(PredicateOp op,
+                                        const MetadataValue &value) {
+  Predicate predicate{op, value.type()};
+  switch (value.type()) {
+  case MetadataType::Bool:
+    predicate.bool_value = value.asBool();
+    break;
+  case MetadataType::Int:
+    predicate.int_value = value.asInt();
+    break;
+  case MetadataType::Float:
+    predicate.float_value = value.asFloat();
+    break;
+  case MetadataType::Str:
+    predicate.str_offset = _strings.size();
+    predicate.str_len = value.asStr().size();
+    _strings.append(value.asStr());
+    break;
+  case MetadataType::Nil:
+    break;
+  }
+  return predicate;
+}
+
+void CompiledConstraints::addSetPredicate(
+    const std::vector<MetadataValue> &values) {
+  std::vector<Predicate> members;
+  members.reserve(values.size());
+  for (const auto &value : values) {
+    // NaN is not equal to any value, including itself.
+    if (isNaN(value)) {
+      continue;
+    }
+    members.push_back(makeValuePredicate(PredicateOp::Eq, value));
+  }
+
+  auto less = [this](const Predicate &a, const Predicate &b) {
+    return compareValue(a, value(b)) < 0;
+  };
+  auto equal = [this](const Predicate &a, const Predicate &b) {
+    return compareValue(a, value(b)) == 0;
+  };
+  std::sort(members.begin(), members.end(), less);
+  members.erase(std::unique(members.begin(), members.end(), equal),
+                members.end());
+
+  Predicate predicate{PredicateOp::In, MetadataType::Nil};
+  predicate.set_offset = _set_members.size();
+  predicate.set_len = members.size();
+  _set_members.insert(_set_members.end(), members.begin(), members.end());
+  _predicates.push_back(predicate);
+}
+
+std::optional<std::string> CompiledConstraints::fingerprint() const {
+  if (!_generic.empty()) {
+    return std::nullopt;
+  }
+
+  BinaryWriter writer;
+  writer.writeVarint(_keys.size());
+  for (uint32_t key_id = 0; key_id < _keys.size(); key_id++) {
+    writer.writeString(_keys[key_id]);
+    writer.writeVarint(_key_offsets[key_id + 1] - _key_offsets[key_id]);
+
+    for (uint32_t i = _key_offsets[key_id]; i < _key_offsets[key_id + 1]; i++) {
+      const Predicate &predicate = _predicates[i];
+      writer.writeFixed<uint8_t>(uint8_t(predicate.op));
+      if (predicate.op == PredicateOp::In) {
+        writer.writeVarint(predicate.set_len);
+        for (uint32_t j = 0; j < predicate.set_len; j++) {
+          writer.writeMetadataValue(
+              value(_set_members[predicate.set_offset + j]));
+        }
+      } else {
+        writer.writeMetadataValue(value(predicate));
+      }
+    }
+  }
+
+  return std::move(writer.buffer());
+}
+
+bool CompiledConstraints::matches(const MetadataMap &metadata) const {
+  for (uint32_t key_id = 0; key_id < _keys.size(); key_id++) {
+    auto it = metadata.find(_keys[key_id]);
+    if (it == metadata.end() || !matchesKey(key_id, it->second)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+MetadataValue CompiledConstraints::value(const Predicate &predicate) const {
+  switch (predicate.type) {
+  case MetadataType::Bool:
+    return MetadataValue::Bool(predicate.bool_value);
+  case MetadataType::Int:
+    return MetadataValue::Int(predicate.int_value);
+  case MetadataType::Float:
+    return MetadataValue::Float(predicate.float_value);
+  case MetadataType::Str:
+    return MetadataValue::Str(std::string(str(predicate)));
+  default:
+    return MetadataValue();
+  }
+}
+
+int CompiledConstraints::compareValue(const Predicate &predicate,
+                                      const MetadataValue &value) const {
+  if (predicate.type != value.type()) {
+    return predicate.type < value.type() ? -1 : 1;
+  }
+
+  switch (predicate.type) {
+  case MetadataType::Bool:
+    return threeWay(predicate.bool_value, value.asBool());
+  case MetadataType::Int:
+    return threeWay(predicate.int_value, value.asInt());
+  case MetadataType::Float:
+    return threeWay(predicate.float_value, value.asFloat());
+  case MetadataType::Str:
+    return str(predicate).compare(value.asStr());
+  default:
+    return 0;
+  }
+}
+
+CompiledConstraints::KeyBounds
+CompiledConstraints::bounds(uint32_t key_id) const {
+  KeyBounds bounds;
+
+  auto restrictType = [&bounds](MetadataType type) {
+    if (bounds.type && *bounds.type != type) {
+      bounds.empty = true;
+    }
+    bounds.type = type;
+    return !bounds.empty;
+  };
+  auto raiseLower = [&bounds](MetadataValue bound) {
+    if (!bounds.lower || bound.greaterThan(*bounds.lower)) {
+      bounds.lower = std::move(bound);
+    }
+  };
+  auto lowerUpper = [&bounds](MetadataValue bound) {
+    if (!bounds.upper || bound.lessThan(*bounds.upper)) {
+      bounds.upper = std::move(bound);
+    }
+  };
+
+  for (uint32_t i = _key_offsets[key_id]; i < _key_offsets[key_id + 1]; i++) {
+    const Predicate &predicate = _predicates[i];
+
+    switch (predicate.op) {
+    case PredicateOp::Generic:
+    case PredicateOp::Ne:
+      break;
+
+    case PredicateOp::In: {
+      if (predicate.set_len == 0) {
+        bounds.empty = true;
+        return bounds;
+      }
+
+      if (!bounds.values || predicate.set_len < bounds.values->size()) {
+        std::vector<MetadataValue> members;
+        members.reserve(predicate.set_len);
+        for (uint32_t j = 0; j < predicate.set_len; j++) {
+          members.push_back(value(_set_members[predicate.set_offset + j]));
+        }
+        bounds.values = std::move(members);
+      }
+
+      // Members are sorted by type first, so the set has a single type if the
+      // first and last members have the same type.
+      const Predicate &first = _set_members[predicate.set_offset];
+      const Predicate &last =
+          _set_members[predicate.set_offset + predicate.set_len - 1];
+      if (first.type == last.type) {
+        if (!restrictType(first.type)) {
+          return bounds;
+        }
+        raiseLower(value(first));
+        lowerUpper(value(last));
+      }
+      break;
+    }
+
+    case PredicateOp::Prefix: {
+      if (!restrictType(MetadataType::Str)) {
+        return bounds;
+      }
+      raiseLower(value(predicate));
+      if (auto successor = prefixSuccessor(str(predicate))) {
+        lowerUpper(MetadataValue::Str(std::move(*successor)));
+      }
+      break;
+    }
+
+    default: {
+      if (!restrictType(predicate.type)) {
+        return bounds;
+      }
+      MetadataValue bound = value(predicate);
+      if (predicate.op == PredicateOp::Eq || predicate.op == PredicateOp::Gt ||
+          predicate.op == PredicateOp::Ge) {
+        raiseLower(bound);
+      }
+      if (predicate.op == PredicateOp::Eq || predicate.op == PredicateOp::Lt ||
+          predicate.op == PredicateOp::Le) {
+        lowerUpper(bound);
+      }
+      break;
+    }
+    }
+  }
+
+  return bounds;
+}
+
+bool CompiledConstraints::setContains(const Predicate &predicate,
+                                      const MetadataValue &value) const {
+  if (isNaN(value)) {
+    return false;
+  }
+
+  auto begin = _set_members.begin() + predicate.set_offset;
+  auto end = begin + predicate.set_len;
+  auto it = std::lower_bound(begin, end, value,
+                             [this](const Predicate &member,
+                                    const MetadataValue &value) {
+                               return compareValue(member, value) < 0;
+                             });
+  return it != end && compareValue(*it, value) == 0;
+}
+
+bool CompiledConstraints::matchesPredicate(const Predicate &predicate,
+                                           const MetadataValue &value) const {
+  switch (predicate.op) {
+  case PredicateOp::Generic:
+    return predicate.generic->matches(value);
+  case PredicateOp::In:
+    return setContains(predicate, value);
+  case PredicateOp::Prefix:
+    return value.type() == MetadataType::Str &&
+           std::string_view(value.asStr()).substr(0, predicate.str_len) ==
+               str(predicate);
+  default:
+    break;
+  }
+
+  // Values of different types are never equal or ordered relative to each
+  // other, this matches the semantics of MetadataValue::equals/lessThan/
+  // greaterThan.
+  if (predicate.type != value.type()) {
+    return predicate.op == PredicateOp::Ne;
+  }
+
+  switch (predicate.type) {
+  case MetadataType::Bool:
+    return compare(predicate.op, value.asBool(), predicate.bool_value);
+  case MetadataType::Int:
+    return compare(predicate.op, value.asInt(), predicate.int_value);
+  case MetadataType::Float:
+    return compare(predicate.op, value.asFloat(), predicate.float_value);
+  case MetadataType::Str:
+    return compare(predicate.op, std::string_view(value.asStr()),
+                   str(predicate));
+  default:
+    // Nil values only compare equal to each other.
+    return predicate.op == PredicateOp::Eq || predicate.op == PredicateOp::Le ||
+           predicate.op == PredicateOp::Ge;
+  }
+}
+
+bool CompiledConstraints::matchesKey(uint32_t key_id,
+                                     const MetadataValue &value) const {
+  const Predicate *begin = _predicates.data() + _key_offsets[key_id];
+  const Predicate *end = _predicates.data() + _key_offsets[key_id + 1];
+
+  for (const Predicate *predicate = begin; predicate != end; predicate++) {
+    if (!matchesPredicate(*predicate, value)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+} // namespace thirdai::search::ndb
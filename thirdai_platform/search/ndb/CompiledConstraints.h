@@ -0,0 +1,182 @@
+#pragma once
+
+#include "Constraints.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+/**
+ * A flattened form of QueryConstraints that is built once per query. The keys
+ * are interned to ids in [0, numKeys()) and the predicates are stored in a flat
+ * array of plain typed values grouped by key id, so evaluating a candidate does
+ * not allocate, compare std::variants, or make a virtual call per predicate.
+ *
+ * The engine's rank evaluates constraints itself, so engineConstraints()
+ * exposes the compiled predicates as one Constraint per key which runs the
+ * flat evaluation for that key. Constraint types that are not known to the
+ * compiler fall back to calling their matches method.
+ */
+class CompiledConstraints {
+public:
+  explicit CompiledConstraints(const QueryConstraints &constraints);
+
+  CompiledConstraints(const CompiledConstraints &) = delete;
+  CompiledConstraints &operator=(const CompiledConstraints &) = delete;
+
+  uint32_t numKeys() const { return _keys.size(); }
+
+  const std::string &key(uint32_t key_id) const { return _keys.at(key_id); }
+
+  bool empty() const { return _keys.empty(); }
+
+  /**
+   * Returns if the value of the key with the given id satisfies every
+   * predicate on that key.
+   */
+  bool matchesKey(uint32_t key_id, const MetadataValue &value) const;
+
+  /**
+   * Returns if the metadata satisfies every predicate. Keys that are missing
+   * from the metadata never match.
+   */
+  bool matches(const MetadataMap &metadata) const;
+
+  /**
+   * Bounds implied by the typed predicates on a key. If type is set, every
+   * value that satisfies the predicates on the key has that type and lies in
+   * [lower, upper], where a missing bound means the range is open on that side.
+   * The range is a superset of the matching values, so values in it must still
+   * be checked with matchesKey. If type is not set the key can only be
+   * evaluated by checking every value. If values is set, every value that
+   * satisfies the predicates is one of the given values, which lets set
+   * membership be evaluated with point lookups instead of a range scan.
+   */
+  struct KeyBounds {
+    bool empty = false;
+    std::optional<MetadataType> type;
+    std::optional<MetadataValue> lower;
+    std::optional<MetadataValue> upper;
+    std::optional<std::vector<MetadataValue>> values;
+  };
+
+  KeyBounds bounds(uint32_t key_id) const;
+
+  /**
+   * A canonical encoding of the predicates, so that constraints which compile
+   * to the same predicates have the same fingerprint. Returns std::nullopt if
+   * any constraint is evaluated through the generic fallback, since those
+   * cannot be encoded.
+   */
+  std::optional<std::string> fingerprint() const;
+
+  /**
+   * Constraints to pass to the engine. They reference this object and must not
+   * outlive it.
+   */
+  const QueryConstraints &engineConstraints() const {
+    return _engine_constraints;
+  }
+
+private:
+  enum class PredicateOp : uint8_t {
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    In,
+    Prefix,
+    Generic
+  };
+
+  struct Predicate {
+    PredicateOp op;
+    MetadataType type;
+    bool bool_value = false;
+    int int_value = 0;
+    float float_value = 0;
+    uint32_t str_offset = 0;
+    uint32_t str_len = 0;
+    // The members of an In predicate are _set_members[set_offset:set_offset +
+    // set_len].
+    uint32_t set_offset = 0;
+    uint32_t set_len = 0;
+    const Constraint *generic = nullptr;
+  };
+
+  void addPredicate(const std::shared_ptr<Constraint> &constraint);
+
+  Predicate makeValuePredicate(PredicateOp op, const MetadataValue &value);
+
+  void addValuePredicate(PredicateOp op, const MetadataValue &value) {
+    _predicates.push_back(makeValuePredicate(op, value));
+  }
+
+  void addSetPredicate(const std::vector<MetadataValue> &values);
+
+  bool matchesPredicate(const Predicate &predicate,
+                        const MetadataValue &value) const;
+
+  bool setContains(const Predicate &predicate,
+                   const MetadataValue &value) const;
+
+  /**
+   * Orders a predicate's value relative to a metadata value by type and then
+   * by value. Returns a negative number, zero, or a positive number if the
+   * predicate's value is less than, equal to, or greater than the value.
+   */
+  int compareValue(const Predicate &predicate,
+                   const MetadataValue &value) const;
+
+  MetadataValue value(const Predicate &predicate) const;
+
+  std::string_view str(const Predicate &predicate) const {
+    return std::string_view(_strings).substr(predicate.str_offset,
+                                             predicate.str_len);
+  }
+
+  template <typename T>
+  static bool compare(PredicateOp op, const T &lhs, const T &rhs) {
+    switch (op) {
+    case PredicateOp::Eq:
+      return lhs == rhs;
+    case PredicateOp::Ne:
+      return lhs != rhs;
+    case PredicateOp::Lt:
+      return lhs < rhs;
+    case PredicateOp::Le:
+      return lhs <= rhs;
+    case PredicateOp::Gt:
+      return lhs > rhs;
+    case PredicateOp::Ge:
+      return lhs >= rhs;
+    default:
+      return false;
+    }
+  }
+
+  std::vector<std::string> _keys;
+
+  // Predicates for key i are _predicates[_key_offsets[i]:_key_offsets[i+1]].
+  std::vector<Predicate> _predicates;
+  std::vector<uint32_t> _key_offsets;
+
+  // Backing storage for string predicate values.
+  std::string _strings;
+
+  // Members of In predicates, each set is sorted by compareValue.
+  std::vector<Predicate> _set_members;
+
+  // Keeps constraints evaluated through the generic fallback alive.
+  std::vector<std::shared_ptr<Constraint>> _generic;
+
+  QueryConstraints _engine_constraints;
+};
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,90 @@
+#include "CompletionQueue.h"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+namespace thirdai::search::ndb {
+
+std::shared_ptr<CompletionQueue> CompletionQueue::make() {
+  return std::shared_ptr<CompletionQueue>(new CompletionQueue());
+}
+
+void CompletionQueue::submit(Executor::Work work, uint64_t ticket,
+                             std::function<void()> f) {
+  {
+    std::lock_guard lock(_mutex);
+    if (_closed) {
+      throw std::logic_error("the completion queue is closed");
+    }
+    _in_flight++;
+  }
+
+  try {
+    Executor::submit(work, [queue = shared_from_this(), ticket,
+                            f = std::move(f)]() {
+      std::exception_ptr error;
+      try {
+        f();
+      } catch (...) {
+        error = std::current_exception();
+      }
+      queue->complete(ticket, std::move(error));
+    });
+  } catch (...) {
+    std::lock_guard lock(_mutex);
+    _in_flight--;
+    if (closedAndDrained()) {
+      _cv.notify_all();
+    }
+    throw;
+  }
+}
+
+void CompletionQueue::complete(uint64_t ticket, std::exception_ptr error) {
+  std::lock_guard lock(_mutex);
+  _completed.push_back({ticket, std::move(error)});
+  _in_flight--;
+  _cv.notify_one();
+}
+
+std::vector<Completion>
+CompletionQueue::wait(size_t max,
+                      std::optional<std::chrono::milliseconds> timeout) {
+  std::unique_lock lock(_mutex);
+
+  auto ready = [&]() { return !_completed.empty() || closedAndDrained(); };
+  if (timeout) {
+    _cv.wait_for(lock, *timeout, ready);
+  } else {
+    _cv.wait(lock, ready);
+  }
+
+  size_t n = std::min(max, _completed.size());
+  std::vector<Completion> completions(
+      std::make_move_iterator(_completed.begin()),
+      std::make_move_iterator(_completed.begin() + n));
+  _completed.erase(_completed.begin(), _completed.begin() + n);
+
+  // Another waiter takes the completions that did not fit, and every waiter
+  // returns once the closed queue is drained.
+  if (!_completed.empty()) {
+    _cv.notify_one();
+  } else if (closedAndDrained()) {
+    _cv.notify_all();
+  }
+  return completions;
+}
+
+void CompletionQueue::close() {
+  std::lock_guard lock(_mutex);
+  _closed = true;
+  _cv.notify_all();
+}
+
+size_t CompletionQueue::inFlight() const {
+  std::lock_guard lock(_mutex);
+  return _in_flight;
+}
+
+} // namespace thirdai::search::ndb
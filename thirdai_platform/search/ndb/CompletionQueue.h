@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Executor.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+struct Completion {
+  // The ticket the call was submitted with.
+  uint64_t ticket;
+  // What the call threw, nullptr if it returned.
+  std::exception_ptr error;
+};
+
+/**
+ * Runs calls asynchronously on the executor threads and collects their
+ * completions, so that a caller can have many calls in flight and wait for
+ * any of them with a single blocking wait, rather than blocking a thread for
+ * each call while it runs. Each call is identified by the ticket it is
+ * submitted with, which the caller chooses.
+ */
+class CompletionQueue : public std::enable_shared_from_this<CompletionQueue> {
+public:
+  static std::shared_ptr<CompletionQueue> make();
+
+  CompletionQueue(const CompletionQueue &) = delete;
+  CompletionQueue &operator=(const CompletionQueue &) = delete;
+
+  /**
+   * Runs f on an executor thread, see Executor::submit, and adds its
+   * completion to the queue once it returns or throws. The call keeps the
+   * queue alive until it completes. Throws if the queue is closed or there are
+   * no executor threads, in which case f is not run.
+   */
+  void submit(Executor::Work work, uint64_t ticket, std::function<void()> f);
+
+  /**
+   * Waits until there is at least one completion and returns up to max
+   * completions in the order the calls finished. Returns no completions if
+   * the timeout expires first, or once the queue is closed and every call
+   * submitted to it has completed and been returned. Waits without a timeout
+   * if timeout is std::nullopt.
+   */
+  std::vector<Completion>
+  wait(size_t max, std::optional<std::chrono::milliseconds> timeout);
+
+  /**
+   * Stops accepting calls. The calls already submitted still run, and wait
+   * returns their completions before it reports that the queue is closed.
+   */
+  void close();
+
+  /**
+   * The number of calls that have been submitted but not completed.
+   */
+  size_t inFlight() const;
+
+private:
+  CompletionQueue() = default;
+
+  void complete(uint64_t ticket, std::exception_ptr error);
+
+  bool closedAndDrained() const {
+    return _closed && _in_flight == 0 && _completed.empty();
+  }
+
+  std::deque<Completion> _completed;
+  size_t _in_flight = 0;
+  bool _closed = false;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _cv;
+};
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,335 @@
+#include "DocCatalog.h"
+#include <algorithm>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+enum class LogOp : uint8_t { Insert, DeleteDocVersion, DeleteDoc };
+
+std::string snapshotPath(const std::string &save_path) {
+  return (std::filesystem::path(save_path) / "doc_catalog").string();
+}
+
+std::string logPath(const std::string &save_path) {
+  return (std::filesystem::path(save_path) / "doc_catalog.log").string();
+}
+
+} // namespace
+
+std::unique_ptr<DocCatalog> DocCatalog::make(const std::string &save_path,
+                                             const std::vector<Source> &sources,
+                                             bool read_only) {
+  std::unique_ptr<DocCatalog> catalog(new DocCatalog());
+  for (const auto &source : sources) {
+    catalog->insertImpl(source.doc_id, source.doc_version, source.document);
+  }
+
+  catalog->_save_path = save_path;
+  if (!read_only) {
+    catalog->persist(save_path);
+  }
+  return catalog;
+}
+
+std::unique_ptr<DocCatalog> DocCatalog::open(const std::string &save_path,
+                                             bool read_only) {
+  if (!exists(save_path)) {
+    return nullptr;
+  }
+
+  auto catalog = deserialize(readFile(snapshotPath(save_path)));
+
+  AppendLog::readRecords(logPath(save_path), [&catalog](BinaryReader record) {
+    catalog->applyLogRecord(record);
+  });
+
+  catalog->_save_path = save_path;
+  if (!read_only) {
+    catalog->persist(save_path);
+  }
+  return catalog;
+}
+
+bool DocCatalog::exists(const std::string &save_path) {
+  return std::filesystem::exists(snapshotPath(save_path));
+}
+
+void DocCatalog::persist(const std::string &save_path) {
+  writeFile(snapshotPath(save_path), serialize());
+  _log = std::make_unique<AppendLog>(logPath(save_path));
+  _log->clear();
+}
+
+void DocCatalog::insert(const InsertMetadata &inserted,
+                        const std::string &document) {
+  auto record = insertRecord(inserted.doc_id, inserted.doc_version, document);
+
+  std::unique_lock lock(_mutex);
+  _log->append(record);
+  insertImpl(inserted.doc_id, inserted.doc_version, document);
+}
+
+void DocCatalog::insertBatch(const std::vector<InsertMetadata> &inserted,
+                             const std::vector<NewDocument> &documents) {
+  std::vector<std::string> records;
+  records.reserve(inserted.size());
+  for (size_t i = 0; i < inserted.size(); i++) {
+    records.push_back(insertRecord(inserted[i].doc_id, inserted[i].doc_version,
+                                   documents.at(i).document));
+  }
+
+  std::unique_lock lock(_mutex);
+  _log->append(records);
+  for (size_t i = 0; i < inserted.size(); i++) {
+    insertImpl(inserted[i].doc_id, inserted[i].doc_version,
+               documents[i].document);
+  }
+}
+
+std::string DocCatalog::insertRecord(const DocId &doc_id, uint32_t doc_version,
+                                     const std::string &document) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::Insert));
+  record.writeString(doc_id);
+  record.writeVarint(doc_version);
+  record.writeString(document);
+  return std::move(record.buffer());
+}
+
+void DocCatalog::insertImpl(const DocId &doc_id, uint32_t doc_version,
+                            std::string document) {
+  auto doc = _docs.try_emplace(doc_id).first;
+  if (doc->second.insert_or_assign(doc_version, std::move(document)).second) {
+    _num_sources++;
+  }
+  _latest[doc->first] = doc->second.rbegin()->first;
+}
+
+void DocCatalog::deleteDocVersion(const DocId &doc_id, uint32_t doc_version) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::DeleteDocVersion));
+  record.writeString(doc_id);
+  record.writeVarint(doc_version);
+
+  std::unique_lock lock(_mutex);
+  _log->append(record.buffer());
+  deleteVersionImpl(doc_id, doc_version);
+}
+
+void DocCatalog::deleteDoc(const DocId &doc_id, bool keep_latest_version) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::DeleteDoc));
+  record.writeString(doc_id);
+  record.writeFixed<uint8_t>(keep_latest_version);
+
+  std::unique_lock lock(_mutex);
+  _log->append(record.buffer());
+  deleteDocImpl(doc_id, keep_latest_version);
+}
+
+void DocCatalog::deleteVersionImpl(const DocId &doc_id, uint32_t doc_version) {
+  auto doc = _docs.find(doc_id);
+  if (doc == _docs.end() || doc->second.erase(doc_version) == 0) {
+    return;
+  }
+  _num_sources--;
+
+  if (doc->second.empty()) {
+    _latest.erase(doc->first);
+    _docs.erase(doc);
+  } else {
+    _latest[doc->first] = doc->second.rbegin()->first;
+  }
+}
+
+void DocCatalog::deleteDocImpl(const DocId &doc_id, bool keep_latest_version) {
+  auto doc = _docs.find(doc_id);
+  if (doc == _docs.end()) {
+    return;
+  }
+
+  auto &versions = doc->second;
+  if (keep_latest_version) {
+    _num_sources -= versions.size() - 1;
+    versions.erase(versions.begin(), std::prev(versions.end()));
+  } else {
+    _num_sources -= versions.size();
+    _latest.erase(doc->first);
+    _docs.erase(doc);
+  }
+}
+
+std::optional<uint32_t> DocCatalog::latestVersion(const DocId &doc_id) const {
+  std::shared_lock lock(_mutex);
+
+  auto it = _latest.find(doc_id);
+  if (it == _latest.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+void DocCatalog::keepLatestVersions(
+    std::vector<std::pair<Chunk, float>> &results, uint32_t top_k) const {
+  std::shared_lock lock(_mutex);
+
+  size_t kept = 0;
+  for (auto &result : results) {
+    if (kept == top_k) {
+      break;
+    }
+    auto it = _latest.find(result.first.doc_id);
+    if (it == _latest.end() || it->second != result.first.doc_version) {
+      continue;
+    }
+    if (&results[kept] != &result) {
+      results[kept] = std::move(result);
+    }
+    kept++;
+  }
+  results.erase(results.begin() + kept, results.end());
+}
+
+std::vector<Source> DocCatalog::sources(size_t offset, size_t limit) const {
+  std::shared_lock lock(_mutex);
+
+  std::vector<Source> sources;
+  if (offset >= _num_sources || limit == 0) {
+    return sources;
+  }
+  sources.reserve(std::min(limit, _num_sources - offset));
+
+  // Documents that end before the offset are skipped without visiting their
+  // versions.
+  auto doc = _docs.begin();
+  while (offset >= doc->second.size()) {
+    offset -= doc->second.size();
+    ++doc;
+  }
+  collectSources(doc, std::next(doc->second.begin(), offset), limit, sources);
+  return sources;
+}
+
+std::vector<Source> DocCatalog::sourcesAfter(const DocId &doc_id,
+                                             uint32_t doc_version,
+                                             size_t limit) const {
+  std::shared_lock lock(_mutex);
+
+  std::vector<Source> sources;
+  if (limit == 0) {
+    return sources;
+  }
+
+  auto doc = _docs.lower_bound(doc_id);
+  if (doc != _docs.end() && doc->first == doc_id) {
+    auto version = doc->second.upper_bound(doc_version);
+    if (version != doc->second.end()) {
+      collectSources(doc, version, limit, sources);
+      return sources;
+    }
+    ++doc;
+  }
+  if (doc != _docs.end()) {
+    collectSources(doc, doc->second.begin(), limit, sources);
+  }
+  return sources;
+}
+
+void DocCatalog::collectSources(std::map<DocId, Versions>::const_iterator doc,
+                                Versions::const_iterator version, size_t limit,
+                                std::vector<Source> &sources) const {
+  while (true) {
+    for (; version != doc->second.end(); ++version) {
+      sources.emplace_back(version->second, doc->first, version->first);
+      if (sources.size() == limit) {
+        return;
+      }
+    }
+    if (++doc == _docs.end()) {
+      return;
+    }
+    version = doc->second.begin();
+  }
+}
+
+size_t DocCatalog::numSources() const {
+  std::shared_lock lock(_mutex);
+  return _num_sources;
+}
+
+void DocCatalog::save(const std::string &save_path) const {
+  std::unique_lock lock(_mutex);
+  writeFile(snapshotPath(save_path), serialize());
+  std::error_code error;
+  if (_log && std::filesystem::equivalent(save_path, _save_path, error)) {
+    _log->clear();
+  }
+}
+
+void DocCatalog::applyLogRecord(BinaryReader &record) {
+  switch (LogOp(record.readFixed<uint8_t>())) {
+  case LogOp::Insert: {
+    DocId doc_id = record.readString();
+    uint32_t doc_version = record.readVarint();
+    insertImpl(doc_id, doc_version, record.readString());
+    break;
+  }
+  case LogOp::DeleteDocVersion: {
+    DocId doc_id = record.readString();
+    deleteVersionImpl(doc_id, record.readVarint());
+    break;
+  }
+  case LogOp::DeleteDoc: {
+    DocId doc_id = record.readString();
+    deleteDocImpl(doc_id, record.readFixed<uint8_t>());
+    break;
+  }
+  default:
+    throw std::runtime_error("invalid record in doc catalog log");
+  }
+}
+
+std::string DocCatalog::serialize() const {
+  BinaryWriter out;
+  out.writeVarint(SNAPSHOT_VERSION);
+
+  out.writeVarint(_docs.size());
+  for (const auto &[doc_id, versions] : _docs) {
+    out.writeString(doc_id);
+    out.writeVarint(versions.size());
+    for (const auto &[version, document] : versions) {
+      out.writeVarint(version);
+      out.writeString(document);
+    }
+  }
+
+  return std::move(out.buffer());
+}
+
+std::unique_ptr<DocCatalog> DocCatalog::deserialize(const std::string &data) {
+  BinaryReader in(data);
+  if (in.readVarint() != SNAPSHOT_VERSION) {
+    throw std::runtime_error("unsupported doc catalog version");
+  }
+
+  std::unique_ptr<DocCatalog> catalog(new DocCatalog());
+  size_t num_docs = in.readVarint();
+  for (size_t i = 0; i < num_docs; i++) {
+    DocId doc_id = in.readString();
+    size_t num_versions = in.readVarint();
+    for (size_t j = 0; j < num_versions; j++) {
+      uint32_t version = in.readVarint();
+      catalog->insertImpl(doc_id, version, in.readString());
+    }
+  }
+
+  return catalog;
+}
+
+} // namespace thirdai::search::ndb
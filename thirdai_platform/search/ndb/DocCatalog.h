@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Chunk.h"
+#include "DocumentBatch.h"
+#include "NeuralDB.h"
+#include "Serialization.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+/**
+ * The documents of an ndb and their versions, so that sources can be listed a
+ * page at a time without asking the engine for every version, and the latest
+ * version of a document can be found with a single hash lookup.
+ *
+ * Like the MetadataIndex, the catalog is stored next to the engine's files in
+ * the ndb directory as a snapshot plus a log of the updates applied since the
+ * snapshot was written, and the log is folded into the snapshot each time the
+ * catalog is opened. Ndbs created before the catalog existed do not have one,
+ * their catalog is built from the engine's sources when they are opened.
+ */
+class DocCatalog {
+public:
+  /**
+   * Creates a catalog of the sources in the ndb directory save_path. If
+   * read_only is true the catalog is not written to save_path, and it must not
+   * be updated.
+   */
+  static std::unique_ptr<DocCatalog> make(const std::string &save_path,
+                                          const std::vector<Source> &sources,
+                                          bool read_only = false);
+
+  /**
+   * Opens the catalog stored in save_path, or returns nullptr if the ndb in
+   * save_path does not have a catalog. If read_only is true the files in
+   * save_path are not modified, and the catalog must not be updated.
+   */
+  static std::unique_ptr<DocCatalog> open(const std::string &save_path,
+                                          bool read_only = false);
+
+  static bool exists(const std::string &save_path);
+
+  DocCatalog(const DocCatalog &) = delete;
+  DocCatalog &operator=(const DocCatalog &) = delete;
+
+  void insert(const InsertMetadata &inserted, const std::string &document);
+
+  /**
+   * Adds the version of each document with a single log write. inserted[i] is
+   * the result of inserting documents[i].
+   */
+  void insertBatch(const std::vector<InsertMetadata> &inserted,
+                   const std::vector<NewDocument> &documents);
+
+  void deleteDocVersion(const DocId &doc_id, uint32_t doc_version);
+
+  void deleteDoc(const DocId &doc_id, bool keep_latest_version);
+
+  std::optional<uint32_t> latestVersion(const DocId &doc_id) const;
+
+  /**
+   * Removes the results that are not from the latest version of their
+   * document, and then all but the first top_k results.
+   */
+  void keepLatestVersions(std::vector<std::pair<Chunk, float>> &results,
+                          uint32_t top_k) const;
+
+  /**
+   * Returns up to limit sources starting at offset, in order of doc id and
+   * then version. Finding the offset walks the documents before it, so paging
+   * through the whole catalog by offset takes time quadratic in the number of
+   * documents, sourcesAfter pages through it in linear time.
+   */
+  std::vector<Source> sources(size_t offset, size_t limit) const;
+
+  /**
+   * Returns up to limit sources that follow version doc_version of doc_id in
+   * the order of sources, which is found with a lookup, so that the catalog
+   * can be paged through by passing the last source of the previous page. The
+   * version does not have to be in the catalog.
+   */
+  std::vector<Source> sourcesAfter(const DocId &doc_id, uint32_t doc_version,
+                                   size_t limit) const;
+
+  size_t numSources() const;
+
+  /**
+   * Writes a snapshot of the catalog to the ndb directory save_path.
+   */
+  void save(const std::string &save_path) const;
+
+private:
+  DocCatalog() = default;
+
+  static std::string insertRecord(const DocId &doc_id, uint32_t doc_version,
+                                  const std::string &document);
+
+  void insertImpl(const DocId &doc_id, uint32_t doc_version,
+                  std::string document);
+
+  void deleteVersionImpl(const DocId &doc_id, uint32_t doc_version);
+
+  void deleteDocImpl(const DocId &doc_id, bool keep_latest_version);
+
+  using Versions = std::map<uint32_t, std::string>;
+
+  /**
+   * Appends the sources from version of the document doc onwards to sources
+   * until it has limit sources.
+   */
+  void collectSources(std::map<DocId, Versions>::const_iterator doc,
+                      Versions::const_iterator version, size_t limit,
+                      std::vector<Source> &sources) const;
+
+  void applyLogRecord(BinaryReader &record);
+
+  std::string serialize() const;
+
+  static std::unique_ptr<DocCatalog> deserialize(const std::string &data);
+
+  /**
+   * Writes a snapshot to save_path and starts a new log there.
+   */
+  void persist(const std::string &save_path);
+
+  // The document name of each version of each document, ordered by doc id
+  // so that pages of sources are stable.
+  std::map<DocId, Versions> _docs;
+  // The latest version of each document, keyed by views of the keys of _docs.
+  std::unordered_map<std::string_view, uint32_t> _latest;
+  size_t _num_sources = 0;
+
+  std::string _save_path;
+  std::unique_ptr<AppendLog> _log;
+
+  mutable std::shared_mutex _mutex;
+};
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,141 @@
+#include "DocumentBatch.h"
+#include "MetadataCodec.h"
+#include "Serialization.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+// The fewest bytes that can encode a document (an empty name and doc id, a
+// version, and a chunk count), a chunk (empty text and metadata), an
+// embedding (its dimension), and a value of an embedding.
+constexpr size_t MIN_DOCUMENT_BYTES = 4;
+constexpr size_t MIN_CHUNK_BYTES = 2;
+constexpr size_t MIN_EMBEDDING_BYTES = 1;
+constexpr size_t MIN_VALUE_BYTES = sizeof(float);
+
+/**
+ * Reads a count of elements that each take at least min_bytes, and throws if
+ * the rest of the batch is too short to hold them, so that a corrupt count
+ * cannot allocate memory for elements that are not in the batch.
+ */
+uint64_t readCount(BinaryReader &reader, size_t min_bytes, const char *what) {
+  uint64_t count = reader.readVarint();
+  if (count > reader.remaining() / min_bytes) {
+    throw std::invalid_argument(
+        "document batch has " + std::to_string(count) + " " + what +
+        ", more than fit in its remaining " +
+        std::to_string(reader.remaining()) + " bytes");
+  }
+  return count;
+}
+
+} // namespace
+
+std::vector<NewDocument> decodeDocumentBatch(std::string_view data) {
+  BinaryReader reader(data);
+
+  MetadataKeys keys;
+  uint64_t n_keys = reader.readVarint();
+  for (uint64_t i = 0; i < n_keys; i++) {
+    keys.intern(reader.readString());
+  }
+
+  std::vector<NewDocument> documents(
+      readCount(reader, MIN_DOCUMENT_BYTES, "documents"));
+  for (auto &document : documents) {
+    document.document = reader.readString();
+    document.doc_id = reader.readString();
+    if (uint64_t version = reader.readVarint()) {
+      document.doc_version = version - 1;
+    }
+
+    uint64_t n_chunks = readCount(reader, MIN_CHUNK_BYTES, "chunks");
+    document.chunks.reserve(n_chunks);
+    document.metadata.reserve(n_chunks);
+    for (uint64_t i = 0; i < n_chunks; i++) {
+      document.chunks.push_back(reader.readString());
+      document.metadata.push_back(decodeMetadata(reader, keys));
+    }
+  }
+
+  if (!reader.done()) {
+    for (auto &document : documents) {
+      document.embeddings.resize(
+          readCount(reader, MIN_EMBEDDING_BYTES, "embeddings"));
+      for (auto &embedding : document.embeddings) {
+        embedding.resize(
+            readCount(reader, MIN_VALUE_BYTES, "embedding values"));
+        for (auto &value : embedding) {
+          value = reader.readFixed<float>();
+        }
+      }
+    }
+  }
+
+  if (!reader.done()) {
+    throw std::invalid_argument("unexpected data after document batch");
+  }
+
+  return documents;
+}
+
+std::string encodeDocumentBatch(const std::vector<NewDocument> &documents) {
+  MetadataKeys keys;
+  BinaryWriter body;
+  body.writeVarint(documents.size());
+  for (const auto &document : documents) {
+    if (document.metadata.size() != document.chunks.size()) {
+      throw std::invalid_argument(
+          "number of metadata entries does not match the number of chunks");
+    }
+    if (!document.embeddings.empty() &&
+        document.embeddings.size() != document.chunks.size()) {
+      throw std::invalid_argument(
+          "number of embeddings does not match the number of chunks");
+    }
+
+    body.writeString(document.document);
+    body.writeString(document.doc_id);
+    body.writeVarint(document.doc_version ? uint64_t(*document.doc_version) + 1
+                                          : 0);
+
+    body.writeVarint(document.chunks.size());
+    for (size_t i = 0; i < document.chunks.size(); i++) {
+      body.writeString(document.chunks[i]);
+      encodeMetadata(body, document.metadata[i], keys);
+    }
+  }
+
+  bool has_embeddings =
+      std::any_of(documents.begin(), documents.end(), [](const auto &document) {
+        return !document.embeddings.empty();
+      });
+  if (has_embeddings) {
+    for (const auto &document : documents) {
+      body.writeVarint(document.embeddings.size());
+      for (const auto &embedding : document.embeddings) {
+        body.writeVarint(embedding.size());
+        for (float value : embedding) {
+          body.writeFixed<float>(value);
+        }
+      }
+    }
+  }
+
+  // The key dictionary precedes the documents, so it is written once every
+  // key has been interned.
+  BinaryWriter writer;
+  writer.writeVarint(keys.size());
+  for (const auto &key : keys.keys()) {
+    writer.writeString(key);
+  }
+  writer.buffer().append(body.buffer());
+  return std::move(writer.buffer());
+}
+
+} // namespace thirdai::search::ndb
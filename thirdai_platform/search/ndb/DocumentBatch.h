@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Chunk.h"
+#include "Constraints.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+/**
+ * The arguments of a single NeuralDB::insert call, and optionally an embedding
+ * of each chunk for the vector index of a PlatformNeuralDB.
+ */
+struct NewDocument {
+  std::vector<std::string> chunks;
+  std::vector<MetadataMap> metadata;
+  std::string document;
+  DocId doc_id;
+  std::optional<uint32_t> doc_version;
+  // Either empty or one embedding per chunk.
+  std::vector<std::vector<float>> embeddings;
+};
+
+/**
+ * Packed encoding of a batch of documents, so that a batch can be passed to the
+ * ndb in a single buffer. Strings are a varint length followed by the bytes.
+ * The batch starts with a dictionary of the metadata keys used in the batch,
+ * a varint key count followed by the keys, then a varint document count and
+ * the documents. Each document is the document name, the doc id, a varint that
+ * is 0 if no version is specified and otherwise the version plus 1, a varint
+ * chunk count, and then the text and metadata of each chunk, where metadata
+ * uses the encoding of encodeMetadata with ids into the key dictionary.
+ *
+ * If any document has embeddings, the documents are followed by a section with
+ * a varint embedding count for each document, 0 or its chunk count, followed
+ * by each embedding as a varint dimension and 4 byte floats. Batches without
+ * embeddings end after the documents.
+ *
+ * Throws std::invalid_argument if a count is larger than the rest of the batch
+ * can hold, before memory is allocated for it.
+ */
+std::vector<NewDocument> decodeDocumentBatch(std::string_view data);
+
+/**
+ * Encodes the documents in the format read by decodeDocumentBatch.
+ */
+std::string encodeDocumentBatch(const std::vector<NewDocument> &documents);
+
+} // namespace thirdai::search::ndb
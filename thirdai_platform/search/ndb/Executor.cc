@@ -0,0 +1,320 @@
+#include "Executor.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <omp.h>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+constexpr uint32_t MAX_THREADS = 1024;
+
+// Parses a sysfs cpu list such as "0-3,8,10-11".
+std::vector<uint32_t> parseCpuList(const std::string &list) {
+  std::vector<uint32_t> cpus;
+  std::stringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    size_t dash = range.find('-');
+    uint32_t first = std::stoul(range.substr(0, dash));
+    uint32_t last =
+        dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+    for (uint32_t cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+uint32_t parallelism(const ExecutorOptions &options, Executor::Work work) {
+  return work == Executor::Work::Query ? options.query_parallelism
+                                       : options.update_parallelism;
+}
+
+void pinCurrentThread(const std::vector<uint32_t> &cpus) {
+  if (cpus.empty()) {
+    return;
+  }
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (uint32_t cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  // Pinning is best effort, a container may not allow every cpu of a node.
+  sched_setaffinity(0, sizeof(set), &set);
+}
+
+} // namespace
+
+class Executor::Pool {
+public:
+  Pool(ExecutorOptions options, std::vector<uint32_t> cpus,
+       int default_parallelism)
+      : _options(std::move(options)), _cpus(std::move(cpus)),
+        _default_parallelism(default_parallelism) {
+    _threads.reserve(_options.threads);
+    for (uint32_t i = 0; i < _options.threads; i++) {
+      _threads.emplace_back([this]() { worker(); });
+    }
+  }
+
+  Pool(const Pool &) = delete;
+  Pool &operator=(const Pool &) = delete;
+
+  ~Pool() {
+    {
+      std::lock_guard lock(_mutex);
+      _stopped = true;
+    }
+    _queue_cv.notify_all();
+    for (auto &thread : _threads) {
+      thread.join();
+    }
+  }
+
+  void run(Work work, void (*call)(void *), void *ctx) {
+    Task task(work, call, ctx);
+
+    std::unique_lock lock(_mutex);
+    _queue.push_back(&task);
+    _queue_cv.notify_one();
+    task.done_cv.wait(lock, [&]() { return task.done; });
+  }
+
+  void submit(Work work, std::function<void()> f) {
+    auto task = std::make_unique<Task>(work, nullptr, nullptr);
+    task->detached = std::move(f);
+
+    std::lock_guard lock(_mutex);
+    _queue.push_back(task.release());
+    _queue_cv.notify_one();
+  }
+
+private:
+  struct Task {
+    Task(Work work, void (*call)(void *), void *ctx)
+        : work(work), call(call), ctx(ctx) {}
+
+    Work work;
+    void (*call)(void *);
+    void *ctx;
+    bool done = false;
+    std::condition_variable done_cv;
+    // Set instead of call for tasks from submit, which nothing waits for and
+    // which are deleted by the worker that runs them.
+    std::function<void()> detached;
+  };
+
+  void worker() {
+    // OpenMP threads inherit the affinity of the thread that starts them.
+    pinCurrentThread(_cpus);
+
+    std::unique_lock lock(_mutex);
+    while (true) {
+      _queue_cv.wait(lock, [&]() { return _stopped || !_queue.empty(); });
+      if (_queue.empty()) {
+        return;
+      }
+
+      Task *task = _queue.front();
+      _queue.pop_front();
+      lock.unlock();
+
+      uint32_t threads = parallelism(_options, task->work);
+      omp_set_num_threads(threads > 0 ? threads : _default_parallelism);
+
+      if (task->detached) {
+        std::unique_ptr<Task> owned(task);
+        owned->detached();
+        // The call may hold the last reference to an ndb, which is closed
+        // here without holding the mutex.
+        owned.reset();
+        lock.lock();
+        continue;
+      }
+
+      // The task catches anything the call throws.
+      task->call(task->ctx);
+
+      lock.lock();
+      task->done = true;
+      task->done_cv.notify_one();
+    }
+  }
+
+  ExecutorOptions _options;
+  std::vector<uint32_t> _cpus;
+  int _default_parallelism;
+
+  std::mutex _mutex;
+  std::condition_variable _queue_cv;
+  std::deque<Task *> _queue;
+  bool _stopped = false;
+
+  std::vector<std::thread> _threads;
+};
+
+struct Executor::State {
+  std::mutex mutex;
+  ExecutorOptions options;
+  // The cpus of the options, including the cpus of their NUMA nodes.
+  std::vector<uint32_t> cpus;
+  // Held in a shared_ptr so that calls keep the pool they were dispatched to
+  // alive while configure replaces it. nullptr if there are no executor
+  // threads.
+  std::shared_ptr<Pool> pool;
+  // The number of OpenMP threads a thread uses unless it is changed, which is
+  // restored when a configuration without parallelism replaces one with it.
+  int default_parallelism = omp_get_max_threads();
+};
+
+Executor::State &Executor::state() {
+  static State state;
+  return state;
+}
+
+void Executor::configure(const ExecutorOptions &options) {
+  if (options.threads > MAX_THREADS ||
+      options.query_parallelism > MAX_THREADS ||
+      options.update_parallelism > MAX_THREADS) {
+    throw std::invalid_argument(
+        "executor threads and parallelism must be at most " +
+        std::to_string(MAX_THREADS));
+  }
+
+  std::vector<uint32_t> cpus = options.cpus;
+  for (uint32_t node : options.numa_nodes) {
+    auto node_cpus = numaNodeCpus(node);
+    cpus.insert(cpus.end(), node_cpus.begin(), node_cpus.end());
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+
+  long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+  for (uint32_t cpu : cpus) {
+    if (cpu >= CPU_SETSIZE || (num_cpus > 0 && cpu >= num_cpus)) {
+      throw std::invalid_argument("invalid cpu " + std::to_string(cpu));
+    }
+  }
+  if (!cpus.empty() && options.threads == 0) {
+    throw std::invalid_argument(
+        "cpu affinity can only be set if there are executor threads");
+  }
+
+  auto &state = Executor::state();
+
+  std::shared_ptr<Pool> new_pool;
+  if (options.threads > 0) {
+    new_pool =
+        std::make_shared<Pool>(options, cpus, state.default_parallelism);
+  }
+
+  std::shared_ptr<Pool> old_pool;
+  {
+    std::lock_guard lock(state.mutex);
+    state.options = options;
+    state.cpus = cpus;
+    old_pool = std::exchange(state.pool, std::move(new_pool));
+  }
+  // The previous threads are joined here once they finish their calls, unless
+  // a call that is waiting on them still holds the pool.
+}
+
+ExecutorOptions Executor::options() {
+  auto &state = Executor::state();
+  std::lock_guard lock(state.mutex);
+  return state.options;
+}
+
+std::vector<uint32_t> Executor::numaNodeCpus(uint32_t node) {
+  std::string path =
+      "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+  std::ifstream file(path);
+  if (!file) {
+    throw std::invalid_argument("unknown NUMA node " + std::to_string(node));
+  }
+  std::string list;
+  std::getline(file, list);
+  return parseCpuList(list);
+}
+
+bool Executor::dispatch(Work work, void (*call)(void *), void *ctx,
+                        uint32_t &inline_parallelism) {
+  auto &state = Executor::state();
+
+  std::shared_ptr<Pool> pool;
+  {
+    std::lock_guard lock(state.mutex);
+    bool inline_query = work == Work::Query && state.options.inline_queries;
+    if (!state.pool || inline_query) {
+      inline_parallelism = parallelism(state.options, work);
+      if (inline_query && inline_parallelism == 0) {
+        inline_parallelism = 1;
+      }
+      return false;
+    }
+    pool = state.pool;
+  }
+
+  pool->run(work, call, ctx);
+  return true;
+}
+
+void Executor::submit(Work work, std::function<void()> f) {
+  auto &state = Executor::state();
+
+  std::shared_ptr<Pool> pool;
+  {
+    std::lock_guard lock(state.mutex);
+    pool = state.pool;
+  }
+  if (!pool) {
+    throw std::logic_error(
+        "asynchronous calls require executor threads, see Executor::configure");
+  }
+
+  pool->submit(work, std::move(f));
+}
+
+void Executor::bindCurrentThread(Work work) {
+  auto &state = Executor::state();
+
+  uint32_t threads;
+  std::vector<uint32_t> cpus;
+  {
+    std::lock_guard lock(state.mutex);
+    threads = parallelism(state.options, work);
+    cpus = state.cpus;
+  }
+
+  omp_set_num_threads(threads > 0 ? threads : state.default_parallelism);
+  pinCurrentThread(cpus);
+}
+
+Executor::ParallelismScope::ParallelismScope(uint32_t parallelism) {
+  if (parallelism > 0) {
+    _previous = omp_get_max_threads();
+    omp_set_num_threads(parallelism);
+  }
+}
+
+Executor::ParallelismScope::~ParallelismScope() {
+  if (_previous) {
+    omp_set_num_threads(*_previous);
+  }
+}
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+struct ExecutorOptions {
+  // The number of threads that run engine calls. Callers wait for a thread to
+  // run their call, which bounds the number of concurrent calls no matter how
+  // many threads make them. If 0 calls run on the calling thread.
+  uint32_t threads = 0;
+
+  // The number of OpenMP threads used by each query and each update (insert,
+  // finetune, associate, and pruning) call. If 0 the engine's default is used,
+  // which is one thread per cpu.
+  uint32_t query_parallelism = 0;
+  uint32_t update_parallelism = 0;
+
+  // The executor threads, and the OpenMP threads they start, are pinned to
+  // the union of these cpus and the cpus of these NUMA nodes. Pinning requires
+  // executor threads, since the calling threads belong to the caller.
+  std::vector<uint32_t> cpus;
+  std::vector<uint32_t> numa_nodes;
+
+  // Runs queries on the calling thread, with query_parallelism threads or a
+  // single thread if it is 0, rather than on an executor thread. This avoids
+  // the handoff to an executor thread and the fork-join of parallel scoring,
+  // which gives lower latency when many queries run concurrently.
+  bool inline_queries = false;
+};
+
+/**
+ * Process wide control of the threads used by the engine, which parallelizes
+ * its calls with OpenMP. OpenMP keeps a separate team of threads for every
+ * thread that starts a parallel region, so when many threads call the engine
+ * (such as the threads running goroutines through cgo), each of them starts a
+ * team of one thread per cpu. Running calls on a fixed set of executor
+ * threads bounds the number of teams, and the parallelism of each call bounds
+ * their size.
+ *
+ * Until configure is called, calls run on the calling thread with the
+ * engine's default parallelism.
+ */
+class Executor {
+public:
+  enum class Work { Query, Update };
+
+  /**
+   * Replaces the executor configuration. Calls that already started finish
+   * with the previous configuration, and the previous executor threads exit
+   * once they have run them.
+   */
+  static void configure(const ExecutorOptions &options);
+
+  static ExecutorOptions options();
+
+  /**
+   * Returns the cpus of the NUMA node, from sysfs.
+   */
+  static std::vector<uint32_t> numaNodeCpus(uint32_t node);
+
+  /**
+   * Runs f with the configured threads for the work and returns its result,
+   * rethrowing anything it throws. f runs on an executor thread unless the
+   * call runs inline, so it must not call run itself.
+   */
+  template <typename F>
+  static auto run(Work work, F &&f) {
+    using Result = std::invoke_result_t<F &>;
+
+    if constexpr (std::is_void_v<Result>) {
+      run(work, [&]() {
+        f();
+        return true;
+      });
+    } else {
+      std::optional<Result> result;
+      std::exception_ptr error;
+      auto call = [&]() {
+        try {
+          result.emplace(f());
+        } catch (...) {
+          error = std::current_exception();
+        }
+      };
+
+      using Call = decltype(call);
+
+      uint32_t inline_parallelism = 0;
+      if (!dispatch(
+              work, [](void *ctx) { (*static_cast<Call *>(ctx))(); }, &call,
+              inline_parallelism)) {
+        ParallelismScope scope(inline_parallelism);
+        return f();
+      }
+
+      if (error) {
+        std::rethrow_exception(error);
+      }
+      return std::move(*result);
+    }
+  }
+
+  /**
+   * Runs f on an executor thread without waiting for it to finish, so f must
+   * catch anything it throws. It runs even if configure replaces the executor
+   * before it starts. Calls submitted this way are never run inline, since
+   * the calling thread does not wait for them, so this throws if there are no
+   * executor threads.
+   */
+  static void submit(Work work, std::function<void()> f);
+
+  /**
+   * Applies the parallelism and cpu affinity for the work to the calling
+   * thread, which is how the ndb's own background threads follow the
+   * configuration.
+   */
+  static void bindCurrentThread(Work work);
+
+private:
+  class Pool;
+  struct State;
+
+  static State &state();
+
+  /**
+   * Sets the number of OpenMP threads of the calling thread while it is in
+   * scope, does nothing if parallelism is 0.
+   */
+  class ParallelismScope {
+  public:
+    explicit ParallelismScope(uint32_t parallelism);
+
+    ParallelismScope(const ParallelismScope &) = delete;
+    ParallelismScope &operator=(const ParallelismScope &) = delete;
+
+    ~ParallelismScope();
+
+  private:
+    std::optional<int> _previous;
+  };
+
+  /**
+   * Runs call(ctx) on an executor thread and waits for it to finish. Returns
+   * false without running it if the call should run on the calling thread,
+   * with inline_parallelism set to the parallelism to use.
+   */
+  static bool dispatch(Work work, void (*call)(void *), void *ctx,
+                       uint32_t &inline_parallelism);
+};
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,349 @@
+#include "FeedbackBuffer.h"
+#include <algorithm>
+#include <exception>
+#include <filesystem>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+enum class LogOp : uint8_t { Finetune, Associate, Applied };
+
+std::string logPath(const std::string &save_path) {
+  return (std::filesystem::path(save_path) / "feedback.log").string();
+}
+
+std::string appliedRecord(uint64_t seq) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::Applied));
+  record.writeVarint(seq);
+  return std::move(record.buffer());
+}
+
+} // namespace
+
+FeedbackBuffer::FeedbackBuffer(
+    const std::string &save_path, Flush flush,
+    std::optional<std::chrono::milliseconds> interval)
+    : _flush(std::move(flush)), _interval(interval), _save_path(save_path) {
+  std::string log_path = logPath(save_path);
+
+  std::vector<PendingFeedback> logged;
+  uint64_t applied = 0;
+  AppendLog::readRecords(log_path, [&](BinaryReader record) {
+    BinaryReader header = record;
+    auto op = LogOp(header.readFixed<uint8_t>());
+    uint64_t seq = header.readVarint();
+    switch (op) {
+    case LogOp::Finetune:
+    case LogOp::Associate:
+      logged.push_back(
+          {seq, std::string(record.readBytes(record.remaining()))});
+      break;
+    case LogOp::Applied:
+      applied = std::max(applied, seq);
+      break;
+    default:
+      throw std::runtime_error("invalid record in feedback log");
+    }
+    _seq = std::max(_seq, seq);
+  });
+
+  for (auto &call : logged) {
+    if (call.seq > applied) {
+      _pending_count += feedbackCount(call.record);
+      _pending.push_back(std::move(call));
+    }
+  }
+
+  // Like the ingest queue's log, the log is rewritten with only the pending
+  // feedback so that it does not grow across restarts.
+  _log = std::make_unique<AppendLog>(log_path);
+  _log->clear();
+  if (!_pending.empty()) {
+    std::vector<std::string> records;
+    records.reserve(_pending.size());
+    for (const auto &call : _pending) {
+      records.push_back(call.record);
+    }
+    _log->append(records);
+
+    _pending_since = std::chrono::steady_clock::now();
+    startWorker();
+  }
+}
+
+bool FeedbackBuffer::exists(const std::string &save_path) {
+  std::error_code error;
+  auto size = std::filesystem::file_size(logPath(save_path), error);
+  return !error && size > 0;
+}
+
+FeedbackBuffer::~FeedbackBuffer() {
+  {
+    std::lock_guard lock(_mutex);
+    _stopping = true;
+  }
+  _pending_cv.notify_one();
+
+  if (_worker.joinable()) {
+    _worker.join();
+  }
+}
+
+size_t FeedbackBuffer::addFinetune(
+    const std::vector<std::string> &queries,
+    const std::vector<std::vector<ChunkId>> &chunk_ids) {
+  if (queries.size() != chunk_ids.size()) {
+    throw std::invalid_argument(
+        "number of queries must match the number of label lists");
+  }
+
+  BinaryWriter body;
+  body.writeVarint(queries.size());
+  for (size_t i = 0; i < queries.size(); i++) {
+    body.writeString(queries[i]);
+    body.writeVarint(chunk_ids[i].size());
+    for (ChunkId id : chunk_ids[i]) {
+      body.writeVarint(id);
+    }
+  }
+  return add(uint8_t(LogOp::Finetune), body.buffer(), queries.size());
+}
+
+size_t FeedbackBuffer::addAssociate(const std::vector<std::string> &sources,
+                                    const std::vector<std::string> &targets,
+                                    uint32_t strength) {
+  if (sources.size() != targets.size()) {
+    throw std::invalid_argument(
+        "number of sources must match the number of targets");
+  }
+
+  BinaryWriter body;
+  body.writeVarint(strength);
+  body.writeVarint(sources.size());
+  for (size_t i = 0; i < sources.size(); i++) {
+    body.writeString(sources[i]);
+    body.writeString(targets[i]);
+  }
+  return add(uint8_t(LogOp::Associate), body.buffer(), sources.size());
+}
+
+size_t FeedbackBuffer::add(uint8_t op, const std::string &body, size_t count) {
+  std::lock_guard lock(_mutex);
+
+  uint64_t seq = _seq + 1;
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(op);
+  record.writeVarint(seq);
+  record.buffer().append(body);
+
+  _log->append(record.buffer());
+  _seq = seq;
+  if (_pending.empty()) {
+    _pending_since = std::chrono::steady_clock::now();
+  }
+  _pending.push_back({seq, std::move(record.buffer())});
+  _pending_count += count;
+
+  startWorker();
+  _pending_cv.notify_one();
+
+  return _pending_count;
+}
+
+void FeedbackBuffer::apply(const ApplyBatch &apply) {
+  std::unique_lock lock(_mutex);
+
+  std::vector<PendingFeedback> calls(std::make_move_iterator(_pending.begin()),
+                                     std::make_move_iterator(_pending.end()));
+  _pending.clear();
+  _applying_count = _pending_count;
+  _pending_count = 0;
+
+  std::optional<std::string> reported = std::move(_error);
+  _error.reset();
+
+  std::exception_ptr error;
+  if (!calls.empty()) {
+    // Feedback added while the batch is applied is logged after the batch,
+    // and is part of the next batch.
+    lock.unlock();
+    try {
+      apply(merge(calls));
+    } catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    _applying_count = 0;
+
+    try {
+      if (_pending.empty()) {
+        _log->clear();
+      } else {
+        _log->append(appliedRecord(calls.back().seq));
+      }
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  lock.unlock();
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  if (reported) {
+    throw std::runtime_error("error applying buffered feedback: " + *reported);
+  }
+}
+
+size_t FeedbackBuffer::pending() const {
+  std::lock_guard lock(_mutex);
+  return _pending_count + _applying_count;
+}
+
+void FeedbackBuffer::save(const std::string &save_path) const {
+  std::error_code error;
+  if (std::filesystem::equivalent(save_path, _save_path, error)) {
+    return;
+  }
+
+  std::lock_guard lock(_mutex);
+
+  std::vector<std::string> records;
+  records.reserve(_pending.size());
+  for (const auto &call : _pending) {
+    records.push_back(call.record);
+  }
+
+  AppendLog log(logPath(save_path));
+  log.clear();
+  if (!records.empty()) {
+    log.append(records);
+  }
+}
+
+size_t FeedbackBuffer::feedbackCount(std::string_view record) {
+  BinaryReader in(record);
+  auto op = LogOp(in.readFixed<uint8_t>());
+  in.readVarint();
+  if (op == LogOp::Associate) {
+    in.readVarint();
+  }
+  return in.readVarint();
+}
+
+FeedbackBatch
+FeedbackBuffer::merge(const std::vector<PendingFeedback> &calls) {
+  FeedbackBatch batch;
+
+  // Each piece of feedback is identified by its encoding.
+  std::unordered_set<std::string> seen;
+  std::unordered_map<uint32_t, size_t> associations;
+
+  for (const auto &call : calls) {
+    BinaryReader in(call.record);
+    auto op = LogOp(in.readFixed<uint8_t>());
+    in.readVarint();
+
+    if (op == LogOp::Finetune) {
+      size_t num_queries = in.readVarint();
+      for (size_t i = 0; i < num_queries; i++) {
+        BinaryWriter key;
+        key.writeFixed<uint8_t>(uint8_t(LogOp::Finetune));
+
+        std::string query = in.readString();
+        key.writeString(query);
+        std::vector<ChunkId> chunk_ids(in.readVarint());
+        key.writeVarint(chunk_ids.size());
+        for (auto &id : chunk_ids) {
+          id = in.readVarint();
+          key.writeVarint(id);
+        }
+
+        if (seen.insert(std::move(key.buffer())).second) {
+          batch.queries.push_back(std::move(query));
+          batch.chunk_ids.push_back(std::move(chunk_ids));
+        }
+      }
+    } else {
+      uint32_t strength = in.readVarint();
+      auto [group, inserted] =
+          associations.try_emplace(strength, batch.associations.size());
+      if (inserted) {
+        batch.associations.push_back({strength, {}, {}});
+      }
+      auto &pairs = batch.associations[group->second];
+
+      size_t num_pairs = in.readVarint();
+      for (size_t i = 0; i < num_pairs; i++) {
+        std::string source = in.readString();
+        std::string target = in.readString();
+
+        BinaryWriter key;
+        key.writeFixed<uint8_t>(uint8_t(LogOp::Associate));
+        key.writeVarint(strength);
+        key.writeString(source);
+        key.writeString(target);
+
+        if (seen.insert(std::move(key.buffer())).second) {
+          pairs.sources.push_back(std::move(source));
+          pairs.targets.push_back(std::move(target));
+        }
+      }
+    }
+  }
+
+  return batch;
+}
+
+void FeedbackBuffer::startWorker() {
+  if (_interval && !_worker.joinable()) {
+    _worker = std::thread([this]() { run(); });
+  }
+}
+
+void FeedbackBuffer::run() {
+  std::unique_lock lock(_mutex);
+
+  while (true) {
+    _pending_cv.wait(lock, [&]() { return !_pending.empty() || _stopping; });
+    if (_stopping) {
+      return;
+    }
+
+    // The pending feedback may be applied, or replaced by newer feedback,
+    // while the worker waits, so the deadline is checked again after waiting.
+    auto due = _pending_since + *_interval;
+    if (std::chrono::steady_clock::now() < due) {
+      _pending_cv.wait_until(lock, due, [&]() { return _stopping; });
+      continue;
+    }
+
+    lock.unlock();
+    std::optional<std::string> error;
+    try {
+      _flush();
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+    lock.lock();
+
+    if (error) {
+      if (!_error) {
+        _error = std::move(error);
+      }
+      // Feedback that is still pending is retried after another interval
+      // instead of immediately.
+      _pending_since = std::chrono::steady_clock::now();
+    }
+  }
+}
+
+} // namespace thirdai::search::ndb
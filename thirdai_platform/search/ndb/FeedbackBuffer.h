@@ -0,0 +1,162 @@
+#pragma once
+
+#include "Chunk.h"
+#include "Serialization.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+/**
+ * The feedback of several finetune and associate calls merged into the
+ * arguments of as few engine calls as possible. Feedback that is repeated
+ * within a batch is only included once.
+ */
+struct FeedbackBatch {
+  std::vector<std::string> queries;
+  std::vector<std::vector<ChunkId>> chunk_ids;
+
+  // The associations of each strength, in order of the first call with that
+  // strength.
+  struct Associations {
+    uint32_t strength;
+    std::vector<std::string> sources;
+    std::vector<std::string> targets;
+  };
+  std::vector<Associations> associations;
+};
+
+/**
+ * Buffers the feedback of finetune and associate calls in a durable log in
+ * the ndb directory, so that the calls return without waiting for the model to
+ * be updated, and applies the buffered feedback in batches. Each batch is
+ * applied with one finetune call and one associate call per strength, with
+ * the finetune feedback applied first.
+ *
+ * The owner applies pending feedback by calling apply with its write lock
+ * held, so that a checkpoint saved with the same lock contains every piece of
+ * feedback exactly once, either applied to the engine or in the checkpoint's
+ * log. With an interval the buffer also calls flush from a background thread
+ * once feedback has been pending for the interval, and flush is expected to
+ * take the write lock and call apply.
+ *
+ * Feedback that was not applied when the ndb was closed is still pending when
+ * it is opened again. A crash between a batch being applied and the buffer
+ * recording that it was applied causes the batch to be applied a second time
+ * when the ndb is opened.
+ */
+class FeedbackBuffer {
+public:
+  using Flush = std::function<void()>;
+  using ApplyBatch = std::function<void(const FeedbackBatch &)>;
+
+  /**
+   * Opens the feedback log in the ndb directory save_path. If interval is
+   * std::nullopt feedback is only applied by calls to apply.
+   */
+  FeedbackBuffer(const std::string &save_path, Flush flush,
+                 std::optional<std::chrono::milliseconds> interval);
+
+  /**
+   * Whether the ndb directory save_path has a feedback log that may hold
+   * pending feedback. The log is emptied once every piece of feedback in it
+   * has been applied.
+   */
+  static bool exists(const std::string &save_path);
+
+  FeedbackBuffer(const FeedbackBuffer &) = delete;
+  FeedbackBuffer &operator=(const FeedbackBuffer &) = delete;
+
+  /**
+   * Stops the background thread, waiting for a flush that is in progress to
+   * finish. Pending feedback is left in the log.
+   */
+  ~FeedbackBuffer();
+
+  /**
+   * Logs the feedback and returns the number of pieces of feedback that are
+   * pending for the next batch, which counts each query and each association.
+   */
+  size_t addFinetune(const std::vector<std::string> &queries,
+                     const std::vector<std::vector<ChunkId>> &chunk_ids);
+
+  size_t addAssociate(const std::vector<std::string> &sources,
+                      const std::vector<std::string> &targets,
+                      uint32_t strength);
+
+  /**
+   * Applies the pending feedback as a single batch by calling apply on the
+   * calling thread, and must be called with the owner's write lock held. The
+   * batch is discarded if apply throws, and the error is rethrown. Otherwise
+   * rethrows the error of a background flush that failed since the last error
+   * was reported.
+   */
+  void apply(const ApplyBatch &apply);
+
+  /**
+   * The number of pieces of feedback that have not been applied, including
+   * the feedback of a batch that is being applied.
+   */
+  size_t pending() const;
+
+  /**
+   * Writes the pending feedback to the log in the ndb directory save_path if
+   * it is not the directory of this buffer, and must be called with the
+   * owner's write lock held.
+   */
+  void save(const std::string &save_path) const;
+
+private:
+  struct PendingFeedback {
+    uint64_t seq;
+    // The log record of the call, which is decoded when it is applied.
+    std::string record;
+  };
+
+  static size_t feedbackCount(std::string_view record);
+
+  static FeedbackBatch merge(const std::vector<PendingFeedback> &calls);
+
+  /**
+   * Logs a call with the encoded arguments body, which is count pieces of
+   * feedback.
+   */
+  size_t add(uint8_t op, const std::string &body, size_t count);
+
+  void startWorker();
+
+  void run();
+
+  Flush _flush;
+  std::optional<std::chrono::milliseconds> _interval;
+
+  std::string _save_path;
+  std::unique_ptr<AppendLog> _log;
+
+  std::deque<PendingFeedback> _pending;
+  size_t _pending_count = 0;
+  // The number of pieces of feedback in the batch that is being applied.
+  size_t _applying_count = 0;
+  uint64_t _seq = 0;
+  // When the oldest pending feedback was added.
+  std::chrono::steady_clock::time_point _pending_since;
+  std::optional<std::string> _error;
+
+  bool _stopping = false;
+  std::thread _worker;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _pending_cv;
+};
+
+} // namespace thirdai::search::ndb
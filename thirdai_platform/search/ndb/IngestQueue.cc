@@ -0,0 +1,242 @@
+#include "IngestQueue.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <iterator>
+#include <stdexcept>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+enum class LogOp : uint8_t { Stage, Indexed };
+
+// Bounds of the exponential backoff between attempts to insert batches that
+// failed to be inserted.
+constexpr std::chrono::milliseconds MIN_RETRY_DELAY(100);
+constexpr std::chrono::milliseconds MAX_RETRY_DELAY(30000);
+
+std::string stagingLogPath(const std::string &save_path) {
+  return (std::filesystem::path(save_path) / "ingest_staging.log").string();
+}
+
+std::string indexedRecord(uint64_t seq) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::Indexed));
+  record.writeVarint(seq);
+  return std::move(record.buffer());
+}
+
+} // namespace
+
+IngestQueue::IngestQueue(const std::string &save_path, InsertBatch insert)
+    : _insert(std::move(insert)) {
+  std::string log_path = stagingLogPath(save_path);
+
+  std::vector<StagedBatch> staged;
+  AppendLog::readRecords(log_path, [&](BinaryReader record) {
+    switch (LogOp(record.readFixed<uint8_t>())) {
+    case LogOp::Stage: {
+      uint64_t seq = record.readVarint();
+      staged.push_back(
+          {seq, std::string(record.readBytes(record.remaining()))});
+      _staged = std::max(_staged, seq);
+      break;
+    }
+    case LogOp::Indexed:
+      _indexed = std::max(_indexed, record.readVarint());
+      break;
+    default:
+      throw std::runtime_error("invalid record in ingest staging log");
+    }
+  });
+
+  for (auto &batch : staged) {
+    if (batch.seq > _indexed) {
+      _pending.push_back(std::move(batch));
+    }
+  }
+  _staged = std::max(_staged, _indexed);
+  _indexed = _pending.empty() ? _staged : _pending.front().seq - 1;
+
+  // The log is rewritten with only the batches that still need to be indexed
+  // so that it does not grow across restarts, and so that new records are
+  // never appended after a truncated one.
+  _log = std::make_unique<AppendLog>(log_path, /* sync= */ true);
+  std::vector<std::string> records;
+  records.reserve(_pending.size());
+  for (const auto &batch : _pending) {
+    records.push_back(stageRecord(batch.seq, batch.data));
+  }
+  _log->rewrite(records);
+
+  if (!_pending.empty()) {
+    startWorker();
+  }
+}
+
+IngestQueue::~IngestQueue() {
+  {
+    std::lock_guard lock(_mutex);
+    _stopping = true;
+  }
+  _pending_cv.notify_one();
+
+  if (_worker.joinable()) {
+    _worker.join();
+  }
+}
+
+uint64_t IngestQueue::stage(std::string_view batch) {
+  decodeDocumentBatch(batch);
+
+  std::lock_guard lock(_mutex);
+
+  uint64_t seq = _staged + 1;
+  _log->append(stageRecord(seq, batch));
+  _staged = seq;
+  _pending.push_back({seq, std::string(batch)});
+
+  startWorker();
+  _pending_cv.notify_one();
+
+  return seq;
+}
+
+void IngestQueue::waitForIndexed(uint64_t seq) {
+  std::unique_lock lock(_mutex);
+  if (seq > _staged) {
+    throw std::invalid_argument("cannot wait for sequence number " +
+                                std::to_string(seq) +
+                                " which has not been staged");
+  }
+
+  waitLocked(lock, seq);
+}
+
+void IngestQueue::flush() {
+  std::unique_lock lock(_mutex);
+  waitLocked(lock, _staged);
+}
+
+void IngestQueue::drain() {
+  std::unique_lock lock(_mutex);
+  _indexed_cv.wait(lock, [&]() { return _indexed >= _staged || _failure; });
+
+  if (_indexed < _staged) {
+    throw std::runtime_error("staged documents are not indexed yet: " +
+                             *_failure);
+  }
+}
+
+uint64_t IngestQueue::staged() const {
+  std::lock_guard lock(_mutex);
+  return _staged;
+}
+
+uint64_t IngestQueue::indexed() const {
+  std::lock_guard lock(_mutex);
+  return _indexed;
+}
+
+std::string IngestQueue::stageRecord(uint64_t seq, std::string_view batch) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::Stage));
+  record.writeVarint(seq);
+  record.buffer().append(batch);
+  return std::move(record.buffer());
+}
+
+void IngestQueue::waitLocked(std::unique_lock<std::mutex> &lock,
+                             uint64_t seq) {
+  _indexed_cv.wait(lock, [&]() { return _indexed >= seq || _error; });
+
+  if (_error) {
+    std::string error = std::move(*_error);
+    _error.reset();
+    throw std::runtime_error("error indexing staged documents: " + error);
+  }
+}
+
+void IngestQueue::startWorker() {
+  if (!_worker.joinable()) {
+    _worker = std::thread([this]() { run(); });
+  }
+}
+
+void IngestQueue::run() {
+  std::unique_lock lock(_mutex);
+
+  auto retry_delay = MIN_RETRY_DELAY;
+  while (true) {
+    _pending_cv.wait(lock, [&]() { return !_pending.empty() || _stopping; });
+    if (_pending.empty()) {
+      return;
+    }
+
+    // Every batch that is pending is inserted together so that the cost of
+    // taking the ndb's write lock and updating its state is shared by all of
+    // the batches that were staged while the previous insert was running.
+    std::vector<StagedBatch> batches(std::make_move_iterator(_pending.begin()),
+                                     std::make_move_iterator(_pending.end()));
+    _pending.clear();
+    lock.unlock();
+
+    std::optional<std::string> error;
+    try {
+      std::vector<NewDocument> documents;
+      for (const auto &batch : batches) {
+        auto decoded = decodeDocumentBatch(batch.data);
+        documents.insert(documents.end(),
+                         std::make_move_iterator(decoded.begin()),
+                         std::make_move_iterator(decoded.end()));
+      }
+      _insert(documents);
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+
+    lock.lock();
+
+    if (error) {
+      // The batches are left in the log and retried ahead of the batches
+      // staged since, so that no documents are dropped and they are still
+      // inserted in the order they were staged.
+      _pending.insert(_pending.begin(),
+                      std::make_move_iterator(batches.begin()),
+                      std::make_move_iterator(batches.end()));
+      _failure = error;
+      _error = std::move(error);
+      _indexed_cv.notify_all();
+
+      // If the queue is stopped the batches are indexed when the ndb is
+      // opened again.
+      if (_pending_cv.wait_for(lock, retry_delay,
+                               [&]() { return _stopping; })) {
+        return;
+      }
+      retry_delay = std::min(retry_delay * 2, MAX_RETRY_DELAY);
+      continue;
+    }
+    retry_delay = MIN_RETRY_DELAY;
+    _failure.reset();
+
+    // The documents are inserted even if this fails, in which case they are
+    // inserted a second time when the ndb is opened.
+    try {
+      if (_pending.empty()) {
+        _log->clear();
+      } else {
+        _log->append(indexedRecord(batches.back().seq));
+      }
+    } catch (const std::exception &e) {
+      _error = e.what();
+    }
+
+    _indexed = batches.back().seq;
+    _indexed_cv.notify_all();
+  }
+}
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "DocumentBatch.h"
+#include "Serialization.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+/**
+ * Stages batches of documents in a durable log in the ndb directory and
+ * inserts them into the ndb on a background thread, so that callers do not
+ * wait for the documents to be indexed. Each staged batch is assigned a
+ * sequence number, which increases with every batch, and the documents of a
+ * batch are searchable once the queue's indexed sequence number reaches it.
+ *
+ * Batches that fail to be inserted stay in the log and are retried with
+ * exponential backoff, and batches staged after them are not inserted until
+ * they succeed. Batches that were staged but not indexed when the ndb was
+ * closed are indexed in the background after it is opened again. A crash
+ * between a batch being inserted and the queue recording that it was indexed
+ * causes the batch to be inserted a second time when the ndb is opened.
+ */
+class IngestQueue {
+public:
+  using InsertBatch = std::function<void(const std::vector<NewDocument> &)>;
+
+  /**
+   * Opens the staging log in the ndb directory save_path. Every staged batch
+   * is indexed by calling insert from the background thread.
+   */
+  IngestQueue(const std::string &save_path, InsertBatch insert);
+
+  IngestQueue(const IngestQueue &) = delete;
+  IngestQueue &operator=(const IngestQueue &) = delete;
+
+  /**
+   * Waits for every staged batch to be indexed and stops the background
+   * thread. If inserting the batches is failing they are left in the log
+   * instead of being retried.
+   */
+  ~IngestQueue();
+
+  /**
+   * Stages a batch in the packed encoding of decodeDocumentBatch and returns
+   * its sequence number. The batch is decoded before it is staged so that
+   * malformed batches are rejected immediately.
+   */
+  uint64_t stage(std::string_view batch);
+
+  /**
+   * Waits until the batch with the given sequence number, and every batch
+   * staged before it, is indexed. Throws if an attempt to insert batches
+   * failed since the last call that reported a failure, in which case the
+   * batches are still retried.
+   */
+  void waitForIndexed(uint64_t seq);
+
+  /**
+   * Waits until every batch staged before the call is indexed, and like
+   * waitForIndexed throws if a batch failed to be inserted.
+   */
+  void flush();
+
+  /**
+   * Waits until every batch staged before the call is indexed. Used to order
+   * other updates after staged inserts, so it throws if the batches are
+   * failing to be inserted rather than waiting for a retry to succeed.
+   */
+  void drain();
+
+  uint64_t staged() const;
+
+  uint64_t indexed() const;
+
+private:
+  struct StagedBatch {
+    uint64_t seq;
+    std::string data;
+  };
+
+  static std::string stageRecord(uint64_t seq, std::string_view batch);
+
+  void waitLocked(std::unique_lock<std::mutex> &lock, uint64_t seq);
+
+  void startWorker();
+
+  void run();
+
+  InsertBatch _insert;
+
+  std::unique_ptr<AppendLog> _log;
+
+  std::deque<StagedBatch> _pending;
+  uint64_t _staged = 0;
+  uint64_t _indexed = 0;
+  // The last failure that has not been reported by waitForIndexed or flush.
+  std::optional<std::string> _error;
+  // Set while the batches at the front of the queue are failing to be inserted.
+  std::optional<std::string> _failure;
+
+  bool _stopping = false;
+  std::thread _worker;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _pending_cv;
+  std::condition_variable _indexed_cv;
+};
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Constraints.h"
+#include "Serialization.h"
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+/**
+ * Interns metadata keys to dense ids. Most chunks share the same handful of
+ * keys, so encodings that reference keys by id only need to store each key
+ * string once in the dictionary rather than once per chunk.
+ */
+class MetadataKeys {
+public:
+  uint32_t intern(const std::string &key) {
+    // try_emplace does not allocate a node when the key is already interned.
+    auto [it, inserted] = _ids.try_emplace(key, _keys.size());
+    if (inserted) {
+      _keys.push_back(key);
+    }
+    return it->second;
+  }
+
+  std::optional<uint32_t> find(const std::string &key) const {
+    auto it = _ids.find(key);
+    if (it == _ids.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  const std::string &key(uint32_t id) const {
+    if (id >= _keys.size()) {
+      throw std::runtime_error("invalid metadata key id " +
+                               std::to_string(id));
+    }
+    return _keys[id];
+  }
+
+  uint32_t size() const { return _keys.size(); }
+
+  const std::vector<std::string> &keys() const { return _keys; }
+
+private:
+  std::vector<std::string> _keys;
+  std::unordered_map<std::string, uint32_t> _ids;
+};
+
+/**
+ * Compact metadata encoding: a varint entry count, then for each entry a
+ * varint key id, a one byte tag, and the value. Bools are stored in the tag,
+ * ints are zigzag varints, floats are 4 bytes, and strings are a varint length
+ * followed by the bytes.
+ */
+enum class MetadataTag : uint8_t { False, True, Int, Float, Str, Nil };
+
+inline void encodeMetadata(BinaryWriter &writer, const MetadataMap &metadata,
+                           MetadataKeys &keys) {
+  writer.writeVarint(metadata.size());
+  for (const auto &[key, value] : metadata) {
+    writer.writeVarint(keys.intern(key));
+    switch (value.type()) {
+    case MetadataType::Bool:
+      writer.writeFixed<uint8_t>(
+          uint8_t(value.asBool() ? MetadataTag::True : MetadataTag::False));
+      break;
+    case MetadataType::Int:
+      writer.writeFixed<uint8_t>(uint8_t(MetadataTag::Int));
+      writer.writeSignedVarint(value.asInt());
+      break;
+    case MetadataType::Float:
+      writer.writeFixed<uint8_t>(uint8_t(MetadataTag::Float));
+      writer.writeFixed<float>(value.asFloat());
+      break;
+    case MetadataType::Str:
+      writer.writeFixed<uint8_t>(uint8_t(MetadataTag::Str));
+      writer.writeString(value.asStr());
+      break;
+    case MetadataType::Nil:
+      writer.writeFixed<uint8_t>(uint8_t(MetadataTag::Nil));
+      break;
+    }
+  }
+}
+
+inline MetadataMap decodeMetadata(BinaryReader &reader,
+                                  const MetadataKeys &keys) {
+  MetadataMap metadata;
+  uint64_t n_entries = reader.readVarint();
+  // Each entry takes at least a key id and a tag.
+  if (n_entries > reader.remaining() / 2) {
+    throw std::runtime_error("invalid metadata entry count " +
+                             std::to_string(n_entries));
+  }
+  metadata.reserve(n_entries);
+  for (uint64_t i = 0; i < n_entries; i++) {
+    const std::string &key = keys.key(reader.readVarint());
+    switch (MetadataTag(reader.readFixed<uint8_t>())) {
+    case MetadataTag::False:
+      metadata[key] = MetadataValue::Bool(false);
+      break;
+    case MetadataTag::True:
+      metadata[key] = MetadataValue::Bool(true);
+      break;
+    case MetadataTag::Int:
+      metadata[key] = MetadataValue::Int(int(reader.readSignedVarint()));
+      break;
+    case MetadataTag::Float:
+      metadata[key] = MetadataValue::Float(reader.readFixed<float>());
+      break;
+    case MetadataTag::Str:
+      metadata[key] = MetadataValue::Str(reader.readString());
+      break;
+    case MetadataTag::Nil:
+      metadata[key] = MetadataValue();
+      break;
+    default:
+      throw std::runtime_error("invalid metadata tag in serialized data");
+    }
+  }
+  return metadata;
+}
+
+} // namespace thirdai::search::ndb
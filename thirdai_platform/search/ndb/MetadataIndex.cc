@@ -0,0 +1,498 @@
+#include "MetadataIndex.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+enum class LogOp : uint8_t { Insert, DeleteDocVersion, DeleteDoc };
+
+std::string snapshotPath(const std::string &save_path) {
+  return (std::filesystem::path(save_path) / "metadata_index").string();
+}
+
+std::string logPath(const std::string &save_path) {
+  return (std::filesystem::path(save_path) / "metadata_index.log").string();
+}
+
+bool isIndexable(MetadataType type) {
+  return type == MetadataType::Bool || type == MetadataType::Int ||
+         type == MetadataType::Float || type == MetadataType::Str;
+}
+
+} // namespace
+
+bool MetadataIndex::ValueLess::operator()(const MetadataValue &a,
+                                          const MetadataValue &b) const {
+  if (a.type() == MetadataType::Float && b.type() == MetadataType::Float) {
+    // NaN is ordered after every other value so that the ordering is a strict
+    // weak ordering.
+    if (std::isnan(a.asFloat()) || std::isnan(b.asFloat())) {
+      return !std::isnan(a.asFloat()) && std::isnan(b.asFloat());
+    }
+  }
+  return a.lessThan(b);
+}
+
+MetadataIndex::MetadataIndex(std::vector<std::string> keys)
+    : _keys(std::move(keys)), _indexes(_keys.size()) {
+  for (uint32_t i = 0; i < _keys.size(); i++) {
+    if (!_key_ids.emplace(_keys[i], i).second) {
+      throw std::invalid_argument("metadata index key '" + _keys[i] +
+                                  "' is declared more than once");
+    }
+  }
+}
+
+std::unique_ptr<MetadataIndex>
+MetadataIndex::make(const std::string &save_path,
+                    std::vector<std::string> keys) {
+  std::unique_ptr<MetadataIndex> index(new MetadataIndex(std::move(keys)));
+
+  index->_save_path = save_path;
+  writeFile(snapshotPath(save_path), index->serialize());
+  index->_log = std::make_unique<AppendLog>(logPath(save_path));
+  index->_log->clear();
+
+  return index;
+}
+
+std::unique_ptr<MetadataIndex>
+MetadataIndex::open(const std::string &save_path, bool read_only) {
+  if (!exists(save_path)) {
+    return nullptr;
+  }
+
+  auto index = deserialize(readFile(snapshotPath(save_path)));
+
+  AppendLog::readRecords(logPath(save_path), [&index](BinaryReader record) {
+    index->applyLogRecord(record);
+  });
+
+  index->_save_path = save_path;
+  if (read_only) {
+    return index;
+  }
+  writeFile(snapshotPath(save_path), index->serialize());
+  index->_log = std::make_unique<AppendLog>(logPath(save_path));
+  index->_log->clear();
+
+  return index;
+}
+
+bool MetadataIndex::exists(const std::string &save_path) {
+  return std::filesystem::exists(snapshotPath(save_path));
+}
+
+void MetadataIndex::insert(const DocId &doc_id, uint32_t doc_version,
+                           ChunkId start_id,
+                           const std::vector<MetadataMap> &metadata) {
+  auto values = indexedValues(metadata);
+  auto record = insertRecord(doc_id, doc_version, start_id, values);
+
+  std::unique_lock lock(_mutex);
+  _log->append(record);
+  insertImpl(doc_id, doc_version, start_id, values);
+}
+
+void MetadataIndex::insertBatch(const std::vector<InsertMetadata> &inserted,
+                                const std::vector<NewDocument> &documents) {
+  std::vector<IndexedValues> values;
+  std::vector<std::string> records;
+  values.reserve(inserted.size());
+  records.reserve(inserted.size());
+  for (size_t i = 0; i < inserted.size(); i++) {
+    values.push_back(indexedValues(documents.at(i).metadata));
+    records.push_back(insertRecord(inserted[i].doc_id, inserted[i].doc_version,
+                                   inserted[i].start_id, values.back()));
+  }
+
+  std::unique_lock lock(_mutex);
+  _log->append(records);
+  for (size_t i = 0; i < inserted.size(); i++) {
+    insertImpl(inserted[i].doc_id, inserted[i].doc_version,
+               inserted[i].start_id, values[i]);
+  }
+}
+
+MetadataIndex::IndexedValues MetadataIndex::indexedValues(
+    const std::vector<MetadataMap> &metadata) const {
+  IndexedValues values(metadata.size());
+  for (size_t i = 0; i < metadata.size(); i++) {
+    for (const auto &[key, value] : metadata[i]) {
+      auto it = _key_ids.find(key);
+      if (it != _key_ids.end() && isIndexable(value.type())) {
+        values[i].emplace_back(it->second, value);
+      }
+    }
+  }
+  return values;
+}
+
+std::string MetadataIndex::insertRecord(const DocId &doc_id,
+                                        uint32_t doc_version, ChunkId start_id,
+                                        const IndexedValues &values) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::Insert));
+  record.writeString(doc_id);
+  record.writeVarint(doc_version);
+  record.writeVarint(start_id);
+  record.writeVarint(values.size());
+  for (const auto &chunk_values : values) {
+    record.writeVarint(chunk_values.size());
+    for (const auto &[key_id, value] : chunk_values) {
+      record.writeVarint(key_id);
+      record.writeMetadataValue(value);
+    }
+  }
+  return std::move(record.buffer());
+}
+
+void MetadataIndex::insertImpl(const DocId &doc_id, uint32_t doc_version,
+                               ChunkId start_id, const IndexedValues &values) {
+  for (size_t i = 0; i < values.size(); i++) {
+    for (const auto &[key_id, value] : values[i]) {
+      // With more than one shard the global ids of later inserts can be
+      // smaller than the ids already in the list, which must stay sorted.
+      auto &ids = _indexes.at(key_id)[size_t(value.type())][value];
+      ChunkId id = start_id + i;
+      if (ids.empty() || ids.back() < id) {
+        ids.push_back(id);
+      } else {
+        ids.insert(std::upper_bound(ids.begin(), ids.end(), id), id);
+      }
+    }
+  }
+
+  _docs[doc_id][doc_version] = {start_id, start_id + values.size()};
+  _num_chunks += values.size();
+}
+
+void MetadataIndex::deleteDocVersion(const DocId &doc_id,
+                                     uint32_t doc_version) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::DeleteDocVersion));
+  record.writeString(doc_id);
+  record.writeVarint(doc_version);
+
+  std::unique_lock lock(_mutex);
+  _log->append(record.buffer());
+  if (auto range = removeVersionImpl(doc_id, doc_version)) {
+    removeRange(*range);
+  }
+}
+
+void MetadataIndex::deleteDoc(const DocId &doc_id, bool keep_latest_version) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::DeleteDoc));
+  record.writeString(doc_id);
+  record.writeFixed<uint8_t>(keep_latest_version);
+
+  std::unique_lock lock(_mutex);
+  _log->append(record.buffer());
+  deleteDocImpl(doc_id, keep_latest_version);
+}
+
+void MetadataIndex::deleteDocImpl(const DocId &doc_id,
+                                  bool keep_latest_version) {
+  auto doc = _docs.find(doc_id);
+  if (doc == _docs.end()) {
+    return;
+  }
+
+  std::vector<uint32_t> versions;
+  for (const auto &[version, _] : doc->second) {
+    versions.push_back(version);
+  }
+  if (keep_latest_version && !versions.empty()) {
+    versions.pop_back();
+  }
+
+  for (uint32_t version : versions) {
+    if (auto range = removeVersionImpl(doc_id, version)) {
+      removeRange(*range);
+    }
+  }
+}
+
+std::optional<MetadataIndex::ChunkRange>
+MetadataIndex::removeVersionImpl(const DocId &doc_id, uint32_t doc_version) {
+  auto doc = _docs.find(doc_id);
+  if (doc == _docs.end()) {
+    return std::nullopt;
+  }
+  auto version = doc->second.find(doc_version);
+  if (version == doc->second.end()) {
+    return std::nullopt;
+  }
+
+  ChunkRange range = version->second;
+  doc->second.erase(version);
+  if (doc->second.empty()) {
+    _docs.erase(doc);
+  }
+  _num_chunks -= range.end - range.start;
+  return range;
+}
+
+void MetadataIndex::removeRange(ChunkRange range) {
+  for (auto &key_index : _indexes) {
+    for (auto &postings : key_index) {
+      for (auto it = postings.begin(); it != postings.end();) {
+        auto &ids = it->second;
+        auto start = std::lower_bound(ids.begin(), ids.end(), range.start);
+        auto end = std::lower_bound(start, ids.end(), range.end);
+        ids.erase(start, end);
+
+        if (ids.empty()) {
+          it = postings.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+}
+
+std::vector<ChunkId>
+MetadataIndex::lookupKey(const KeyIndex &index,
+                         const CompiledConstraints &constraints,
+                         uint32_t key_id) const {
+  auto bounds = constraints.bounds(key_id);
+  if (bounds.empty) {
+    return {};
+  }
+
+  std::vector<const std::vector<ChunkId> *> matches;
+
+  auto scan = [&](const Postings &postings) {
+    auto it = bounds.lower ? postings.lower_bound(*bounds.lower)
+                           : postings.begin();
+    for (; it != postings.end(); ++it) {
+      if (bounds.upper && ValueLess()(*bounds.upper, it->first)) {
+        break;
+      }
+      if (constraints.matchesKey(key_id, it->first)) {
+        matches.push_back(&it->second);
+      }
+    }
+  };
+
+  if (bounds.values) {
+    for (const auto &value : *bounds.values) {
+      if (!isIndexable(value.type()) ||
+          (bounds.type && *bounds.type != value.type())) {
+        continue;
+      }
+      const auto &postings = index[size_t(value.type())];
+      auto it = postings.find(value);
+      if (it != postings.end() && constraints.matchesKey(key_id, it->first)) {
+        matches.push_back(&it->second);
+      }
+    }
+  } else if (bounds.type) {
+    if (isIndexable(*bounds.type)) {
+      scan(index[size_t(*bounds.type)]);
+    }
+  } else {
+    for (const auto &postings : index) {
+      scan(postings);
+    }
+  }
+
+  if (matches.size() == 1) {
+    return *matches.front();
+  }
+
+  std::vector<ChunkId> ids;
+  for (const auto *match : matches) {
+    ids.insert(ids.end(), match->begin(), match->end());
+  }
+  // Each chunk has at most one value per key, so there are no duplicates.
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+std::optional<std::vector<ChunkId>>
+MetadataIndex::lookup(const CompiledConstraints &constraints) const {
+  std::shared_lock lock(_mutex);
+
+  std::optional<std::vector<ChunkId>> result;
+  for (uint32_t key_id = 0; key_id < constraints.numKeys(); key_id++) {
+    auto it = _key_ids.find(constraints.key(key_id));
+    if (it == _key_ids.end()) {
+      continue;
+    }
+
+    auto ids = lookupKey(_indexes[it->second], constraints, key_id);
+    if (!result) {
+      result = std::move(ids);
+    } else {
+      std::vector<ChunkId> intersection;
+      std::set_intersection(result->begin(), result->end(), ids.begin(),
+                            ids.end(), std::back_inserter(intersection));
+      result = std::move(intersection);
+    }
+
+    if (result->empty()) {
+      break;
+    }
+  }
+
+  return result;
+}
+
+bool MetadataIndex::covers(const CompiledConstraints &constraints) const {
+  for (uint32_t key_id = 0; key_id < constraints.numKeys(); key_id++) {
+    if (!_key_ids.count(constraints.key(key_id))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t MetadataIndex::numChunks() const {
+  std::shared_lock lock(_mutex);
+  return _num_chunks;
+}
+
+void MetadataIndex::save(const std::string &save_path) const {
+  std::unique_lock lock(_mutex);
+  writeFile(snapshotPath(save_path), serialize());
+  std::error_code error;
+  if (_log && std::filesystem::equivalent(save_path, _save_path, error)) {
+    _log->clear();
+  }
+}
+
+void MetadataIndex::applyLogRecord(BinaryReader &record) {
+  switch (LogOp(record.readFixed<uint8_t>())) {
+  case LogOp::Insert: {
+    DocId doc_id = record.readString();
+    uint32_t doc_version = record.readVarint();
+    ChunkId start_id = record.readVarint();
+    IndexedValues values(record.readVarint());
+    for (auto &chunk_values : values) {
+      chunk_values.resize(record.readVarint());
+      for (auto &[key_id, value] : chunk_values) {
+        key_id = record.readVarint();
+        value = record.readMetadataValue();
+      }
+    }
+    insertImpl(doc_id, doc_version, start_id, values);
+    break;
+  }
+  case LogOp::DeleteDocVersion: {
+    DocId doc_id = record.readString();
+    uint32_t doc_version = record.readVarint();
+    if (auto range = removeVersionImpl(doc_id, doc_version)) {
+      removeRange(*range);
+    }
+    break;
+  }
+  case LogOp::DeleteDoc: {
+    DocId doc_id = record.readString();
+    bool keep_latest_version = record.readFixed<uint8_t>();
+    deleteDocImpl(doc_id, keep_latest_version);
+    break;
+  }
+  default:
+    throw std::runtime_error("invalid record in metadata index log");
+  }
+}
+
+std::string MetadataIndex::serialize() const {
+  BinaryWriter out;
+  out.writeVarint(SNAPSHOT_VERSION);
+
+  out.writeVarint(_keys.size());
+  for (const auto &key : _keys) {
+    out.writeString(key);
+  }
+
+  out.writeVarint(_num_chunks);
+  out.writeVarint(_docs.size());
+  for (const auto &[doc_id, versions] : _docs) {
+    out.writeString(doc_id);
+    out.writeVarint(versions.size());
+    for (const auto &[version, range] : versions) {
+      out.writeVarint(version);
+      out.writeVarint(range.start);
+      out.writeVarint(range.end);
+    }
+  }
+
+  for (const auto &key_index : _indexes) {
+    for (const auto &postings : key_index) {
+      out.writeVarint(postings.size());
+      for (const auto &[value, ids] : postings) {
+        out.writeMetadataValue(value);
+        out.writeVarint(ids.size());
+        ChunkId prev = 0;
+        for (ChunkId id : ids) {
+          out.writeVarint(id - prev);
+          prev = id;
+        }
+      }
+    }
+  }
+
+  return std::move(out.buffer());
+}
+
+std::unique_ptr<MetadataIndex>
+MetadataIndex::deserialize(const std::string &data) {
+  BinaryReader in(data);
+  if (in.readVarint() != SNAPSHOT_VERSION) {
+    throw std::runtime_error("unsupported metadata index version");
+  }
+
+  std::vector<std::string> keys(in.readVarint());
+  for (auto &key : keys) {
+    key = in.readString();
+  }
+  std::unique_ptr<MetadataIndex> index(new MetadataIndex(std::move(keys)));
+
+  index->_num_chunks = in.readVarint();
+  size_t num_docs = in.readVarint();
+  for (size_t i = 0; i < num_docs; i++) {
+    auto &versions = index->_docs[in.readString()];
+    size_t num_versions = in.readVarint();
+    for (size_t j = 0; j < num_versions; j++) {
+      uint32_t version = in.readVarint();
+      ChunkId start = in.readVarint();
+      ChunkId end = in.readVarint();
+      versions[version] = {start, end};
+    }
+  }
+
+  for (auto &key_index : index->_indexes) {
+    for (auto &postings : key_index) {
+      size_t num_values = in.readVarint();
+      for (size_t i = 0; i < num_values; i++) {
+        auto &ids = postings[in.readMetadataValue()];
+        ids.resize(in.readVarint());
+        ChunkId prev = 0;
+        for (auto &id : ids) {
+          id = prev + in.readVarint();
+          prev = id;
+        }
+        // Snapshots of sharded ndbs written before inserts kept the lists
+        // sorted can contain unsorted lists.
+        if (!std::is_sorted(ids.begin(), ids.end())) {
+          std::sort(ids.begin(), ids.end());
+        }
+      }
+    }
+  }
+
+  return index;
+}
+
+} // namespace thirdai::search::ndb
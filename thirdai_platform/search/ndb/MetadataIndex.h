@@ -0,0 +1,150 @@
+#pragma once
+
+#include "Chunk.h"
+#include "CompiledConstraints.h"
+#include "Constraints.h"
+#include "DocumentBatch.h"
+#include "NeuralDB.h"
+#include "Serialization.h"
+#include <array>
+#include <map>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+/**
+ * Secondary indexes over the values of a fixed set of metadata keys. For each
+ * key and value type the index keeps an ordered map from value to the sorted
+ * ids of the chunks with that value, so equality lookups on bool/str values
+ * are a single map lookup and range constraints on int/float values are a
+ * scan over a contiguous range of the map.
+ *
+ * The index is stored next to the engine's files in the ndb directory as a
+ * snapshot plus a log of the updates applied since the snapshot was written.
+ * The log is folded into the snapshot each time the index is opened.
+ */
+class MetadataIndex {
+public:
+  /**
+   * Creates an empty index for the given keys in the ndb directory save_path.
+   */
+  static std::unique_ptr<MetadataIndex>
+  make(const std::string &save_path, std::vector<std::string> keys);
+
+  /**
+   * Opens the index stored in save_path, or returns nullptr if the ndb in
+   * save_path does not have metadata indexes. If read_only is true the files
+   * in save_path are not modified, and the index must not be updated.
+   */
+  static std::unique_ptr<MetadataIndex> open(const std::string &save_path,
+                                             bool read_only = false);
+
+  static bool exists(const std::string &save_path);
+
+  const std::vector<std::string> &keys() const { return _keys; }
+
+  void insert(const DocId &doc_id, uint32_t doc_version, ChunkId start_id,
+              const std::vector<MetadataMap> &metadata);
+
+  /**
+   * Applies the insertion of each document with a single log write. inserted[i]
+   * is the result of inserting documents[i].
+   */
+  void insertBatch(const std::vector<InsertMetadata> &inserted,
+                   const std::vector<NewDocument> &documents);
+
+  void deleteDocVersion(const DocId &doc_id, uint32_t doc_version);
+
+  void deleteDoc(const DocId &doc_id, bool keep_latest_version);
+
+  /**
+   * Returns the sorted ids of the chunks whose metadata satisfies every
+   * constraint on the indexed keys. Returns std::nullopt if none of the
+   * constrained keys are indexed. Constraints on keys that are not indexed are
+   * ignored, so the result is a superset of the matching chunks in that case.
+   */
+  std::optional<std::vector<ChunkId>>
+  lookup(const CompiledConstraints &constraints) const;
+
+  /**
+   * Returns if every constrained key is indexed.
+   */
+  bool covers(const CompiledConstraints &constraints) const;
+
+  /**
+   * The number of chunks that have not been deleted.
+   */
+  size_t numChunks() const;
+
+  /**
+   * Writes a snapshot of the index to the ndb directory save_path.
+   */
+  void save(const std::string &save_path) const;
+
+private:
+  explicit MetadataIndex(std::vector<std::string> keys);
+
+  struct ValueLess {
+    bool operator()(const MetadataValue &a, const MetadataValue &b) const;
+  };
+
+  using Postings = std::map<MetadataValue, std::vector<ChunkId>, ValueLess>;
+
+  // Postings for each indexable MetadataType, indexed by the type's value.
+  using KeyIndex = std::array<Postings, 4>;
+
+  struct ChunkRange {
+    ChunkId start;
+    ChunkId end;
+  };
+
+  // The values of the indexed keys for each chunk, as (key id, value) pairs.
+  using IndexedValues =
+      std::vector<std::vector<std::pair<uint32_t, MetadataValue>>>;
+
+  IndexedValues indexedValues(const std::vector<MetadataMap> &metadata) const;
+
+  static std::string insertRecord(const DocId &doc_id, uint32_t doc_version,
+                                  ChunkId start_id,
+                                  const IndexedValues &values);
+
+  void insertImpl(const DocId &doc_id, uint32_t doc_version, ChunkId start_id,
+                  const IndexedValues &values);
+
+  std::optional<ChunkRange> removeVersionImpl(const DocId &doc_id,
+                                              uint32_t doc_version);
+
+  void removeRange(ChunkRange range);
+
+  std::vector<ChunkId> lookupKey(const KeyIndex &index,
+                                 const CompiledConstraints &constraints,
+                                 uint32_t key_id) const;
+
+  void deleteDocImpl(const DocId &doc_id, bool keep_latest_version);
+
+  void applyLogRecord(BinaryReader &record);
+
+  std::string serialize() const;
+
+  static std::unique_ptr<MetadataIndex> deserialize(const std::string &data);
+
+  std::vector<std::string> _keys;
+  std::unordered_map<std::string, uint32_t> _key_ids;
+
+  std::vector<KeyIndex> _indexes;
+
+  std::unordered_map<DocId, std::map<uint32_t, ChunkRange>> _docs;
+  size_t _num_chunks = 0;
+
+  std::string _save_path;
+  std::unique_ptr<AppendLog> _log;
+
+  mutable std::shared_mutex _mutex;
+};
+
+} // namespace thirdai::search::ndb
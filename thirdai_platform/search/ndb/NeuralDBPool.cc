@@ -0,0 +1,277 @@
+#include "NeuralDBPool.h"
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+uint64_t directorySize(const std::string &path) {
+  uint64_t size = 0;
+  std::error_code error;
+  for (auto it = std::filesystem::recursive_directory_iterator(path, error);
+       !error && it != std::filesystem::recursive_directory_iterator();
+       it.increment(error)) {
+    std::error_code file_error;
+    if (it->is_regular_file(file_error)) {
+      uint64_t file_size = it->file_size(file_error);
+      if (!file_error) {
+        size += file_size;
+      }
+    }
+  }
+  return size;
+}
+
+} // namespace
+
+NeuralDBPool::NeuralDBPool(const NeuralDBPoolOptions &options)
+    : _state(std::make_shared<State>()) {
+  _state->options = options;
+  if (options.query_cache_size > 0) {
+    _state->query_cache = std::make_shared<QueryCache>(options.query_cache_size);
+  }
+
+  if (options.idle_timeout_ms > 0) {
+    _idle_worker = std::thread([this]() { runIdleEviction(); });
+  }
+}
+
+NeuralDBPool::~NeuralDBPool() {
+  {
+    std::lock_guard lock(_state->mutex);
+    _state->stopping = true;
+  }
+  _state->idle_cv.notify_all();
+
+  if (_idle_worker.joinable()) {
+    _idle_worker.join();
+  }
+
+  std::unordered_map<std::string, Entry> entries;
+  {
+    std::lock_guard lock(_state->mutex);
+    entries.swap(_state->entries);
+  }
+  // The ndbs that are not in use are closed here, the others are closed when
+  // their last pointer is released.
+}
+
+std::shared_ptr<PlatformNeuralDB>
+NeuralDBPool::acquire(const std::string &save_path,
+                      const NeuralDBOptions &options) {
+  if (options.query_cache_size > 0 || options.shared_query_cache) {
+    throw std::invalid_argument(
+        "the ndbs in a pool use the query cache of the pool");
+  }
+
+  // Keyed by the canonical path so that different spellings of a path refer
+  // to the same ndb, which the engine cannot open twice.
+  std::string key = std::filesystem::weakly_canonical(save_path).string();
+
+  std::unique_lock lock(_state->mutex);
+  while (true) {
+    auto it = _state->entries.find(key);
+    if (it == _state->entries.end()) {
+      break;
+    }
+    if (it->second.opening) {
+      _state->opened_cv.wait(lock);
+      continue;
+    }
+    if (it->second.read_only != options.read_only) {
+      throw std::invalid_argument(
+          "ndb " + save_path + " is already open in the pool " +
+          (it->second.read_only ? "as read only" : "with write access"));
+    }
+    _state->stats.hits++;
+    return lease(key, it->second);
+  }
+
+  // The entry is added before the ndb is opened, outside of the mutex, so that
+  // concurrent acquires of the ndb wait for it to open rather than opening it
+  // again, and acquires of other ndbs do not wait at all.
+  Entry &entry = _state->entries[key];
+  entry.read_only = options.read_only;
+  lock.unlock();
+
+  NeuralDBOptions pool_options = options;
+  pool_options.shared_query_cache = _state->query_cache;
+
+  std::shared_ptr<PlatformNeuralDB> ndb;
+  uint64_t bytes;
+  try {
+    ndb = PlatformNeuralDB::make(save_path, pool_options);
+    bytes = directorySize(save_path);
+  } catch (...) {
+    lock.lock();
+    _state->entries.erase(key);
+    _state->opened_cv.notify_all();
+    throw;
+  }
+
+  lock.lock();
+  entry.ndb = std::move(ndb);
+  entry.bytes = bytes;
+  entry.opening = false;
+  _state->stats.opens++;
+
+  auto leased = lease(key, entry);
+  auto evicted = takeEvicted(*_state, Clock::now());
+  _state->opened_cv.notify_all();
+  lock.unlock();
+
+  return leased;
+}
+
+void NeuralDBPool::evictIdle() {
+  std::unique_lock lock(_state->mutex);
+  auto evicted = takeEvicted(*_state, Clock::now());
+  lock.unlock();
+}
+
+NeuralDBPoolStats NeuralDBPool::stats() const {
+  std::lock_guard lock(_state->mutex);
+
+  NeuralDBPoolStats stats = _state->stats;
+  for (const auto &[_, entry] : _state->entries) {
+    if (entry.opening) {
+      continue;
+    }
+    stats.open++;
+    if (!entry.read_only) {
+      stats.pinned++;
+    }
+    stats.open_bytes += entry.bytes;
+  }
+  return stats;
+}
+
+QueryCacheStats NeuralDBPool::queryCacheStats() const {
+  if (!_state->query_cache) {
+    return {};
+  }
+  return _state->query_cache->stats();
+}
+
+std::shared_ptr<PlatformNeuralDB> NeuralDBPool::lease(const std::string &key,
+                                                      Entry &entry) {
+  entry.leases++;
+  entry.last_used = Clock::now();
+
+  // The pointer shares the ndb without owning it, its deleter returns the
+  // lease to the pool. It holds the ndb itself so that the ndb outlives the
+  // pool if the pool is destroyed first.
+  return std::shared_ptr<PlatformNeuralDB>(
+      entry.ndb.get(),
+      [state = _state, key, ndb = entry.ndb](PlatformNeuralDB *) {
+        std::vector<std::shared_ptr<PlatformNeuralDB>> evicted;
+        {
+          std::lock_guard lock(state->mutex);
+          auto it = state->entries.find(key);
+          if (it != state->entries.end() && it->second.ndb == ndb) {
+            auto now = Clock::now();
+            it->second.leases--;
+            it->second.last_used = now;
+            evicted = takeEvicted(*state, now);
+          }
+        }
+        state->idle_cv.notify_all();
+      });
+}
+
+std::vector<std::shared_ptr<PlatformNeuralDB>>
+NeuralDBPool::takeEvicted(State &state, Clock::time_point now) {
+  std::vector<std::shared_ptr<PlatformNeuralDB>> evicted;
+
+  auto evict = [&](auto it) {
+    evicted.push_back(std::move(it->second.ndb));
+    state.stats.evictions++;
+    return state.entries.erase(it);
+  };
+
+  const auto &options = state.options;
+  if (options.idle_timeout_ms > 0) {
+    auto timeout = std::chrono::milliseconds(options.idle_timeout_ms);
+    for (auto it = state.entries.begin(); it != state.entries.end();) {
+      if (evictable(it->second) && now - it->second.last_used >= timeout) {
+        it = evict(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  if (options.max_open == 0 && options.max_open_bytes == 0) {
+    return evicted;
+  }
+
+  size_t open = 0;
+  uint64_t open_bytes = 0;
+  for (const auto &[_, entry] : state.entries) {
+    if (!entry.opening) {
+      open++;
+      open_bytes += entry.bytes;
+    }
+  }
+
+  auto over_limits = [&]() {
+    return (options.max_open > 0 && open > options.max_open) ||
+           (options.max_open_bytes > 0 && open_bytes > options.max_open_bytes);
+  };
+
+  while (over_limits()) {
+    auto lru = state.entries.end();
+    for (auto it = state.entries.begin(); it != state.entries.end(); ++it) {
+      if (evictable(it->second) &&
+          (lru == state.entries.end() ||
+           it->second.last_used < lru->second.last_used)) {
+        lru = it;
+      }
+    }
+    if (lru == state.entries.end()) {
+      break;
+    }
+    open--;
+    open_bytes -= lru->second.bytes;
+    evict(lru);
+  }
+
+  return evicted;
+}
+
+void NeuralDBPool::runIdleEviction() {
+  auto timeout = std::chrono::milliseconds(_state->options.idle_timeout_ms);
+
+  std::unique_lock lock(_state->mutex);
+  while (!_state->stopping) {
+    auto evicted = takeEvicted(*_state, Clock::now());
+    if (!evicted.empty()) {
+      // The ndbs are closed without holding the mutex.
+      lock.unlock();
+      evicted.clear();
+      lock.lock();
+      continue;
+    }
+
+    std::optional<Clock::time_point> next_deadline;
+    for (const auto &[_, entry] : _state->entries) {
+      if (evictable(entry) &&
+          (!next_deadline || entry.last_used + timeout < *next_deadline)) {
+        next_deadline = entry.last_used + timeout;
+      }
+    }
+
+    // Releasing an ndb wakes the worker to recompute the deadline.
+    if (next_deadline) {
+      _state->idle_cv.wait_until(lock, *next_deadline);
+    } else {
+      _state->idle_cv.wait(lock);
+    }
+  }
+}
+
+} // namespace thirdai::search::ndb
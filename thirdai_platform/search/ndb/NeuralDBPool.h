@@ -0,0 +1,146 @@
+#pragma once
+
+#include "PlatformNeuralDB.h"
+#include "QueryCache.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+struct NeuralDBPoolOptions {
+  // The maximum number of ndbs to keep open, 0 for no limit.
+  size_t max_open = 0;
+
+  // The maximum total size of the ndbs to keep open, 0 for no limit. The
+  // engine does not report the memory it uses, so the size of an ndb is
+  // estimated by the size of its files when it is opened.
+  uint64_t max_open_bytes = 0;
+
+  // Ndbs that have not been used for this long are closed, 0 only closes ndbs
+  // to stay within max_open and max_open_bytes.
+  uint64_t idle_timeout_ms = 0;
+
+  // The maximum number of query results to cache across every ndb in the
+  // pool, 0 disables the cache.
+  size_t query_cache_size = 0;
+};
+
+struct NeuralDBPoolStats {
+  // The number of ndbs that are open, and how many of them are pinned because
+  // they are writable.
+  size_t open = 0;
+  size_t pinned = 0;
+  // The estimated size of the open ndbs.
+  uint64_t open_bytes = 0;
+  // The number of acquires that found the ndb open, and that had to open it.
+  uint64_t hits = 0;
+  uint64_t opens = 0;
+  // The number of ndbs closed to stay within the limits or because they were
+  // idle.
+  uint64_t evictions = 0;
+};
+
+/**
+ * Serves many ndbs from one process, such as the models of a node that hosts
+ * many small models. The ndbs are opened when they are first acquired and
+ * share a single query cache, and their engine calls share the threads of the
+ * process wide Executor. Ndbs that are not in use are closed to keep the pool
+ * within its limits, least recently used first, and are opened again the next
+ * time they are acquired.
+ *
+ * Only read only ndbs are closed by the pool. The engine cannot open an ndb
+ * again in the same process once it has been opened with write access, so
+ * writable ndbs stay open until the pool is destroyed and count towards the
+ * limits without being evicted. A pool may exceed its limits when every open
+ * ndb is in use or pinned, it returns within them as ndbs are released.
+ */
+class NeuralDBPool {
+public:
+  explicit NeuralDBPool(const NeuralDBPoolOptions &options = {});
+
+  NeuralDBPool(const NeuralDBPool &) = delete;
+  NeuralDBPool &operator=(const NeuralDBPool &) = delete;
+
+  /**
+   * Closes every ndb that is not in use, ndbs that are in use are closed once
+   * they are released.
+   */
+  ~NeuralDBPool();
+
+  /**
+   * Returns the ndb in save_path, opening it with the options if it is not
+   * open. The ndb is not closed by the pool while the returned pointer or any
+   * copy of it is alive. The options cannot set a query cache, since the ndbs
+   * use the pool's cache, and must have the same read_only as the options the
+   * ndb is open with if it is already open.
+   */
+  std::shared_ptr<PlatformNeuralDB> acquire(const std::string &save_path,
+                                            const NeuralDBOptions &options);
+
+  /**
+   * Closes the ndbs that have been idle for longer than the idle timeout, and
+   * the least recently used ndbs that are not in use while the pool exceeds
+   * its limits.
+   */
+  void evictIdle();
+
+  NeuralDBPoolStats stats() const;
+
+  QueryCacheStats queryCacheStats() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    std::shared_ptr<PlatformNeuralDB> ndb;
+    bool read_only;
+    uint64_t bytes = 0;
+    // The number of pointers returned by acquire that are alive.
+    size_t leases = 0;
+    Clock::time_point last_used;
+    bool opening = true;
+  };
+
+  // The state shared with the pointers returned by acquire, so that they can
+  // be released after the pool is destroyed.
+  struct State {
+    NeuralDBPoolOptions options;
+    std::shared_ptr<QueryCache> query_cache;
+
+    std::unordered_map<std::string, Entry> entries;
+    NeuralDBPoolStats stats;
+    bool stopping = false;
+
+    std::mutex mutex;
+    std::condition_variable opened_cv;
+    std::condition_variable idle_cv;
+  };
+
+  std::shared_ptr<PlatformNeuralDB> lease(const std::string &key,
+                                          Entry &entry);
+
+  /**
+   * Removes the ndbs to close from the pool with state.mutex held, and
+   * returns them so that they are destroyed after it is released.
+   */
+  static std::vector<std::shared_ptr<PlatformNeuralDB>>
+  takeEvicted(State &state, Clock::time_point now);
+
+  static bool evictable(const Entry &entry) {
+    return entry.read_only && !entry.opening && entry.leases == 0;
+  }
+
+  void runIdleEviction();
+
+  std::shared_ptr<State> _state;
+  std::thread _idle_worker;
+};
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,92 @@
+#include "NeuralDBStats.h"
+#include <algorithm>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+size_t bucketOf(uint64_t ns) {
+  uint64_t us = ns / 1000;
+  if (us == 0) {
+    return 0;
+  }
+  size_t bits = 64 - __builtin_clzll(us);
+  return std::min(bits, NeuralDBStats::NUM_BUCKETS - 1);
+}
+
+} // namespace
+
+void NeuralDBStats::record(Stage stage,
+                           std::chrono::steady_clock::duration duration) {
+  uint64_t ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+
+  auto &histogram = _stages[size_t(stage)];
+  histogram.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+  histogram.buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+}
+
+NeuralDBStats::Snapshot NeuralDBStats::snapshot() const {
+  Snapshot snapshot;
+  for (size_t i = 0; i < NUM_STAGES; i++) {
+    const auto &histogram = _stages[i];
+    auto &out = snapshot.stages[i];
+    for (size_t b = 0; b < NUM_BUCKETS; b++) {
+      out.buckets[b] = histogram.buckets[b].load(std::memory_order_relaxed);
+      out.count += out.buckets[b];
+    }
+    // The count is the sum of the buckets so that they always agree in a
+    // snapshot taken while calls are being recorded.
+    out.sum_ns = histogram.sum_ns.load(std::memory_order_relaxed);
+  }
+  for (size_t i = 0; i < NUM_COUNTERS; i++) {
+    snapshot.counters[i] = _counters[i].load(std::memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+const char *NeuralDBStats::name(Stage stage) {
+  switch (stage) {
+  case Stage::CacheLookup:
+    return "cache_lookup";
+  case Stage::IndexLookup:
+    return "index_lookup";
+  case Stage::EngineQuery:
+    return "engine_query";
+  case Stage::EngineRank:
+    return "engine_rank";
+  case Stage::CandidateFilter:
+    return "candidate_filter";
+  case Stage::Materialize:
+    return "materialize";
+  case Stage::EngineInsert:
+    return "engine_insert";
+  case Stage::IndexUpdate:
+    return "index_update";
+  case Stage::VectorSearch:
+    return "vector_search";
+  }
+  return "unknown";
+}
+
+const char *NeuralDBStats::name(Counter counter) {
+  switch (counter) {
+  case Counter::Queries:
+    return "queries";
+  case Counter::Candidates:
+    return "candidates";
+  case Counter::Results:
+    return "results";
+  case Counter::CacheHits:
+    return "cache_hits";
+  case Counter::CacheMisses:
+    return "cache_misses";
+  case Counter::ResultBytes:
+    return "result_bytes";
+  case Counter::InsertedChunks:
+    return "inserted_chunks";
+  }
+  return "unknown";
+}
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace thirdai::search::ndb {
+
+/**
+ * Latency histograms for the stages of the platform's query and insert paths,
+ * and counters of the work they do. Recording only uses relaxed atomic
+ * increments, so it does not add locking to the hot paths, and a snapshot
+ * taken while calls are in flight may include part of a call.
+ *
+ * The engine is a prebuilt library, so its work is measured at the calls into
+ * it: EngineQuery and EngineRank include tokenization, candidate retrieval,
+ * scoring, and the engine's storage reads.
+ */
+class NeuralDBStats {
+public:
+  enum class Stage : uint32_t {
+    CacheLookup,
+    IndexLookup,
+    EngineQuery,
+    EngineRank,
+    CandidateFilter,
+    Materialize,
+    EngineInsert,
+    IndexUpdate,
+    // The vector index search of a hybrid query, including reading the
+    // stored chunks of its results.
+    VectorSearch,
+  };
+  static constexpr size_t NUM_STAGES = size_t(Stage::VectorSearch) + 1;
+
+  enum class Counter : uint32_t {
+    Queries,
+    // Results retrieved from the engine, including candidates that were
+    // filtered out by constraints or limits.
+    Candidates,
+    Results,
+    CacheHits,
+    CacheMisses,
+    // Bytes of result fields copied out for the caller.
+    ResultBytes,
+    InsertedChunks,
+  };
+  static constexpr size_t NUM_COUNTERS = size_t(Counter::InsertedChunks) + 1;
+
+  // Bucket 0 counts calls that took less than 1us, bucket i counts calls that
+  // took at least 2^(i-1)us and less than 2^i us, and the last bucket counts
+  // every slower call.
+  static constexpr size_t NUM_BUCKETS = 24;
+
+  struct Histogram {
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    std::array<uint64_t, NUM_BUCKETS> buckets{};
+  };
+
+  struct Snapshot {
+    std::array<Histogram, NUM_STAGES> stages;
+    std::array<uint64_t, NUM_COUNTERS> counters{};
+  };
+
+  /**
+   * Records the time from its construction to its destruction as a call to
+   * the stage.
+   */
+  class Timer {
+  public:
+    Timer(NeuralDBStats &stats, Stage stage)
+        : _stats(stats), _stage(stage),
+          _start(std::chrono::steady_clock::now()) {}
+
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+    ~Timer() {
+      _stats.record(_stage, std::chrono::steady_clock::now() - _start);
+    }
+
+  private:
+    NeuralDBStats &_stats;
+    Stage _stage;
+    std::chrono::steady_clock::time_point _start;
+  };
+
+  void record(Stage stage, std::chrono::steady_clock::duration duration);
+
+  void add(Counter counter, uint64_t n = 1) {
+    _counters[size_t(counter)].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  Snapshot snapshot() const;
+
+  static const char *name(Stage stage);
+
+  static const char *name(Counter counter);
+
+private:
+  // Each stage is on its own cache line so that threads recording different
+  // stages do not contend.
+  struct alignas(64) AtomicHistogram {
+    std::atomic<uint64_t> sum_ns = 0;
+    std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets{};
+  };
+
+  std::array<AtomicHistogram, NUM_STAGES> _stages;
+  std::array<std::atomic<uint64_t>, NUM_COUNTERS> _counters{};
+};
+
+} // namespace thirdai::search::ndb
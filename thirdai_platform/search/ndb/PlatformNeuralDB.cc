@@ -0,0 +1,1000 @@
+#include "PlatformNeuralDB.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <future>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+// When the metadata indexes show that a filter keeps a large enough fraction
+// of the chunks, a constrained query is answered by filtering the results of
+// an unconstrained query, which avoids loading the metadata of every candidate
+// in the engine's rank. The first query fetches OVERFETCH_FACTOR * top_k /
+// selectivity results, and each retry fetches OVERFETCH_GROWTH times as many
+// until MAX_OVERFETCH results are fetched.
+constexpr float OVERFETCH_FACTOR = 2.0;
+constexpr uint32_t OVERFETCH_GROWTH = 4;
+constexpr uint32_t MAX_OVERFETCH = 4096;
+
+// Results are sorted by descending score.
+void trimBelow(std::vector<std::pair<Chunk, float>> &results, float min_score) {
+  auto end = std::find_if(results.begin(), results.end(),
+                          [&](const auto &result) {
+                            return result.second < min_score;
+                          });
+  results.erase(end, results.end());
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+uint64_t nextCacheOwner() {
+  static std::atomic<uint64_t> next_owner = 0;
+  return next_owner++;
+}
+
+} // namespace
+
+PlatformNeuralDB::PlatformNeuralDB(
+    const std::string &save_path, std::unique_ptr<ShardedNeuralDB> ndb,
+    std::unique_ptr<MetadataIndex> metadata_index,
+    std::unique_ptr<VectorIndex> vector_index,
+    std::unique_ptr<DocCatalog> doc_catalog,
+    std::unique_ptr<ChunkStore> chunk_store,
+    std::shared_ptr<QueryCache> query_cache, const NeuralDBOptions &options)
+    : _ndb(std::move(ndb)), _read_only(options.read_only),
+      _buffer_feedback(options.buffer_feedback),
+      _feedback_batch_size(options.feedback_batch_size),
+      _metadata_index(std::move(metadata_index)),
+      _chunk_store(std::move(chunk_store)),
+      _vector_index(std::move(vector_index)),
+      _doc_catalog(std::move(doc_catalog)),
+      _query_cache(std::move(query_cache)), _cache_owner(nextCacheOwner()),
+      _stats(std::make_shared<NeuralDBStats>()) {
+  if (!_read_only) {
+    std::optional<std::chrono::milliseconds> interval;
+    if (options.compaction_interval_ms > 0) {
+      interval = std::chrono::milliseconds(options.compaction_interval_ms);
+    }
+    // The compactor, ingest queue, and feedback buffer call the engine from
+    // their own threads, which follow the executor configuration for updates.
+    _compactor = std::make_unique<Compactor>(
+        [this]() {
+          Executor::bindCurrentThread(Executor::Work::Update);
+          compactDeletedChunks();
+        },
+        interval);
+
+    _ingest_queue = std::make_unique<IngestQueue>(
+        save_path, [this](const std::vector<NewDocument> &documents) {
+          Executor::bindCurrentThread(Executor::Work::Update);
+          insertDocuments(documents);
+        });
+
+    // Without buffering the feedback buffer is only opened to replay the
+    // feedback an earlier open left pending, which make applies.
+    if (options.buffer_feedback || FeedbackBuffer::exists(save_path)) {
+      std::optional<std::chrono::milliseconds> feedback_interval;
+      if (options.feedback_interval_ms > 0) {
+        feedback_interval =
+            std::chrono::milliseconds(options.feedback_interval_ms);
+      }
+      _feedback = std::make_unique<FeedbackBuffer>(
+          save_path,
+          [this]() {
+            Executor::bindCurrentThread(Executor::Work::Update);
+            applyFeedback();
+          },
+          feedback_interval);
+    }
+  }
+}
+
+std::unique_ptr<PlatformNeuralDB>
+PlatformNeuralDB::make(const std::string &save_path,
+                       const NeuralDBOptions &options) {
+  auto open_start = std::chrono::steady_clock::now();
+
+  if (options.query_cache_size > 0 && options.shared_query_cache) {
+    throw std::invalid_argument(
+        "query_cache_size cannot be combined with a shared query cache");
+  }
+
+  if (!options.buffer_feedback &&
+      (options.feedback_batch_size > 0 || options.feedback_interval_ms > 0)) {
+    throw std::invalid_argument("feedback_batch_size and feedback_interval_ms "
+                                "require buffer_feedback");
+  }
+
+  bool is_new = !ShardedNeuralDB::exists(save_path);
+
+  if (options.read_only && is_new) {
+    throw std::invalid_argument("cannot open '" + save_path +
+                                "' in read only mode, it is not an ndb");
+  }
+
+  OpenTimings timings;
+
+  auto open_indexes = [&]() {
+    std::unique_ptr<MetadataIndex> metadata_index;
+    auto start = std::chrono::steady_clock::now();
+    if (MetadataIndex::exists(save_path)) {
+      metadata_index = MetadataIndex::open(save_path, options.read_only);
+      if (!options.metadata_indexes.empty() &&
+          options.metadata_indexes != metadata_index->keys()) {
+        throw std::invalid_argument("metadata indexes do not match the "
+                                    "indexes the ndb was created with");
+      }
+    } else if (!options.metadata_indexes.empty()) {
+      if (!is_new) {
+        throw std::invalid_argument(
+            "metadata indexes can only be declared when the ndb is created");
+      }
+      metadata_index = MetadataIndex::make(save_path, options.metadata_indexes);
+    }
+    timings.metadata_index_ms = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    auto doc_catalog = DocCatalog::open(save_path, options.read_only);
+    timings.doc_catalog_ms = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    auto chunk_store = ChunkStore::open(save_path, options.read_only);
+    if (!chunk_store && options.store_chunks) {
+      if (!is_new) {
+        throw std::invalid_argument(
+            "store_chunks can only be declared when the ndb is created");
+      }
+      chunk_store = ChunkStore::make(save_path);
+    }
+    timings.chunk_store_ms = elapsedMs(start);
+
+    std::unique_ptr<VectorIndex> vector_index;
+    start = std::chrono::steady_clock::now();
+    if (VectorIndex::exists(save_path)) {
+      vector_index = VectorIndex::open(save_path, options.read_only,
+                                       chunk_store.get());
+      if (options.embedding_dim > 0 &&
+          options.embedding_dim != vector_index->dim()) {
+        throw std::invalid_argument(
+            "cannot open ndb with embedding dimension " +
+            std::to_string(options.embedding_dim) +
+            ", it was created with dimension " +
+            std::to_string(vector_index->dim()));
+      }
+    } else if (options.embedding_dim > 0) {
+      if (!is_new) {
+        throw std::invalid_argument(
+            "an embedding dimension can only be declared when the ndb is "
+            "created");
+      }
+      // The vector index of a new ndb reads its chunks from the chunk store
+      // instead of keeping a copy of them.
+      vector_index = VectorIndex::make(save_path, options.embedding_dim,
+                                       chunk_store.get());
+    }
+    timings.vector_index_ms = elapsedMs(start);
+
+    return std::make_tuple(std::move(metadata_index), std::move(vector_index),
+                           std::move(doc_catalog), std::move(chunk_store));
+  };
+
+  // The indexes of an existing ndb are loaded while the engine opens, the
+  // indexes of a new ndb are created after the engine has created its
+  // directory.
+  auto indexes = std::async(
+      is_new ? std::launch::deferred : std::launch::async, open_indexes);
+
+  std::unique_ptr<ShardedNeuralDB> ndb;
+  auto engine_start = std::chrono::steady_clock::now();
+  if (options.read_only) {
+    ndb = ShardedNeuralDB::load(save_path, /*read_only=*/true);
+    if (options.num_shards > 0 && options.num_shards != ndb->numShards()) {
+      throw std::invalid_argument("cannot open ndb with " +
+                                  std::to_string(options.num_shards) +
+                                  " shards, it was created with " +
+                                  std::to_string(ndb->numShards()));
+    }
+  } else {
+    std::optional<uint32_t> num_shards;
+    if (options.num_shards > 0) {
+      num_shards = options.num_shards;
+    }
+    ndb = ShardedNeuralDB::make(save_path, num_shards);
+  }
+  timings.engine_ms = elapsedMs(engine_start);
+
+  auto [metadata_index, vector_index, doc_catalog, chunk_store] =
+      indexes.get();
+
+  if (!doc_catalog) {
+    // The engine lists the sources of an ndb that was created before the
+    // catalog existed, which is only needed the first time it is opened
+    // unless it is read only.
+    auto start = std::chrono::steady_clock::now();
+    doc_catalog = DocCatalog::make(
+        save_path, is_new ? std::vector<Source>{} : ndb->sources(),
+        options.read_only);
+    timings.doc_catalog_ms += elapsedMs(start);
+  }
+
+  std::shared_ptr<QueryCache> query_cache = options.shared_query_cache;
+  if (options.query_cache_size > 0) {
+    query_cache = std::make_shared<QueryCache>(options.query_cache_size);
+  }
+
+  auto ingest_start = std::chrono::steady_clock::now();
+  std::unique_ptr<PlatformNeuralDB> platform_ndb(new PlatformNeuralDB(
+      save_path, std::move(ndb), std::move(metadata_index),
+      std::move(vector_index), std::move(doc_catalog), std::move(chunk_store),
+      std::move(query_cache), options));
+  timings.ingest_queue_ms = elapsedMs(ingest_start);
+
+  // Feedback buffered by an earlier open is kept buffered if the ndb still
+  // buffers feedback, so that batches are not cut by reopening it.
+  if (platform_ndb->_feedback && !options.buffer_feedback) {
+    if (platform_ndb->_feedback->pending() > 0) {
+      platform_ndb->applyFeedback();
+    }
+    platform_ndb->_feedback.reset();
+  }
+
+  timings.total_ms = elapsedMs(open_start);
+  platform_ndb->_open_timings = timings;
+
+  return platform_ndb;
+}
+
+void PlatformNeuralDB::checkWritable() const {
+  if (_read_only) {
+    throw std::runtime_error(
+        "cannot update an ndb that is opened in read only mode");
+  }
+}
+
+InsertMetadata PlatformNeuralDB::insert(
+    const std::vector<std::string> &chunks,
+    const std::vector<MetadataMap> &metadata, const std::string &document,
+    const DocId &doc_id, std::optional<uint32_t> doc_version) {
+  checkWritable();
+  _ingest_queue->drain();
+
+  std::lock_guard lock(_write_mutex);
+
+  InsertMetadata inserted = [&]() {
+    NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::EngineInsert);
+    return _ndb->insert(chunks, metadata, document, doc_id, doc_version);
+  }();
+  _stats->add(NeuralDBStats::Counter::InsertedChunks, chunks.size());
+
+  {
+    NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::IndexUpdate);
+    if (_metadata_index) {
+      _metadata_index->insert(inserted.doc_id, inserted.doc_version,
+                              inserted.start_id, metadata);
+    }
+    _doc_catalog->insert(inserted, document);
+    if (_chunk_store) {
+      _chunk_store->insert(inserted, chunks, metadata, document);
+    }
+  }
+  bumpWriteEpoch();
+
+  return inserted;
+}
+
+std::vector<InsertMetadata>
+PlatformNeuralDB::insertBatch(const std::vector<NewDocument> &documents) {
+  checkWritable();
+  _ingest_queue->drain();
+
+  return insertDocuments(documents);
+}
+
+uint64_t PlatformNeuralDB::insertAsync(std::string_view batch) {
+  checkWritable();
+  return _ingest_queue->stage(batch);
+}
+
+void PlatformNeuralDB::waitForIndexed(uint64_t seq) {
+  checkWritable();
+  _ingest_queue->waitForIndexed(seq);
+}
+
+void PlatformNeuralDB::flush() {
+  checkWritable();
+  _ingest_queue->flush();
+}
+
+std::vector<InsertMetadata>
+PlatformNeuralDB::insertDocuments(const std::vector<NewDocument> &documents) {
+  // Embeddings are checked before anything is inserted, since the engine's
+  // insertions cannot be undone.
+  for (const auto &document : documents) {
+    if (document.embeddings.empty()) {
+      continue;
+    }
+    if (!_vector_index) {
+      throw std::invalid_argument(
+          "cannot insert embeddings into an ndb without an embedding "
+          "dimension");
+    }
+    _vector_index->checkEmbeddings(document);
+  }
+
+  std::lock_guard lock(_write_mutex);
+
+  std::vector<InsertMetadata> inserted;
+  inserted.reserve(documents.size());
+
+  std::exception_ptr error;
+  try {
+    for (const auto &document : documents) {
+      NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::EngineInsert);
+      inserted.push_back(_ndb->insert(document.chunks, document.metadata,
+                                      document.document, document.doc_id,
+                                      document.doc_version));
+      _stats->add(NeuralDBStats::Counter::InsertedChunks,
+                  document.chunks.size());
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  if (!inserted.empty()) {
+    NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::IndexUpdate);
+    if (_metadata_index) {
+      _metadata_index->insertBatch(inserted, documents);
+    }
+    _doc_catalog->insertBatch(inserted, documents);
+    // The vector index reads the chunks it finds from the chunk store, so they
+    // are stored before they are added to the index.
+    if (_chunk_store) {
+      _chunk_store->insertBatch(inserted, documents);
+    }
+    if (_vector_index) {
+      _vector_index->insertBatch(inserted, documents);
+    }
+  }
+  bumpWriteEpoch();
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  return inserted;
+}
+
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::query(const std::string &query, uint32_t top_k) {
+  return recordQuery(
+      [&]() { return queryWithLimits(query, top_k, QueryLimits{}); });
+}
+
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::rank(const std::string &query,
+                       const QueryConstraints &constraints, uint32_t top_k) {
+  return recordQuery([&]() {
+    return rankWithLimits(query, constraints, top_k, QueryLimits{});
+  });
+}
+
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::search(const std::string &query,
+                         const QueryConstraints &constraints, uint32_t top_k,
+                         const QueryLimits &limits) {
+  return recordQuery([&]() {
+    if (constraints.empty()) {
+      return queryWithLimits(query, top_k, limits);
+    }
+    return rankWithLimits(query, constraints, top_k, limits);
+  });
+}
+
+std::vector<std::pair<Chunk, float>> PlatformNeuralDB::hybridSearch(
+    const std::string &query, const std::vector<float> &embedding,
+    const QueryConstraints &constraints, uint32_t top_k,
+    const HybridOptions &options) {
+  if (!_vector_index) {
+    throw std::invalid_argument(
+        "hybrid queries require an ndb with an embedding dimension");
+  }
+  if (!embedding.empty()) {
+    _vector_index->checkEmbedding(embedding);
+  }
+  if (!(options.lexical_weight >= 0) || !(options.vector_weight >= 0)) {
+    throw std::invalid_argument("hybrid query weights must be >= 0");
+  }
+
+  return recordQuery([&]() {
+    uint32_t candidates = options.candidates;
+    if (candidates == 0) {
+      candidates = std::max(top_k, HybridOptions::DEFAULT_CANDIDATES);
+    }
+
+    std::vector<std::pair<Chunk, float>> lexical;
+    if (options.lexical_weight > 0 && !query.empty() && top_k > 0) {
+      if (constraints.empty()) {
+        lexical = queryWithLimits(query, candidates, QueryLimits{});
+      } else {
+        lexical =
+            rankWithLimits(query, constraints, candidates, QueryLimits{});
+      }
+    }
+
+    std::vector<std::pair<Chunk, float>> vector;
+    if (options.vector_weight > 0 && !embedding.empty() && top_k > 0) {
+      vector = vectorSearch(embedding, constraints, candidates);
+    }
+
+    std::vector<std::pair<Chunk, float>> fused;
+    // The index of each chunk in fused.
+    std::unordered_map<ChunkId, size_t> fused_positions;
+    auto fuse = [&](std::vector<std::pair<Chunk, float>> &results,
+                    float weight) {
+      for (size_t position = 0; position < results.size(); position++) {
+        float score = weight / (options.rrf_k + position + 1);
+        auto [it, inserted] = fused_positions.try_emplace(
+            results[position].first.id, fused.size());
+        if (inserted) {
+          fused.emplace_back(std::move(results[position].first), score);
+        } else {
+          fused[it->second].second += score;
+        }
+      }
+    };
+    fuse(lexical, options.lexical_weight);
+    fuse(vector, options.vector_weight);
+
+    std::sort(fused.begin(), fused.end(), [](const auto &a, const auto &b) {
+      if (a.second != b.second) {
+        return a.second > b.second;
+      }
+      return a.first.id < b.first.id;
+    });
+    if (fused.size() > top_k) {
+      fused.erase(fused.begin() + top_k, fused.end());
+    }
+    return fused;
+  });
+}
+
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::vectorSearch(const std::vector<float> &embedding,
+                               const QueryConstraints &constraints,
+                               uint32_t top_k) {
+  std::optional<CompiledConstraints> compiled;
+  std::optional<std::vector<ChunkId>> allowed;
+  bool covered = constraints.empty();
+  if (!constraints.empty()) {
+    compiled.emplace(constraints);
+    if (_metadata_index) {
+      NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::IndexLookup);
+      allowed = _metadata_index->lookup(*compiled);
+      if (allowed && allowed->empty()) {
+        return {};
+      }
+      covered = allowed && _metadata_index->covers(*compiled);
+    }
+  }
+
+  std::function<bool(const Chunk &)> matches;
+  if (!covered) {
+    matches = [&](const Chunk &chunk) {
+      return compiled->matches(chunk.metadata);
+    };
+  }
+
+  NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::VectorSearch);
+
+  auto results = _vector_index->search(
+      embedding, top_k, allowed ? &*allowed : nullptr, matches);
+  _stats->add(NeuralDBStats::Counter::Candidates, results.size());
+  return results;
+}
+
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::queryWithLimits(const std::string &query, uint32_t top_k,
+                                  const QueryLimits &limits) {
+  std::shared_lock reader(_delete_mutex);
+
+  auto fetch = [&](uint32_t k) {
+    if (!_query_cache) {
+      return engineQuery(query, k);
+    }
+    // The limits do not change the candidates of an unconstrained query, so
+    // its results are cached regardless of the limits.
+    return cachedQuery(QueryCache::key(_cache_owner, query, nullptr, k),
+                       [&]() { return engineQuery(query, k); });
+  };
+
+  auto results = limits.latest_versions_only ? latestVersions(top_k, fetch)
+                                             : fetch(top_k);
+  trimBelow(results, limits.min_score);
+  return results;
+}
+
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::rankWithLimits(const std::string &query,
+                                 const QueryConstraints &constraints,
+                                 uint32_t top_k, const QueryLimits &limits) {
+  CompiledConstraints compiled(constraints);
+
+  std::shared_lock reader(_delete_mutex);
+
+  auto evaluate = [&](uint32_t k) {
+    if (limits.max_candidates > 0) {
+      return rankWithBudget(query, compiled, k, limits);
+    }
+
+    if (_metadata_index) {
+      if (auto results = rankWithIndex(query, compiled, k, limits.min_score)) {
+        return std::move(*results);
+      }
+    }
+
+    return engineRank(query, compiled.engineConstraints(), k);
+  };
+
+  auto fetch = [&](uint32_t k) {
+    if (!_query_cache) {
+      return evaluate(k);
+    }
+
+    auto key = QueryCache::key(_cache_owner, query, &compiled, k);
+    if (limits.unlimited()) {
+      return cachedQuery(key, [&]() { return evaluate(k); });
+    }
+    // Results computed with limits may omit results of the unlimited query,
+    // so they are not cached, but cached unlimited results can still be used.
+    std::shared_ptr<const std::vector<std::pair<Chunk, float>>> cached;
+    if (key) {
+      cached = lookupCache(*key, _write_epoch);
+    }
+    return cached ? *cached : evaluate(k);
+  };
+
+  auto results = limits.latest_versions_only ? latestVersions(top_k, fetch)
+                                             : fetch(top_k);
+  trimBelow(results, limits.min_score);
+  return results;
+}
+
+template <typename Evaluate>
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::recordQuery(Evaluate &&evaluate) {
+  _stats->add(NeuralDBStats::Counter::Queries);
+
+  auto results = evaluate();
+  _stats->add(NeuralDBStats::Counter::Results, results.size());
+  return results;
+}
+
+template <typename Fetch>
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::latestVersions(uint32_t top_k, Fetch &&fetch) {
+  uint32_t k = top_k;
+  while (true) {
+    auto results = fetch(k);
+    bool exhausted = results.size() < k;
+
+    {
+      NeuralDBStats::Timer timer(*_stats,
+                                 NeuralDBStats::Stage::CandidateFilter);
+      _doc_catalog->keepLatestVersions(results, top_k);
+    }
+    if (results.size() == top_k || exhausted ||
+        k == std::numeric_limits<uint32_t>::max()) {
+      return results;
+    }
+
+    // Each retry at least doubles the candidates, so a query whose candidates
+    // are mostly older versions does not retry once per missing result.
+    k = uint32_t(std::min<uint64_t>(uint64_t(k) * 2,
+                                    std::numeric_limits<uint32_t>::max()));
+  }
+}
+
+template <typename Evaluate>
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::cachedQuery(const std::optional<std::string> &key,
+                              Evaluate &&evaluate) {
+  if (!key) {
+    return evaluate();
+  }
+
+  // The epoch is read before the query is evaluated so that results which
+  // may not reflect an update that finished during the query are never
+  // cached under the epoch of that update.
+  uint64_t epoch = _write_epoch;
+
+  if (auto cached = lookupCache(*key, epoch)) {
+    return *cached;
+  }
+
+  auto results = std::make_shared<const std::vector<std::pair<Chunk, float>>>(
+      evaluate());
+  if (epoch == _write_epoch) {
+    _query_cache->put(*key, epoch, results);
+  }
+  return *results;
+}
+
+std::shared_ptr<const std::vector<std::pair<Chunk, float>>>
+PlatformNeuralDB::lookupCache(const std::string &key, uint64_t epoch) {
+  NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::CacheLookup);
+
+  auto cached = _query_cache->get(key, epoch);
+  _stats->add(cached ? NeuralDBStats::Counter::CacheHits
+                     : NeuralDBStats::Counter::CacheMisses);
+  return cached;
+}
+
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::engineQuery(const std::string &query, uint32_t top_k) {
+  NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::EngineQuery);
+
+  auto results = _ndb->query(query, top_k);
+  _stats->add(NeuralDBStats::Counter::Candidates, results.size());
+  return results;
+}
+
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::engineRank(const std::string &query,
+                             const QueryConstraints &constraints,
+                             uint32_t top_k) {
+  NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::EngineRank);
+
+  auto results = _ndb->rank(query, constraints, top_k);
+  _stats->add(NeuralDBStats::Counter::Candidates, results.size());
+  return results;
+}
+
+std::optional<std::vector<std::pair<Chunk, float>>>
+PlatformNeuralDB::rankWithIndex(const std::string &query,
+                                const CompiledConstraints &constraints,
+                                uint32_t top_k, float min_score) {
+  auto allowed = [&]() {
+    NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::IndexLookup);
+    return _metadata_index->lookup(constraints);
+  }();
+  if (!allowed) {
+    return std::nullopt;
+  }
+  if (allowed->empty() || top_k == 0) {
+    return std::vector<std::pair<Chunk, float>>{};
+  }
+
+  // The engine cannot score a given set of chunks, so the allowed chunks can
+  // only be found among the engine's unconstrained results. Filters that are
+  // too selective for MAX_OVERFETCH results to contain top_k allowed chunks
+  // are left to the engine's rank, and are not improved by the index.
+  size_t num_chunks = std::max<size_t>(_metadata_index->numChunks(), 1);
+  float selectivity = float(allowed->size()) / num_chunks;
+  float initial_fetch = std::ceil(OVERFETCH_FACTOR * top_k / selectivity);
+  if (initial_fetch > MAX_OVERFETCH) {
+    return std::nullopt;
+  }
+  uint32_t fetch = uint32_t(initial_fetch);
+
+  bool covered = _metadata_index->covers(constraints);
+
+  while (true) {
+    auto candidates = engineQuery(query, fetch);
+    bool exhausted = candidates.size() < fetch;
+
+    NeuralDBStats::Timer timer(*_stats,
+                               NeuralDBStats::Stage::CandidateFilter);
+
+    std::vector<std::pair<Chunk, float>> results;
+    for (auto &candidate : candidates) {
+      // The candidates are sorted by score, so none of the remaining
+      // candidates can be returned either.
+      if (candidate.second < min_score) {
+        return results;
+      }
+      if (!std::binary_search(allowed->begin(), allowed->end(),
+                              candidate.first.id)) {
+        continue;
+      }
+      if (!covered && !constraints.matches(candidate.first.metadata)) {
+        continue;
+      }
+      results.push_back(std::move(candidate));
+      if (results.size() == top_k) {
+        return results;
+      }
+    }
+
+    // If the engine returned fewer candidates than requested then every
+    // candidate was considered, otherwise the filtered results may be
+    // missing matches that scored below the candidates that were fetched.
+    if (exhausted) {
+      return results;
+    }
+    if (fetch == MAX_OVERFETCH) {
+      return std::nullopt;
+    }
+    fetch = std::min(fetch * OVERFETCH_GROWTH, MAX_OVERFETCH);
+  }
+}
+
+std::vector<std::pair<Chunk, float>>
+PlatformNeuralDB::rankWithBudget(const std::string &query,
+                                 const CompiledConstraints &constraints,
+                                 uint32_t top_k, const QueryLimits &limits) {
+  std::optional<std::vector<ChunkId>> allowed;
+  bool covered = false;
+  if (_metadata_index) {
+    NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::IndexLookup);
+    allowed = _metadata_index->lookup(constraints);
+    if (allowed && allowed->empty()) {
+      return {};
+    }
+    covered = allowed && _metadata_index->covers(constraints);
+  }
+
+  std::vector<std::pair<Chunk, float>> results;
+  if (top_k == 0) {
+    return results;
+  }
+
+  auto candidates = engineQuery(query, limits.max_candidates);
+
+  NeuralDBStats::Timer timer(*_stats, NeuralDBStats::Stage::CandidateFilter);
+
+  for (auto &candidate : candidates) {
+    if (candidate.second < limits.min_score) {
+      break;
+    }
+    if (allowed && !std::binary_search(allowed->begin(), allowed->end(),
+                                       candidate.first.id)) {
+      continue;
+    }
+    if (!covered && !constraints.matches(candidate.first.metadata)) {
+      continue;
+    }
+    results.push_back(std::move(candidate));
+    if (results.size() == top_k) {
+      break;
+    }
+  }
+  return results;
+}
+
+void PlatformNeuralDB::finetune(
+    const std::vector<std::string> &queries,
+    const std::vector<std::vector<ChunkId>> &chunk_ids) {
+  checkWritable();
+
+  if (_buffer_feedback) {
+    size_t pending = _feedback->addFinetune(queries, chunk_ids);
+    if (_feedback_batch_size > 0 && pending >= _feedback_batch_size) {
+      applyFeedback();
+    }
+    return;
+  }
+
+  _ingest_queue->drain();
+
+  std::lock_guard lock(_write_mutex);
+
+  _ndb->finetune(queries, chunk_ids);
+  bumpWriteEpoch();
+}
+
+void PlatformNeuralDB::associate(const std::vector<std::string> &sources,
+                                 const std::vector<std::string> &targets,
+                                 uint32_t strength) {
+  checkWritable();
+
+  if (_buffer_feedback) {
+    size_t pending = _feedback->addAssociate(sources, targets, strength);
+    if (_feedback_batch_size > 0 && pending >= _feedback_batch_size) {
+      applyFeedback();
+    }
+    return;
+  }
+
+  _ingest_queue->drain();
+
+  std::lock_guard lock(_write_mutex);
+
+  _ndb->associate(sources, targets, strength);
+  bumpWriteEpoch();
+}
+
+void PlatformNeuralDB::applyPendingFeedback() {
+  checkWritable();
+  if (_feedback) {
+    applyFeedback();
+  }
+}
+
+void PlatformNeuralDB::applyFeedback() {
+  _ingest_queue->drain();
+
+  std::lock_guard lock(_write_mutex);
+
+  auto apply = [&](const FeedbackBatch &batch) {
+    if (!batch.queries.empty()) {
+      _ndb->finetune(batch.queries, batch.chunk_ids);
+    }
+    for (const auto &associations : batch.associations) {
+      if (!associations.sources.empty()) {
+        _ndb->associate(associations.sources, associations.targets,
+                        associations.strength);
+      }
+    }
+  };
+
+  // Part of a batch may have been applied when it fails, so cached results
+  // are invalidated either way.
+  try {
+    _feedback->apply(apply);
+  } catch (...) {
+    bumpWriteEpoch();
+    throw;
+  }
+  bumpWriteEpoch();
+}
+
+size_t PlatformNeuralDB::pendingFeedback() const {
+  return _feedback ? _feedback->pending() : 0;
+}
+
+void PlatformNeuralDB::deleteDocVersion(const DocId &doc_id,
+                                        uint32_t doc_version) {
+  checkWritable();
+  _ingest_queue->drain();
+
+  std::lock_guard lock(_write_mutex);
+  std::unique_lock deletion(_delete_mutex);
+
+  _ndb->deleteDocVersion(doc_id, doc_version);
+
+  if (_metadata_index) {
+    _metadata_index->deleteDocVersion(doc_id, doc_version);
+  }
+  if (_vector_index) {
+    _vector_index->deleteDocVersion(doc_id, doc_version);
+  }
+  _doc_catalog->deleteDocVersion(doc_id, doc_version);
+  if (_chunk_store) {
+    _chunk_store->deleteDocVersion(doc_id, doc_version);
+  }
+  bumpWriteEpoch();
+
+  _compactor->notifyDeletion();
+}
+
+void PlatformNeuralDB::deleteDoc(const DocId &doc_id,
+                                 bool keep_latest_version) {
+  checkWritable();
+  _ingest_queue->drain();
+
+  std::lock_guard lock(_write_mutex);
+  std::unique_lock deletion(_delete_mutex);
+
+  _ndb->deleteDoc(doc_id, keep_latest_version);
+
+  if (_metadata_index) {
+    _metadata_index->deleteDoc(doc_id, keep_latest_version);
+  }
+  if (_vector_index) {
+    _vector_index->deleteDoc(doc_id, keep_latest_version);
+  }
+  _doc_catalog->deleteDoc(doc_id, keep_latest_version);
+  if (_chunk_store) {
+    _chunk_store->deleteDoc(doc_id, keep_latest_version);
+  }
+  bumpWriteEpoch();
+
+  _compactor->notifyDeletion();
+}
+
+void PlatformNeuralDB::prune() {
+  checkWritable();
+  _ingest_queue->drain();
+
+  // The write lock is taken by the pass, not here, since the pass may have to
+  // wait for a background pass that is waiting for the write lock.
+  _compactor->compactNow();
+}
+
+void PlatformNeuralDB::compactDeletedChunks() {
+  std::lock_guard lock(_write_mutex);
+  // Like deletions, the engine's prune rewrites the indexes and storage that
+  // queries read, so readers are blocked while the deleted chunks are
+  // reclaimed.
+  std::unique_lock deletion(_delete_mutex);
+
+  _ndb->prune();
+  bumpWriteEpoch();
+}
+
+std::vector<Source> PlatformNeuralDB::sources() {
+  return _doc_catalog->sources(0, std::numeric_limits<size_t>::max());
+}
+
+std::vector<Source> PlatformNeuralDB::sources(size_t offset,
+                                              size_t limit) const {
+  return _doc_catalog->sources(offset, limit);
+}
+
+std::vector<Source> PlatformNeuralDB::sourcesAfter(const DocId &doc_id,
+                                                   uint32_t doc_version,
+                                                   size_t limit) const {
+  return _doc_catalog->sourcesAfter(doc_id, doc_version, limit);
+}
+
+size_t PlatformNeuralDB::numSources() const {
+  return _doc_catalog->numSources();
+}
+
+std::optional<uint32_t>
+PlatformNeuralDB::latestVersion(const DocId &doc_id) const {
+  return _doc_catalog->latestVersion(doc_id);
+}
+
+std::unique_ptr<ChunkCursor>
+PlatformNeuralDB::chunkCursor(const ChunkCursorOptions &options) const {
+  if (!_chunk_store) {
+    throw std::invalid_argument(
+        "cannot iterate over the chunks of an ndb created without "
+        "store_chunks");
+  }
+  return _chunk_store->cursor(options);
+}
+
+void PlatformNeuralDB::save(const std::string &save_path) const {
+  if (_ingest_queue) {
+    _ingest_queue->drain();
+  }
+
+  std::lock_guard lock(_write_mutex);
+
+  _ndb->save(save_path);
+
+  if (_metadata_index) {
+    _metadata_index->save(save_path);
+  }
+  if (_vector_index) {
+    _vector_index->save(save_path);
+  }
+  _doc_catalog->save(save_path);
+  if (_chunk_store) {
+    _chunk_store->save(save_path);
+  }
+  if (_feedback) {
+    _feedback->save(save_path);
+  }
+
+  CheckpointManifest::build(save_path, _checkpoint_hashes).write(save_path);
+}
+
+QueryCacheStats PlatformNeuralDB::queryCacheStats() const {
+  if (!_query_cache) {
+    return QueryCacheStats{};
+  }
+  return _query_cache->stats();
+}
+
+CompactionStats PlatformNeuralDB::compactionStats() const {
+  if (!_compactor) {
+    return CompactionStats{};
+  }
+  return _compactor->stats();
+}
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,522 @@
+#pragma once
+
+#include "CheckpointManifest.h"
+#include "Chunk.h"
+#include "ChunkStore.h"
+#include "Compactor.h"
+#include "CompiledConstraints.h"
+#include "DocCatalog.h"
+#include "DocumentBatch.h"
+#include "Executor.h"
+#include "FeedbackBuffer.h"
+#include "IngestQueue.h"
+#include "MetadataIndex.h"
+#include "NeuralDB.h"
+#include "NeuralDBStats.h"
+#include "QueryCache.h"
+#include "ShardedNeuralDB.h"
+#include "VectorIndex.h"
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+struct NeuralDBOptions {
+  // Metadata keys to maintain secondary indexes for. Indexes can only be
+  // declared when the ndb is created, they are persisted with the ndb and are
+  // loaded automatically when it is opened again.
+  std::vector<std::string> metadata_indexes;
+
+  // The maximum number of query results to cache, 0 disables the cache.
+  // Cached results are invalidated by any update to the ndb.
+  size_t query_cache_size = 0;
+
+  // A query cache to use instead of a cache owned by this ndb. A cache can be
+  // shared by every ndb in a process to bound the total memory used for cached
+  // results. Cannot be combined with query_cache_size.
+  std::shared_ptr<QueryCache> shared_query_cache;
+
+  // Opens an existing ndb without modifying any of its files, so that it can be
+  // served directly from a shared location without being copied first, and by
+  // several processes at once. Updates throw, queries and save are allowed.
+  bool read_only = false;
+
+  // The minimum time between background passes that reclaim the chunks left
+  // behind by deletions. Each pass blocks queries while it runs, so background
+  // compaction is opt in, and with 0 the chunks are only reclaimed by prune.
+  uint64_t compaction_interval_ms = 0;
+
+  // The number of shards to split the documents of a new ndb across, so that
+  // each query is evaluated on the shards in parallel. 0 creates a single
+  // shard, or opens an existing ndb with the shards it was created with,
+  // otherwise it must match the shards of an existing ndb.
+  uint32_t num_shards = 0;
+
+  // The dimension of the embeddings that can be inserted with the chunks of a
+  // new ndb, which are indexed for hybrid queries. 0 creates an ndb without a
+  // vector index, or opens an existing ndb with the dimension it was created
+  // with, otherwise it must match the dimension of an existing ndb.
+  uint32_t embedding_dim = 0;
+
+  // Keeps a ChunkStore of the chunks of a new ndb, so that they can be read
+  // back in order of id with chunkCursor. The store can only be declared when
+  // the ndb is created, an ndb created with it always opens it.
+  bool store_chunks = false;
+
+  // Buffers the feedback of finetune and associate in a durable log in the
+  // ndb directory and returns without updating the model, see FeedbackBuffer.
+  // The buffered feedback is applied in batches by applyPendingFeedback, once
+  // feedback_batch_size pieces of feedback are pending if it is not 0, and in
+  // the background once feedback has been pending for feedback_interval_ms if
+  // it is not 0. Batches cut by size or by applyPendingFeedback are the same
+  // on every replica that makes the same calls, background batches are not.
+  bool buffer_feedback = false;
+  size_t feedback_batch_size = 0;
+  uint64_t feedback_interval_ms = 0;
+};
+
+struct QueryLimits {
+  // Results that score below min_score are not returned. Candidates are
+  // considered in descending order of score, so a constrained query stops
+  // considering candidates once one scores below min_score.
+  float min_score = -std::numeric_limits<float>::infinity();
+
+  // The maximum number of candidates retrieved from the engine for a
+  // constrained query, 0 for no limit. With a limit the candidates are only
+  // filtered, instead of falling back to the engine's rank when they do not
+  // contain top_k matches, so the results may omit matches that score below
+  // the candidates.
+  uint32_t max_candidates = 0;
+
+  // Only returns chunks from the latest version of their document. Chunks of
+  // older versions are skipped as the candidates are considered, and more
+  // candidates are retrieved if they displaced results from the latest
+  // versions, so the results are the top_k results of the latest versions.
+  bool latest_versions_only = false;
+
+  // Whether the limits can change the candidates an evaluation of the query
+  // returns. latest_versions_only only filters the candidates, so it does not
+  // count.
+  bool unlimited() const {
+    return min_score == -std::numeric_limits<float>::infinity() &&
+           max_candidates == 0;
+  }
+};
+
+struct HybridOptions {
+  // The results of a hybrid query are fused with reciprocal rank fusion: each
+  // chunk scores weight / (rrf_k + rank) for its 1 based rank in the lexical
+  // results of the engine and in the results of the vector index. A weight of
+  // 0 skips the retrieval.
+  float lexical_weight = 1.0;
+  float vector_weight = 1.0;
+  uint32_t rrf_k = 60;
+
+  // The number of results retrieved from the engine and from the vector index
+  // to fuse. 0 retrieves max(top_k, DEFAULT_CANDIDATES) results.
+  uint32_t candidates = 0;
+
+  static constexpr uint32_t DEFAULT_CANDIDATES = 50;
+};
+
+struct OpenTimings {
+  // The time spent opening the shards of the engine, which are opened in
+  // parallel, and the platform's indexes, which are opened alongside the
+  // engine when the ndb already exists.
+  double engine_ms = 0;
+  double metadata_index_ms = 0;
+  double vector_index_ms = 0;
+  // The time spent opening the DocCatalog, which includes building it from
+  // the engine's sources for an ndb created before it had one.
+  double doc_catalog_ms = 0;
+  double chunk_store_ms = 0;
+  // The time spent reading the documents staged by insertAsync that were not
+  // indexed when the ndb was closed, which are indexed in the background.
+  double ingest_queue_ms = 0;
+  // The time make took to open the ndb.
+  double total_ms = 0;
+};
+
+/**
+ * The NeuralDB used by the platform. It wraps the OnDiskNeuralDB engine, which
+ * is built separately and linked as a static library, through a
+ * ShardedNeuralDB, and maintains the platform's own state alongside the
+ * engine's files in the ndb directory.
+ *
+ * Concurrency: any number of query, rank, queryBatch, and sources calls may run
+ * concurrently with each other and with a single writer. The methods that
+ * update the ndb (insert, finetune, associate, deleteDocVersion, deleteDoc,
+ * and prune) and save are serialized by an internal mutex, so callers do not
+ * need their own locking. Inserts, finetuning, and associations do not block
+ * readers, but the engine's deletions and prune are not safe to run alongside
+ * its queries, so deleteDocVersion, deleteDoc, and prune wait for in flight
+ * readers and block new ones until they finish. A reader that overlaps an
+ * update may or may not observe it, a reader that starts after an update
+ * returns always observes it. save captures the state after every update that
+ * returned before it, and does not block readers.
+ *
+ * Documents can also be staged with insertAsync, which returns once they are
+ * durably logged and indexes them on a background thread. Every other update
+ * and save first waits for the documents staged before it to be indexed, so
+ * updates are always applied in the order they were made.
+ *
+ * Deletions only mark chunks as deleted, the chunks are reclaimed from the
+ * engine's indexes and storage by prune, or by a Compactor that prunes the ndb
+ * in the background at most once per compaction_interval_ms if it is set.
+ * Like deletions, a pass blocks readers while it runs.
+ *
+ * An ndb created with an embedding_dim also maintains a VectorIndex of the
+ * embeddings inserted with insertBatch or insertAsync, which hybridSearch
+ * combines with the engine's retrieval, and an ndb created with store_chunks
+ * maintains a ChunkStore that chunkCursor reads the chunks from.
+ *
+ * With buffer_feedback, finetune and associate only log their feedback in a
+ * FeedbackBuffer, which is applied to the engine in deduplicated batches.
+ * Feedback that is pending when the ndb is closed is applied after it is
+ * opened again, when the ndb is opened without buffer_feedback, or by the
+ * next batch otherwise.
+ */
+class PlatformNeuralDB final : public NeuralDB {
+public:
+  static std::unique_ptr<PlatformNeuralDB>
+  make(const std::string &save_path, const NeuralDBOptions &options = {});
+
+  InsertMetadata insert(const std::vector<std::string> &chunks,
+                        const std::vector<MetadataMap> &metadata,
+                        const std::string &document, const DocId &doc_id,
+                        std::optional<uint32_t> doc_version) final;
+
+  /**
+   * Inserts the documents while holding the write lock once, and applies the
+   * updates to the platform's own state in a single pass. Returns the result
+   * of each insertion. If an insertion fails, the documents before it remain
+   * inserted and the error is rethrown.
+   */
+  std::vector<InsertMetadata>
+  insertBatch(const std::vector<NewDocument> &documents);
+
+  /**
+   * Stages a batch of documents in the packed encoding of decodeDocumentBatch
+   * to be inserted in the background, and returns the sequence number of the
+   * batch, which can be passed to waitForIndexed. The documents are not
+   * returned by queries until they are indexed.
+   */
+  uint64_t insertAsync(std::string_view batch);
+
+  /**
+   * Waits until the staged batch with the given sequence number, and every
+   * batch staged before it, is indexed. Throws if a staged batch failed to be
+   * inserted since the last failure was reported.
+   */
+  void waitForIndexed(uint64_t seq);
+
+  /**
+   * Waits until every batch staged before the call is indexed, and like
+   * waitForIndexed throws if a staged batch failed to be inserted.
+   */
+  void flush();
+
+  std::vector<std::pair<Chunk, float>> query(const std::string &query,
+                                             uint32_t top_k) final;
+
+  std::vector<std::pair<Chunk, float>> rank(const std::string &query,
+                                            const QueryConstraints &constraints,
+                                            uint32_t top_k) final;
+
+  /**
+   * Same as rank if there are constraints and query otherwise, with the
+   * results limited by limits. Cached results are used if an unlimited query
+   * with the same arguments was cached, but results computed with limits are
+   * not cached.
+   */
+  std::vector<std::pair<Chunk, float>>
+  search(const std::string &query, const QueryConstraints &constraints,
+         uint32_t top_k, const QueryLimits &limits);
+
+  /**
+   * Fuses the results of the engine for the query with the results of the
+   * vector index for the embedding, both restricted to chunks that satisfy
+   * the constraints, and returns the top_k chunks by their fused score. The
+   * lexical retrieval is skipped if the query is empty and the vector
+   * retrieval if the embedding is empty. Throws if the ndb does not have a
+   * vector index. Chunks that were inserted without embeddings can only be
+   * found by the lexical retrieval. Hybrid results are not cached.
+   */
+  std::vector<std::pair<Chunk, float>>
+  hybridSearch(const std::string &query, const std::vector<float> &embedding,
+               const QueryConstraints &constraints, uint32_t top_k,
+               const HybridOptions &options);
+
+  void finetune(const std::vector<std::string> &queries,
+                const std::vector<std::vector<ChunkId>> &chunk_ids) final;
+
+  void associate(const std::vector<std::string> &sources,
+                 const std::vector<std::string> &targets,
+                 uint32_t strength) final;
+
+  /**
+   * Applies every piece of buffered feedback as a single batch, after the
+   * documents staged before the call are indexed. Throws if the batch fails,
+   * in which case its feedback is discarded, or if a background batch failed
+   * since the last failure was reported.
+   */
+  void applyPendingFeedback();
+
+  /**
+   * The number of queries and associations that are buffered, which is 0
+   * unless the ndb was opened with buffer_feedback.
+   */
+  size_t pendingFeedback() const;
+
+  void deleteDocVersion(const DocId &doc_id, uint32_t doc_version) final;
+
+  void deleteDoc(const DocId &doc_id, bool keep_latest_version) final;
+
+  /**
+   * Reclaims the chunks of every deletion before the call, without waiting
+   * for the next background pass.
+   */
+  void prune() final;
+
+  /**
+   * Returns every version of every document, in order of doc id and then
+   * version.
+   */
+  std::vector<Source> sources() final;
+
+  /**
+   * Returns up to limit of the sources returned by sources, starting at
+   * offset.
+   */
+  std::vector<Source> sources(size_t offset, size_t limit) const;
+
+  /**
+   * Returns up to limit of the sources returned by sources that follow
+   * version doc_version of doc_id, see DocCatalog::sourcesAfter.
+   */
+  std::vector<Source> sourcesAfter(const DocId &doc_id, uint32_t doc_version,
+                                   size_t limit) const;
+
+  size_t numSources() const;
+
+  /**
+   * Returns the latest version of the document, or std::nullopt if the ndb
+   * does not contain it.
+   */
+  std::optional<uint32_t> latestVersion(const DocId &doc_id) const;
+
+  /**
+   * Returns a cursor over the chunks of the ndb as of the call, in order of
+   * id. Updates made while the cursor is open are not visible to it and are
+   * not blocked by it. Throws if the ndb was created without store_chunks.
+   * The cursor must not outlive the ndb.
+   */
+  std::unique_ptr<ChunkCursor>
+  chunkCursor(const ChunkCursorOptions &options) const;
+
+  /**
+   * Saves a checkpoint of the ndb to save_path, which must not exist, along
+   * with a CheckpointManifest of the files in the checkpoint.
+   */
+  void save(const std::string &save_path) const;
+
+  /**
+   * Returns the query cache counters, which are all 0 if the cache is disabled.
+   * If the cache is shared the counters are for every ndb sharing it.
+   */
+  QueryCacheStats queryCacheStats() const;
+
+  /**
+   * Returns the compaction counters, which are all 0 if the ndb is read only.
+   */
+  CompactionStats compactionStats() const;
+
+  /**
+   * Returns the latency histograms and counters of the ndb's calls, which are
+   * updated by every call and can be read while calls are in flight.
+   */
+  const std::shared_ptr<NeuralDBStats> &stats() const { return _stats; }
+
+  /**
+   * Returns how long each phase of opening the ndb took.
+   */
+  const OpenTimings &openTimings() const { return _open_timings; }
+
+private:
+  PlatformNeuralDB(const std::string &save_path,
+                   std::unique_ptr<ShardedNeuralDB> ndb,
+                   std::unique_ptr<MetadataIndex> metadata_index,
+                   std::unique_ptr<VectorIndex> vector_index,
+                   std::unique_ptr<DocCatalog> doc_catalog,
+                   std::unique_ptr<ChunkStore> chunk_store,
+                   std::shared_ptr<QueryCache> query_cache,
+                   const NeuralDBOptions &options);
+
+  /**
+   * Throws if the ndb was opened in read only mode.
+   */
+  void checkWritable() const;
+
+  /**
+   * Evaluates a query, recording it and its results in the stats.
+   */
+  template <typename Evaluate>
+  std::vector<std::pair<Chunk, float>> recordQuery(Evaluate &&evaluate);
+
+  /**
+   * Returns the cached results for the key if there are any, otherwise
+   * evaluates the query and caches its results. key is std::nullopt if the
+   * query cannot be cached.
+   */
+  template <typename Evaluate>
+  std::vector<std::pair<Chunk, float>>
+  cachedQuery(const std::optional<std::string> &key, Evaluate &&evaluate);
+
+  /**
+   * Returns the top_k results of fetch(k) that are from the latest version of
+   * their document, calling fetch with larger k until it returns top_k such
+   * results or fewer than k results. fetch(k) must return the first k results
+   * of the query in descending order of score.
+   */
+  template <typename Fetch>
+  std::vector<std::pair<Chunk, float>> latestVersions(uint32_t top_k,
+                                                      Fetch &&fetch);
+
+  /**
+   * Returns the cached results for the key at the epoch, or nullptr on a miss,
+   * and records the lookup in the stats.
+   */
+  std::shared_ptr<const std::vector<std::pair<Chunk, float>>>
+  lookupCache(const std::string &key, uint64_t epoch);
+
+  /**
+   * Calls into the engine, recording the call and the candidates it returns in
+   * the stats.
+   */
+  std::vector<std::pair<Chunk, float>> engineQuery(const std::string &query,
+                                                   uint32_t top_k);
+
+  std::vector<std::pair<Chunk, float>>
+  engineRank(const std::string &query, const QueryConstraints &constraints,
+             uint32_t top_k);
+
+  /**
+   * Inserts the documents without waiting for staged documents, which is how
+   * insertBatch and the ingest queue's background thread insert documents.
+   */
+  std::vector<InsertMetadata>
+  insertDocuments(const std::vector<NewDocument> &documents);
+
+  /**
+   * Applies the pending feedback with the write lock held, which is how
+   * buffered feedback is applied by every caller.
+   */
+  void applyFeedback();
+
+  /**
+   * Prunes the engine, which is how the compactor reclaims deleted chunks.
+   */
+  void compactDeletedChunks();
+
+  /**
+   * Invalidates cached query results, called after every update to the ndb.
+   */
+  void bumpWriteEpoch() { _write_epoch++; }
+
+  std::vector<std::pair<Chunk, float>>
+  queryWithLimits(const std::string &query, uint32_t top_k,
+                  const QueryLimits &limits);
+
+  std::vector<std::pair<Chunk, float>>
+  rankWithLimits(const std::string &query, const QueryConstraints &constraints,
+                 uint32_t top_k, const QueryLimits &limits);
+
+  /**
+   * Answers a constrained query using the metadata indexes. Returns
+   * std::nullopt if the indexes cannot answer the query exactly, in which
+   * case the engine's rank should be used.
+   */
+  std::optional<std::vector<std::pair<Chunk, float>>>
+  rankWithIndex(const std::string &query,
+                const CompiledConstraints &constraints, uint32_t top_k,
+                float min_score);
+
+  /**
+   * Answers a constrained query by filtering at most limits.max_candidates
+   * results of an unconstrained query.
+   */
+  std::vector<std::pair<Chunk, float>>
+  rankWithBudget(const std::string &query,
+                 const CompiledConstraints &constraints, uint32_t top_k,
+                 const QueryLimits &limits);
+
+  /**
+   * Searches the vector index for the chunks that satisfy the constraints,
+   * using the metadata indexes to restrict the search if there are any.
+   */
+  std::vector<std::pair<Chunk, float>>
+  vectorSearch(const std::vector<float> &embedding,
+               const QueryConstraints &constraints, uint32_t top_k);
+
+  std::unique_ptr<ShardedNeuralDB> _ndb;
+
+  bool _read_only;
+
+  bool _buffer_feedback;
+  size_t _feedback_batch_size;
+
+  std::unique_ptr<MetadataIndex> _metadata_index;
+
+  // nullptr if the ndb was created without store_chunks. Declared before the
+  // vector index, which may read its chunks from the store.
+  std::unique_ptr<ChunkStore> _chunk_store;
+
+  // nullptr if the ndb was created without an embedding dimension.
+  std::unique_ptr<VectorIndex> _vector_index;
+
+  std::unique_ptr<DocCatalog> _doc_catalog;
+
+  std::shared_ptr<QueryCache> _query_cache;
+  // Distinguishes the entries of this ndb in a shared query cache.
+  uint64_t _cache_owner;
+  std::atomic<uint64_t> _write_epoch = 0;
+
+  // Shared with the query results returned by the binding, which record the
+  // time spent copying their fields out after the query has returned.
+  std::shared_ptr<NeuralDBStats> _stats;
+
+  OpenTimings _open_timings;
+
+  // Serializes updates and saves, readers do not take this lock.
+  mutable std::mutex _write_mutex;
+
+  // Guarded by _write_mutex.
+  mutable CheckpointManifest::HashCache _checkpoint_hashes;
+
+  // Held shared by readers and exclusively by deletions, which the engine does
+  // not support concurrently with queries. Always acquired after _write_mutex.
+  mutable std::shared_mutex _delete_mutex;
+
+  // Prunes the ndb through this object from its background thread, so it is
+  // destroyed before the state it uses. nullptr if the ndb is read only.
+  std::unique_ptr<Compactor> _compactor;
+
+  // Declared after the state it uses so that it is destroyed first, since its
+  // background thread inserts documents through this object until it is
+  // stopped. nullptr if the ndb is read only.
+  std::unique_ptr<IngestQueue> _ingest_queue;
+
+  // Declared last since its background thread applies feedback through this
+  // object, which drains the ingest queue. nullptr unless the ndb buffers
+  // feedback.
+  std::unique_ptr<FeedbackBuffer> _feedback;
+};
+
+} // namespace thirdai::search::ndb
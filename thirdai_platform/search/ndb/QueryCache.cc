@@ -0,0 +1,100 @@
+#include "QueryCache.h"
+#include "Serialization.h"
+#include <cctype>
+#include <stdexcept>
+
+namespace thirdai::search::ndb {
+
+QueryCache::QueryCache(size_t capacity) : _capacity(capacity) {
+  if (capacity == 0) {
+    throw std::invalid_argument("query cache capacity must be > 0");
+  }
+}
+
+std::optional<std::string>
+QueryCache::key(uint64_t owner, const std::string &query,
+                const CompiledConstraints *constraints, uint32_t top_k) {
+  BinaryWriter key;
+  key.writeVarint(owner);
+  key.writeFixed<uint32_t>(top_k);
+
+  if (constraints) {
+    auto fingerprint = constraints->fingerprint();
+    if (!fingerprint) {
+      return std::nullopt;
+    }
+    key.writeString(*fingerprint);
+  } else {
+    key.writeString("");
+  }
+
+  // Queries are tokenized on whitespace, so queries that only differ in
+  // leading, trailing, or repeated whitespace share an entry.
+  bool started = false;
+  bool pending_space = false;
+  for (char c : query) {
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      pending_space = started;
+      continue;
+    }
+    if (pending_space) {
+      key.buffer().push_back(' ');
+      pending_space = false;
+    }
+    started = true;
+    key.buffer().push_back(c);
+  }
+
+  return std::move(key.buffer());
+}
+
+std::shared_ptr<const QueryCache::Results>
+QueryCache::get(const std::string &key, uint64_t epoch) {
+  std::lock_guard lock(_mutex);
+
+  auto it = _index.find(key);
+  if (it == _index.end()) {
+    _misses++;
+    return nullptr;
+  }
+
+  if (it->second->epoch != epoch) {
+    // The index entry is erased first since its key points into the entry.
+    auto entry = it->second;
+    _index.erase(it);
+    _entries.erase(entry);
+    _misses++;
+    return nullptr;
+  }
+
+  _entries.splice(_entries.begin(), _entries, it->second);
+  _hits++;
+  return it->second->results;
+}
+
+void QueryCache::put(std::string key, uint64_t epoch,
+                     std::shared_ptr<const Results> results) {
+  std::lock_guard lock(_mutex);
+
+  auto existing = _index.find(key);
+  if (existing != _index.end()) {
+    auto entry = existing->second;
+    _index.erase(existing);
+    _entries.erase(entry);
+  }
+
+  _entries.push_front(Entry{std::move(key), epoch, std::move(results)});
+  _index.emplace(_entries.front().key, _entries.begin());
+
+  while (_entries.size() > _capacity) {
+    _index.erase(_entries.back().key);
+    _entries.pop_back();
+  }
+}
+
+QueryCacheStats QueryCache::stats() const {
+  std::lock_guard lock(_mutex);
+  return QueryCacheStats{_hits, _misses, _entries.size()};
+}
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Chunk.h"
+#include "CompiledConstraints.h"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+struct QueryCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  size_t entries = 0;
+};
+
+/**
+ * Bounded LRU cache of query results. Each entry is tagged with the write epoch
+ * of the ndb at the time the query was evaluated, and lookups only return
+ * entries whose epoch matches the current epoch, so any update to the ndb
+ * invalidates every cached result without having to walk the cache. Stale
+ * entries are dropped when they are looked up or evicted.
+ *
+ * A cache can be shared by several ndbs to bound the memory used for caching
+ * across all of them, keys include the id of the ndb that owns the entry.
+ */
+class QueryCache {
+public:
+  using Results = std::vector<std::pair<Chunk, float>>;
+
+  explicit QueryCache(size_t capacity);
+
+  /**
+   * Returns the cache key for the query, or std::nullopt if the query cannot
+   * be cached because its constraints cannot be fingerprinted. owner
+   * identifies the ndb the query is for. constraints may be nullptr for
+   * unconstrained queries.
+   */
+  static std::optional<std::string>
+  key(uint64_t owner, const std::string &query,
+      const CompiledConstraints *constraints, uint32_t top_k);
+
+  std::shared_ptr<const Results> get(const std::string &key, uint64_t epoch);
+
+  void put(std::string key, uint64_t epoch,
+           std::shared_ptr<const Results> results);
+
+  QueryCacheStats stats() const;
+
+private:
+  struct Entry {
+    std::string key;
+    uint64_t epoch;
+    std::shared_ptr<const Results> results;
+  };
+
+  size_t _capacity;
+
+  // Entries from most to least recently used, _index points into the list and
+  // its keys reference the key of the entry they map to.
+  std::list<Entry> _entries;
+  std::unordered_map<std::string_view, std::list<Entry>::iterator> _index;
+
+  uint64_t _hits = 0;
+  uint64_t _misses = 0;
+
+  mutable std::mutex _mutex;
+};
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,427 @@
+#pragma once
+
+#include "Chunk.h"
+#include "Constraints.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+/**
+ * Minimal helpers for the binary files the platform layer persists next to the
+ * engine's own files. Integers are written in the host byte order, which is
+ * little endian on every platform the bindings are built for.
+ */
+class BinaryWriter {
+public:
+  template <typename T> void writeFixed(T value) {
+    _buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  void writeVarint(uint64_t value) {
+    while (value >= 0x80) {
+      _buffer.push_back(char((value & 0x7F) | 0x80));
+      value >>= 7;
+    }
+    _buffer.push_back(char(value));
+  }
+
+  void writeSignedVarint(int64_t value) {
+    // Zigzag encoding so that small negative values are also short.
+    writeVarint((uint64_t(value) << 1) ^ uint64_t(value >> 63));
+  }
+
+  void writeString(std::string_view value) {
+    writeVarint(value.size());
+    _buffer.append(value);
+  }
+
+  void writeMetadataValue(const MetadataValue &value) {
+    writeFixed<uint8_t>(uint8_t(value.type()));
+    switch (value.type()) {
+    case MetadataType::Bool:
+      writeFixed<uint8_t>(value.asBool());
+      break;
+    case MetadataType::Int:
+      writeFixed<int32_t>(value.asInt());
+      break;
+    case MetadataType::Float:
+      writeFixed<float>(value.asFloat());
+      break;
+    case MetadataType::Str:
+      writeString(value.asStr());
+      break;
+    case MetadataType::Nil:
+      break;
+    }
+  }
+
+  const std::string &buffer() const { return _buffer; }
+
+  std::string &buffer() { return _buffer; }
+
+private:
+  std::string _buffer;
+};
+
+class BinaryReader {
+public:
+  explicit BinaryReader(std::string_view data) : _data(data) {}
+
+  template <typename T> T readFixed() {
+    checkRemaining(sizeof(T));
+    T value;
+    std::memcpy(&value, _data.data(), sizeof(T));
+    _data.remove_prefix(sizeof(T));
+    return value;
+  }
+
+  uint64_t readVarint() {
+    uint64_t value = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+      uint8_t byte = readFixed<uint8_t>();
+      value |= uint64_t(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) {
+        return value;
+      }
+    }
+    throw std::runtime_error("invalid varint in serialized data");
+  }
+
+  int64_t readSignedVarint() {
+    uint64_t value = readVarint();
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+  }
+
+  std::string_view readBytes(size_t len) {
+    checkRemaining(len);
+    std::string_view value = _data.substr(0, len);
+    _data.remove_prefix(len);
+    return value;
+  }
+
+  std::string_view readStringView() { return readBytes(readVarint()); }
+
+  std::string readString() { return std::string(readStringView()); }
+
+  MetadataValue readMetadataValue() {
+    auto type = MetadataType(readFixed<uint8_t>());
+    switch (type) {
+    case MetadataType::Bool:
+      return MetadataValue::Bool(readFixed<uint8_t>());
+    case MetadataType::Int:
+      return MetadataValue::Int(readFixed<int32_t>());
+    case MetadataType::Float:
+      return MetadataValue::Float(readFixed<float>());
+    case MetadataType::Str:
+      return MetadataValue::Str(readString());
+    case MetadataType::Nil:
+      return MetadataValue();
+    default:
+      throw std::runtime_error("invalid metadata type in serialized data");
+    }
+  }
+
+  bool done() const { return _data.empty(); }
+
+  size_t remaining() const { return _data.size(); }
+
+private:
+  void checkRemaining(size_t n) const {
+    if (_data.size() < n) {
+      throw std::runtime_error("unexpected end of serialized data");
+    }
+  }
+
+  std::string_view _data;
+};
+
+/**
+ * 64 bit FNV-1a, for hashes that are persisted or must otherwise be the same
+ * in every process, unlike std::hash. Pass FNV_OFFSET as the initial hash.
+ */
+constexpr uint64_t FNV_OFFSET = 14695981039346656037ULL;
+constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+inline uint64_t fnv1a(uint64_t hash, const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= uint8_t(data[i]);
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+inline std::string readFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("unable to open file '" + path + "'");
+  }
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+/**
+ * Writes the file to a temporary path and renames it into place so that a
+ * crash never leaves a partially written file behind.
+ */
+inline void writeFile(const std::string &path, const std::string &data) {
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!file.write(data.data(), data.size()) || !file.flush()) {
+      throw std::runtime_error("unable to write file '" + tmp_path + "'");
+    }
+  }
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("unable to rename '" + tmp_path + "' to '" + path +
+                             "'");
+  }
+}
+
+/**
+ * Reads exactly len bytes at the offset of the file, throwing if the file ends
+ * first.
+ */
+inline void readAt(int fd, char *data, size_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t n = ::pread(fd, data, len, off_t(offset));
+    if (n <= 0) {
+      throw std::runtime_error("unable to read stored chunk");
+    }
+    data += n;
+    len -= n;
+    offset += n;
+  }
+}
+
+/**
+ * A file that stored chunks are appended to and read from by offset, which is
+ * replaced by a new file when its owner rewrites it without deleted chunks.
+ */
+class ChunkFile {
+public:
+  /**
+   * Opens the file, creating it unless read_only is true, and emptying it if
+   * truncate is true.
+   */
+  ChunkFile(std::string path, bool read_only, bool truncate = false)
+      : _path(std::move(path)) {
+    int flags = read_only ? O_RDONLY : O_RDWR | O_CREAT | O_APPEND;
+    if (truncate) {
+      flags |= O_TRUNC;
+    }
+    _fd = ::open(_path.c_str(), flags | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+      throw std::runtime_error("unable to open file '" + _path + "'");
+    }
+    off_t size = ::lseek(_fd, 0, SEEK_END);
+    if (size < 0) {
+      ::close(_fd);
+      throw std::runtime_error("unable to read the size of file '" + _path +
+                               "'");
+    }
+    _size = size;
+  }
+
+  ChunkFile(const ChunkFile &) = delete;
+  ChunkFile &operator=(const ChunkFile &) = delete;
+
+  ~ChunkFile() { ::close(_fd); }
+
+  uint64_t size() const { return _size; }
+
+  void append(const std::string &data) {
+    const char *next = data.data();
+    size_t remaining = data.size();
+    while (remaining > 0) {
+      ssize_t n = ::write(_fd, next, remaining);
+      if (n < 0) {
+        throw std::runtime_error("unable to append to file '" + _path + "'");
+      }
+      next += n;
+      remaining -= n;
+    }
+    _size += data.size();
+  }
+
+  void read(char *data, size_t len, uint64_t offset) const {
+    readAt(_fd, data, len, offset);
+  }
+
+private:
+  std::string _path;
+  int _fd;
+  uint64_t _size;
+};
+
+/**
+ * The encoding of the copies of chunks that the platform stores because the
+ * engine cannot look chunks up by id.
+ */
+inline void encodeChunk(BinaryWriter &out, const std::string &text,
+                        const std::string &document, const DocId &doc_id,
+                        uint32_t doc_version, const MetadataMap &metadata) {
+  out.writeString(text);
+  out.writeString(document);
+  out.writeString(doc_id);
+  out.writeVarint(doc_version);
+  out.writeVarint(metadata.size());
+  for (const auto &[key, value] : metadata) {
+    out.writeString(key);
+    out.writeMetadataValue(value);
+  }
+}
+
+inline Chunk decodeChunk(BinaryReader &in, ChunkId id) {
+  std::string text = in.readString();
+  std::string document = in.readString();
+  DocId doc_id = in.readString();
+  uint32_t doc_version = in.readVarint();
+  MetadataMap metadata;
+  size_t num_entries = in.readVarint();
+  for (size_t i = 0; i < num_entries; i++) {
+    std::string key = in.readString();
+    metadata[key] = in.readMetadataValue();
+  }
+
+  return Chunk(id, std::move(text), std::move(document), std::move(doc_id),
+               doc_version, std::move(metadata));
+}
+
+/**
+ * Appends length prefixed records to a file. Each record is written with a
+ * single write call, and readRecords ignores a truncated trailing record so
+ * that a crash in the middle of an append does not corrupt the log. Owners of
+ * a log are expected to fold it into a snapshot and clear it when they are
+ * opened, so that new records are never appended after a truncated one.
+ *
+ * Records are only flushed to the OS unless sync is true, in which case every
+ * append is also synced to disk before it returns, for logs whose records must
+ * survive the machine crashing and not only the process.
+ */
+class AppendLog {
+public:
+  explicit AppendLog(std::string path, bool sync = false)
+      : _path(std::move(path)), _sync(sync) {
+    _fd = openFile(_path, O_APPEND);
+  }
+
+  AppendLog(const AppendLog &) = delete;
+  AppendLog &operator=(const AppendLog &) = delete;
+
+  ~AppendLog() { ::close(_fd); }
+
+  void append(const std::string &record) {
+    BinaryWriter frame;
+    frame.writeFixed<uint32_t>(record.size());
+    frame.buffer().append(record);
+    if (!writeAll(_fd, frame.buffer()) || !syncIfNeeded(_fd)) {
+      throw std::runtime_error("unable to append to log '" + _path + "'");
+    }
+  }
+
+  /**
+   * Appends the records with a single write call.
+   */
+  void append(const std::vector<std::string> &records) {
+    if (!writeAll(_fd, frames(records)) || !syncIfNeeded(_fd)) {
+      throw std::runtime_error("unable to append to log '" + _path + "'");
+    }
+  }
+
+  void clear() {
+    if (::ftruncate(_fd, 0) != 0 || !syncIfNeeded(_fd)) {
+      throw std::runtime_error("unable to truncate log '" + _path + "'");
+    }
+  }
+
+  /**
+   * Replaces the contents of the log with the records. The records are written
+   * to a temporary file that is renamed over the log, so that a crash leaves
+   * either the old or the new records and never an empty log.
+   */
+  void rewrite(const std::vector<std::string> &records) {
+    std::string tmp_path = _path + ".tmp";
+    int tmp_fd = openFile(tmp_path, O_TRUNC);
+    bool written = writeAll(tmp_fd, frames(records)) && syncIfNeeded(tmp_fd);
+    ::close(tmp_fd);
+    if (!written) {
+      throw std::runtime_error("unable to write file '" + tmp_path + "'");
+    }
+    if (std::rename(tmp_path.c_str(), _path.c_str()) != 0) {
+      throw std::runtime_error("unable to rename '" + tmp_path + "' to '" +
+                               _path + "'");
+    }
+
+    ::close(_fd);
+    _fd = openFile(_path, O_APPEND);
+  }
+
+  template <typename F>
+  static void readRecords(const std::string &path, F &&callback) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      return;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+
+    BinaryReader reader(data);
+    while (reader.remaining() >= sizeof(uint32_t)) {
+      uint32_t len = reader.readFixed<uint32_t>();
+      if (reader.remaining() < len) {
+        break;
+      }
+      callback(BinaryReader(reader.readBytes(len)));
+    }
+  }
+
+private:
+  static int openFile(const std::string &path, int flags) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("unable to open log '" + path + "'");
+    }
+    return fd;
+  }
+
+  static std::string frames(const std::vector<std::string> &records) {
+    BinaryWriter frames;
+    for (const auto &record : records) {
+      frames.writeFixed<uint32_t>(record.size());
+      frames.buffer().append(record);
+    }
+    return std::move(frames.buffer());
+  }
+
+  static bool writeAll(int fd, const std::string &data) {
+    const char *next = data.data();
+    size_t remaining = data.size();
+    while (remaining > 0) {
+      ssize_t n = ::write(fd, next, remaining);
+      if (n < 0) {
+        return false;
+      }
+      next += n;
+      remaining -= n;
+    }
+    return true;
+  }
+
+  bool syncIfNeeded(int fd) const { return !_sync || ::fsync(fd) == 0; }
+
+  std::string _path;
+  bool _sync;
+  int _fd;
+};
+
+} // namespace thirdai::search::ndb
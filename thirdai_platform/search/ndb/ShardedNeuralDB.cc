@@ -0,0 +1,384 @@
+#include "ShardedNeuralDB.h"
+#include "Serialization.h"
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+constexpr uint32_t CONFIG_VERSION = 1;
+
+constexpr ChunkId LOCAL_ID_MASK =
+    (ChunkId(1) << ShardedNeuralDB::LOCAL_ID_BITS) - 1;
+
+ChunkId globalId(uint32_t shard, ChunkId local_id) {
+  if (local_id > LOCAL_ID_MASK) {
+    throw std::runtime_error("chunk id " + std::to_string(local_id) +
+                             " exceeds the ids supported by a shard");
+  }
+  return (ChunkId(shard) << ShardedNeuralDB::LOCAL_ID_BITS) | local_id;
+}
+
+// Opens the shards on a thread each, since opening a shard is dominated by
+// loading its files and the shards do not share any state.
+std::vector<std::shared_ptr<OnDiskNeuralDB>> openShards(
+    uint32_t n_shards,
+    const std::function<std::shared_ptr<OnDiskNeuralDB>(uint32_t)> &open) {
+  std::vector<std::shared_ptr<OnDiskNeuralDB>> shards(n_shards);
+  if (n_shards == 1) {
+    shards[0] = open(0);
+    return shards;
+  }
+
+  std::vector<std::exception_ptr> errors(n_shards);
+  std::vector<std::thread> threads;
+  threads.reserve(n_shards);
+  for (uint32_t i = 0; i < n_shards; i++) {
+    threads.emplace_back([&, i]() {
+      try {
+        shards[i] = open(i);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (const auto &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  return shards;
+}
+
+} // namespace
+
+ShardedNeuralDB::ShardedNeuralDB(
+    std::vector<std::shared_ptr<OnDiskNeuralDB>> shards)
+    : _shards(std::move(shards)) {}
+
+bool ShardedNeuralDB::exists(const std::string &save_path) {
+  return existingShards(save_path).has_value();
+}
+
+std::unique_ptr<ShardedNeuralDB>
+ShardedNeuralDB::make(const std::string &save_path,
+                      std::optional<uint32_t> num_shards) {
+  if (num_shards && (*num_shards == 0 || *num_shards > MAX_SHARDS)) {
+    throw std::invalid_argument("number of shards must be between 1 and " +
+                                std::to_string(MAX_SHARDS));
+  }
+
+  auto existing = existingShards(save_path);
+  if (existing && num_shards && *existing != *num_shards) {
+    throw std::invalid_argument(
+        "cannot open ndb with " + std::to_string(*num_shards) +
+        " shards, it was created with " + std::to_string(*existing));
+  }
+  uint32_t n_shards = existing ? *existing : num_shards.value_or(1);
+
+  if (!existing && n_shards > 1) {
+    // The config is written before the shards are created so that a partially
+    // created ndb is completed rather than replaced when it is opened again.
+    writeConfig(save_path, n_shards);
+  }
+
+  auto shards = openShards(n_shards, [&](uint32_t i) {
+    return OnDiskNeuralDB::make(shardPath(save_path, i, n_shards));
+  });
+
+  return std::unique_ptr<ShardedNeuralDB>(
+      new ShardedNeuralDB(std::move(shards)));
+}
+
+std::unique_ptr<ShardedNeuralDB>
+ShardedNeuralDB::load(const std::string &save_path, bool read_only) {
+  auto n_shards = existingShards(save_path);
+  if (!n_shards) {
+    throw std::invalid_argument("cannot load '" + save_path +
+                                "', it is not an ndb");
+  }
+
+  auto shards = openShards(*n_shards, [&](uint32_t i) {
+    return OnDiskNeuralDB::load(shardPath(save_path, i, *n_shards), read_only);
+  });
+
+  return std::unique_ptr<ShardedNeuralDB>(
+      new ShardedNeuralDB(std::move(shards)));
+}
+
+std::optional<uint32_t>
+ShardedNeuralDB::existingShards(const std::string &save_path) {
+  std::filesystem::path root(save_path);
+
+  auto config_path = root / CONFIG_FILENAME;
+  if (std::filesystem::exists(config_path)) {
+    std::string data = readFile(config_path.string());
+    BinaryReader reader(data);
+    uint32_t version = reader.readFixed<uint32_t>();
+    if (version != CONFIG_VERSION) {
+      throw std::runtime_error("unsupported shard config version " +
+                               std::to_string(version));
+    }
+    uint64_t n_shards = reader.readVarint();
+    if (n_shards == 0 || n_shards > MAX_SHARDS || !reader.done()) {
+      throw std::runtime_error("invalid shard config in '" + save_path + "'");
+    }
+    return n_shards;
+  }
+
+  if (std::filesystem::exists(root / "model")) {
+    return 1;
+  }
+
+  return std::nullopt;
+}
+
+void ShardedNeuralDB::writeConfig(const std::string &save_path,
+                                  uint32_t num_shards) {
+  std::filesystem::create_directories(save_path);
+
+  BinaryWriter config;
+  config.writeFixed<uint32_t>(CONFIG_VERSION);
+  config.writeVarint(num_shards);
+  writeFile((std::filesystem::path(save_path) / CONFIG_FILENAME).string(),
+            config.buffer());
+}
+
+std::string ShardedNeuralDB::shardPath(const std::string &save_path,
+                                       uint32_t shard, uint32_t num_shards) {
+  if (num_shards == 1) {
+    return save_path;
+  }
+  return (std::filesystem::path(save_path) / ("shard_" + std::to_string(shard)))
+      .string();
+}
+
+uint32_t ShardedNeuralDB::shardOf(const DocId &doc_id) const {
+  return fnv1a(FNV_OFFSET, doc_id.data(), doc_id.size()) % _shards.size();
+}
+
+InsertMetadata ShardedNeuralDB::insert(const std::vector<std::string> &chunks,
+                                       const std::vector<MetadataMap> &metadata,
+                                       const std::string &document,
+                                       const DocId &doc_id,
+                                       std::optional<uint32_t> doc_version) {
+  uint32_t shard = shardOf(doc_id);
+
+  auto inserted =
+      _shards[shard]->insert(chunks, metadata, document, doc_id, doc_version);
+
+  return InsertMetadata(std::move(inserted.doc_id), inserted.doc_version,
+                        globalId(shard, inserted.start_id),
+                        globalId(shard, inserted.end_id));
+}
+
+std::vector<std::pair<Chunk, float>>
+ShardedNeuralDB::query(const std::string &query, uint32_t top_k) {
+  return scatterGather(
+      [&](OnDiskNeuralDB &shard) { return shard.query(query, top_k); }, top_k);
+}
+
+std::vector<std::pair<Chunk, float>>
+ShardedNeuralDB::rank(const std::string &query,
+                      const QueryConstraints &constraints, uint32_t top_k) {
+  return scatterGather(
+      [&](OnDiskNeuralDB &shard) {
+        return shard.rank(query, constraints, top_k);
+      },
+      top_k);
+}
+
+template <typename Evaluate>
+std::vector<std::pair<Chunk, float>>
+ShardedNeuralDB::scatterGather(Evaluate &&evaluate, uint32_t top_k) {
+  if (_shards.size() == 1) {
+    return evaluate(*_shards.front());
+  }
+
+  std::vector<std::vector<std::pair<Chunk, float>>> shard_results(
+      _shards.size());
+
+  std::exception_ptr error;
+
+#pragma omp parallel for default(none)                                         \
+    shared(evaluate, shard_results, error) schedule(static)
+  for (size_t i = 0; i < _shards.size(); i++) {
+    try {
+      shard_results[i] = evaluate(*_shards[i]);
+      for (auto &result : shard_results[i]) {
+        result.first.id = globalId(i, result.first.id);
+      }
+    } catch (...) {
+#pragma omp critical
+      error = std::current_exception();
+    }
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  // Each shard's results are sorted, so the top results overall are found by
+  // repeatedly taking the best remaining result of any shard. Ties are broken
+  // by shard so that results are deterministic.
+  struct Head {
+    float score;
+    uint32_t shard;
+    size_t pos;
+
+    bool operator<(const Head &other) const {
+      if (score != other.score) {
+        return score < other.score;
+      }
+      return shard > other.shard;
+    }
+  };
+
+  std::priority_queue<Head> heads;
+  for (uint32_t i = 0; i < shard_results.size(); i++) {
+    if (!shard_results[i].empty()) {
+      heads.push({shard_results[i].front().second, i, 0});
+    }
+  }
+
+  std::vector<std::pair<Chunk, float>> results;
+  results.reserve(top_k);
+  while (results.size() < top_k && !heads.empty()) {
+    Head head = heads.top();
+    heads.pop();
+
+    auto &shard = shard_results[head.shard];
+    results.push_back(std::move(shard[head.pos]));
+    if (head.pos + 1 < shard.size()) {
+      heads.push({shard[head.pos + 1].second, head.shard, head.pos + 1});
+    }
+  }
+
+  return results;
+}
+
+void ShardedNeuralDB::finetune(
+    const std::vector<std::string> &queries,
+    const std::vector<std::vector<ChunkId>> &chunk_ids) {
+  if (queries.size() != chunk_ids.size()) {
+    throw std::invalid_argument(
+        "number of queries must match the number of label lists");
+  }
+
+  struct ShardFeedback {
+    std::vector<std::string> queries;
+    std::vector<std::vector<ChunkId>> chunk_ids;
+  };
+
+  // A query whose labels are in several shards is finetuned in each of them
+  // with the labels in that shard.
+  std::vector<ShardFeedback> feedback(_shards.size());
+  for (size_t i = 0; i < queries.size(); i++) {
+    std::unordered_map<uint32_t, std::vector<ChunkId>> labels;
+    for (ChunkId id : chunk_ids[i]) {
+      ChunkId shard = id >> LOCAL_ID_BITS;
+      if (shard >= _shards.size()) {
+        throw std::invalid_argument("invalid chunk id " + std::to_string(id));
+      }
+      labels[shard].push_back(id & LOCAL_ID_MASK);
+    }
+
+    for (auto &[shard, local_ids] : labels) {
+      feedback[shard].queries.push_back(queries[i]);
+      feedback[shard].chunk_ids.push_back(std::move(local_ids));
+    }
+  }
+
+  updateShards([&](size_t i) {
+    if (!feedback[i].queries.empty()) {
+      _shards[i]->finetune(feedback[i].queries, feedback[i].chunk_ids);
+    }
+  });
+}
+
+void ShardedNeuralDB::associate(const std::vector<std::string> &sources,
+                                const std::vector<std::string> &targets,
+                                uint32_t strength) {
+  updateShards([&](size_t i) {
+    _shards[i]->associate(sources, targets, strength);
+  });
+}
+
+template <typename Update>
+void ShardedNeuralDB::updateShards(Update &&update) {
+  if (_shards.size() == 1) {
+    update(0);
+    return;
+  }
+
+  std::exception_ptr error;
+
+#pragma omp parallel for default(none) shared(update, error) schedule(static)
+  for (size_t i = 0; i < _shards.size(); i++) {
+    try {
+      update(i);
+    } catch (...) {
+#pragma omp critical
+      error = std::current_exception();
+    }
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void ShardedNeuralDB::deleteDocVersion(const DocId &doc_id,
+                                       uint32_t doc_version) {
+  _shards[shardOf(doc_id)]->deleteDocVersion(doc_id, doc_version);
+}
+
+void ShardedNeuralDB::deleteDoc(const DocId &doc_id, bool keep_latest_version) {
+  _shards[shardOf(doc_id)]->deleteDoc(doc_id, keep_latest_version);
+}
+
+void ShardedNeuralDB::prune() {
+  for (auto &shard : _shards) {
+    shard->prune();
+  }
+}
+
+std::vector<Source> ShardedNeuralDB::sources() {
+  if (_shards.size() == 1) {
+    return _shards.front()->sources();
+  }
+
+  std::vector<Source> sources;
+  for (auto &shard : _shards) {
+    auto shard_sources = shard->sources();
+    sources.insert(sources.end(), std::make_move_iterator(shard_sources.begin()),
+                   std::make_move_iterator(shard_sources.end()));
+  }
+  return sources;
+}
+
+void ShardedNeuralDB::save(const std::string &save_path) const {
+  uint32_t n_shards = _shards.size();
+
+  if (n_shards > 1) {
+    writeConfig(save_path, n_shards);
+  }
+
+  for (uint32_t i = 0; i < n_shards; i++) {
+    _shards[i]->save(shardPath(save_path, i, n_shards));
+  }
+}
+
+} // namespace thirdai::search::ndb
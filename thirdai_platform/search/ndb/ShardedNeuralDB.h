@@ -0,0 +1,143 @@
+#pragma once
+
+#include "Chunk.h"
+#include "Constraints.h"
+#include "NeuralDB.h"
+#include "OnDiskNeuralDB.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+/**
+ * Splits the documents of an ndb across several OnDiskNeuralDB shards, so that
+ * each shard indexes a fraction of the chunks and queries are evaluated on
+ * every shard in parallel. Documents are assigned to shards by a hash of their
+ * doc id, so that every version of a document is in the same shard and updates
+ * to a document only touch its shard.
+ *
+ * A single shard is stored directly in the ndb directory, so that an ndb
+ * created by the engine without sharding can be opened as a single shard.
+ * Multiple shards are stored in subdirectories of the ndb directory along with
+ * a CONFIG_FILENAME file that records the number of shards.
+ *
+ * Chunk ids are the id assigned by the shard, with the shard number stored in
+ * the bits above LOCAL_ID_BITS, so the ids of a single insert are contiguous
+ * and the ids of an ndb with one shard are the ids assigned by the engine.
+ *
+ * The engine scores the chunks of each shard using the statistics of that
+ * shard, so the scores of chunks in different shards are only comparable if
+ * the documents are spread evenly enough that the shards have similar
+ * statistics, which is the case for large corpora.
+ */
+class ShardedNeuralDB final : public NeuralDB {
+public:
+  static constexpr const char *CONFIG_FILENAME = "shards";
+
+  // Chunk ids stay below 2^53 for every shard, so that they are exactly
+  // representable as doubles, such as numbers in JSON.
+  static constexpr uint32_t LOCAL_ID_BITS = 40;
+  static constexpr uint32_t MAX_SHARDS = 1 << 13;
+
+  /**
+   * Returns whether save_path contains an ndb, sharded or not.
+   */
+  static bool exists(const std::string &save_path);
+
+  /**
+   * Opens the ndb in save_path, creating it with num_shards shards if it does
+   * not exist. If num_shards is std::nullopt a new ndb has a single shard, and
+   * otherwise it must match the number of shards of an existing ndb. The
+   * shards are opened in parallel.
+   */
+  static std::unique_ptr<ShardedNeuralDB>
+  make(const std::string &save_path, std::optional<uint32_t> num_shards);
+
+  /**
+   * Opens an existing ndb, with every shard in read only mode if read_only is
+   * true. The shards are opened in parallel.
+   */
+  static std::unique_ptr<ShardedNeuralDB> load(const std::string &save_path,
+                                               bool read_only);
+
+  InsertMetadata insert(const std::vector<std::string> &chunks,
+                        const std::vector<MetadataMap> &metadata,
+                        const std::string &document, const DocId &doc_id,
+                        std::optional<uint32_t> doc_version) final;
+
+  std::vector<std::pair<Chunk, float>> query(const std::string &query,
+                                             uint32_t top_k) final;
+
+  std::vector<std::pair<Chunk, float>> rank(const std::string &query,
+                                            const QueryConstraints &constraints,
+                                            uint32_t top_k) final;
+
+  /**
+   * Each query is applied to the shards that hold its chunks, and the shards
+   * are updated in parallel.
+   */
+  void finetune(const std::vector<std::string> &queries,
+                const std::vector<std::vector<ChunkId>> &chunk_ids) final;
+
+  /**
+   * Associations are between query terms rather than chunks, so they are
+   * applied to every shard. Like finetune, the shards are updated in
+   * parallel.
+   */
+  void associate(const std::vector<std::string> &sources,
+                 const std::vector<std::string> &targets,
+                 uint32_t strength) final;
+
+  void deleteDocVersion(const DocId &doc_id, uint32_t doc_version) final;
+
+  void deleteDoc(const DocId &doc_id, bool keep_latest_version) final;
+
+  void prune() final;
+
+  std::vector<Source> sources() final;
+
+  /**
+   * Saves a checkpoint of every shard to save_path, which must not exist.
+   */
+  void save(const std::string &save_path) const;
+
+  uint32_t numShards() const { return _shards.size(); }
+
+private:
+  explicit ShardedNeuralDB(std::vector<std::shared_ptr<OnDiskNeuralDB>> shards);
+
+  /**
+   * Returns the number of shards of the ndb in save_path, or std::nullopt if
+   * it does not exist.
+   */
+  static std::optional<uint32_t> existingShards(const std::string &save_path);
+
+  static void writeConfig(const std::string &save_path, uint32_t num_shards);
+
+  static std::string shardPath(const std::string &save_path, uint32_t shard,
+                               uint32_t num_shards);
+
+  uint32_t shardOf(const DocId &doc_id) const;
+
+  /**
+   * Evaluates the query on every shard in parallel by calling
+   * evaluate(shard), and merges the results of the shards, which are each
+   * sorted by descending score, into the top_k results overall.
+   */
+  template <typename Evaluate>
+  std::vector<std::pair<Chunk, float>> scatterGather(Evaluate &&evaluate,
+                                                     uint32_t top_k);
+
+  /**
+   * Calls update(i) for every shard i in parallel, like scatterGather does
+   * for queries, and rethrows an error if any of the calls fail.
+   */
+  template <typename Update> void updateShards(Update &&update);
+
+  std::vector<std::shared_ptr<OnDiskNeuralDB>> _shards;
+};
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,872 @@
+#include "VectorIndex.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace thirdai::search::ndb {
+
+namespace {
+
+// Version 1 snapshots are of indexes that always have a chunks file.
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+
+// The maximum number of links of a node in the layers above the bottom layer,
+// and in the bottom layer, where every node is.
+constexpr uint32_t MAX_LINKS = 16;
+constexpr uint32_t MAX_BOTTOM_LINKS = 2 * MAX_LINKS;
+constexpr uint32_t MAX_LAYER = 16;
+
+// The number of candidates considered when a node is added to the graph, and
+// the minimum number of candidates considered by a search.
+constexpr uint32_t EF_CONSTRUCTION = 100;
+constexpr uint32_t EF_SEARCH = 64;
+
+// Searches that are restricted to at most this many allowed chunks score each
+// of them instead of searching the graph, which is exact and is faster than a
+// graph search that has to pass through many chunks that are not allowed.
+constexpr size_t EXACT_SEARCH_LIMIT = 4096;
+
+constexpr uint64_t RNG_SEED = 0x9e3779b97f4a7c15ULL;
+
+enum class LogOp : uint8_t { Insert, DeleteDocVersion, DeleteDoc };
+
+std::string snapshotPath(const std::string &save_path) {
+  return (std::filesystem::path(save_path) / "vector_index").string();
+}
+
+std::string logPath(const std::string &save_path) {
+  return (std::filesystem::path(save_path) / "vector_index.log").string();
+}
+
+std::string chunksPath(const std::string &save_path, uint64_t generation) {
+  return (std::filesystem::path(save_path) /
+          ("vector_index.chunks." + std::to_string(generation)))
+      .string();
+}
+
+// Compiled for several instruction sets on x86, where the best version for the
+// cpu is chosen when the library is loaded. Elsewhere the loop is vectorized
+// for the baseline instruction set, which includes NEON on arm64.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+int32_t dotProduct(const int8_t *a, const int8_t *b, uint32_t dim) {
+  int32_t sum = 0;
+  for (uint32_t i = 0; i < dim; i++) {
+    sum += int32_t(a[i]) * int32_t(b[i]);
+  }
+  return sum;
+}
+
+/**
+ * Tracks the nodes visited by a search without clearing a set per search,
+ * each thread reuses its own set and starts a search by advancing its epoch.
+ */
+class VisitedSet {
+public:
+  static VisitedSet &forThread(size_t num_nodes) {
+    thread_local VisitedSet set;
+    set.reset(num_nodes);
+    return set;
+  }
+
+  // Returns false if the node was already visited.
+  bool visit(uint32_t node) {
+    if (_epochs[node] == _epoch) {
+      return false;
+    }
+    _epochs[node] = _epoch;
+    return true;
+  }
+
+private:
+  void reset(size_t num_nodes) {
+    if (_epochs.size() < num_nodes) {
+      _epochs.resize(num_nodes, 0);
+    }
+    if (++_epoch == 0) {
+      std::fill(_epochs.begin(), _epochs.end(), 0);
+      _epoch = 1;
+    }
+  }
+
+  std::vector<uint32_t> _epochs;
+  uint32_t _epoch = 0;
+};
+
+} // namespace
+
+VectorIndex::VectorIndex(uint32_t dim) : _dim(dim), _rng(RNG_SEED) {
+  if (dim == 0 || dim > MAX_DIM) {
+    throw std::invalid_argument("embedding dimension must be between 1 and " +
+                                std::to_string(MAX_DIM));
+  }
+}
+
+VectorIndex::~VectorIndex() = default;
+
+std::unique_ptr<VectorIndex>
+VectorIndex::make(const std::string &save_path, uint32_t dim,
+                  const ChunkStore *chunk_store) {
+  std::unique_ptr<VectorIndex> index(new VectorIndex(dim));
+
+  index->_save_path = save_path;
+  index->_reads_chunk_store = chunk_store != nullptr;
+  index->_chunk_store = chunk_store;
+  index->openChunks(/*read_only=*/false, /*truncate=*/true);
+  writeFile(snapshotPath(save_path), index->serialize());
+  index->_log = std::make_unique<AppendLog>(logPath(save_path));
+  index->_log->clear();
+
+  return index;
+}
+
+std::unique_ptr<VectorIndex>
+VectorIndex::open(const std::string &save_path, bool read_only,
+                  const ChunkStore *chunk_store) {
+  if (!exists(save_path)) {
+    return nullptr;
+  }
+
+  auto index = deserialize(readFile(snapshotPath(save_path)));
+  if (index->_reads_chunk_store) {
+    if (!chunk_store) {
+      throw std::runtime_error(
+          "vector index reads its chunks from a chunk store that is missing");
+    }
+    index->_chunk_store = chunk_store;
+  }
+
+  AppendLog::readRecords(logPath(save_path), [&index](BinaryReader record) {
+    index->applyLogRecord(record);
+  });
+
+  index->_save_path = save_path;
+  index->openChunks(read_only);
+  if (read_only) {
+    return index;
+  }
+
+  uint64_t generation = index->_generation;
+  if (index->_num_deleted > index->numVectors()) {
+    index->rebuild();
+  }
+  writeFile(snapshotPath(save_path), index->serialize());
+  index->_log = std::make_unique<AppendLog>(logPath(save_path));
+  index->_log->clear();
+  if (index->_generation != generation) {
+    std::filesystem::remove(chunksPath(save_path, generation));
+  }
+
+  return index;
+}
+
+bool VectorIndex::exists(const std::string &save_path) {
+  return std::filesystem::exists(snapshotPath(save_path));
+}
+
+void VectorIndex::checkEmbedding(const std::vector<float> &embedding) const {
+  if (embedding.size() != _dim) {
+    throw std::invalid_argument("expected an embedding of dimension " +
+                                std::to_string(_dim) + ", got dimension " +
+                                std::to_string(embedding.size()));
+  }
+}
+
+void VectorIndex::checkEmbeddings(const NewDocument &document) const {
+  if (document.embeddings.empty()) {
+    return;
+  }
+  if (document.embeddings.size() != document.chunks.size()) {
+    throw std::invalid_argument(
+        "number of embeddings does not match the number of chunks");
+  }
+  for (const auto &embedding : document.embeddings) {
+    checkEmbedding(embedding);
+    quantize(embedding.data());
+  }
+}
+
+VectorIndex::Quantized VectorIndex::quantize(const float *embedding) const {
+  double norm = 0;
+  for (uint32_t i = 0; i < _dim; i++) {
+    norm += double(embedding[i]) * embedding[i];
+  }
+  norm = std::sqrt(norm);
+  if (!std::isfinite(norm) || norm == 0) {
+    throw std::invalid_argument("embeddings must be finite and nonzero");
+  }
+
+  float max_abs = 0;
+  for (uint32_t i = 0; i < _dim; i++) {
+    max_abs = std::max(max_abs, float(std::abs(embedding[i] / norm)));
+  }
+
+  Quantized vector;
+  vector.scale = max_abs / 127;
+  vector.codes.resize(_dim);
+  for (uint32_t i = 0; i < _dim; i++) {
+    vector.codes[i] = int8_t(std::lround(embedding[i] / norm / vector.scale));
+  }
+  return vector;
+}
+
+float VectorIndex::similarity(const int8_t *codes, float scale,
+                              uint32_t node) const {
+  return float(dotProduct(codes, this->codes(node), _dim)) * scale *
+         _nodes[node].scale;
+}
+
+uint32_t VectorIndex::randomLevel() {
+  // Each layer has 1 / MAX_LINKS of the nodes of the layer below it.
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  double level = -std::log(1.0 - uniform(_rng)) / std::log(double(MAX_LINKS));
+  return std::min<uint32_t>(uint32_t(level), MAX_LAYER);
+}
+
+void VectorIndex::insertBatch(const std::vector<InsertMetadata> &inserted,
+                              const std::vector<NewDocument> &documents) {
+  struct Pending {
+    ChunkId id;
+    Quantized vector;
+    uint64_t offset;
+    uint32_t len;
+  };
+
+  // The chunks are encoded and quantized before the lock is taken, with
+  // offsets relative to the start of the batch.
+  std::vector<Pending> pending;
+  BinaryWriter chunks;
+  for (size_t i = 0; i < inserted.size(); i++) {
+    const auto &document = documents.at(i);
+    for (size_t j = 0; j < document.embeddings.size(); j++) {
+      if (_reads_chunk_store) {
+        pending.push_back({inserted[i].start_id + j,
+                           quantize(document.embeddings[j].data()), 0, 0});
+        continue;
+      }
+      uint64_t offset = chunks.buffer().size();
+      encodeChunk(chunks, document.chunks[j], document.document,
+                  inserted[i].doc_id, inserted[i].doc_version,
+                  document.metadata[j]);
+      pending.push_back({inserted[i].start_id + j,
+                         quantize(document.embeddings[j].data()), offset,
+                         uint32_t(chunks.buffer().size() - offset)});
+    }
+  }
+  if (pending.empty()) {
+    return;
+  }
+
+  std::unique_lock lock(_mutex);
+
+  uint64_t base = _chunks ? _chunks->size() : 0;
+  std::vector<std::string> records;
+  size_t next = 0;
+  for (size_t i = 0; i < inserted.size(); i++) {
+    size_t count = documents[i].embeddings.size();
+    if (count == 0) {
+      continue;
+    }
+
+    BinaryWriter record;
+    record.writeFixed<uint8_t>(uint8_t(LogOp::Insert));
+    record.writeString(inserted[i].doc_id);
+    record.writeVarint(inserted[i].doc_version);
+    record.writeVarint(inserted[i].start_id);
+    record.writeVarint(count);
+    for (size_t j = 0; j < count; j++) {
+      auto &chunk = pending[next + j];
+      chunk.offset += base;
+      record.writeFixed<float>(chunk.vector.scale);
+      record.buffer().append(
+          reinterpret_cast<const char *>(chunk.vector.codes.data()), _dim);
+      record.writeVarint(chunk.offset);
+      record.writeVarint(chunk.len);
+    }
+    next += count;
+    records.push_back(std::move(record.buffer()));
+  }
+
+  // The chunks are written before the log records that refer to them, so a
+  // crash in between only leaves unreferenced bytes in the chunks file.
+  if (_chunks) {
+    _chunks->append(chunks.buffer());
+  }
+  _log->append(records);
+
+  next = 0;
+  for (size_t i = 0; i < inserted.size(); i++) {
+    size_t count = documents[i].embeddings.size();
+    if (count == 0) {
+      continue;
+    }
+    for (size_t j = 0; j < count; j++) {
+      const auto &chunk = pending[next + j];
+      addNode(chunk.id, chunk.vector, chunk.offset, chunk.len);
+    }
+    next += count;
+    _docs[inserted[i].doc_id][inserted[i].doc_version] = {
+        inserted[i].start_id, inserted[i].start_id + count};
+  }
+}
+
+void VectorIndex::addNode(ChunkId id, const Quantized &vector, uint64_t offset,
+                          uint32_t len) {
+  uint32_t node = _nodes.size();
+  uint32_t level = randomLevel();
+  _nodes.push_back(Node{id, vector.scale, offset, len, false,
+                        std::vector<std::vector<uint32_t>>(level + 1)});
+  _codes.insert(_codes.end(), vector.codes.begin(), vector.codes.end());
+  _node_ids[id] = node;
+
+  if (node == 0) {
+    _entry_point = node;
+    _max_layer = level;
+    return;
+  }
+
+  const int8_t *node_codes = codes(node);
+  float scale = vector.scale;
+
+  std::vector<uint32_t> entry_points{
+      descend(node_codes, scale, std::min(level, _max_layer))};
+  for (uint32_t layer = std::min(level, _max_layer) + 1; layer-- > 0;) {
+    auto candidates =
+        searchLayer(node_codes, scale, entry_points, EF_CONSTRUCTION, layer,
+                    [](uint32_t) { return true; });
+
+    auto neighbors = selectNeighbors(candidates, MAX_LINKS);
+    uint32_t max_links = layer == 0 ? MAX_BOTTOM_LINKS : MAX_LINKS;
+    for (uint32_t neighbor : neighbors) {
+      auto &links = _nodes[neighbor].links[layer];
+      links.push_back(node);
+      if (links.size() > max_links) {
+        pruneLinks(neighbor, layer);
+      }
+    }
+    _nodes[node].links[layer] = std::move(neighbors);
+
+    entry_points.clear();
+    for (const auto &candidate : candidates) {
+      entry_points.push_back(candidate.node);
+    }
+  }
+
+  if (level > _max_layer) {
+    _max_layer = level;
+    _entry_point = node;
+  }
+}
+
+uint32_t VectorIndex::descend(const int8_t *codes, float scale,
+                              uint32_t layer) const {
+  uint32_t current = _entry_point;
+  float best = similarity(codes, scale, current);
+  for (uint32_t l = _max_layer; l > layer; l--) {
+    bool improved = true;
+    while (improved) {
+      improved = false;
+      for (uint32_t neighbor : _nodes[current].links[l]) {
+        float sim = similarity(codes, scale, neighbor);
+        if (sim > best) {
+          best = sim;
+          current = neighbor;
+          improved = true;
+        }
+      }
+    }
+  }
+  return current;
+}
+
+template <typename Accept>
+std::vector<VectorIndex::Candidate>
+VectorIndex::searchLayer(const int8_t *codes, float scale,
+                         const std::vector<uint32_t> &entry_points, uint32_t ef,
+                         uint32_t layer, Accept &&accept) const {
+  auto less = [](const Candidate &a, const Candidate &b) {
+    return a.similarity < b.similarity;
+  };
+  auto greater = [](const Candidate &a, const Candidate &b) {
+    return a.similarity > b.similarity;
+  };
+
+  // The most similar unexpanded node is at the top of to_visit, and the least
+  // similar accepted result is at the top of results.
+  std::priority_queue<Candidate, std::vector<Candidate>, decltype(less)>
+      to_visit(less);
+  std::priority_queue<Candidate, std::vector<Candidate>, decltype(greater)>
+      results(greater);
+
+  auto &visited = VisitedSet::forThread(_nodes.size());
+  for (uint32_t node : entry_points) {
+    if (!visited.visit(node)) {
+      continue;
+    }
+    Candidate candidate{similarity(codes, scale, node), node};
+    to_visit.push(candidate);
+    if (accept(node)) {
+      results.push(candidate);
+      if (results.size() > ef) {
+        results.pop();
+      }
+    }
+  }
+
+  while (!to_visit.empty()) {
+    Candidate current = to_visit.top();
+    if (results.size() >= ef && current.similarity < results.top().similarity) {
+      break;
+    }
+    to_visit.pop();
+
+    for (uint32_t neighbor : _nodes[current.node].links[layer]) {
+      if (!visited.visit(neighbor)) {
+        continue;
+      }
+      float sim = similarity(codes, scale, neighbor);
+      if (results.size() < ef || sim > results.top().similarity) {
+        to_visit.push({sim, neighbor});
+        if (accept(neighbor)) {
+          results.push({sim, neighbor});
+          if (results.size() > ef) {
+            results.pop();
+          }
+        }
+      }
+    }
+  }
+
+  std::vector<Candidate> sorted(results.size());
+  for (size_t i = sorted.size(); i-- > 0;) {
+    sorted[i] = results.top();
+    results.pop();
+  }
+  return sorted;
+}
+
+std::vector<uint32_t>
+VectorIndex::selectNeighbors(const std::vector<Candidate> &candidates,
+                             uint32_t max_links) const {
+  std::vector<uint32_t> selected;
+  for (const auto &candidate : candidates) {
+    if (selected.size() == max_links) {
+      break;
+    }
+    const int8_t *candidate_codes = codes(candidate.node);
+    float candidate_scale = _nodes[candidate.node].scale;
+    bool diverse = std::none_of(
+        selected.begin(), selected.end(), [&](uint32_t neighbor) {
+          return similarity(candidate_codes, candidate_scale, neighbor) >
+                 candidate.similarity;
+        });
+    if (diverse) {
+      selected.push_back(candidate.node);
+    }
+  }
+  return selected;
+}
+
+void VectorIndex::pruneLinks(uint32_t node, uint32_t layer) {
+  const int8_t *node_codes = codes(node);
+  float scale = _nodes[node].scale;
+
+  std::vector<Candidate> candidates;
+  for (uint32_t neighbor : _nodes[node].links[layer]) {
+    candidates.push_back({similarity(node_codes, scale, neighbor), neighbor});
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate &a, const Candidate &b) {
+              return a.similarity > b.similarity;
+            });
+
+  _nodes[node].links[layer] = selectNeighbors(
+      candidates, layer == 0 ? MAX_BOTTOM_LINKS : MAX_LINKS);
+}
+
+std::vector<std::pair<Chunk, float>>
+VectorIndex::search(const std::vector<float> &embedding, uint32_t top_k,
+                    const std::vector<ChunkId> *allowed,
+                    const std::function<bool(const Chunk &)> &matches) const {
+  checkEmbedding(embedding);
+  Quantized query = quantize(embedding.data());
+
+  std::shared_lock lock(_mutex);
+
+  std::vector<std::pair<Chunk, float>> results;
+  size_t num_vectors = _nodes.size() - _num_deleted;
+  if (top_k == 0 || num_vectors == 0) {
+    return results;
+  }
+
+  // Adds the candidates, which are sorted by descending similarity, to the
+  // results until there are top_k results. Returns the nodes rejected by
+  // matches.
+  std::unordered_set<uint32_t> rejected;
+  auto collect = [&](const std::vector<Candidate> &candidates) {
+    results.clear();
+    for (const auto &candidate : candidates) {
+      if (results.size() == top_k) {
+        break;
+      }
+      Chunk chunk = readChunk(_nodes[candidate.node]);
+      if (matches && !matches(chunk)) {
+        rejected.insert(candidate.node);
+        continue;
+      }
+      results.emplace_back(std::move(chunk), candidate.similarity);
+    }
+  };
+
+  if (allowed && allowed->size() <= EXACT_SEARCH_LIMIT) {
+    std::vector<Candidate> candidates;
+    for (ChunkId id : *allowed) {
+      auto it = _node_ids.find(id);
+      if (it != _node_ids.end()) {
+        candidates.push_back(
+            {similarity(query.codes.data(), query.scale, it->second),
+             it->second});
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate &a, const Candidate &b) {
+                return a.similarity > b.similarity;
+              });
+    collect(candidates);
+    return results;
+  }
+
+  auto accept = [&](uint32_t node) {
+    if (_nodes[node].deleted || rejected.count(node)) {
+      return false;
+    }
+    return !allowed || std::binary_search(allowed->begin(), allowed->end(),
+                                          _nodes[node].id);
+  };
+
+  uint32_t entry = descend(query.codes.data(), query.scale, 0);
+  uint32_t ef = std::max(EF_SEARCH, top_k);
+  while (true) {
+    auto candidates =
+        searchLayer(query.codes.data(), query.scale, {entry}, ef, 0, accept);
+    collect(candidates);
+
+    // If candidates were rejected by matches, the search is repeated with more
+    // candidates until there are top_k results or every vector is considered.
+    if (results.size() == top_k || candidates.size() < ef ||
+        ef >= num_vectors) {
+      return results;
+    }
+    ef = uint32_t(std::min<size_t>(size_t(ef) * 4, num_vectors));
+  }
+}
+
+Chunk VectorIndex::readChunk(const Node &node) const {
+  if (_chunk_store) {
+    // Chunks are stored before they are added to the index and deleted from
+    // the index before they are deleted from the store.
+    auto chunk = _chunk_store->read(node.id);
+    if (!chunk) {
+      throw std::runtime_error("chunk " + std::to_string(node.id) +
+                               " of the vector index is not in the store");
+    }
+    return std::move(*chunk);
+  }
+
+  std::string data(node.len, '\0');
+  _chunks->read(data.data(), data.size(), node.offset);
+
+  BinaryReader in(data);
+  return decodeChunk(in, node.id);
+}
+
+void VectorIndex::deleteDocVersion(const DocId &doc_id, uint32_t doc_version) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::DeleteDocVersion));
+  record.writeString(doc_id);
+  record.writeVarint(doc_version);
+
+  std::unique_lock lock(_mutex);
+  _log->append(record.buffer());
+  if (auto range = removeVersionImpl(doc_id, doc_version)) {
+    deleteRange(*range);
+  }
+}
+
+void VectorIndex::deleteDoc(const DocId &doc_id, bool keep_latest_version) {
+  BinaryWriter record;
+  record.writeFixed<uint8_t>(uint8_t(LogOp::DeleteDoc));
+  record.writeString(doc_id);
+  record.writeFixed<uint8_t>(keep_latest_version);
+
+  std::unique_lock lock(_mutex);
+  _log->append(record.buffer());
+  deleteDocImpl(doc_id, keep_latest_version);
+}
+
+void VectorIndex::deleteDocImpl(const DocId &doc_id, bool keep_latest_version) {
+  auto doc = _docs.find(doc_id);
+  if (doc == _docs.end()) {
+    return;
+  }
+
+  std::vector<uint32_t> versions;
+  for (const auto &[version, _] : doc->second) {
+    versions.push_back(version);
+  }
+  if (keep_latest_version && !versions.empty()) {
+    versions.pop_back();
+  }
+
+  for (uint32_t version : versions) {
+    if (auto range = removeVersionImpl(doc_id, version)) {
+      deleteRange(*range);
+    }
+  }
+}
+
+std::optional<VectorIndex::ChunkRange>
+VectorIndex::removeVersionImpl(const DocId &doc_id, uint32_t doc_version) {
+  auto doc = _docs.find(doc_id);
+  if (doc == _docs.end()) {
+    return std::nullopt;
+  }
+  auto version = doc->second.find(doc_version);
+  if (version == doc->second.end()) {
+    return std::nullopt;
+  }
+
+  ChunkRange range = version->second;
+  doc->second.erase(version);
+  if (doc->second.empty()) {
+    _docs.erase(doc);
+  }
+  return range;
+}
+
+void VectorIndex::deleteRange(ChunkRange range) {
+  for (ChunkId id = range.start; id < range.end; id++) {
+    auto it = _node_ids.find(id);
+    if (it == _node_ids.end()) {
+      continue;
+    }
+    _nodes[it->second].deleted = true;
+    _num_deleted++;
+    _node_ids.erase(it);
+  }
+}
+
+size_t VectorIndex::numVectors() const {
+  std::shared_lock lock(_mutex);
+  return _nodes.size() - _num_deleted;
+}
+
+void VectorIndex::save(const std::string &save_path) const {
+  std::unique_lock lock(_mutex);
+  std::error_code error;
+  bool is_own_path = std::filesystem::equivalent(save_path, _save_path, error);
+  if (!is_own_path && _chunks) {
+    std::filesystem::copy_file(
+        chunksPath(_save_path, _generation), chunksPath(save_path, _generation),
+        std::filesystem::copy_options::overwrite_existing);
+  }
+  writeFile(snapshotPath(save_path), serialize());
+  if (_log && is_own_path) {
+    _log->clear();
+  }
+}
+
+void VectorIndex::applyLogRecord(BinaryReader &record) {
+  switch (LogOp(record.readFixed<uint8_t>())) {
+  case LogOp::Insert: {
+    DocId doc_id = record.readString();
+    uint32_t doc_version = record.readVarint();
+    ChunkId start_id = record.readVarint();
+    size_t count = record.readVarint();
+    for (size_t i = 0; i < count; i++) {
+      Quantized vector;
+      vector.scale = record.readFixed<float>();
+      auto codes = record.readBytes(_dim);
+      vector.codes.assign(codes.begin(), codes.end());
+      uint64_t offset = record.readVarint();
+      uint32_t len = record.readVarint();
+      addNode(start_id + i, vector, offset, len);
+    }
+    _docs[doc_id][doc_version] = {start_id, start_id + count};
+    break;
+  }
+  case LogOp::DeleteDocVersion: {
+    DocId doc_id = record.readString();
+    uint32_t doc_version = record.readVarint();
+    if (auto range = removeVersionImpl(doc_id, doc_version)) {
+      deleteRange(*range);
+    }
+    break;
+  }
+  case LogOp::DeleteDoc: {
+    DocId doc_id = record.readString();
+    bool keep_latest_version = record.readFixed<uint8_t>();
+    deleteDocImpl(doc_id, keep_latest_version);
+    break;
+  }
+  default:
+    throw std::runtime_error("invalid record in vector index log");
+  }
+}
+
+void VectorIndex::rebuild() {
+  std::vector<Node> nodes = std::move(_nodes);
+  std::vector<int8_t> codes = std::move(_codes);
+  _nodes.clear();
+  _codes.clear();
+  _node_ids.clear();
+  _num_deleted = 0;
+  _entry_point = 0;
+  _max_layer = 0;
+
+  std::vector<uint64_t> offsets(nodes.size());
+  if (_chunks) {
+    auto old_chunks = std::move(_chunks);
+    _generation++;
+    openChunks(/*read_only=*/false, /*truncate=*/true);
+
+    BinaryWriter chunks;
+    for (size_t i = 0; i < nodes.size(); i++) {
+      if (nodes[i].deleted) {
+        continue;
+      }
+      offsets[i] = chunks.buffer().size();
+      size_t start = chunks.buffer().size();
+      chunks.buffer().resize(start + nodes[i].len);
+      old_chunks->read(chunks.buffer().data() + start, nodes[i].len,
+                       nodes[i].offset);
+    }
+    _chunks->append(chunks.buffer());
+  }
+
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].deleted) {
+      continue;
+    }
+    Quantized vector;
+    vector.scale = nodes[i].scale;
+    vector.codes.assign(codes.begin() + i * _dim,
+                        codes.begin() + (i + 1) * _dim);
+    addNode(nodes[i].id, vector, offsets[i], nodes[i].len);
+  }
+}
+
+void VectorIndex::openChunks(bool read_only, bool truncate) {
+  if (_reads_chunk_store) {
+    return;
+  }
+  _chunks = std::make_unique<ChunkFile>(chunksPath(_save_path, _generation),
+                                        read_only, truncate);
+}
+
+std::string VectorIndex::serialize() const {
+  BinaryWriter out;
+  out.writeVarint(SNAPSHOT_VERSION);
+  out.writeVarint(_dim);
+  out.writeVarint(_generation);
+  out.writeFixed<uint8_t>(_reads_chunk_store);
+
+  out.writeVarint(_entry_point);
+  out.writeVarint(_max_layer);
+  out.writeVarint(_nodes.size());
+  for (uint32_t i = 0; i < _nodes.size(); i++) {
+    const auto &node = _nodes[i];
+    out.writeVarint(node.id);
+    out.writeFixed<float>(node.scale);
+    out.writeVarint(node.offset);
+    out.writeVarint(node.len);
+    out.writeFixed<uint8_t>(node.deleted);
+    out.buffer().append(reinterpret_cast<const char *>(codes(i)), _dim);
+    out.writeVarint(node.links.size());
+    for (const auto &links : node.links) {
+      out.writeVarint(links.size());
+      for (uint32_t neighbor : links) {
+        out.writeVarint(neighbor);
+      }
+    }
+  }
+
+  out.writeVarint(_docs.size());
+  for (const auto &[doc_id, versions] : _docs) {
+    out.writeString(doc_id);
+    out.writeVarint(versions.size());
+    for (const auto &[version, range] : versions) {
+      out.writeVarint(version);
+      out.writeVarint(range.start);
+      out.writeVarint(range.end);
+    }
+  }
+
+  return std::move(out.buffer());
+}
+
+std::unique_ptr<VectorIndex>
+VectorIndex::deserialize(const std::string &data) {
+  BinaryReader in(data);
+  uint32_t version = in.readVarint();
+  if (version != 1 && version != SNAPSHOT_VERSION) {
+    throw std::runtime_error("unsupported vector index version");
+  }
+
+  std::unique_ptr<VectorIndex> index(new VectorIndex(in.readVarint()));
+  index->_generation = in.readVarint();
+  if (version >= 2) {
+    index->_reads_chunk_store = in.readFixed<uint8_t>();
+  }
+
+  index->_entry_point = in.readVarint();
+  index->_max_layer = in.readVarint();
+  size_t num_nodes = in.readVarint();
+  index->_nodes.reserve(num_nodes);
+  index->_codes.reserve(num_nodes * index->_dim);
+  for (uint32_t i = 0; i < num_nodes; i++) {
+    Node node;
+    node.id = in.readVarint();
+    node.scale = in.readFixed<float>();
+    node.offset = in.readVarint();
+    node.len = in.readVarint();
+    node.deleted = in.readFixed<uint8_t>();
+    auto codes = in.readBytes(index->_dim);
+    index->_codes.insert(index->_codes.end(), codes.begin(), codes.end());
+    node.links.resize(in.readVarint());
+    for (auto &links : node.links) {
+      links.resize(in.readVarint());
+      for (auto &neighbor : links) {
+        neighbor = in.readVarint();
+      }
+    }
+
+    if (node.deleted) {
+      index->_num_deleted++;
+    } else {
+      index->_node_ids[node.id] = i;
+    }
+    index->_nodes.push_back(std::move(node));
+  }
+
+  size_t num_docs = in.readVarint();
+  for (size_t i = 0; i < num_docs; i++) {
+    auto &versions = index->_docs[in.readString()];
+    size_t num_versions = in.readVarint();
+    for (size_t j = 0; j < num_versions; j++) {
+      uint32_t version = in.readVarint();
+      ChunkId start = in.readVarint();
+      ChunkId end = in.readVarint();
+      versions[version] = {start, end};
+    }
+  }
+
+  return index;
+}
+
+} // namespace thirdai::search::ndb
@@ -0,0 +1,249 @@
+#pragma once
+
+#include "Chunk.h"
+#include "ChunkStore.h"
+#include "DocumentBatch.h"
+#include "NeuralDB.h"
+#include "Serialization.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace thirdai::search::ndb {
+
+/**
+ * An approximate nearest neighbor index over the embeddings supplied with
+ * inserted chunks, for the dense retrieval of hybrid queries. Embeddings are
+ * normalized, so similarity is cosine similarity, and stored quantized to int8
+ * with a scale per vector. The vectors are searched with an HNSW graph.
+ *
+ * The engine cannot look up chunks by id, so chunks that are only found by
+ * their embedding are read from the ChunkStore of the ndb if it has one.
+ * Otherwise the index stores a copy of each chunk that has an embedding in a
+ * file of its own, and only their offsets are kept in memory.
+ *
+ * Like the MetadataIndex, the vectors and graph are stored next to the
+ * engine's files in the ndb directory as a snapshot plus a log of the updates
+ * applied since the snapshot was written, and the log is folded into the
+ * snapshot each time the index is opened. Deleted vectors remain in the graph
+ * as tombstones so that searches can pass through them, and the graph is
+ * rebuilt without them when an index that is not read only is opened with more
+ * tombstones than vectors.
+ */
+class VectorIndex {
+public:
+  static constexpr uint32_t MAX_DIM = 16384;
+
+  /**
+   * Creates an empty index for embeddings of the given dimension in the ndb
+   * directory save_path. If chunk_store is not nullptr the index reads its
+   * chunks from the store, which must outlive the index and store each chunk
+   * before it is added to the index.
+   */
+  static std::unique_ptr<VectorIndex>
+  make(const std::string &save_path, uint32_t dim,
+       const ChunkStore *chunk_store = nullptr);
+
+  /**
+   * Opens the index stored in save_path, or returns nullptr if the ndb in
+   * save_path does not have a vector index. If read_only is true the files in
+   * save_path are not modified, and the index must not be updated. The index
+   * reads its chunks from chunk_store if it was created with a store, and
+   * throws if chunk_store is nullptr.
+   */
+  static std::unique_ptr<VectorIndex>
+  open(const std::string &save_path, bool read_only = false,
+       const ChunkStore *chunk_store = nullptr);
+
+  static bool exists(const std::string &save_path);
+
+  VectorIndex(const VectorIndex &) = delete;
+  VectorIndex &operator=(const VectorIndex &) = delete;
+
+  ~VectorIndex();
+
+  uint32_t dim() const { return _dim; }
+
+  /**
+   * Throws if the embedding does not have the dimension of the index.
+   */
+  void checkEmbedding(const std::vector<float> &embedding) const;
+
+  /**
+   * Throws if the document has embeddings that are not one embedding per
+   * chunk with the dimension of the index. Documents without embeddings are
+   * valid, their chunks are not added to the index.
+   */
+  void checkEmbeddings(const NewDocument &document) const;
+
+  /**
+   * Adds the embedded chunks of each document with a single log write.
+   * inserted[i] is the result of inserting documents[i].
+   */
+  void insertBatch(const std::vector<InsertMetadata> &inserted,
+                   const std::vector<NewDocument> &documents);
+
+  void deleteDocVersion(const DocId &doc_id, uint32_t doc_version);
+
+  void deleteDoc(const DocId &doc_id, bool keep_latest_version);
+
+  /**
+   * Returns up to top_k chunks sorted by descending similarity to the
+   * embedding. If allowed is not nullptr only chunks whose ids are in the
+   * sorted list are returned, and if matches is set only chunks it accepts
+   * are returned, which is checked on the stored copy of each candidate.
+   */
+  std::vector<std::pair<Chunk, float>>
+  search(const std::vector<float> &embedding, uint32_t top_k,
+         const std::vector<ChunkId> *allowed,
+         const std::function<bool(const Chunk &)> &matches) const;
+
+  /**
+   * The number of vectors that have not been deleted.
+   */
+  size_t numVectors() const;
+
+  /**
+   * Writes a snapshot of the index, and a copy of its stored chunks if it does
+   * not read them from a chunk store, to the ndb directory save_path.
+   */
+  void save(const std::string &save_path) const;
+
+private:
+  explicit VectorIndex(uint32_t dim);
+
+  struct Node {
+    ChunkId id;
+    float scale;
+    // The location of the stored copy of the chunk in the chunks file, which
+    // is unused if the chunks are read from the chunk store.
+    uint64_t offset;
+    uint32_t len;
+    bool deleted = false;
+    // The neighbors of the node in each layer of the graph it is in.
+    std::vector<std::vector<uint32_t>> links;
+  };
+
+  struct ChunkRange {
+    ChunkId start;
+    ChunkId end;
+  };
+
+  // A vector quantized for the index, codes has dim entries.
+  struct Quantized {
+    std::vector<int8_t> codes;
+    float scale;
+  };
+
+  struct Candidate {
+    float similarity;
+    uint32_t node;
+  };
+
+  Quantized quantize(const float *embedding) const;
+
+  const int8_t *codes(uint32_t node) const {
+    return _codes.data() + size_t(node) * _dim;
+  }
+
+  float similarity(const int8_t *codes, float scale, uint32_t node) const;
+
+  uint32_t randomLevel();
+
+  /**
+   * Adds a node for the quantized vector to the graph.
+   */
+  void addNode(ChunkId id, const Quantized &vector, uint64_t offset,
+               uint32_t len);
+
+  /**
+   * Returns the ef nodes closest to the vector in the layer that are accepted
+   * by accept, found by a best first search from the entry points, sorted by
+   * descending similarity. Nodes that are not accepted are still traversed.
+   */
+  template <typename Accept>
+  std::vector<Candidate> searchLayer(const int8_t *codes, float scale,
+                                     const std::vector<uint32_t> &entry_points,
+                                     uint32_t ef, uint32_t layer,
+                                     Accept &&accept) const;
+
+  /**
+   * Returns the node closest to the vector found by a greedy descent from
+   * the entry point to the layer.
+   */
+  uint32_t descend(const int8_t *codes, float scale, uint32_t layer) const;
+
+  /**
+   * Chooses at most max_links neighbors from the candidates, which are sorted
+   * by descending similarity, skipping candidates that are closer to an
+   * already chosen neighbor than to the node so that the links of a node
+   * point in diverse directions.
+   */
+  std::vector<uint32_t> selectNeighbors(const std::vector<Candidate> &candidates,
+                                        uint32_t max_links) const;
+
+  void pruneLinks(uint32_t node, uint32_t layer);
+
+  Chunk readChunk(const Node &node) const;
+
+  void deleteRange(ChunkRange range);
+
+  std::optional<ChunkRange> removeVersionImpl(const DocId &doc_id,
+                                              uint32_t doc_version);
+
+  void deleteDocImpl(const DocId &doc_id, bool keep_latest_version);
+
+  void applyLogRecord(BinaryReader &record);
+
+  /**
+   * Rebuilds the graph from the vectors that are not deleted, and rewrites
+   * the chunks file, if the index has one, with only their chunks.
+   */
+  void rebuild();
+
+  std::string serialize() const;
+
+  static std::unique_ptr<VectorIndex> deserialize(const std::string &data);
+
+  /**
+   * Opens the chunks file of the current generation, creating it if the index
+   * is not read only.
+   */
+  void openChunks(bool read_only, bool truncate = false);
+
+  uint32_t _dim;
+
+  std::vector<Node> _nodes;
+  std::vector<int8_t> _codes;
+  std::unordered_map<ChunkId, uint32_t> _node_ids;
+  size_t _num_deleted = 0;
+
+  uint32_t _entry_point = 0;
+  uint32_t _max_layer = 0;
+  std::mt19937_64 _rng;
+
+  std::unordered_map<DocId, std::map<uint32_t, ChunkRange>> _docs;
+
+  std::string _save_path;
+  std::unique_ptr<AppendLog> _log;
+  // Set if the chunks are read from the chunk store, in which case there is
+  // no chunks file.
+  bool _reads_chunk_store = false;
+  const ChunkStore *_chunk_store = nullptr;
+  // The file of stored chunks. The file is replaced by a file of the next
+  // generation when the index is rebuilt, so that the snapshot always refers
+  // to a complete chunks file.
+  uint64_t _generation = 0;
+  std::unique_ptr<ChunkFile> _chunks;
+
+  mutable std::shared_mutex _mutex;
+};
+
+} // namespace thirdai::search::ndb
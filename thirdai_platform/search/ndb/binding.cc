@@ -1,22 +1,54 @@
 #include "binding.h"
+#include "CompletionQueue.h"
 #include "Licensing.h"
-#include "OnDiskNeuralDB.h"
+#include "MetadataCodec.h"
+#include "NeuralDBPool.h"
+#include "PlatformNeuralDB.h"
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <memory>
 #include <optional>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 
+using thirdai::search::ndb::addConstraint;
+using thirdai::search::ndb::Between;
+using thirdai::search::ndb::BinaryWriter;
+using thirdai::search::ndb::CheckpointManifest;
 using thirdai::search::ndb::Chunk;
+using thirdai::search::ndb::ChunkCursor;
+using thirdai::search::ndb::ChunkCursorOptions;
+using thirdai::search::ndb::Completion;
+using thirdai::search::ndb::CompletionQueue;
+using thirdai::search::ndb::decodeDocumentBatch;
+using thirdai::search::ndb::encodeDocumentBatch;
+using thirdai::search::ndb::encodeMetadata;
 using thirdai::search::ndb::EqualTo;
+using thirdai::search::ndb::Executor;
+using thirdai::search::ndb::ExecutorOptions;
 using thirdai::search::ndb::GreaterThan;
+using thirdai::search::ndb::HybridOptions;
+using thirdai::search::ndb::In;
 using thirdai::search::ndb::LessThan;
+using thirdai::search::ndb::MetadataKeys;
 using thirdai::search::ndb::MetadataMap;
 using thirdai::search::ndb::MetadataValue;
-using thirdai::search::ndb::OnDiskNeuralDB;
+using thirdai::search::ndb::NeuralDBOptions;
+using thirdai::search::ndb::NeuralDBPool;
+using thirdai::search::ndb::NeuralDBPoolOptions;
+using thirdai::search::ndb::NeuralDBStats;
+using thirdai::search::ndb::NewDocument;
+using thirdai::search::ndb::NotEqual;
+using thirdai::search::ndb::PlatformNeuralDB;
+using thirdai::search::ndb::QueryLimits;
+using thirdai::search::ndb::QueryCacheStats;
 using thirdai::search::ndb::QueryConstraints;
 using thirdai::search::ndb::Source;
+using thirdai::search::ndb::StartsWith;
 
 void copyError(const std::exception &e, const char **err_ptr) {
   char *err_msg = new char[std::strlen(e.what()) + 1];
@@ -24,6 +56,12 @@ void copyError(const std::exception &e, const char **err_ptr) {
   *err_ptr = err_msg;
 }
 
+void copyStats(const QueryCacheStats &stats, QueryCacheStats_t *out) {
+  out->hits = stats.hits;
+  out->misses = stats.misses;
+  out->entries = stats.entries;
+}
+
 struct MetadataValue_t {
   MetadataValue value;
 };
@@ -54,13 +92,7 @@ MetadataValue_t *MetadataValue_str(const char *value) {
 
 void MetadataValue_free(MetadataValue_t *value) { delete value; }
 
-struct Document_t {
-  std::vector<std::string> chunks;
-  std::vector<MetadataMap> metadata;
-  std::string document;
-  std::string doc_id;
-  std::optional<uint32_t> doc_version;
-};
+struct Document_t : NewDocument {};
 
 Document_t *Document_new(const char *document, const char *doc_id) {
   Document_t *doc = new Document_t();
@@ -86,6 +118,15 @@ void Document_add_metadata(Document_t *doc, unsigned int i, const char *key,
   doc->metadata.at(i)[key] = value->value;
 }
 
+char *Document_serialize(Document_t *doc, unsigned long long *len) {
+  std::string data = encodeDocumentBatch({*doc});
+  char *out =
+      static_cast<char *>(std::malloc(std::max<size_t>(data.size(), 1)));
+  std::memcpy(out, data.data(), data.size());
+  *len = data.size();
+  return out;
+}
+
 struct MetadataList_t {
   std::vector<std::pair<std::string, MetadataValue>> metadata;
 };
@@ -131,29 +172,145 @@ void Constraints_free(Constraints_t *constraints) { delete constraints; }
 const int BinaryConstraintEq = 0;
 const int BinaryConstraintLt = 1;
 const int BinaryConstraintGt = 2;
+const int BinaryConstraintNe = 3;
 
+// Constraints added for a key that already has constraints are combined with
+// them, so that a query can apply several constraints to the same key.
 void Constraints_add_binary_constraint(Constraints_t *constraints, int op,
                                        const char *key,
                                        const MetadataValue_t *value) {
   switch (op) {
   case BinaryConstraintEq:
-    constraints->constraints[key] = EqualTo::make(value->value);
+    addConstraint(constraints->constraints, key, EqualTo::make(value->value));
     break;
   case BinaryConstraintLt:
-    constraints->constraints[key] = LessThan::make(value->value);
+    addConstraint(constraints->constraints, key, LessThan::make(value->value));
     break;
   case BinaryConstraintGt:
-    constraints->constraints[key] = GreaterThan::make(value->value);
+    addConstraint(constraints->constraints, key,
+                  GreaterThan::make(value->value));
+    break;
+  case BinaryConstraintNe:
+    addConstraint(constraints->constraints, key, NotEqual::make(value->value));
     break;
   }
 }
 
+void Constraints_add_between_constraint(Constraints_t *constraints,
+                                        const char *key,
+                                        const MetadataValue_t *lower,
+                                        const MetadataValue_t *upper) {
+  addConstraint(constraints->constraints, key,
+                Between::make(lower->value, upper->value));
+}
+
+void Constraints_add_in_constraint(Constraints_t *constraints, const char *key,
+                                   const MetadataValue_t *const *values,
+                                   unsigned int n_values) {
+  std::vector<MetadataValue> set;
+  set.reserve(n_values);
+  for (unsigned int i = 0; i < n_values; i++) {
+    set.push_back(values[i]->value);
+  }
+  addConstraint(constraints->constraints, key, In::make(std::move(set)));
+}
+
+void Constraints_add_prefix_constraint(Constraints_t *constraints,
+                                       const char *key, const char *prefix) {
+  addConstraint(constraints->constraints, key, StartsWith::make(prefix));
+}
+
+// A reused QueryResults_t keeps buffers of at most this many bytes, so that a
+// handle that once held very large results does not hold their memory.
+constexpr size_t MAX_RETAINED_ARENA = 1 << 20;
+// The key dictionary is kept across reuses of a QueryResults_t, since most
+// queries return the same keys, unless it grows past this many keys.
+constexpr size_t MAX_RETAINED_KEYS = 1024;
+
 struct QueryResults_t {
+  QueryResults_t() = default;
+
+  QueryResults_t(std::vector<std::pair<Chunk, float>> results,
+                 unsigned int fields, std::shared_ptr<NeuralDBStats> stats) {
+    assign(std::move(results), fields, std::move(stats));
+  }
+
+  // Replaces the results, reusing the buffers of the columnar copy. Releases
+  // the fields of the results that were not requested, so that they are not
+  // held while the results are alive or copied by QueryResults_export.
+  void assign(std::vector<std::pair<Chunk, float>> new_results,
+              unsigned int new_fields,
+              std::shared_ptr<NeuralDBStats> new_stats) {
+    reset();
+    results = std::move(new_results);
+    fields = new_fields;
+    stats = std::move(new_stats);
+
+    for (auto &[chunk, _] : results) {
+      if (!(fields & QueryResultFieldText)) {
+        std::string().swap(chunk.text);
+      }
+      if (!(fields & QueryResultFieldDocument)) {
+        std::string().swap(chunk.document);
+      }
+      if (!(fields & QueryResultFieldDocId)) {
+        std::string().swap(chunk.doc_id);
+      }
+      if (!(fields & QueryResultFieldMetadata)) {
+        MetadataMap().swap(chunk.metadata);
+      }
+    }
+  }
+
+  // Clears the results, keeping the capacity of the buffers for reuse.
+  void reset() {
+    results.clear();
+    stats.reset();
+
+    ids.clear();
+    scores.clear();
+    doc_versions.clear();
+    offsets.clear();
+    key_offsets.clear();
+    metadata.buffer().clear();
+    if (keys.size() > MAX_RETAINED_KEYS) {
+      keys = MetadataKeys();
+    }
+
+    if (arena.capacity() > MAX_RETAINED_ARENA) {
+      std::string().swap(arena);
+      std::string().swap(metadata.buffer());
+    } else {
+      arena.clear();
+    }
+  }
+
   std::vector<std::pair<Chunk, float>> results;
+  unsigned int fields = QueryResultFieldsAll;
+
+  // The stats of the ndb that returned the results, which record the time
+  // spent in QueryResults_export.
+  std::shared_ptr<NeuralDBStats> stats;
+
+  // Columnar copy of the results, populated by QueryResults_export.
+  std::vector<unsigned long long> ids;
+  std::vector<float> scores;
+  std::vector<unsigned int> doc_versions;
+  std::vector<unsigned long long> offsets;
+  std::vector<unsigned long long> key_offsets;
+  std::string arena;
+
+  // Scratch state of QueryResults_export, kept to reuse its allocations.
+  MetadataKeys keys;
+  BinaryWriter metadata;
 };
 
+QueryResults_t *QueryResults_new() { return new QueryResults_t(); }
+
 void QueryResults_free(QueryResults_t *results) { delete results; }
 
+void QueryResults_reset(QueryResults_t *results) { results->reset(); }
+
 unsigned int QueryResults_len(QueryResults_t *results) {
   return results->results.size();
 }
@@ -189,6 +346,88 @@ MetadataList_t *QueryResults_metadata(QueryResults_t *results, unsigned int i) {
   return out;
 }
 
+void QueryResults_export(QueryResults_t *results, QueryResultsExport_t *out) {
+  if (results->offsets.empty()) {
+    std::optional<NeuralDBStats::Timer> timer;
+    if (results->stats) {
+      timer.emplace(*results->stats, NeuralDBStats::Stage::Materialize);
+    }
+
+    size_t n = results->results.size();
+
+    results->ids.reserve(n);
+    results->scores.reserve(n);
+    results->doc_versions.reserve(n);
+    results->offsets.reserve(n * QueryResultsExportFields + 1);
+
+    size_t arena_size = 0;
+    for (const auto &[chunk, _] : results->results) {
+      arena_size +=
+          chunk.text.size() + chunk.document.size() + chunk.doc_id.size();
+    }
+    results->arena.reserve(arena_size);
+
+    auto &keys = results->keys;
+    auto &metadata = results->metadata;
+
+    for (const auto &[chunk, score] : results->results) {
+      results->ids.push_back(chunk.id);
+      results->scores.push_back(score);
+      results->doc_versions.push_back(chunk.doc_version);
+
+      results->offsets.push_back(results->arena.size());
+      results->arena.append(chunk.text);
+      results->offsets.push_back(results->arena.size());
+      results->arena.append(chunk.document);
+      results->offsets.push_back(results->arena.size());
+      results->arena.append(chunk.doc_id);
+      results->offsets.push_back(results->arena.size());
+      if (results->fields & QueryResultFieldMetadata) {
+        metadata.buffer().clear();
+        encodeMetadata(metadata, chunk.metadata, keys);
+        results->arena.append(metadata.buffer());
+      }
+    }
+    results->offsets.push_back(results->arena.size());
+
+    for (const auto &key : keys.keys()) {
+      results->key_offsets.push_back(results->arena.size());
+      results->arena.append(key);
+    }
+    results->key_offsets.push_back(results->arena.size());
+
+    if (results->stats) {
+      results->stats->add(NeuralDBStats::Counter::ResultBytes,
+                          results->arena.size());
+    }
+  }
+
+  out->len = results->results.size();
+  out->ids = results->ids.data();
+  out->scores = results->scores.data();
+  out->doc_versions = results->doc_versions.data();
+  out->offsets = results->offsets.data();
+  out->n_keys = results->key_offsets.size() - 1;
+  out->key_offsets = results->key_offsets.data();
+  out->arena = results->arena.data();
+  out->arena_len = results->arena.size();
+}
+
+struct QueryResultsBatch_t {
+  std::vector<QueryResults_t> batch;
+};
+
+void QueryResultsBatch_free(QueryResultsBatch_t *batch) { delete batch; }
+
+unsigned int QueryResultsBatch_len(QueryResultsBatch_t *batch) {
+  return batch->batch.size();
+}
+
+QueryResults_t *QueryResultsBatch_get(QueryResultsBatch_t *batch,
+                                      unsigned int i) {
+  return &batch->batch.at(i);
+}
+
 struct StringList_t {
   std::vector<std::string> list;
 };
@@ -198,6 +437,10 @@ void StringList_free(StringList_t *list) { delete list; }
 void StringList_append(StringList_t *list, const char *value) {
   list->list.emplace_back(value);
 }
+unsigned int StringList_len(StringList_t *list) { return list->list.size(); }
+const char *StringList_get(StringList_t *list, unsigned int i) {
+  return list->list.at(i).c_str();
+}
 
 struct LabelList_t {
   std::vector<std::vector<uint64_t>> list;
@@ -208,6 +451,15 @@ void LabelList_free(LabelList_t *list) { delete list; }
 void LabelList_append(LabelList_t *list, unsigned long long value) {
   list->list.emplace_back(std::vector<uint64_t>{value});
 }
+void LabelList_extend(LabelList_t *list, const unsigned long long *labels,
+                      const unsigned int *counts, unsigned int n) {
+  list->list.reserve(list->list.size() + n);
+  for (unsigned int i = 0; i < n; i++) {
+    unsigned int count = counts ? counts[i] : 1;
+    list->list.emplace_back(labels, labels + count);
+    labels += count;
+  }
+}
 
 struct Sources_t {
   std::vector<Source> sources;
@@ -229,17 +481,150 @@ unsigned int Sources_doc_version(Sources_t *sources, unsigned int i) {
   return sources->sources.at(i).doc_version;
 }
 
+struct NeuralDBOptions_t {
+  NeuralDBOptions options;
+};
+
+NeuralDBOptions_t *NeuralDBOptions_new() { return new NeuralDBOptions_t(); }
+
+void NeuralDBOptions_free(NeuralDBOptions_t *options) { delete options; }
+
+void NeuralDBOptions_add_metadata_index(NeuralDBOptions_t *options,
+                                        const char *key) {
+  options->options.metadata_indexes.emplace_back(key);
+}
+
+void NeuralDBOptions_set_query_cache_size(NeuralDBOptions_t *options,
+                                          unsigned long long size) {
+  options->options.query_cache_size = size;
+}
+
+void NeuralDBOptions_set_read_only(NeuralDBOptions_t *options, bool read_only) {
+  options->options.read_only = read_only;
+}
+
+void NeuralDBOptions_set_compaction_interval(NeuralDBOptions_t *options,
+                                             unsigned long long interval_ms) {
+  options->options.compaction_interval_ms = interval_ms;
+}
+
+void NeuralDBOptions_set_num_shards(NeuralDBOptions_t *options,
+                                    unsigned int num_shards) {
+  options->options.num_shards = num_shards;
+}
+
+void NeuralDBOptions_set_embedding_dim(NeuralDBOptions_t *options,
+                                       unsigned int embedding_dim) {
+  options->options.embedding_dim = embedding_dim;
+}
+
+void NeuralDBOptions_set_store_chunks(NeuralDBOptions_t *options,
+                                      bool store_chunks) {
+  options->options.store_chunks = store_chunks;
+}
+
+void NeuralDBOptions_set_buffer_feedback(NeuralDBOptions_t *options,
+                                         bool buffer_feedback,
+                                         unsigned long long batch_size,
+                                         unsigned long long interval_ms) {
+  options->options.buffer_feedback = buffer_feedback;
+  options->options.feedback_batch_size = batch_size;
+  options->options.feedback_interval_ms = interval_ms;
+}
+
+struct ExecutorOptions_t {
+  ExecutorOptions options;
+};
+
+ExecutorOptions_t *ExecutorOptions_new() { return new ExecutorOptions_t(); }
+
+void ExecutorOptions_free(ExecutorOptions_t *options) { delete options; }
+
+void ExecutorOptions_set_threads(ExecutorOptions_t *options,
+                                 unsigned int threads) {
+  options->options.threads = threads;
+}
+
+void ExecutorOptions_set_parallelism(ExecutorOptions_t *options,
+                                     unsigned int query_parallelism,
+                                     unsigned int update_parallelism) {
+  options->options.query_parallelism = query_parallelism;
+  options->options.update_parallelism = update_parallelism;
+}
+
+void ExecutorOptions_add_cpu(ExecutorOptions_t *options, unsigned int cpu) {
+  options->options.cpus.push_back(cpu);
+}
+
+void ExecutorOptions_add_numa_node(ExecutorOptions_t *options,
+                                   unsigned int node) {
+  options->options.numa_nodes.push_back(node);
+}
+
+void ExecutorOptions_set_inline_queries(ExecutorOptions_t *options,
+                                        bool inline_queries) {
+  options->options.inline_queries = inline_queries;
+}
+
+void Executor_configure(const ExecutorOptions_t *options,
+                        const char **err_ptr) {
+  try {
+    Executor::configure(options->options);
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+  }
+}
+
+struct CompletionQueue_t {
+  std::shared_ptr<CompletionQueue> queue = CompletionQueue::make();
+};
+
+CompletionQueue_t *CompletionQueue_new() { return new CompletionQueue_t(); }
+
+void CompletionQueue_free(CompletionQueue_t *queue) { delete queue; }
+
+void CompletionQueue_close(CompletionQueue_t *queue) { queue->queue->close(); }
+
+unsigned int CompletionQueue_wait(CompletionQueue_t *queue,
+                                  long long timeout_ms,
+                                  Completion_t *completions, unsigned int max) {
+  std::optional<std::chrono::milliseconds> timeout;
+  if (timeout_ms >= 0) {
+    timeout = std::chrono::milliseconds(timeout_ms);
+  }
+
+  auto ready = queue->queue->wait(max, timeout);
+  for (size_t i = 0; i < ready.size(); i++) {
+    completions[i].ticket = ready[i].ticket;
+    completions[i].error = nullptr;
+    if (ready[i].error) {
+      try {
+        std::rethrow_exception(ready[i].error);
+      } catch (const std::exception &e) {
+        copyError(e, &completions[i].error);
+      } catch (...) {
+        copyError(std::runtime_error("unknown error"), &completions[i].error);
+      }
+    }
+  }
+  return ready.size();
+}
+
 struct NeuralDB_t {
-  std::unique_ptr<OnDiskNeuralDB> ndb;
+  // Shared with the pool if the ndb was acquired from a NeuralDBPool.
+  std::shared_ptr<PlatformNeuralDB> ndb;
+
+  NeuralDB_t(const std::string &save_path, const NeuralDBOptions &options)
+      : ndb(PlatformNeuralDB::make(save_path, options)) {}
 
-  NeuralDB_t(const std::string &save_path)
-      : ndb(OnDiskNeuralDB::make(save_path)) {}
+  explicit NeuralDB_t(std::shared_ptr<PlatformNeuralDB> ndb)
+      : ndb(std::move(ndb)) {}
 };
 
 NeuralDB_t *NeuralDB_new(const char *save_path, const char **err_ptr) {
   try {
     std::string path(save_path);
-    return new NeuralDB_t(path);
+    return new NeuralDB_t(path, NeuralDBOptions());
   } catch (const std::exception &e) {
     // TODO(Nicholas): have case for NeuralDBError to return better errors
     copyError(e, err_ptr);
@@ -247,38 +632,290 @@ NeuralDB_t *NeuralDB_new(const char *save_path, const char **err_ptr) {
   }
 }
 
+NeuralDB_t *NeuralDB_new_with_options(const char *save_path,
+                                      const NeuralDBOptions_t *options,
+                                      const char **err_ptr) {
+  try {
+    std::string path(save_path);
+    return new NeuralDB_t(path, options->options);
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+    return nullptr;
+  }
+}
+
 void NeuralDB_free(NeuralDB_t *ndb) { delete ndb; }
 
+void NeuralDB_query_cache_stats(NeuralDB_t *ndb, QueryCacheStats_t *out) {
+  copyStats(ndb->ndb->queryCacheStats(), out);
+}
+
+void NeuralDB_compaction_stats(NeuralDB_t *ndb, CompactionStats_t *out) {
+  auto stats = ndb->ndb->compactionStats();
+  out->passes = stats.passes;
+  out->failures = stats.failures;
+  out->pending_deletions = stats.pending_deletions;
+  out->last_duration_ms = stats.last_duration_ms;
+  out->total_duration_ms = stats.total_duration_ms;
+  out->running = stats.running;
+}
+
+void NeuralDB_stats(NeuralDB_t *ndb, NeuralDBStats_t *out) {
+  static_assert(NeuralDBStages == NeuralDBStats::NUM_STAGES);
+  static_assert(NeuralDBCounters == NeuralDBStats::NUM_COUNTERS);
+  static_assert(NeuralDBLatencyBuckets == NeuralDBStats::NUM_BUCKETS);
+
+  auto stats = ndb->ndb->stats()->snapshot();
+  for (size_t i = 0; i < NeuralDBStages; i++) {
+    const auto &stage = stats.stages[i];
+    out->stages[i].count = stage.count;
+    out->stages[i].sum_ms = stage.sum_ns / 1e6;
+    std::copy(stage.buckets.begin(), stage.buckets.end(),
+              out->stages[i].buckets);
+  }
+  std::copy(stats.counters.begin(), stats.counters.end(), out->counters);
+}
+
+void NeuralDB_open_timings(NeuralDB_t *ndb, OpenTimings_t *out) {
+  const auto &timings = ndb->ndb->openTimings();
+  out->engine_ms = timings.engine_ms;
+  out->metadata_index_ms = timings.metadata_index_ms;
+  out->vector_index_ms = timings.vector_index_ms;
+  out->doc_catalog_ms = timings.doc_catalog_ms;
+  out->chunk_store_ms = timings.chunk_store_ms;
+  out->ingest_queue_ms = timings.ingest_queue_ms;
+  out->total_ms = timings.total_ms;
+}
+
+const char *NeuralDBStats_stage_name(unsigned int stage) {
+  return NeuralDBStats::name(NeuralDBStats::Stage(stage));
+}
+
+const char *NeuralDBStats_counter_name(unsigned int counter) {
+  return NeuralDBStats::name(NeuralDBStats::Counter(counter));
+}
+
 void NeuralDB_insert(NeuralDB_t *ndb, Document_t *doc, const char **err_ptr) {
   try {
-    ndb->ndb->insert(
-        /*chunks=*/doc->chunks,
-        /*metadata*/ doc->metadata,
-        /*document=*/doc->document,
-        /*doc_id=*/doc->doc_id,
-        /*doc_version=*/doc->doc_version);
+    Executor::run(Executor::Work::Update, [&]() {
+      ndb->ndb->insert(
+          /*chunks=*/doc->chunks,
+          /*metadata*/ doc->metadata,
+          /*document=*/doc->document,
+          /*doc_id=*/doc->doc_id,
+          /*doc_version=*/doc->doc_version);
+    });
   } catch (const std::exception &e) {
     copyError(e, err_ptr);
     return;
   }
 }
 
+void NeuralDB_insert_batch(NeuralDB_t *ndb, const char *data,
+                           unsigned long long len, const char **err_ptr) {
+  try {
+    auto documents = decodeDocumentBatch(std::string_view(data, len));
+    Executor::run(Executor::Work::Update,
+                  [&]() { ndb->ndb->insertBatch(documents); });
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+  }
+}
+
+unsigned long long NeuralDB_insert_async(NeuralDB_t *ndb, const char *data,
+                                         unsigned long long len,
+                                         const char **err_ptr) {
+  try {
+    return ndb->ndb->insertAsync(std::string_view(data, len));
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+    return 0;
+  }
+}
+
+void NeuralDB_wait_for_indexed(NeuralDB_t *ndb, unsigned long long seq,
+                               const char **err_ptr) {
+  try {
+    ndb->ndb->waitForIndexed(seq);
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+  }
+}
+
+void NeuralDB_flush(NeuralDB_t *ndb, const char **err_ptr) {
+  try {
+    ndb->ndb->flush();
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+  }
+}
+
 QueryResults_t *NeuralDB_query(NeuralDB_t *ndb, const char *query,
                                unsigned int topk,
                                const Constraints_t *constraints,
-                               const char **err_ptr) {
+                               unsigned int fields, const char **err_ptr) {
   try {
-    std::vector<std::pair<Chunk, float>> results;
-    if (constraints == nullptr) {
-      results = ndb->ndb->query(query, topk);
-    } else {
-      results = ndb->ndb->rank(query, constraints->constraints, topk);
+    auto results = Executor::run(Executor::Work::Query, [&]() {
+      if (constraints == nullptr) {
+        return ndb->ndb->query(query, topk);
+      }
+      return ndb->ndb->rank(query, constraints->constraints, topk);
+    });
+    return new QueryResults_t(std::move(results), fields, ndb->ndb->stats());
+  } catch (const std::exception &e) {
+    // TODO(Nicholas): have case for NeuralDBError to return better errors
+    copyError(e, err_ptr);
+    return nullptr;
+  }
+}
+
+QueryLimits toQueryLimits(const QueryLimits_t *limits) {
+  QueryLimits query_limits;
+  if (limits != nullptr) {
+    query_limits.min_score = limits->min_score;
+    query_limits.max_candidates = limits->max_candidates;
+    query_limits.latest_versions_only = limits->latest_versions_only;
+  }
+  return query_limits;
+}
+
+QueryResults_t *NeuralDB_query_with_limits(NeuralDB_t *ndb, const char *query,
+                                           unsigned int topk,
+                                           const Constraints_t *constraints,
+                                           const QueryLimits_t *limits,
+                                           unsigned int fields,
+                                           const char **err_ptr) {
+  try {
+    QueryLimits query_limits = toQueryLimits(limits);
+
+    auto results = Executor::run(Executor::Work::Query, [&]() {
+      return ndb->ndb->search(query,
+                              constraints == nullptr
+                                  ? QueryConstraints{}
+                                  : constraints->constraints,
+                              topk, query_limits);
+    });
+    return new QueryResults_t(std::move(results), fields, ndb->ndb->stats());
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+    return nullptr;
+  }
+}
+
+void NeuralDB_query_into(NeuralDB_t *ndb, const char *query,
+                         unsigned long long query_len, unsigned int topk,
+                         const Constraints_t *constraints,
+                         const QueryLimits_t *limits, unsigned int fields,
+                         QueryResults_t *results, const char **err_ptr) {
+  try {
+    QueryLimits query_limits = toQueryLimits(limits);
+
+    std::string query_str =
+        query_len == 0 ? std::string() : std::string(query, query_len);
+
+    auto query_results = Executor::run(Executor::Work::Query, [&]() {
+      return ndb->ndb->search(query_str,
+                              constraints == nullptr
+                                  ? QueryConstraints{}
+                                  : constraints->constraints,
+                              topk, query_limits);
+    });
+    results->assign(std::move(query_results), fields, ndb->ndb->stats());
+  } catch (const std::exception &e) {
+    results->reset();
+    copyError(e, err_ptr);
+  }
+}
+
+void NeuralDB_query_async(NeuralDB_t *ndb, const char *query,
+                          unsigned long long query_len, unsigned int topk,
+                          const Constraints_t *constraints,
+                          const QueryLimits_t *limits, unsigned int fields,
+                          QueryResults_t *results, CompletionQueue_t *queue,
+                          unsigned long long ticket, const char **err_ptr) {
+  try {
+    // Everything the query needs is copied, since the arguments may be freed
+    // once this returns. The ndb is shared so that it stays open until the
+    // query completes.
+    queue->queue->submit(
+        Executor::Work::Query, ticket,
+        [ndb = ndb->ndb,
+         query_str =
+             query_len == 0 ? std::string() : std::string(query, query_len),
+         query_constraints = constraints == nullptr ? QueryConstraints{}
+                                                    : constraints->constraints,
+         topk, query_limits = toQueryLimits(limits), fields, results]() {
+          try {
+            auto query_results =
+                ndb->search(query_str, query_constraints, topk, query_limits);
+            results->assign(std::move(query_results), fields, ndb->stats());
+          } catch (...) {
+            results->reset();
+            throw;
+          }
+        });
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+  }
+}
+
+void NeuralDB_hybrid_query_into(NeuralDB_t *ndb, const char *query,
+                                unsigned long long query_len,
+                                const float *embedding,
+                                unsigned int embedding_len, unsigned int topk,
+                                const Constraints_t *constraints,
+                                const HybridOptions_t *options,
+                                unsigned int fields, QueryResults_t *results,
+                                const char **err_ptr) {
+  try {
+    HybridOptions hybrid_options;
+    if (options != nullptr) {
+      hybrid_options.lexical_weight = options->lexical_weight;
+      hybrid_options.vector_weight = options->vector_weight;
+      hybrid_options.rrf_k = options->rrf_k;
+      hybrid_options.candidates = options->candidates;
+    }
+
+    std::string query_str =
+        query_len == 0 ? std::string() : std::string(query, query_len);
+    std::vector<float> embedding_vec(embedding, embedding + embedding_len);
+
+    auto query_results = Executor::run(Executor::Work::Query, [&]() {
+      return ndb->ndb->hybridSearch(query_str, embedding_vec,
+                                    constraints == nullptr
+                                        ? QueryConstraints{}
+                                        : constraints->constraints,
+                                    topk, hybrid_options);
+    });
+    results->assign(std::move(query_results), fields, ndb->ndb->stats());
+  } catch (const std::exception &e) {
+    results->reset();
+    copyError(e, err_ptr);
+  }
+}
+
+QueryResultsBatch_t *NeuralDB_query_batch(NeuralDB_t *ndb,
+                                          const StringList_t *queries,
+                                          unsigned int topk,
+                                          const Constraints_t *constraints,
+                                          unsigned int fields,
+                                          const char **err_ptr) {
+  try {
+    auto results = Executor::run(Executor::Work::Query, [&]() {
+      return ndb->ndb->queryBatch(queries->list,
+                                  constraints == nullptr
+                                      ? QueryConstraints{}
+                                      : constraints->constraints,
+                                  topk);
+    });
+
+    auto out = new QueryResultsBatch_t();
+    out->batch.reserve(results.size());
+    for (auto &result : results) {
+      out->batch.emplace_back(std::move(result), fields, ndb->ndb->stats());
     }
-    auto out = new QueryResults_t();
-    out->results = std::move(results);
     return out;
   } catch (const std::exception &e) {
-    // TODO(Nicholas): have case for NeuralDBError to return better errors
     copyError(e, err_ptr);
     return nullptr;
   }
@@ -287,7 +924,9 @@ QueryResults_t *NeuralDB_query(NeuralDB_t *ndb, const char *query,
 void NeuralDB_finetune(NeuralDB_t *ndb, const StringList_t *queries,
                        const LabelList_t *chunk_ids, const char **err_ptr) {
   try {
-    ndb->ndb->finetune(queries->list, chunk_ids->list);
+    Executor::run(Executor::Work::Update, [&]() {
+      ndb->ndb->finetune(queries->list, chunk_ids->list);
+    });
   } catch (const std::exception &e) {
     // TODO(Nicholas): have case for NeuralDBError to return better errors
     copyError(e, err_ptr);
@@ -299,7 +938,9 @@ void NeuralDB_associate(NeuralDB_t *ndb, const StringList_t *sources,
                         const StringList_t *targets, unsigned int strength,
                         const char **err_ptr) {
   try {
-    ndb->ndb->associate(sources->list, targets->list, strength);
+    Executor::run(Executor::Work::Update, [&]() {
+      ndb->ndb->associate(sources->list, targets->list, strength);
+    });
   } catch (const std::exception &e) {
     // TODO(Nicholas): have case for NeuralDBError to return better errors
     copyError(e, err_ptr);
@@ -311,7 +952,9 @@ void NeuralDB_delete_doc(NeuralDB_t *ndb, const char *doc_id,
                          bool keep_latest_version, const char **err_ptr) {
 
   try {
-    ndb->ndb->deleteDoc(doc_id, keep_latest_version);
+    Executor::run(Executor::Work::Update, [&]() {
+      ndb->ndb->deleteDoc(doc_id, keep_latest_version);
+    });
   } catch (const std::exception &e) {
     // TODO(Nicholas): have case for NeuralDBError to return better errors
     copyError(e, err_ptr);
@@ -319,6 +962,41 @@ void NeuralDB_delete_doc(NeuralDB_t *ndb, const char *doc_id,
   }
 }
 
+void NeuralDB_delete_doc_version(NeuralDB_t *ndb, const char *doc_id,
+                                 unsigned int doc_version,
+                                 const char **err_ptr) {
+  try {
+    Executor::run(Executor::Work::Update, [&]() {
+      ndb->ndb->deleteDocVersion(doc_id, doc_version);
+    });
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+    return;
+  }
+}
+
+void NeuralDB_apply_pending_feedback(NeuralDB_t *ndb, const char **err_ptr) {
+  try {
+    Executor::run(Executor::Work::Update,
+                  [&]() { ndb->ndb->applyPendingFeedback(); });
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+  }
+}
+
+unsigned long long NeuralDB_pending_feedback(NeuralDB_t *ndb) {
+  return ndb->ndb->pendingFeedback();
+}
+
+void NeuralDB_prune(NeuralDB_t *ndb, const char **err_ptr) {
+  try {
+    Executor::run(Executor::Work::Update, [&]() { ndb->ndb->prune(); });
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+    return;
+  }
+}
+
 Sources_t *NeuralDB_sources(NeuralDB_t *ndb, const char **err_ptr) {
   try {
     auto sources = ndb->ndb->sources();
@@ -332,16 +1010,188 @@ Sources_t *NeuralDB_sources(NeuralDB_t *ndb, const char **err_ptr) {
   }
 }
 
+Sources_t *NeuralDB_sources_page(NeuralDB_t *ndb, unsigned long long offset,
+                                 unsigned long long limit,
+                                 const char **err_ptr) {
+  try {
+    auto sources = ndb->ndb->sources(offset, limit);
+    auto out = new Sources_t();
+    out->sources = std::move(sources);
+    return out;
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+    return nullptr;
+  }
+}
+
+Sources_t *NeuralDB_sources_after(NeuralDB_t *ndb, const char *doc_id,
+                                  unsigned int doc_version,
+                                  unsigned long long limit,
+                                  const char **err_ptr) {
+  try {
+    auto sources = ndb->ndb->sourcesAfter(doc_id, doc_version, limit);
+    auto out = new Sources_t();
+    out->sources = std::move(sources);
+    return out;
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+    return nullptr;
+  }
+}
+
+unsigned long long NeuralDB_num_sources(NeuralDB_t *ndb) {
+  return ndb->ndb->numSources();
+}
+
+bool NeuralDB_latest_version(NeuralDB_t *ndb, const char *doc_id,
+                             unsigned int *version) {
+  auto latest = ndb->ndb->latestVersion(doc_id);
+  if (!latest) {
+    return false;
+  }
+  *version = *latest;
+  return true;
+}
+
 void NeuralDB_save(NeuralDB_t *ndb, const char *save_path,
                    const char **err_ptr) {
   try {
-    ndb->ndb->save(save_path);
+    Executor::run(Executor::Work::Update,
+                  [&]() { ndb->ndb->save(save_path); });
   } catch (const std::exception &e) {
     copyError(e, err_ptr);
     return;
   }
 }
 
+struct ChunkCursor_t {
+  // Declared before the cursor so that the ndb outlives it.
+  std::shared_ptr<PlatformNeuralDB> ndb;
+  std::unique_ptr<ChunkCursor> cursor;
+};
+
+ChunkCursor_t *NeuralDB_chunk_cursor(NeuralDB_t *ndb, const char *doc_id,
+                                     const Constraints_t *constraints,
+                                     unsigned long long start_id,
+                                     const char **err_ptr) {
+  try {
+    ChunkCursorOptions options;
+    if (doc_id != nullptr) {
+      options.doc_id = doc_id;
+    }
+    if (constraints != nullptr) {
+      options.constraints = constraints->constraints;
+    }
+    options.start_id = start_id;
+
+    auto cursor = ndb->ndb->chunkCursor(options);
+    return new ChunkCursor_t{ndb->ndb, std::move(cursor)};
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+    return nullptr;
+  }
+}
+
+void ChunkCursor_free(ChunkCursor_t *cursor) { delete cursor; }
+
+void ChunkCursor_next(ChunkCursor_t *cursor, unsigned int max,
+                      unsigned int fields, QueryResults_t *results,
+                      const char **err_ptr) {
+  try {
+    auto chunks = cursor->cursor->next(max);
+
+    std::vector<std::pair<Chunk, float>> page;
+    page.reserve(chunks.size());
+    for (auto &chunk : chunks) {
+      page.emplace_back(std::move(chunk), 0.0);
+    }
+    results->assign(std::move(page), fields, cursor->ndb->stats());
+  } catch (const std::exception &e) {
+    results->reset();
+    copyError(e, err_ptr);
+  }
+}
+
+struct NeuralDBPool_t {
+  NeuralDBPool pool;
+};
+
+NeuralDBPool_t *NeuralDBPool_new(const NeuralDBPoolOptions_t *options,
+                                 const char **err_ptr) {
+  try {
+    NeuralDBPoolOptions pool_options;
+    pool_options.max_open = options->max_open;
+    pool_options.max_open_bytes = options->max_open_bytes;
+    pool_options.idle_timeout_ms = options->idle_timeout_ms;
+    pool_options.query_cache_size = options->query_cache_size;
+    return new NeuralDBPool_t{NeuralDBPool(pool_options)};
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+    return nullptr;
+  }
+}
+
+void NeuralDBPool_free(NeuralDBPool_t *pool) { delete pool; }
+
+NeuralDB_t *NeuralDBPool_acquire(NeuralDBPool_t *pool, const char *save_path,
+                                 const NeuralDBOptions_t *options,
+                                 const char **err_ptr) {
+  try {
+    return new NeuralDB_t(pool->pool.acquire(save_path, options->options));
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+    return nullptr;
+  }
+}
+
+void NeuralDBPool_evict_idle(NeuralDBPool_t *pool) { pool->pool.evictIdle(); }
+
+void NeuralDBPool_stats(NeuralDBPool_t *pool, NeuralDBPoolStats_t *out) {
+  auto stats = pool->pool.stats();
+  out->open = stats.open;
+  out->pinned = stats.pinned;
+  out->open_bytes = stats.open_bytes;
+  out->hits = stats.hits;
+  out->opens = stats.opens;
+  out->evictions = stats.evictions;
+}
+
+void NeuralDBPool_query_cache_stats(NeuralDBPool_t *pool,
+                                    QueryCacheStats_t *out) {
+  copyStats(pool->pool.queryCacheStats(), out);
+}
+
+struct CheckpointManifest_t {
+  CheckpointManifest manifest;
+};
+
+CheckpointManifest_t *CheckpointManifest_load(const char *manifest_path,
+                                              const char **err_ptr) {
+  try {
+    return new CheckpointManifest_t{CheckpointManifest::load(manifest_path)};
+  } catch (const std::exception &e) {
+    copyError(e, err_ptr);
+    return nullptr;
+  }
+}
+
+void CheckpointManifest_free(CheckpointManifest_t *manifest) {
+  delete manifest;
+}
+
+const char *CheckpointManifest_id(CheckpointManifest_t *manifest) {
+  return manifest->manifest.id().c_str();
+}
+
+StringList_t *CheckpointManifest_files(CheckpointManifest_t *manifest) {
+  return new StringList_t{manifest->manifest.files()};
+}
+
+StringList_t *CheckpointManifest_delta(CheckpointManifest_t *manifest,
+                                       const CheckpointManifest_t *base) {
+  return new StringList_t{manifest->manifest.delta(base->manifest)};
+}
+
 void set_license_key(const char *key, const char **err_ptr) {
   try {
     thirdai::licensing::activate(key);
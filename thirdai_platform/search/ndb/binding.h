@@ -20,6 +20,10 @@ void Document_add_chunk(Document_t *doc, const char *chunk);
 void Document_set_version(Document_t *doc, unsigned int version);
 void Document_add_metadata(Document_t *doc, unsigned int i, const char *key,
                            const MetadataValue_t *value);
+// Encodes the document as a batch in the format of decodeDocumentBatch in
+// DocumentBatch.h, which can be stored or replicated and later applied with
+// NeuralDB_insert_batch. The returned buffer must be released with free.
+char *Document_serialize(Document_t *doc, unsigned long long *len);
 
 typedef struct MetadataList_t MetadataList_t;
 void MetadataList_free(MetadataList_t *metadata);
@@ -37,11 +41,37 @@ void Constraints_free(Constraints_t *constraints);
 void Constraints_add_binary_constraint(Constraints_t *constraints, int op,
                                        const char *key,
                                        const MetadataValue_t *value);
+void Constraints_add_between_constraint(Constraints_t *constraints,
+                                        const char *key,
+                                        const MetadataValue_t *lower,
+                                        const MetadataValue_t *upper);
+void Constraints_add_in_constraint(Constraints_t *constraints, const char *key,
+                                   const MetadataValue_t *const *values,
+                                   unsigned int n_values);
+void Constraints_add_prefix_constraint(Constraints_t *constraints,
+                                       const char *key, const char *prefix);
+
+// Fields of the results that can be requested from a query. The id, score,
+// and doc version of each result are always returned, the other fields are
+// empty unless they are requested.
+enum {
+  QueryResultFieldText = 1 << 0,
+  QueryResultFieldDocument = 1 << 1,
+  QueryResultFieldDocId = 1 << 2,
+  QueryResultFieldMetadata = 1 << 3,
+  QueryResultFieldsAll = (1 << 4) - 1,
+};
 
 typedef struct QueryResults_t QueryResults_t;
+// Returns an empty results handle that can be filled by NeuralDB_query_into
+// any number of times, reusing its buffers so that steady state queries do
+// not allocate them again.
+QueryResults_t *QueryResults_new();
 unsigned int QueryResults_len(QueryResults_t *results);
 unsigned long long QueryResults_id(QueryResults_t *results, unsigned int i);
 void QueryResults_free(QueryResults_t *results);
+// Clears the results, keeping their buffers for the next NeuralDB_query_into.
+void QueryResults_reset(QueryResults_t *results);
 const char *QueryResults_text(QueryResults_t *results, unsigned int i);
 const char *QueryResults_document(QueryResults_t *results, unsigned int i);
 const char *QueryResults_doc_id(QueryResults_t *results, unsigned int i);
@@ -49,15 +79,67 @@ unsigned int QueryResults_doc_version(QueryResults_t *results, unsigned int i);
 MetadataList_t *QueryResults_metadata(QueryResults_t *results, unsigned int i);
 float QueryResults_score(QueryResults_t *results, unsigned int i);
 
+// The string fields of each result are packed into a single arena. The bytes
+// of field f of result i are arena[offsets[i * QueryResultsExportFields + f]]
+// up to arena[offsets[i * QueryResultsExportFields + f + 1]], so offsets has
+// len * QueryResultsExportFields + 1 entries.
+//
+// The metadata keys of all of the results are interned into a dictionary which
+// is stored in the arena after the fields: key k is arena[key_offsets[k]] up to
+// arena[key_offsets[k + 1]], so key_offsets has n_keys + 1 entries. A reused
+// handle may also have keys of its earlier results in the dictionary. Metadata
+// is encoded as a varint entry count followed by the entries, each a varint key
+// id, a one byte tag, and the value. The tags are 0 and 1 for false and true,
+// which have no value bytes, 2 for int with a zigzag varint value, 3 for float
+// with a 4 byte little endian value, and 4 for str with a varint length
+// followed by the bytes. Varints are unsigned LEB128.
+enum {
+  QueryResultsExportText = 0,
+  QueryResultsExportDocument = 1,
+  QueryResultsExportDocId = 2,
+  QueryResultsExportMetadata = 3,
+  QueryResultsExportFields = 4,
+};
+
+typedef struct {
+  unsigned int len;
+  const unsigned long long *ids;
+  const float *scores;
+  const unsigned int *doc_versions;
+  const unsigned long long *offsets;
+  unsigned int n_keys;
+  const unsigned long long *key_offsets;
+  const char *arena;
+  unsigned long long arena_len;
+} QueryResultsExport_t;
+
+// Fills out with pointers into buffers owned by results, which remain valid
+// until QueryResults_free or QueryResults_reset is called, or the results are
+// replaced by NeuralDB_query_into.
+void QueryResults_export(QueryResults_t *results, QueryResultsExport_t *out);
+
+typedef struct QueryResultsBatch_t QueryResultsBatch_t;
+void QueryResultsBatch_free(QueryResultsBatch_t *batch);
+unsigned int QueryResultsBatch_len(QueryResultsBatch_t *batch);
+// The returned results are owned by the batch and must not be freed.
+QueryResults_t *QueryResultsBatch_get(QueryResultsBatch_t *batch,
+                                      unsigned int i);
+
 typedef struct StringList_t StringList_t;
 StringList_t *StringList_new();
 void StringList_free(StringList_t *list);
 void StringList_append(StringList_t *list, const char *value);
+unsigned int StringList_len(StringList_t *list);
+const char *StringList_get(StringList_t *list, unsigned int i);
 
 typedef struct LabelList_t LabelList_t;
 LabelList_t *LabelList_new();
 void LabelList_free(LabelList_t *list);
 void LabelList_append(LabelList_t *list, unsigned long long value);
+// Appends n entries, where entry i has the next counts[i] labels in labels. If
+// counts is NULL every entry has a single label.
+void LabelList_extend(LabelList_t *list, const unsigned long long *labels,
+                      const unsigned int *counts, unsigned int n);
 
 typedef struct Sources_t Sources_t;
 void Sources_free(Sources_t *sources);
@@ -66,14 +148,235 @@ const char *Sources_document(Sources_t *sources, unsigned int i);
 const char *Sources_doc_id(Sources_t *sources, unsigned int i);
 unsigned int Sources_doc_version(Sources_t *sources, unsigned int i);
 
+typedef struct {
+  unsigned long long passes;
+  unsigned long long failures;
+  unsigned long long pending_deletions;
+  double last_duration_ms;
+  double total_duration_ms;
+  bool running;
+} CompactionStats_t;
+
+// Stages of the query and insert paths whose latencies are recorded by
+// NeuralDB_stats, the names of the stages are given by
+// NeuralDBStats_stage_name.
+enum {
+  NeuralDBStageCacheLookup = 0,
+  NeuralDBStageIndexLookup = 1,
+  NeuralDBStageEngineQuery = 2,
+  NeuralDBStageEngineRank = 3,
+  NeuralDBStageCandidateFilter = 4,
+  NeuralDBStageMaterialize = 5,
+  NeuralDBStageEngineInsert = 6,
+  NeuralDBStageIndexUpdate = 7,
+  NeuralDBStageVectorSearch = 8,
+  NeuralDBStages = 9,
+};
+
+enum {
+  NeuralDBCounterQueries = 0,
+  NeuralDBCounterCandidates = 1,
+  NeuralDBCounterResults = 2,
+  NeuralDBCounterCacheHits = 3,
+  NeuralDBCounterCacheMisses = 4,
+  NeuralDBCounterResultBytes = 5,
+  NeuralDBCounterInsertedChunks = 6,
+  NeuralDBCounters = 7,
+};
+
+// Bucket 0 counts calls that took less than 1us, bucket i counts calls that
+// took at least 2^(i-1)us and less than 2^i us, and the last bucket counts
+// every slower call.
+enum { NeuralDBLatencyBuckets = 24 };
+
+typedef struct {
+  unsigned long long count;
+  double sum_ms;
+  unsigned long long buckets[NeuralDBLatencyBuckets];
+} LatencyHistogram_t;
+
+typedef struct {
+  LatencyHistogram_t stages[NeuralDBStages];
+  unsigned long long counters[NeuralDBCounters];
+} NeuralDBStats_t;
+
+const char *NeuralDBStats_stage_name(unsigned int stage);
+const char *NeuralDBStats_counter_name(unsigned int counter);
+
+typedef struct NeuralDBOptions_t NeuralDBOptions_t;
+NeuralDBOptions_t *NeuralDBOptions_new();
+void NeuralDBOptions_free(NeuralDBOptions_t *options);
+void NeuralDBOptions_add_metadata_index(NeuralDBOptions_t *options,
+                                        const char *key);
+void NeuralDBOptions_set_query_cache_size(NeuralDBOptions_t *options,
+                                          unsigned long long size);
+void NeuralDBOptions_set_read_only(NeuralDBOptions_t *options, bool read_only);
+// 0 disables background compaction.
+void NeuralDBOptions_set_compaction_interval(NeuralDBOptions_t *options,
+                                             unsigned long long interval_ms);
+void NeuralDBOptions_set_num_shards(NeuralDBOptions_t *options,
+                                    unsigned int num_shards);
+void NeuralDBOptions_set_embedding_dim(NeuralDBOptions_t *options,
+                                       unsigned int embedding_dim);
+void NeuralDBOptions_set_store_chunks(NeuralDBOptions_t *options,
+                                      bool store_chunks);
+// See buffer_feedback in PlatformNeuralDB.h, 0 disables a trigger.
+void NeuralDBOptions_set_buffer_feedback(NeuralDBOptions_t *options,
+                                         bool buffer_feedback,
+                                         unsigned long long batch_size,
+                                         unsigned long long interval_ms);
+
+// Process wide control of the threads that run engine calls, see
+// ExecutorOptions in Executor.h. The options can be freed once they have been
+// passed to Executor_configure.
+typedef struct ExecutorOptions_t ExecutorOptions_t;
+ExecutorOptions_t *ExecutorOptions_new();
+void ExecutorOptions_free(ExecutorOptions_t *options);
+void ExecutorOptions_set_threads(ExecutorOptions_t *options,
+                                 unsigned int threads);
+void ExecutorOptions_set_parallelism(ExecutorOptions_t *options,
+                                     unsigned int query_parallelism,
+                                     unsigned int update_parallelism);
+void ExecutorOptions_add_cpu(ExecutorOptions_t *options, unsigned int cpu);
+void ExecutorOptions_add_numa_node(ExecutorOptions_t *options,
+                                   unsigned int node);
+void ExecutorOptions_set_inline_queries(ExecutorOptions_t *options,
+                                        bool inline_queries);
+void Executor_configure(const ExecutorOptions_t *options,
+                        const char **err_ptr);
+
+// Collects the completions of calls submitted with NeuralDB_query_async, which
+// run on the executor threads, so that many queries can be in flight while a
+// single thread waits for them. See CompletionQueue.h.
+typedef struct CompletionQueue_t CompletionQueue_t;
+CompletionQueue_t *CompletionQueue_new();
+// The queries that have not completed keep the queue alive, so it can be freed
+// with queries in flight, but then their completions are not reported.
+void CompletionQueue_free(CompletionQueue_t *queue);
+// Stops accepting queries, CompletionQueue_wait returns 0 once every query
+// submitted before this has completed and been returned.
+void CompletionQueue_close(CompletionQueue_t *queue);
+// error is NULL if the query succeeded, otherwise it must be released with
+// free.
+typedef struct {
+  unsigned long long ticket;
+  const char *error;
+} Completion_t;
+// Waits for queries to complete and writes up to max of their completions to
+// completions, and returns how many it wrote. Returns 0 if timeout_ms expires
+// first, or once the queue is closed and drained. A negative timeout_ms waits
+// without a timeout.
+unsigned int CompletionQueue_wait(CompletionQueue_t *queue,
+                                  long long timeout_ms,
+                                  Completion_t *completions, unsigned int max);
+
 typedef struct NeuralDB_t NeuralDB_t;
 NeuralDB_t *NeuralDB_new(const char *save_path, const char **err_ptr);
+NeuralDB_t *NeuralDB_new_with_options(const char *save_path,
+                                      const NeuralDBOptions_t *options,
+                                      const char **err_ptr);
 void NeuralDB_free(NeuralDB_t *ndb);
+
+typedef struct {
+  unsigned long long hits;
+  unsigned long long misses;
+  unsigned long long entries;
+} QueryCacheStats_t;
+
+void NeuralDB_query_cache_stats(NeuralDB_t *ndb, QueryCacheStats_t *out);
+void NeuralDB_compaction_stats(NeuralDB_t *ndb, CompactionStats_t *out);
+// Returns the counters and latency histograms of every call to the ndb since
+// it was opened.
+void NeuralDB_stats(NeuralDB_t *ndb, NeuralDBStats_t *out);
+// See OpenTimings in PlatformNeuralDB.h.
+typedef struct {
+  double engine_ms;
+  double metadata_index_ms;
+  double vector_index_ms;
+  double doc_catalog_ms;
+  double chunk_store_ms;
+  double ingest_queue_ms;
+  double total_ms;
+} OpenTimings_t;
+void NeuralDB_open_timings(NeuralDB_t *ndb, OpenTimings_t *out);
 void NeuralDB_insert(NeuralDB_t *ndb, Document_t *doc, const char **err_ptr);
+// Inserts a batch of documents packed in the format described by
+// decodeDocumentBatch in DocumentBatch.h.
+void NeuralDB_insert_batch(NeuralDB_t *ndb, const char *data,
+                           unsigned long long len, const char **err_ptr);
+// Stages a packed batch of documents to be indexed in the background and
+// returns its sequence number, which can be passed to NeuralDB_wait_for_indexed.
+unsigned long long NeuralDB_insert_async(NeuralDB_t *ndb, const char *data,
+                                         unsigned long long len,
+                                         const char **err_ptr);
+void NeuralDB_wait_for_indexed(NeuralDB_t *ndb, unsigned long long seq,
+                               const char **err_ptr);
+void NeuralDB_flush(NeuralDB_t *ndb, const char **err_ptr);
+// fields is a bitmask of the QueryResultField values to return.
 QueryResults_t *NeuralDB_query(NeuralDB_t *ndb, const char *query,
                                unsigned int topk,
                                const Constraints_t *constraints,
-                               const char **err_ptr);
+                               unsigned int fields, const char **err_ptr);
+// Results that score below min_score are not returned. If max_candidates is
+// not 0, constrained queries only consider that many candidates. If
+// latest_versions_only is set, only chunks from the latest version of their
+// document are returned. See QueryLimits in PlatformNeuralDB.h.
+typedef struct {
+  float min_score;
+  unsigned int max_candidates;
+  bool latest_versions_only;
+} QueryLimits_t;
+QueryResults_t *NeuralDB_query_with_limits(NeuralDB_t *ndb, const char *query,
+                                           unsigned int topk,
+                                           const Constraints_t *constraints,
+                                           const QueryLimits_t *limits,
+                                           unsigned int fields,
+                                           const char **err_ptr);
+// Same as NeuralDB_query_with_limits, but writes the results into a handle
+// from QueryResults_new, replacing its contents. The query is passed with its
+// length so it does not have to be copied into a C string first, and limits
+// may be NULL.
+void NeuralDB_query_into(NeuralDB_t *ndb, const char *query,
+                         unsigned long long query_len, unsigned int topk,
+                         const Constraints_t *constraints,
+                         const QueryLimits_t *limits, unsigned int fields,
+                         QueryResults_t *results, const char **err_ptr);
+// Same as NeuralDB_query_into, but returns without waiting for the query,
+// which runs on an executor thread and adds a completion with the ticket to
+// the queue once it has written its results. The results handle must not be
+// used or freed until then. The arguments are copied and the ndb stays open
+// until the query completes, so they can be freed once this returns. Fails if
+// the queue is closed or Executor_configure did not set executor threads.
+void NeuralDB_query_async(NeuralDB_t *ndb, const char *query,
+                          unsigned long long query_len, unsigned int topk,
+                          const Constraints_t *constraints,
+                          const QueryLimits_t *limits, unsigned int fields,
+                          QueryResults_t *results, CompletionQueue_t *queue,
+                          unsigned long long ticket, const char **err_ptr);
+// See HybridOptions in PlatformNeuralDB.h.
+typedef struct {
+  float lexical_weight;
+  float vector_weight;
+  unsigned int rrf_k;
+  unsigned int candidates;
+} HybridOptions_t;
+// Writes the results of a hybrid query, scored by their fused score, into a
+// handle from QueryResults_new like NeuralDB_query_into. The embedding has
+// embedding_len floats, and options may be NULL to use the default options.
+void NeuralDB_hybrid_query_into(NeuralDB_t *ndb, const char *query,
+                                unsigned long long query_len,
+                                const float *embedding,
+                                unsigned int embedding_len, unsigned int topk,
+                                const Constraints_t *constraints,
+                                const HybridOptions_t *options,
+                                unsigned int fields, QueryResults_t *results,
+                                const char **err_ptr);
+QueryResultsBatch_t *NeuralDB_query_batch(NeuralDB_t *ndb,
+                                          const StringList_t *queries,
+                                          unsigned int topk,
+                                          const Constraints_t *constraints,
+                                          unsigned int fields,
+                                          const char **err_ptr);
 void NeuralDB_finetune(NeuralDB_t *ndb, const StringList_t *queries,
                        const LabelList_t *chunk_ids, const char **err_ptr);
 void NeuralDB_associate(NeuralDB_t *ndb, const StringList_t *sources,
@@ -81,10 +384,96 @@ void NeuralDB_associate(NeuralDB_t *ndb, const StringList_t *sources,
                         const char **err_ptr);
 void NeuralDB_delete_doc(NeuralDB_t *ndb, const char *doc_id,
                          bool keep_latest_version, const char **err_ptr);
+void NeuralDB_delete_doc_version(NeuralDB_t *ndb, const char *doc_id,
+                                 unsigned int doc_version,
+                                 const char **err_ptr);
+// Applies the feedback buffered by an ndb opened with buffer_feedback.
+void NeuralDB_apply_pending_feedback(NeuralDB_t *ndb, const char **err_ptr);
+unsigned long long NeuralDB_pending_feedback(NeuralDB_t *ndb);
+// Reclaims the chunks of deleted documents without waiting for background
+// compaction.
+void NeuralDB_prune(NeuralDB_t *ndb, const char **err_ptr);
 Sources_t *NeuralDB_sources(NeuralDB_t *ndb, const char **err_ptr);
+// Returns up to limit of the sources returned by NeuralDB_sources, which are
+// ordered by doc id and then version, starting at offset.
+Sources_t *NeuralDB_sources_page(NeuralDB_t *ndb, unsigned long long offset,
+                                 unsigned long long limit,
+                                 const char **err_ptr);
+// Returns up to limit of the sources returned by NeuralDB_sources that follow
+// version doc_version of doc_id.
+Sources_t *NeuralDB_sources_after(NeuralDB_t *ndb, const char *doc_id,
+                                  unsigned int doc_version,
+                                  unsigned long long limit,
+                                  const char **err_ptr);
+unsigned long long NeuralDB_num_sources(NeuralDB_t *ndb);
+// Returns false if the ndb does not contain the document, otherwise sets
+// version to its latest version.
+bool NeuralDB_latest_version(NeuralDB_t *ndb, const char *doc_id,
+                             unsigned int *version);
 void NeuralDB_save(NeuralDB_t *ndb, const char *save_path,
                    const char **err_ptr);
 
+// Reads the chunks of an ndb created with store_chunks in order of id, see
+// ChunkCursor in ChunkStore.h. doc_id and constraints may be NULL, and only
+// chunks with ids of at least start_id are returned. The cursor keeps the ndb
+// open until it is freed, and must not be used by two threads at once.
+typedef struct ChunkCursor_t ChunkCursor_t;
+ChunkCursor_t *NeuralDB_chunk_cursor(NeuralDB_t *ndb, const char *doc_id,
+                                     const Constraints_t *constraints,
+                                     unsigned long long start_id,
+                                     const char **err_ptr);
+void ChunkCursor_free(ChunkCursor_t *cursor);
+// Writes up to max of the next chunks into a handle from QueryResults_new,
+// with scores of 0, replacing its contents. The results are empty once every
+// chunk has been returned.
+void ChunkCursor_next(ChunkCursor_t *cursor, unsigned int max,
+                      unsigned int fields, QueryResults_t *results,
+                      const char **err_ptr);
+
+// A pool of ndbs that share a query cache and are closed when they are not in
+// use, see NeuralDBPool in NeuralDBPool.h. NeuralDB_free releases an ndb
+// returned by NeuralDBPool_acquire, which can also be done after the pool has
+// been freed.
+typedef struct {
+  unsigned long long max_open;
+  unsigned long long max_open_bytes;
+  unsigned long long idle_timeout_ms;
+  unsigned long long query_cache_size;
+} NeuralDBPoolOptions_t;
+
+typedef struct {
+  unsigned long long open;
+  unsigned long long pinned;
+  unsigned long long open_bytes;
+  unsigned long long hits;
+  unsigned long long opens;
+  unsigned long long evictions;
+} NeuralDBPoolStats_t;
+
+typedef struct NeuralDBPool_t NeuralDBPool_t;
+NeuralDBPool_t *NeuralDBPool_new(const NeuralDBPoolOptions_t *options,
+                                 const char **err_ptr);
+void NeuralDBPool_free(NeuralDBPool_t *pool);
+NeuralDB_t *NeuralDBPool_acquire(NeuralDBPool_t *pool, const char *save_path,
+                                 const NeuralDBOptions_t *options,
+                                 const char **err_ptr);
+void NeuralDBPool_evict_idle(NeuralDBPool_t *pool);
+void NeuralDBPool_stats(NeuralDBPool_t *pool, NeuralDBPoolStats_t *out);
+void NeuralDBPool_query_cache_stats(NeuralDBPool_t *pool,
+                                    QueryCacheStats_t *out);
+
+// The manifest that NeuralDB_save writes into each checkpoint, listing its
+// files with their sizes and content hashes.
+typedef struct CheckpointManifest_t CheckpointManifest_t;
+CheckpointManifest_t *CheckpointManifest_load(const char *manifest_path,
+                                              const char **err_ptr);
+void CheckpointManifest_free(CheckpointManifest_t *manifest);
+const char *CheckpointManifest_id(CheckpointManifest_t *manifest);
+StringList_t *CheckpointManifest_files(CheckpointManifest_t *manifest);
+// Returns the files of the checkpoint that are not shared with base.
+StringList_t *CheckpointManifest_delta(CheckpointManifest_t *manifest,
+                                       const CheckpointManifest_t *base);
+
 void set_license_key(const char *key, const char **err_ptr);
 
 void set_license_path(const char *path, const char **err_ptr);
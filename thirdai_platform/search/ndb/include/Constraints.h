@@ -131,6 +131,8 @@ public:
     return _value.equals(value);
   }
 
+  const MetadataValue &value() const { return _value; }
+
 private:
   MetadataValue _value;
 };
@@ -147,6 +149,8 @@ public:
     return value.lessThan(_value);
   }
 
+  const MetadataValue &value() const { return _value; }
+
 private:
   MetadataValue _value;
 };
@@ -163,8 +167,146 @@ public:
     return value.greaterThan(_value);
   }
 
+  const MetadataValue &value() const { return _value; }
+
 private:
   MetadataValue _value;
 };
 
+class NotEqual final : public Constraint {
+public:
+  explicit NotEqual(MetadataValue value) : _value(std::move(value)) {}
+
+  static std::shared_ptr<NotEqual> make(MetadataValue value) {
+    return std::make_shared<NotEqual>(std::move(value));
+  }
+
+  bool matches(const MetadataValue &value) const final {
+    return !_value.equals(value);
+  }
+
+  const MetadataValue &value() const { return _value; }
+
+private:
+  MetadataValue _value;
+};
+
+/**
+ * Matches values of the same type as the bounds that lie in the inclusive
+ * range [lower, upper].
+ */
+class Between final : public Constraint {
+public:
+  Between(MetadataValue lower, MetadataValue upper)
+      : _lower(std::move(lower)), _upper(std::move(upper)) {}
+
+  static std::shared_ptr<Between> make(MetadataValue lower,
+                                       MetadataValue upper) {
+    return std::make_shared<Between>(std::move(lower), std::move(upper));
+  }
+
+  bool matches(const MetadataValue &value) const final {
+    return (value.greaterThan(_lower) || value.equals(_lower)) &&
+           (value.lessThan(_upper) || value.equals(_upper));
+  }
+
+  const MetadataValue &lower() const { return _lower; }
+
+  const MetadataValue &upper() const { return _upper; }
+
+private:
+  MetadataValue _lower;
+  MetadataValue _upper;
+};
+
+class In final : public Constraint {
+public:
+  explicit In(std::vector<MetadataValue> values) : _values(std::move(values)) {}
+
+  static std::shared_ptr<In> make(std::vector<MetadataValue> values) {
+    return std::make_shared<In>(std::move(values));
+  }
+
+  bool matches(const MetadataValue &value) const final {
+    return std::any_of(
+        _values.begin(), _values.end(),
+        [&value](const MetadataValue &other) { return other.equals(value); });
+  }
+
+  const std::vector<MetadataValue> &values() const { return _values; }
+
+private:
+  std::vector<MetadataValue> _values;
+};
+
+class StartsWith final : public Constraint {
+public:
+  explicit StartsWith(std::string prefix) : _prefix(std::move(prefix)) {}
+
+  static std::shared_ptr<StartsWith> make(std::string prefix) {
+    return std::make_shared<StartsWith>(std::move(prefix));
+  }
+
+  bool matches(const MetadataValue &value) const final {
+    return value.type() == MetadataType::Str &&
+           value.asStr().compare(0, _prefix.size(), _prefix) == 0;
+  }
+
+  const std::string &prefix() const { return _prefix; }
+
+private:
+  std::string _prefix;
+};
+
+/**
+ * Matches values that satisfy every one of the given constraints. This is how
+ * multiple constraints are applied to the same key in QueryConstraints.
+ */
+class AllOf final : public Constraint {
+public:
+  explicit AllOf(std::vector<std::shared_ptr<Constraint>> constraints)
+      : _constraints(std::move(constraints)) {}
+
+  static std::shared_ptr<AllOf>
+  make(std::vector<std::shared_ptr<Constraint>> constraints) {
+    return std::make_shared<AllOf>(std::move(constraints));
+  }
+
+  bool matches(const MetadataValue &value) const final {
+    return std::all_of(_constraints.begin(), _constraints.end(),
+                       [&value](const std::shared_ptr<Constraint> &constraint) {
+                         return constraint->matches(value);
+                       });
+  }
+
+  const std::vector<std::shared_ptr<Constraint>> &constraints() const {
+    return _constraints;
+  }
+
+private:
+  std::vector<std::shared_ptr<Constraint>> _constraints;
+};
+
+/**
+ * Adds the constraint for the key, combining it with any constraint that is
+ * already present for the key so that both must be satisfied.
+ */
+inline void addConstraint(QueryConstraints &constraints, const std::string &key,
+                          std::shared_ptr<Constraint> constraint) {
+  auto it = constraints.find(key);
+  if (it == constraints.end()) {
+    constraints.emplace(key, std::move(constraint));
+    return;
+  }
+
+  std::vector<std::shared_ptr<Constraint>> combined;
+  if (auto all = std::dynamic_pointer_cast<AllOf>(it->second)) {
+    combined = all->constraints();
+  } else {
+    combined.push_back(it->second);
+  }
+  combined.push_back(std::move(constraint));
+  it->second = AllOf::make(std::move(combined));
+}
+
 } // namespace thirdai::search::ndb
@@ -2,6 +2,7 @@
 
 #include "Chunk.h"
 #include "Constraints.h"
+#include <exception>
 #include <optional>
 #include <vector>
 
@@ -59,6 +60,41 @@ public:
 
   virtual std::vector<Source> sources() = 0;
 
+  /**
+   * Answers a batch of queries in a single parallel pass. Queries are
+   * dispatched to rank if any constraints are given, otherwise to query. This
+   * is intentionally not virtual so that it does not change the vtable layout
+   * of implementations that are compiled separately from this header.
+   */
+  std::vector<std::vector<std::pair<Chunk, float>>>
+  queryBatch(const std::vector<std::string> &queries,
+             const QueryConstraints &constraints, uint32_t top_k) {
+    std::vector<std::vector<std::pair<Chunk, float>>> results(queries.size());
+
+    std::exception_ptr error;
+
+#pragma omp parallel for default(none)                                         \
+    shared(queries, constraints, top_k, results, error) schedule(dynamic)
+    for (size_t i = 0; i < queries.size(); i++) {
+      try {
+        if (constraints.empty()) {
+          results[i] = query(queries[i], top_k);
+        } else {
+          results[i] = rank(queries[i], constraints, top_k);
+        }
+      } catch (...) {
+#pragma omp critical
+        error = std::current_exception();
+      }
+    }
+
+    if (error) {
+      std::rethrow_exception(error);
+    }
+
+    return results;
+  }
+
   virtual ~NeuralDB() = default;
 };
 
@@ -15,6 +15,9 @@ public:
 
   explicit OnDiskNeuralDB(const std::string &save_path);
 
+  static std::shared_ptr<OnDiskNeuralDB> load(const std::string &save_path,
+                                              bool read_only);
+
   InsertMetadata insert(const std::vector<std::string> &chunks,
                         const std::vector<MetadataMap> &metadata,
                         const std::string &document, const DocId &doc_id,
@@ -4,16 +4,30 @@ package ndb
 // #cgo darwin LDFLAGS: -L./lib/macos_arm64 -lthirdai -lrocksdb -lutf8proc -lcryptopp -L/opt/homebrew/opt/libomp/lib/ -lomp -L/opt/homebrew/Cellar/openssl@3/3.4.0/lib/ -lssl -lcrypto
 // #cgo CFLAGS: -O3
 // #cgo CXXFLAGS: -O3 -fPIC -std=c++17 -I./include -fvisibility=hidden
+// #cgo linux CXXFLAGS: -fopenmp
+// #cgo darwin CXXFLAGS: -Xpreprocessor -fopenmp -I/opt/homebrew/opt/libomp/include/
 // #include "binding.h"
 // #include <stdlib.h>
 import "C"
 import (
+	"encoding/binary"
 	"errors"
 	"fmt"
+	"math"
+	"runtime"
 	"strings"
+	"sync"
+	"time"
 	"unsafe"
 )
 
+// NeuralDB is safe for concurrent use. Queries and Sources run concurrently
+// with each other and with updates, and updates and Save are serialized
+// internally, so a long insert or finetune does not block queries. Deletions,
+// Prune, and background compaction are the exception, queries wait while they
+// are in progress. A query that overlaps an update may or may not observe it, a
+// query that starts after an update returns always observes it. Free must not
+// be called concurrently with any other method.
 type NeuralDB struct {
 	ndb *C.NeuralDB_t
 }
@@ -32,10 +46,385 @@ func New(savePath string) (NeuralDB, error) {
 	return NeuralDB{ndb: ndb}, nil
 }
 
+type Options struct {
+	// Metadata keys to maintain secondary indexes for. Constrained queries on
+	// indexed keys can be answered without checking the metadata of every
+	// candidate chunk. Indexes can only be declared when the ndb is created,
+	// after that they are loaded with the ndb.
+	MetadataIndexes []string
+
+	// The maximum number of query results to cache, 0 disables the cache.
+	// Cached results are invalidated by any update to the ndb.
+	QueryCacheSize int
+
+	// Opens an existing ndb without modifying any of its files, so that it can
+	// be served directly from a shared location without copying it first, and
+	// by several processes at once. Queries and Save are allowed, updates
+	// return an error.
+	ReadOnly bool
+
+	// The minimum time between background passes that reclaim the chunks of
+	// deleted documents. Each pass blocks queries while it runs, so background
+	// compaction is only enabled by a positive interval, otherwise deleted
+	// chunks are only reclaimed by Prune.
+	CompactionInterval time.Duration
+
+	// The number of shards to split the documents of a new ndb across, so that
+	// each query is evaluated on the shards in parallel. 0 creates a single
+	// shard, or opens an existing ndb with the shards it was created with,
+	// otherwise it must match the shards of an existing ndb.
+	NumShards int
+
+	// The dimension of the embeddings that can be inserted with the chunks of
+	// a new ndb through Document.Embeddings, which are indexed for
+	// HybridQuery. 0 creates an ndb without embeddings, or opens an existing
+	// ndb with the dimension it was created with, otherwise it must match the
+	// dimension of an existing ndb.
+	EmbeddingDim int
+
+	// Keeps a copy of the chunks of a new ndb that ChunkCursor reads them back
+	// from. It can only be set when the ndb is created, an ndb created with it
+	// always keeps the copy. A new ndb with an EmbeddingDim also reads the
+	// chunks that HybridQuery finds by their embeddings from the copy, instead
+	// of keeping a second copy of the embedded chunks.
+	StoreChunks bool
+
+	// Buffers the feedback of Finetune and Associate in a durable log in the
+	// ndb directory, so that they return without updating the model. The
+	// feedback is applied in deduplicated batches by ApplyPendingFeedback,
+	// once FeedbackBatchSize queries and associations are pending if it is not
+	// 0, and in the background once feedback has been pending for
+	// FeedbackInterval if it is not 0. Batches cut by time depend on when the
+	// calls are made, so replicas that must stay identical should only use
+	// FeedbackBatchSize and ApplyPendingFeedback.
+	BufferFeedback    bool
+	FeedbackBatchSize int
+	FeedbackInterval  time.Duration
+}
+
+func NewWithOptions(savePath string, options Options) (NeuralDB, error) {
+	savePathCStr := C.CString(savePath)
+	defer C.free(unsafe.Pointer(savePathCStr))
+
+	cOptions, err := newOptions(options)
+	if err != nil {
+		return NeuralDB{}, err
+	}
+	defer C.NeuralDBOptions_free(cOptions)
+
+	var cErr *C.char
+	ndb := C.NeuralDB_new_with_options(savePathCStr, cOptions, &cErr)
+	if cErr != nil {
+		defer C.free(unsafe.Pointer(cErr))
+		return NeuralDB{}, errors.New(C.GoString(cErr))
+	}
+
+	return NeuralDB{ndb: ndb}, nil
+}
+
+func newOptions(options Options) (*C.NeuralDBOptions_t, error) {
+	if options.QueryCacheSize < 0 {
+		return nil, errors.New("query cache size must be >= 0")
+	}
+	if options.NumShards < 0 {
+		return nil, errors.New("number of shards must be >= 0")
+	}
+	if options.EmbeddingDim < 0 {
+		return nil, errors.New("embedding dimension must be >= 0")
+	}
+	if options.FeedbackBatchSize < 0 || options.FeedbackInterval < 0 {
+		return nil, errors.New("feedback batch size and interval must be >= 0")
+	}
+
+	cOptions := C.NeuralDBOptions_new()
+
+	for _, key := range options.MetadataIndexes {
+		keyCStr := C.CString(key)
+		C.NeuralDBOptions_add_metadata_index(cOptions, keyCStr)
+		C.free(unsafe.Pointer(keyCStr))
+	}
+
+	C.NeuralDBOptions_set_query_cache_size(cOptions, C.ulonglong(options.QueryCacheSize))
+	C.NeuralDBOptions_set_read_only(cOptions, C.bool(options.ReadOnly))
+	if options.CompactionInterval > 0 {
+		intervalMs := max(options.CompactionInterval.Milliseconds(), 1)
+		C.NeuralDBOptions_set_compaction_interval(cOptions, C.ulonglong(intervalMs))
+	}
+	C.NeuralDBOptions_set_num_shards(cOptions, C.uint(options.NumShards))
+	C.NeuralDBOptions_set_embedding_dim(cOptions, C.uint(options.EmbeddingDim))
+	C.NeuralDBOptions_set_store_chunks(cOptions, C.bool(options.StoreChunks))
+	feedbackIntervalMs := options.FeedbackInterval.Milliseconds()
+	if options.FeedbackInterval > 0 {
+		feedbackIntervalMs = max(feedbackIntervalMs, 1)
+	}
+	C.NeuralDBOptions_set_buffer_feedback(
+		cOptions, C.bool(options.BufferFeedback), C.ulonglong(options.FeedbackBatchSize), C.ulonglong(feedbackIntervalMs),
+	)
+
+	return cOptions, nil
+}
+
 func (ndb *NeuralDB) Free() {
 	C.NeuralDB_free(ndb.ndb)
 }
 
+type QueryCacheStats struct {
+	Hits    uint64
+	Misses  uint64
+	Entries uint64
+}
+
+func convertQueryCacheStats(stats C.QueryCacheStats_t) QueryCacheStats {
+	return QueryCacheStats{Hits: uint64(stats.hits), Misses: uint64(stats.misses), Entries: uint64(stats.entries)}
+}
+
+// QueryCacheStats returns the query cache counters, which are all 0 if the
+// cache is disabled. If the cache is shared the counters are for every ndb
+// that shares it.
+func (ndb *NeuralDB) QueryCacheStats() QueryCacheStats {
+	var stats C.QueryCacheStats_t
+	C.NeuralDB_query_cache_stats(ndb.ndb, &stats)
+	return convertQueryCacheStats(stats)
+}
+
+type CompactionStats struct {
+	// Completed passes, including passes run by Prune.
+	Passes uint64
+	// Passes that failed, their deletions are retried by the next pass.
+	Failures uint64
+	// Deletions that have not been reclaimed by a completed pass yet.
+	PendingDeletions uint64
+	LastDuration     time.Duration
+	TotalDuration    time.Duration
+	Running          bool
+}
+
+// CompactionStats returns the progress of the compaction that reclaims the
+// chunks of deleted documents, the counters are all 0 if the ndb is read only.
+func (ndb *NeuralDB) CompactionStats() CompactionStats {
+	var stats C.CompactionStats_t
+	C.NeuralDB_compaction_stats(ndb.ndb, &stats)
+	return CompactionStats{
+		Passes:           uint64(stats.passes),
+		Failures:         uint64(stats.failures),
+		PendingDeletions: uint64(stats.pending_deletions),
+		LastDuration:     time.Duration(float64(stats.last_duration_ms) * float64(time.Millisecond)),
+		TotalDuration:    time.Duration(float64(stats.total_duration_ms) * float64(time.Millisecond)),
+		Running:          bool(stats.running),
+	}
+}
+
+// LatencyHistogram is the distribution of the latencies of a stage. Buckets[0]
+// counts calls that took less than LatencyBucketBound(0), and Buckets[i] counts
+// calls that took at least LatencyBucketBound(i-1) and less than
+// LatencyBucketBound(i). The last bucket has no upper bound.
+type LatencyHistogram struct {
+	Count   uint64
+	Sum     time.Duration
+	Buckets []uint64
+}
+
+// LatencyBucketBound returns the exclusive upper bound of the latencies
+// counted by bucket i of a LatencyHistogram.
+func LatencyBucketBound(i int) time.Duration {
+	return time.Microsecond << i
+}
+
+// Stats are the counters and stage latencies of every call to an ndb since it
+// was opened, keyed by name, such as "engine_query" or "cache_hits".
+type Stats struct {
+	Stages   map[string]LatencyHistogram
+	Counters map[string]uint64
+}
+
+// Stats returns the counters and stage latencies of the ndb. They can be
+// read while other calls are in flight, so a snapshot may include part of a
+// call.
+func (ndb *NeuralDB) Stats() Stats {
+	var stats C.NeuralDBStats_t
+	C.NeuralDB_stats(ndb.ndb, &stats)
+
+	out := Stats{
+		Stages:   make(map[string]LatencyHistogram, C.NeuralDBStages),
+		Counters: make(map[string]uint64, C.NeuralDBCounters),
+	}
+	for i := 0; i < C.NeuralDBStages; i++ {
+		stage := stats.stages[i]
+		buckets := make([]uint64, C.NeuralDBLatencyBuckets)
+		for b := range buckets {
+			buckets[b] = uint64(stage.buckets[b])
+		}
+		out.Stages[C.GoString(C.NeuralDBStats_stage_name(C.uint(i)))] = LatencyHistogram{
+			Count:   uint64(stage.count),
+			Sum:     time.Duration(float64(stage.sum_ms) * float64(time.Millisecond)),
+			Buckets: buckets,
+		}
+	}
+	for i := 0; i < C.NeuralDBCounters; i++ {
+		out.Counters[C.GoString(C.NeuralDBStats_counter_name(C.uint(i)))] = uint64(stats.counters[i])
+	}
+	return out
+}
+
+// OpenTimings is how long each phase of opening an ndb took.
+type OpenTimings struct {
+	// Opening the shards of the engine, which are opened in parallel, and the
+	// platform's indexes, which are opened alongside the engine when the ndb
+	// already exists.
+	Engine        time.Duration
+	MetadataIndex time.Duration
+	VectorIndex   time.Duration
+	// Opening the catalog of documents, or building it from the engine's
+	// sources for an ndb created before the catalog existed.
+	DocCatalog time.Duration
+	ChunkStore time.Duration
+	// Reading the documents staged by InsertAsync that were not indexed when
+	// the ndb was closed, which are indexed in the background.
+	IngestQueue time.Duration
+	Total       time.Duration
+}
+
+func (ndb *NeuralDB) OpenTimings() OpenTimings {
+	var timings C.OpenTimings_t
+	C.NeuralDB_open_timings(ndb.ndb, &timings)
+
+	duration := func(ms C.double) time.Duration {
+		return time.Duration(float64(ms) * float64(time.Millisecond))
+	}
+	return OpenTimings{
+		Engine:        duration(timings.engine_ms),
+		MetadataIndex: duration(timings.metadata_index_ms),
+		VectorIndex:   duration(timings.vector_index_ms),
+		DocCatalog:    duration(timings.doc_catalog_ms),
+		ChunkStore:    duration(timings.chunk_store_ms),
+		IngestQueue:   duration(timings.ingest_queue_ms),
+		Total:         duration(timings.total_ms),
+	}
+}
+
+type PoolOptions struct {
+	// The maximum number of ndbs to keep open, 0 for no limit.
+	MaxOpen int
+
+	// The maximum total size of the ndbs to keep open, 0 for no limit. The
+	// size of an ndb is estimated by the size of its files when it is opened.
+	MaxOpenBytes int64
+
+	// Ndbs that have not been used for this long are closed, 0 only closes
+	// ndbs to stay within MaxOpen and MaxOpenBytes.
+	IdleTimeout time.Duration
+
+	// The maximum number of query results to cache across every ndb in the
+	// pool, 0 disables the cache.
+	QueryCacheSize int
+}
+
+// Pool serves many ndbs from one process. The ndbs are opened when they are
+// first acquired and share a single query cache, and ndbs that are not in use
+// are closed to keep the pool within its limits, least recently used first,
+// and opened again the next time they are acquired. Only read only ndbs are
+// closed, writable ndbs stay open until the pool is freed since the engine
+// cannot open them again in the same process. Pool is safe for concurrent use.
+type Pool struct {
+	pool *C.NeuralDBPool_t
+}
+
+func NewPool(options PoolOptions) (*Pool, error) {
+	if options.MaxOpen < 0 || options.MaxOpenBytes < 0 || options.IdleTimeout < 0 || options.QueryCacheSize < 0 {
+		return nil, errors.New("pool limits must be >= 0")
+	}
+
+	cOptions := C.NeuralDBPoolOptions_t{
+		max_open:         C.ulonglong(options.MaxOpen),
+		max_open_bytes:   C.ulonglong(options.MaxOpenBytes),
+		query_cache_size: C.ulonglong(options.QueryCacheSize),
+	}
+	if options.IdleTimeout > 0 {
+		cOptions.idle_timeout_ms = C.ulonglong(max(options.IdleTimeout.Milliseconds(), 1))
+	}
+
+	var err *C.char
+	pool := C.NeuralDBPool_new(&cOptions, &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return nil, errors.New(C.GoString(err))
+	}
+
+	return &Pool{pool: pool}, nil
+}
+
+// Free closes the ndbs that are not in use, the others are closed once they
+// are released.
+func (pool *Pool) Free() {
+	C.NeuralDBPool_free(pool.pool)
+}
+
+// Acquire returns the ndb in savePath, opening it with the options if it is
+// not open. The pool does not close the ndb until it is released by calling
+// Free on the returned NeuralDB. The options cannot set a query cache, and
+// must have the same ReadOnly as the options the ndb is open with if it is
+// already open.
+func (pool *Pool) Acquire(savePath string, options Options) (NeuralDB, error) {
+	savePathCStr := C.CString(savePath)
+	defer C.free(unsafe.Pointer(savePathCStr))
+
+	cOptions, err := newOptions(options)
+	if err != nil {
+		return NeuralDB{}, err
+	}
+	defer C.NeuralDBOptions_free(cOptions)
+
+	var cErr *C.char
+	ndb := C.NeuralDBPool_acquire(pool.pool, savePathCStr, cOptions, &cErr)
+	if cErr != nil {
+		defer C.free(unsafe.Pointer(cErr))
+		return NeuralDB{}, errors.New(C.GoString(cErr))
+	}
+
+	return NeuralDB{ndb: ndb}, nil
+}
+
+// EvictIdle closes the ndbs that have been idle for longer than the idle
+// timeout, and the least recently used ndbs that are not in use while the pool
+// exceeds its limits.
+func (pool *Pool) EvictIdle() {
+	C.NeuralDBPool_evict_idle(pool.pool)
+}
+
+type PoolStats struct {
+	// The ndbs that are open, and how many of them are pinned because they are
+	// writable.
+	Open   int
+	Pinned int
+	// The estimated size of the open ndbs.
+	OpenBytes int64
+	// The number of acquires that found the ndb open, and that opened it.
+	Hits  uint64
+	Opens uint64
+	// The number of ndbs closed to stay within the limits or because they were
+	// idle.
+	Evictions uint64
+}
+
+func (pool *Pool) Stats() PoolStats {
+	var stats C.NeuralDBPoolStats_t
+	C.NeuralDBPool_stats(pool.pool, &stats)
+	return PoolStats{
+		Open:      int(stats.open),
+		Pinned:    int(stats.pinned),
+		OpenBytes: int64(stats.open_bytes),
+		Hits:      uint64(stats.hits),
+		Opens:     uint64(stats.opens),
+		Evictions: uint64(stats.evictions),
+	}
+}
+
+func (pool *Pool) QueryCacheStats() QueryCacheStats {
+	var stats C.QueryCacheStats_t
+	C.NeuralDBPool_query_cache_stats(pool.pool, &stats)
+	return convertQueryCacheStats(stats)
+}
+
 func newMetadataValue(value interface{}) (*C.MetadataValue_t, error) {
 	switch value := value.(type) {
 	case bool:
@@ -146,139 +535,886 @@ func (ndb *NeuralDB) Insert(document, docId string, chunks []string, metadata []
 		return errors.New(C.GoString(err))
 	}
 
-	return nil
+	return nil
+}
+
+// Document is a document to insert with InsertBatch. Metadata and Version are
+// optional, the arguments are the same as the arguments of Insert.
+// Embeddings is also optional, and if it is set it has an embedding of each
+// chunk for the vector index of an ndb created with Options.EmbeddingDim.
+type Document struct {
+	Document   string
+	DocId      string
+	Chunks     []string
+	Metadata   []map[string]interface{}
+	Version    *uint
+	Embeddings [][]float32
+}
+
+func checkDocument(doc Document) error {
+	if err := CheckInsertArgs(doc.Document, doc.DocId, doc.Chunks, doc.Metadata); err != nil {
+		return err
+	}
+	if doc.Embeddings != nil && len(doc.Embeddings) != len(doc.Chunks) {
+		return fmt.Errorf("len of embeddings must match the len of chunks if embeddings are specified")
+	}
+	return nil
+}
+
+// InsertBatch inserts the documents with a single call into the ndb, which
+// avoids the per chunk and per metadata value calls made by Insert. If the
+// insertion of a document fails, the documents before it remain inserted.
+func (ndb *NeuralDB) InsertBatch(docs []Document) error {
+	for i, doc := range docs {
+		if err := checkDocument(doc); err != nil {
+			return fmt.Errorf("invalid document %d: %w", i, err)
+		}
+	}
+	if len(docs) == 0 {
+		return nil
+	}
+
+	data := encodeDocumentBatch(docs)
+
+	var err *C.char
+	C.NeuralDB_insert_batch(ndb.ndb, (*C.char)(unsafe.Pointer(&data[0])), C.ulonglong(len(data)), &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return errors.New(C.GoString(err))
+	}
+
+	return nil
+}
+
+// EncodeDocuments packs the documents in the binary format used by the ndb for
+// batches of documents, so that they can be stored or replicated and later
+// inserted with InsertEncoded without being converted again.
+func EncodeDocuments(docs []Document) ([]byte, error) {
+	for i, doc := range docs {
+		if err := checkDocument(doc); err != nil {
+			return nil, fmt.Errorf("invalid document %d: %w", i, err)
+		}
+	}
+	return encodeDocumentBatch(docs), nil
+}
+
+// InsertEncoded inserts a batch of documents encoded by EncodeDocuments. The
+// encoded batch is passed to the ndb as is.
+func (ndb *NeuralDB) InsertEncoded(data []byte) error {
+	if len(data) == 0 {
+		return errors.New("encoded document batch is empty")
+	}
+
+	var err *C.char
+	C.NeuralDB_insert_batch(ndb.ndb, (*C.char)(unsafe.Pointer(&data[0])), C.ulonglong(len(data)), &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return errors.New(C.GoString(err))
+	}
+
+	return nil
+}
+
+// InsertAsync durably stages the documents and returns without waiting for
+// them to be indexed, which happens on a background thread. The documents are
+// not returned by queries until they are indexed, the returned sequence number
+// can be passed to WaitForIndexed to wait for them. Any other update or Save
+// waits for the documents staged before it, so updates are applied in order,
+// and returns an error instead if indexing them is failing. Documents that fail
+// to be indexed stay staged and are retried with backoff.
+func (ndb *NeuralDB) InsertAsync(docs []Document) (uint64, error) {
+	for i, doc := range docs {
+		if err := checkDocument(doc); err != nil {
+			return 0, fmt.Errorf("invalid document %d: %w", i, err)
+		}
+	}
+
+	data := encodeDocumentBatch(docs)
+
+	var err *C.char
+	seq := C.NeuralDB_insert_async(ndb.ndb, (*C.char)(unsafe.Pointer(&data[0])), C.ulonglong(len(data)), &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return 0, errors.New(C.GoString(err))
+	}
+
+	return uint64(seq), nil
+}
+
+// WaitForIndexed waits until the documents staged by the InsertAsync call that
+// returned seq, and by every call before it, are indexed. It returns an error
+// if an attempt to index staged documents failed since the last error was
+// returned, in which case the documents are still retried.
+func (ndb *NeuralDB) WaitForIndexed(seq uint64) error {
+	var err *C.char
+	C.NeuralDB_wait_for_indexed(ndb.ndb, C.ulonglong(seq), &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return errors.New(C.GoString(err))
+	}
+	return nil
+}
+
+// Flush waits until every document staged by InsertAsync before the call is
+// indexed, and like WaitForIndexed returns an error if indexing failed.
+func (ndb *NeuralDB) Flush() error {
+	var err *C.char
+	C.NeuralDB_flush(ndb.ndb, &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return errors.New(C.GoString(err))
+	}
+	return nil
+}
+
+// encodeDocumentBatch packs the documents in the format described in
+// DocumentBatch.h. The documents must have been checked by checkDocument.
+func encodeDocumentBatch(docs []Document) []byte {
+	appendString := func(buf []byte, value string) []byte {
+		buf = binary.AppendUvarint(buf, uint64(len(value)))
+		return append(buf, value...)
+	}
+
+	keyIds := make(map[string]uint64)
+	keys := []string{}
+
+	body := binary.AppendUvarint(nil, uint64(len(docs)))
+	for _, doc := range docs {
+		body = appendString(body, doc.Document)
+		body = appendString(body, doc.DocId)
+		var version uint64
+		if doc.Version != nil {
+			version = uint64(uint32(*doc.Version)) + 1
+		}
+		body = binary.AppendUvarint(body, version)
+
+		body = binary.AppendUvarint(body, uint64(len(doc.Chunks)))
+		for i, chunk := range doc.Chunks {
+			body = appendString(body, chunk)
+
+			var metadata map[string]interface{}
+			if doc.Metadata != nil {
+				metadata = doc.Metadata[i]
+			}
+			body = binary.AppendUvarint(body, uint64(len(metadata)))
+			for key, value := range metadata {
+				id, ok := keyIds[key]
+				if !ok {
+					id = uint64(len(keys))
+					keyIds[key] = id
+					keys = append(keys, key)
+				}
+				body = binary.AppendUvarint(body, id)
+
+				switch value := value.(type) {
+				case bool:
+					if value {
+						body = append(body, 1)
+					} else {
+						body = append(body, 0)
+					}
+				case int:
+					body = append(body, 2)
+					body = binary.AppendVarint(body, int64(int32(value)))
+				case float32:
+					body = append(body, 3)
+					body = binary.LittleEndian.AppendUint32(body, math.Float32bits(value))
+				case float64:
+					body = append(body, 3)
+					body = binary.LittleEndian.AppendUint32(body, math.Float32bits(float32(value)))
+				case string:
+					body = append(body, 4)
+					body = appendString(body, value)
+				}
+			}
+		}
+	}
+
+	for _, doc := range docs {
+		if len(doc.Embeddings) > 0 {
+			body = appendEmbeddings(body, docs)
+			break
+		}
+	}
+
+	out := binary.AppendUvarint(nil, uint64(len(keys)))
+	for _, key := range keys {
+		out = appendString(out, key)
+	}
+	return append(out, body...)
+}
+
+// appendEmbeddings appends the embedding section of a document batch, which is
+// only written if a document has embeddings.
+func appendEmbeddings(buf []byte, docs []Document) []byte {
+	for _, doc := range docs {
+		buf = binary.AppendUvarint(buf, uint64(len(doc.Embeddings)))
+		for _, embedding := range doc.Embeddings {
+			buf = binary.AppendUvarint(buf, uint64(len(embedding)))
+			for _, value := range embedding {
+				buf = binary.LittleEndian.AppendUint32(buf, math.Float32bits(value))
+			}
+		}
+	}
+	return buf
+}
+
+type Constraint interface {
+	addToConstraints(constraints *C.Constraints_t, key string) error
+}
+
+type binaryConstraintOp int8
+
+const (
+	BinaryConstraintEq binaryConstraintOp = iota
+	BinaryConstraintLt
+	BinaryConstraintGt
+	BinaryConstraintNe
+)
+
+type binaryConstraint struct {
+	value interface{}
+	op    binaryConstraintOp
+}
+
+func (c binaryConstraint) addToConstraints(constraints *C.Constraints_t, key string) error {
+	keyCStr := C.CString(key)
+	defer C.free(unsafe.Pointer(keyCStr))
+
+	metadataValue, err := newMetadataValue(c.value)
+	if err != nil {
+		return fmt.Errorf("invalid constraint for key '%v': %w", key, err)
+	}
+	defer C.MetadataValue_free(metadataValue)
+
+	C.Constraints_add_binary_constraint(constraints, C.int(c.op), keyCStr, metadataValue)
+
+	return nil
+}
+
+func EqualTo(value interface{}) Constraint {
+	return binaryConstraint{value: value, op: BinaryConstraintEq}
+}
+
+func LessThan(value interface{}) Constraint {
+	return binaryConstraint{value: value, op: BinaryConstraintLt}
+}
+
+func GreaterThan(value interface{}) Constraint {
+	return binaryConstraint{value: value, op: BinaryConstraintGt}
+}
+
+func NotEqual(value interface{}) Constraint {
+	return binaryConstraint{value: value, op: BinaryConstraintNe}
+}
+
+type betweenConstraint struct {
+	lower, upper interface{}
+}
+
+func (c betweenConstraint) addToConstraints(constraints *C.Constraints_t, key string) error {
+	keyCStr := C.CString(key)
+	defer C.free(unsafe.Pointer(keyCStr))
+
+	lower, err := newMetadataValue(c.lower)
+	if err != nil {
+		return fmt.Errorf("invalid constraint for key '%v': %w", key, err)
+	}
+	defer C.MetadataValue_free(lower)
+
+	upper, err := newMetadataValue(c.upper)
+	if err != nil {
+		return fmt.Errorf("invalid constraint for key '%v': %w", key, err)
+	}
+	defer C.MetadataValue_free(upper)
+
+	C.Constraints_add_between_constraint(constraints, keyCStr, lower, upper)
+
+	return nil
+}
+
+// Between matches values of the same type as the bounds in the inclusive range
+// [lower, upper].
+func Between(lower, upper interface{}) Constraint {
+	return betweenConstraint{lower: lower, upper: upper}
+}
+
+type inConstraint struct {
+	values []interface{}
+}
+
+func (c inConstraint) addToConstraints(constraints *C.Constraints_t, key string) error {
+	keyCStr := C.CString(key)
+	defer C.free(unsafe.Pointer(keyCStr))
+
+	values := make([]*C.MetadataValue_t, 0, len(c.values))
+	defer func() {
+		for _, value := range values {
+			C.MetadataValue_free(value)
+		}
+	}()
+
+	for _, v := range c.values {
+		value, err := newMetadataValue(v)
+		if err != nil {
+			return fmt.Errorf("invalid constraint for key '%v': %w", key, err)
+		}
+		values = append(values, value)
+	}
+
+	var valuesPtr **C.MetadataValue_t
+	if len(values) > 0 {
+		valuesPtr = &values[0]
+	}
+	C.Constraints_add_in_constraint(constraints, keyCStr, valuesPtr, C.uint(len(values)))
+
+	return nil
+}
+
+// In matches values equal to any of the given values.
+func In(values ...interface{}) Constraint {
+	return inConstraint{values: values}
+}
+
+type prefixConstraint struct {
+	prefix string
+}
+
+func (c prefixConstraint) addToConstraints(constraints *C.Constraints_t, key string) error {
+	keyCStr := C.CString(key)
+	defer C.free(unsafe.Pointer(keyCStr))
+
+	prefixCStr := C.CString(c.prefix)
+	defer C.free(unsafe.Pointer(prefixCStr))
+
+	C.Constraints_add_prefix_constraint(constraints, keyCStr, prefixCStr)
+
+	return nil
+}
+
+// StartsWith matches string values that begin with the prefix.
+func StartsWith(prefix string) Constraint {
+	return prefixConstraint{prefix: prefix}
+}
+
+type allConstraint struct {
+	constraints []Constraint
+}
+
+func (c allConstraint) addToConstraints(constraints *C.Constraints_t, key string) error {
+	for _, constraint := range c.constraints {
+		if err := constraint.addToConstraints(constraints, key); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// All matches values that satisfy every one of the constraints, it is used to
+// apply multiple constraints to the same key.
+func All(constraints ...Constraint) Constraint {
+	return allConstraint{constraints: constraints}
+}
+
+type Constraints = map[string]Constraint
+
+func newConstraints(constraints Constraints) (*C.Constraints_t, error) {
+	constraintsMap := C.Constraints_new()
+
+	for k, v := range constraints {
+		err := v.addToConstraints(constraintsMap, k)
+		if err != nil {
+			return nil, err
+		}
+	}
+
+	return constraintsMap, nil
+}
+
+type Chunk struct {
+	Id         uint64
+	Text       string
+	Document   string
+	DocId      string
+	DocVersion uint32
+	Metadata   map[string]interface{}
+	Score      float32
+}
+
+// Field is a bitmask of the fields of the results to return from a query.
+// The Id, Score, and DocVersion of each result are always returned, fields that
+// are not requested are left empty and are not copied out of the engine's
+// results.
+type Field uint32
+
+const (
+	FieldText     Field = C.QueryResultFieldText
+	FieldDocument Field = C.QueryResultFieldDocument
+	FieldDocId    Field = C.QueryResultFieldDocId
+	FieldMetadata Field = C.QueryResultFieldMetadata
+	AllFields     Field = C.QueryResultFieldsAll
+)
+
+func (ndb *NeuralDB) Query(query string, topk int, constraints Constraints) ([]Chunk, error) {
+	return ndb.QueryFields(query, topk, constraints, AllFields)
+}
+
+// QueryFields is the same as Query, but only returns the requested fields of
+// each result.
+func (ndb *NeuralDB) QueryFields(query string, topk int, constraints Constraints, fields Field) ([]Chunk, error) {
+	return ndb.query(query, topk, constraints, nil, fields)
+}
+
+type QueryLimits struct {
+	// Results that score below MinScore are not returned. A constrained query
+	// stops considering candidates once one scores below MinScore.
+	MinScore float32
+
+	// The maximum number of candidates considered by a constrained query, 0
+	// for no limit. With a limit the results may omit matches that score
+	// below the candidates that were considered.
+	MaxCandidates int
+
+	// Only return chunks from the latest version of their document. Results
+	// from older versions do not count towards topk.
+	LatestVersionsOnly bool
+}
+
+// QueryWithLimits is the same as QueryFields, with the results limited by
+// limits, which is cheaper than filtering the results of a full query.
+func (ndb *NeuralDB) QueryWithLimits(query string, topk int, constraints Constraints, limits QueryLimits, fields Field) ([]Chunk, error) {
+	cLimits, err := newQueryLimits(limits)
+	if err != nil {
+		return nil, err
+	}
+	return ndb.query(query, topk, constraints, &cLimits, fields)
+}
+
+func newQueryLimits(limits QueryLimits) (C.QueryLimits_t, error) {
+	if limits.MaxCandidates < 0 {
+		return C.QueryLimits_t{}, errors.New("max candidates must be >= 0")
+	}
+	return C.QueryLimits_t{
+		min_score:            C.float(limits.MinScore),
+		max_candidates:       C.uint(limits.MaxCandidates),
+		latest_versions_only: C.bool(limits.LatestVersionsOnly),
+	}, nil
+}
+
+func (ndb *NeuralDB) query(query string, topk int, constraints Constraints, limits *C.QueryLimits_t, fields Field) ([]Chunk, error) {
+	if topk <= 0 {
+		return nil, errors.New("topk must be > 0")
+	}
+
+	constraintsMap, err := newOptionalConstraints(constraints)
+	if constraintsMap != nil {
+		// This is because we could allocate the map, convert some of the constraints,
+		// then get a type error, in which case the map should still be freed.
+		defer C.Constraints_free(constraintsMap)
+	}
+	if err != nil {
+		return nil, err
+	}
+
+	handle := resultsPool.Get().(*resultsHandle)
+	defer func() {
+		C.QueryResults_reset(handle.results)
+		resultsPool.Put(handle)
+	}()
+
+	// The engine copies the query, so it is passed without copying it into a C
+	// string first.
+	var cErr *C.char
+	C.NeuralDB_query_into(
+		ndb.ndb, (*C.char)(unsafe.Pointer(unsafe.StringData(query))), C.ulonglong(len(query)),
+		C.uint(topk), constraintsMap, limits, C.uint(fields), handle.results, &cErr,
+	)
+	if cErr != nil {
+		defer C.free(unsafe.Pointer(cErr))
+		return nil, errors.New(C.GoString(cErr))
+	}
+
+	return convertResults(handle.results, fields), nil
+}
+
+// CompletionQueue runs queries submitted with QueryAsync on the executor
+// threads, see ExecutorOptions, and waits for all of them with a single
+// blocking call. Queries that are in flight do not hold an OS thread, so the
+// number of threads does not grow with the number of concurrent queries.
+// QueryAsync requires ExecutorOptions.Threads > 0.
+type CompletionQueue struct {
+	queue *C.CompletionQueue_t
+
+	mu         sync.Mutex
+	nextTicket uint64
+	pending    map[uint64]*PendingQuery
+	closed     bool
+
+	// Closed once every query has completed after Close.
+	drained chan struct{}
+}
+
+// The maximum number of completions each wait returns.
+const completionBatch = 64
+
+func NewCompletionQueue() *CompletionQueue {
+	queue := &CompletionQueue{
+		queue:   C.CompletionQueue_new(),
+		pending: make(map[uint64]*PendingQuery),
+		drained: make(chan struct{}),
+	}
+	go queue.poll()
+	return queue
+}
+
+// Close waits for the queries in flight to complete and frees the queue.
+// QueryAsync fails once Close is called.
+func (queue *CompletionQueue) Close() {
+	queue.mu.Lock()
+	if queue.closed {
+		queue.mu.Unlock()
+		<-queue.drained
+		return
+	}
+	queue.closed = true
+	queue.mu.Unlock()
+
+	C.CompletionQueue_close(queue.queue)
+	<-queue.drained
+	C.CompletionQueue_free(queue.queue)
+}
+
+func (queue *CompletionQueue) poll() {
+	defer close(queue.drained)
+
+	var completions [completionBatch]C.Completion_t
+	for {
+		n := int(C.CompletionQueue_wait(queue.queue, -1, &completions[0], completionBatch))
+		if n == 0 {
+			return
+		}
+
+		queue.mu.Lock()
+		for _, completion := range completions[:n] {
+			pending := queue.pending[uint64(completion.ticket)]
+			delete(queue.pending, uint64(completion.ticket))
+			if completion.error != nil {
+				pending.err = errors.New(C.GoString(completion.error))
+				C.free(unsafe.Pointer(completion.error))
+			}
+			close(pending.done)
+		}
+		queue.mu.Unlock()
+	}
+}
+
+// PendingQuery is a query submitted with QueryAsync.
+type PendingQuery struct {
+	handle *resultsHandle
+	fields Field
+	done   chan struct{}
+	err    error
+
+	once    sync.Once
+	results []Chunk
+}
+
+// Done is closed once the query completes.
+func (pending *PendingQuery) Done() <-chan struct{} {
+	return pending.done
+}
+
+// Wait waits for the query to complete and returns its results.
+func (pending *PendingQuery) Wait() ([]Chunk, error) {
+	<-pending.done
+	pending.once.Do(func() {
+		if pending.err == nil {
+			pending.results = convertResults(pending.handle.results, pending.fields)
+		}
+		C.QueryResults_reset(pending.handle.results)
+		resultsPool.Put(pending.handle)
+		pending.handle = nil
+	})
+	return pending.results, pending.err
+}
+
+// QueryAsync is the same as QueryWithLimits, but submits the query to the
+// queue and returns without waiting for it to run.
+func (ndb *NeuralDB) QueryAsync(queue *CompletionQueue, query string, topk int, constraints Constraints, limits QueryLimits, fields Field) (*PendingQuery, error) {
+	if topk <= 0 {
+		return nil, errors.New("topk must be > 0")
+	}
+	cLimits, err := newQueryLimits(limits)
+	if err != nil {
+		return nil, err
+	}
+
+	constraintsMap, err := newOptionalConstraints(constraints)
+	if constraintsMap != nil {
+		defer C.Constraints_free(constraintsMap)
+	}
+	if err != nil {
+		return nil, err
+	}
+
+	pending := &PendingQuery{
+		handle: resultsPool.Get().(*resultsHandle),
+		fields: fields,
+		done:   make(chan struct{}),
+	}
+
+	// The query is registered before it is submitted since it can complete
+	// before NeuralDB_query_async returns.
+	queue.mu.Lock()
+	if queue.closed {
+		queue.mu.Unlock()
+		resultsPool.Put(pending.handle)
+		return nil, errors.New("the completion queue is closed")
+	}
+	ticket := queue.nextTicket
+	queue.nextTicket++
+	queue.pending[ticket] = pending
+	queue.mu.Unlock()
+
+	// The binding copies the query, so it is passed without copying it into a
+	// C string first.
+	var cErr *C.char
+	C.NeuralDB_query_async(
+		ndb.ndb, (*C.char)(unsafe.Pointer(unsafe.StringData(query))), C.ulonglong(len(query)),
+		C.uint(topk), constraintsMap, &cLimits, C.uint(fields), pending.handle.results,
+		queue.queue, C.ulonglong(ticket), &cErr,
+	)
+	if cErr != nil {
+		defer C.free(unsafe.Pointer(cErr))
+
+		queue.mu.Lock()
+		delete(queue.pending, ticket)
+		queue.mu.Unlock()
+		resultsPool.Put(pending.handle)
+		return nil, errors.New(C.GoString(cErr))
+	}
+
+	return pending, nil
 }
 
-type Constraint interface {
-	addToConstraints(constraints *C.Constraints_t, key string) error
+// HybridOptions controls how HybridQuery fuses the lexical results of the ndb
+// with the results of its vector index, see HybridOptions in PlatformNeuralDB.h.
+type HybridOptions struct {
+	// Each result scores weight / (RRFK + rank) for its 1 based rank in the
+	// lexical results and in the vector results. A weight of 0 skips that
+	// retrieval.
+	LexicalWeight float32
+	VectorWeight  float32
+	RRFK          int
+
+	// The number of results retrieved for each retrieval, 0 retrieves the
+	// greater of topk and 50.
+	Candidates int
 }
 
-type binaryConstraintOp int8
-
-const (
-	BinaryConstraintEq binaryConstraintOp = iota
-	BinaryConstraintLt
-	BinaryConstraintGt
-)
-
-type binaryConstraint struct {
-	value interface{}
-	op    binaryConstraintOp
+// DefaultHybridOptions weights both retrievals equally with the usual RRF
+// constant of 60.
+func DefaultHybridOptions() HybridOptions {
+	return HybridOptions{LexicalWeight: 1, VectorWeight: 1, RRFK: 60}
 }
 
-func (c binaryConstraint) addToConstraints(constraints *C.Constraints_t, key string) error {
-	keyCStr := C.CString(key)
-	defer C.free(unsafe.Pointer(keyCStr))
+// HybridQuery returns the topk chunks that satisfy the constraints by their
+// fused rank in the results of the ndb for the query and the results of its
+// vector index for the embedding, with the fused score as the Score of each
+// chunk. The query or the embedding may be empty to skip that retrieval. The
+// ndb must have been created with Options.EmbeddingDim.
+func (ndb *NeuralDB) HybridQuery(query string, embedding []float32, topk int, constraints Constraints, options HybridOptions, fields Field) ([]Chunk, error) {
+	if topk <= 0 {
+		return nil, errors.New("topk must be > 0")
+	}
+	if options.RRFK < 0 || options.Candidates < 0 {
+		return nil, errors.New("rrf k and candidates must be >= 0")
+	}
 
-	metadataValue, err := newMetadataValue(c.value)
+	constraintsMap, err := newOptionalConstraints(constraints)
+	if constraintsMap != nil {
+		defer C.Constraints_free(constraintsMap)
+	}
 	if err != nil {
-		return fmt.Errorf("invalid constraint for key '%v': %w", key, err)
+		return nil, err
 	}
-	defer C.MetadataValue_free(metadataValue)
 
-	C.Constraints_add_binary_constraint(constraints, C.int(c.op), keyCStr, metadataValue)
+	handle := resultsPool.Get().(*resultsHandle)
+	defer func() {
+		C.QueryResults_reset(handle.results)
+		resultsPool.Put(handle)
+	}()
+
+	cOptions := C.HybridOptions_t{
+		lexical_weight: C.float(options.LexicalWeight),
+		vector_weight:  C.float(options.VectorWeight),
+		rrf_k:          C.uint(options.RRFK),
+		candidates:     C.uint(options.Candidates),
+	}
+	var embeddingPtr *C.float
+	if len(embedding) > 0 {
+		embeddingPtr = (*C.float)(unsafe.Pointer(&embedding[0]))
+	}
 
-	return nil
-}
+	var cErr *C.char
+	C.NeuralDB_hybrid_query_into(
+		ndb.ndb, (*C.char)(unsafe.Pointer(unsafe.StringData(query))), C.ulonglong(len(query)),
+		embeddingPtr, C.uint(len(embedding)), C.uint(topk), constraintsMap, &cOptions,
+		C.uint(fields), handle.results, &cErr,
+	)
+	if cErr != nil {
+		defer C.free(unsafe.Pointer(cErr))
+		return nil, errors.New(C.GoString(cErr))
+	}
 
-func EqualTo(value interface{}) Constraint {
-	return binaryConstraint{value: value, op: BinaryConstraintEq}
+	return convertResults(handle.results, fields), nil
 }
 
-func LessThan(value interface{}) Constraint {
-	return binaryConstraint{value: value, op: BinaryConstraintLt}
+// resultsHandle is a QueryResults_t that is reused by queries through
+// resultsPool, so that the binding does not allocate result buffers for each
+// query. Handles that the pool drops are freed when they are collected.
+type resultsHandle struct {
+	results *C.QueryResults_t
 }
 
-func GreaterThan(value interface{}) Constraint {
-	return binaryConstraint{value: value, op: BinaryConstraintGt}
+var resultsPool = sync.Pool{
+	New: func() any {
+		handle := &resultsHandle{results: C.QueryResults_new()}
+		runtime.SetFinalizer(handle, func(handle *resultsHandle) {
+			C.QueryResults_free(handle.results)
+		})
+		return handle
+	},
 }
 
-type Constraints = map[string]Constraint
+// QueryBatch answers all of the queries with a single call into the engine,
+// which scores them in parallel. The same constraints are applied to every
+// query, and the results for queries[i] are returned at index i.
+func (ndb *NeuralDB) QueryBatch(queries []string, topk int, constraints Constraints) ([][]Chunk, error) {
+	if topk <= 0 {
+		return nil, errors.New("topk must be > 0")
+	}
 
-func newConstraints(constraints Constraints) (*C.Constraints_t, error) {
-	constraintsMap := C.Constraints_new()
+	queryList := newStringList(queries)
+	defer C.StringList_free(queryList)
 
-	for k, v := range constraints {
-		err := v.addToConstraints(constraintsMap, k)
-		if err != nil {
-			return nil, err
-		}
+	constraintsMap, err := newOptionalConstraints(constraints)
+	if constraintsMap != nil {
+		defer C.Constraints_free(constraintsMap)
+	}
+	if err != nil {
+		return nil, err
 	}
 
-	return constraintsMap, nil
+	var cErr *C.char
+	batch := C.NeuralDB_query_batch(ndb.ndb, queryList, C.uint(topk), constraintsMap, C.uint(AllFields), &cErr)
+	if cErr != nil {
+		defer C.free(unsafe.Pointer(cErr))
+		return nil, errors.New(C.GoString(cErr))
+	}
+	defer C.QueryResultsBatch_free(batch)
+
+	nQueries := C.QueryResultsBatch_len(batch)
+	output := make([][]Chunk, nQueries)
+	for i := C.uint(0); i < nQueries; i++ {
+		output[i] = convertResults(C.QueryResultsBatch_get(batch, i), AllFields)
+	}
+
+	return output, nil
 }
 
-type Chunk struct {
-	Id         uint64
-	Text       string
-	Document   string
-	DocId      string
-	DocVersion uint32
-	Metadata   map[string]interface{}
-	Score      float32
+// newOptionalConstraints returns nil if there are no constraints so that the
+// query is not routed through the constrained search path. If an error is
+// returned the map may still be allocated and must be freed by the caller.
+func newOptionalConstraints(constraints Constraints) (*C.Constraints_t, error) {
+	if len(constraints) == 0 {
+		return nil, nil
+	}
+	return newConstraints(constraints)
 }
 
-func (ndb *NeuralDB) Query(query string, topk int, constraints Constraints) ([]Chunk, error) {
-	if topk <= 0 {
-		return nil, errors.New("topk must be > 0")
+// convertResults decodes the results with a single call to QueryResults_export.
+// The string data for all of the results is copied out of the arena once and
+// the individual fields are then sliced out of that copy.
+func convertResults(results *C.QueryResults_t, fields Field) []Chunk {
+	var export C.QueryResultsExport_t
+	C.QueryResults_export(results, &export)
+
+	nResults := int(export.len)
+	if nResults == 0 {
+		return []Chunk{}
 	}
-	queryCStr := C.CString(query)
-	defer C.free(unsafe.Pointer(queryCStr))
-
-	var constraintsMap *C.Constraints_t
-	if len(constraints) > 0 {
-		var err error
-		constraintsMap, err = newConstraints(constraints)
-		if constraintsMap != nil {
-			// This is because we could allocate the map, convert some of the constraints,
-			// then get a type error, in which case the map should still be freed.
-			defer C.Constraints_free(constraintsMap)
-		}
-		if err != nil {
-			return nil, err
-		}
+
+	ids := unsafe.Slice((*uint64)(unsafe.Pointer(export.ids)), nResults)
+	scores := unsafe.Slice((*float32)(unsafe.Pointer(export.scores)), nResults)
+	docVersions := unsafe.Slice((*uint32)(unsafe.Pointer(export.doc_versions)), nResults)
+	offsets := unsafe.Slice((*uint64)(unsafe.Pointer(export.offsets)), nResults*C.QueryResultsExportFields+1)
+	arena := C.GoStringN(export.arena, C.int(export.arena_len))
+
+	field := func(i, f int) string {
+		start := i*C.QueryResultsExportFields + f
+		return arena[offsets[start]:offsets[start+1]]
 	}
 
-	var err *C.char
-	results := C.NeuralDB_query(ndb.ndb, queryCStr, C.uint(topk), constraintsMap, &err)
-	if err != nil {
-		defer C.free(unsafe.Pointer(err))
-		return nil, errors.New(C.GoString(err))
+	nKeys := int(export.n_keys)
+	keyOffsets := unsafe.Slice((*uint64)(unsafe.Pointer(export.key_offsets)), nKeys+1)
+	keys := make([]string, nKeys)
+	for k := range keys {
+		keys[k] = arena[keyOffsets[k]:keyOffsets[k+1]]
 	}
-	defer C.QueryResults_free(results)
 
-	nResults := C.QueryResults_len(results)
 	chunks := make([]Chunk, nResults)
-	for i := C.uint(0); i < nResults; i++ {
-		chunks[i].Id = uint64(C.QueryResults_id(results, i))
-		chunks[i].Text = C.GoString(C.QueryResults_text(results, i))
-		chunks[i].Document = C.GoString(C.QueryResults_document(results, i))
-		chunks[i].DocId = C.GoString(C.QueryResults_doc_id(results, i))
-		chunks[i].DocVersion = uint32(C.QueryResults_doc_version(results, i))
-		chunks[i].Score = float32(C.QueryResults_score(results, i))
-		chunks[i].Metadata = convertMetadata(C.QueryResults_metadata(results, i))
+	for i := range chunks {
+		chunks[i].Id = ids[i]
+		chunks[i].Text = field(i, C.QueryResultsExportText)
+		chunks[i].Document = field(i, C.QueryResultsExportDocument)
+		chunks[i].DocId = field(i, C.QueryResultsExportDocId)
+		chunks[i].DocVersion = docVersions[i]
+		chunks[i].Score = scores[i]
+		if fields&FieldMetadata != 0 {
+			chunks[i].Metadata = decodeMetadata(field(i, C.QueryResultsExportMetadata), keys)
+		}
 	}
-
-	return chunks, nil
+	return chunks
 }
 
-func convertMetadata(metadata *C.MetadataList_t) map[string]interface{} {
-	defer C.MetadataList_free(metadata)
+// decodeMetadata parses the metadata encoding described in binding.h, keys is
+// the key dictionary of the results.
+func decodeMetadata(data string, keys []string) map[string]interface{} {
+	readUvarint := func() uint64 {
+		var value uint64
+		for shift := 0; ; shift += 7 {
+			b := data[0]
+			data = data[1:]
+			value |= uint64(b&0x7F) << shift
+			if b < 0x80 {
+				return value
+			}
+		}
+	}
 
-	len := C.MetadataList_len(metadata)
-	out := make(map[string]interface{})
+	nEntries := int(readUvarint())
+	out := make(map[string]interface{}, nEntries)
 
-	for i := C.uint(0); i < len; i++ {
-		key := C.GoString(C.MetadataList_key(metadata, i))
-		switch C.MetadataList_type(metadata, i) {
+	for i := 0; i < nEntries; i++ {
+		key := keys[readUvarint()]
+		tag := data[0]
+		data = data[1:]
+		switch tag {
 		case 0:
-			out[key] = bool(C.MetadataList_bool(metadata, i))
+			out[key] = false
 		case 1:
-			out[key] = int(C.MetadataList_int(metadata, i))
+			out[key] = true
 		case 2:
-			out[key] = float32(C.MetadataList_float(metadata, i))
+			zigzag := readUvarint()
+			out[key] = int(int32(zigzag>>1) ^ -int32(zigzag&1))
 		case 3:
-			out[key] = C.GoString(C.MetadataList_str(metadata, i))
+			out[key] = math.Float32frombits(binary.LittleEndian.Uint32([]byte(data[:4])))
+			data = data[4:]
+		case 4:
+			n := readUvarint()
+			out[key] = data[:n]
+			data = data[n:]
 		}
 	}
 	return out
@@ -296,9 +1432,25 @@ func newStringList(values []string) *C.StringList_t {
 
 func newLabelList(values []uint64) *C.LabelList_t {
 	list := C.LabelList_new()
-	for _, v := range values {
-		C.LabelList_append(list, C.ulonglong(v))
+	if len(values) > 0 {
+		C.LabelList_extend(list, (*C.ulonglong)(unsafe.Pointer(&values[0])), nil, C.uint(len(values)))
+	}
+	return list
+}
+
+func newMultiLabelList(labels [][]uint64) *C.LabelList_t {
+	list := C.LabelList_new()
+	if len(labels) == 0 {
+		return list
+	}
+
+	flat := make([]uint64, 0, len(labels))
+	counts := make([]C.uint, len(labels))
+	for i, group := range labels {
+		flat = append(flat, group...)
+		counts[i] = C.uint(len(group))
 	}
+	C.LabelList_extend(list, (*C.ulonglong)(unsafe.Pointer(&flat[0])), &counts[0], C.uint(len(labels)))
 	return list
 }
 
@@ -309,6 +1461,18 @@ func CheckFinetuneArgs(queries []string, labels []uint64) error {
 	return nil
 }
 
+func CheckFinetuneMultiLabelArgs(queries []string, labels [][]uint64) error {
+	if len(queries) != len(labels) {
+		return fmt.Errorf("len of queries must match len of labels")
+	}
+	for i, group := range labels {
+		if len(group) == 0 {
+			return fmt.Errorf("query %d has no labels", i)
+		}
+	}
+	return nil
+}
+
 func (ndb *NeuralDB) Finetune(queries []string, labels []uint64) error {
 	if err := CheckFinetuneArgs(queries, labels); err != nil {
 		return err
@@ -330,6 +1494,30 @@ func (ndb *NeuralDB) Finetune(queries []string, labels []uint64) error {
 	return nil
 }
 
+// FinetuneMultiLabel is like Finetune, but each query can be associated with
+// several chunks. The whole batch is passed to the ndb in a single call, so
+// large batches of feedback should be sent together rather than one at a time.
+func (ndb *NeuralDB) FinetuneMultiLabel(queries []string, labels [][]uint64) error {
+	if err := CheckFinetuneMultiLabelArgs(queries, labels); err != nil {
+		return err
+	}
+
+	queryList := newStringList(queries)
+	defer C.StringList_free(queryList)
+
+	labelList := newMultiLabelList(labels)
+	defer C.LabelList_free(labelList)
+
+	var err *C.char
+	C.NeuralDB_finetune(ndb.ndb, queryList, labelList, &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return errors.New(C.GoString(err))
+	}
+
+	return nil
+}
+
 func CheckAssociateArgs(sources, targets []string) error {
 	if len(sources) != len(targets) {
 		return fmt.Errorf("len of sources must match length of targets")
@@ -362,6 +1550,25 @@ func (ndb *NeuralDB) Associate(sources, targets []string, strength uint32) error
 	return nil
 }
 
+// ApplyPendingFeedback applies the feedback buffered by an ndb opened with
+// Options.BufferFeedback as a single batch. A batch that fails is discarded,
+// and the error is also reported for a background batch that failed.
+func (ndb *NeuralDB) ApplyPendingFeedback() error {
+	var err *C.char
+	C.NeuralDB_apply_pending_feedback(ndb.ndb, &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return errors.New(C.GoString(err))
+	}
+	return nil
+}
+
+// PendingFeedback returns the number of queries and associations that are
+// buffered and not applied yet.
+func (ndb *NeuralDB) PendingFeedback() int {
+	return int(C.NeuralDB_pending_feedback(ndb.ndb))
+}
+
 func (ndb *NeuralDB) Delete(docId string, keepLatestVersion bool) error {
 	docIdCStr := C.CString(docId)
 	defer C.free(unsafe.Pointer(docIdCStr))
@@ -376,6 +1583,34 @@ func (ndb *NeuralDB) Delete(docId string, keepLatestVersion bool) error {
 	return nil
 }
 
+func (ndb *NeuralDB) DeleteVersion(docId string, docVersion uint32) error {
+	docIdCStr := C.CString(docId)
+	defer C.free(unsafe.Pointer(docIdCStr))
+
+	var err *C.char
+	C.NeuralDB_delete_doc_version(ndb.ndb, docIdCStr, C.uint(docVersion), &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return errors.New(C.GoString(err))
+	}
+
+	return nil
+}
+
+// Prune reclaims the chunks of every document deleted before the call, without
+// waiting for the next background compaction pass. Like deletions, queries
+// wait while the chunks are reclaimed.
+func (ndb *NeuralDB) Prune() error {
+	var err *C.char
+	C.NeuralDB_prune(ndb.ndb, &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return errors.New(C.GoString(err))
+	}
+
+	return nil
+}
+
 type Source struct {
 	Document   string
 	DocId      string
@@ -389,6 +1624,66 @@ func (ndb *NeuralDB) Sources() ([]Source, error) {
 		defer C.free(unsafe.Pointer(err))
 		return nil, errors.New(C.GoString(err))
 	}
+	return convertSources(sources), nil
+}
+
+// SourcesPage returns up to limit of the sources returned by Sources, which
+// are ordered by doc id and then version, starting at offset. Finding the
+// offset walks the documents before it, so SourcesAfter is faster for paging
+// through every source.
+func (ndb *NeuralDB) SourcesPage(offset, limit int) ([]Source, error) {
+	if offset < 0 || limit < 0 {
+		return nil, errors.New("offset and limit must be >= 0")
+	}
+
+	var err *C.char
+	sources := C.NeuralDB_sources_page(ndb.ndb, C.ulonglong(offset), C.ulonglong(limit), &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return nil, errors.New(C.GoString(err))
+	}
+	return convertSources(sources), nil
+}
+
+// SourcesAfter returns up to limit of the sources returned by Sources that
+// follow after, which is usually the last source of the previous page. Each
+// page is found with a lookup of after, which does not have to be a source of
+// the ndb, so the sources can be paged through in time linear in their number.
+func (ndb *NeuralDB) SourcesAfter(after Source, limit int) ([]Source, error) {
+	if limit < 0 {
+		return nil, errors.New("limit must be >= 0")
+	}
+
+	docIdCStr := C.CString(after.DocId)
+	defer C.free(unsafe.Pointer(docIdCStr))
+
+	var err *C.char
+	sources := C.NeuralDB_sources_after(ndb.ndb, docIdCStr, C.uint(after.DocVersion), C.ulonglong(limit), &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return nil, errors.New(C.GoString(err))
+	}
+	return convertSources(sources), nil
+}
+
+func (ndb *NeuralDB) NumSources() int {
+	return int(C.NeuralDB_num_sources(ndb.ndb))
+}
+
+// LatestVersion returns the latest version of the document, or false if the
+// ndb does not contain it.
+func (ndb *NeuralDB) LatestVersion(docId string) (uint32, bool) {
+	docIdCStr := C.CString(docId)
+	defer C.free(unsafe.Pointer(docIdCStr))
+
+	var version C.uint
+	if !C.NeuralDB_latest_version(ndb.ndb, docIdCStr, &version) {
+		return 0, false
+	}
+	return uint32(version), true
+}
+
+func convertSources(sources *C.Sources_t) []Source {
 	defer C.Sources_free(sources)
 
 	nResults := C.Sources_len(sources)
@@ -399,7 +1694,80 @@ func (ndb *NeuralDB) Sources() ([]Source, error) {
 		output[i].DocVersion = uint32(C.Sources_doc_version(sources, i))
 	}
 
-	return output, nil
+	return output
+}
+
+type ChunkCursorOptions struct {
+	// Only returns the chunks of every version of the document if not empty.
+	DocId string
+
+	// Only returns the chunks whose metadata satisfies the constraints.
+	Constraints Constraints
+
+	// Only returns chunks with an Id of at least StartId, so that an export
+	// that was interrupted can resume after the last chunk it received.
+	StartId uint64
+}
+
+// ChunkCursor reads the chunks of an ndb in order of Id, a page at a time, as
+// they were when the cursor was created. Inserts and deletes made while the
+// cursor is open are not visible to it. The cursor keeps the ndb open until
+// it is freed, and must not be used from several goroutines at once.
+type ChunkCursor struct {
+	cursor *C.ChunkCursor_t
+}
+
+// ChunkCursor returns a cursor over the chunks of the ndb, which must have
+// been created with Options.StoreChunks.
+func (ndb *NeuralDB) ChunkCursor(options ChunkCursorOptions) (*ChunkCursor, error) {
+	constraintsMap, err := newOptionalConstraints(options.Constraints)
+	if constraintsMap != nil {
+		defer C.Constraints_free(constraintsMap)
+	}
+	if err != nil {
+		return nil, err
+	}
+
+	var docIdCStr *C.char
+	if options.DocId != "" {
+		docIdCStr = C.CString(options.DocId)
+		defer C.free(unsafe.Pointer(docIdCStr))
+	}
+
+	var cErr *C.char
+	cursor := C.NeuralDB_chunk_cursor(ndb.ndb, docIdCStr, constraintsMap, C.ulonglong(options.StartId), &cErr)
+	if cErr != nil {
+		defer C.free(unsafe.Pointer(cErr))
+		return nil, errors.New(C.GoString(cErr))
+	}
+	return &ChunkCursor{cursor: cursor}, nil
+}
+
+// Next returns up to max of the next chunks, with a Score of 0, or no chunks
+// once every chunk has been returned.
+func (cursor *ChunkCursor) Next(max int, fields Field) ([]Chunk, error) {
+	if max <= 0 {
+		return nil, errors.New("max must be > 0")
+	}
+
+	handle := resultsPool.Get().(*resultsHandle)
+	defer func() {
+		C.QueryResults_reset(handle.results)
+		resultsPool.Put(handle)
+	}()
+
+	var cErr *C.char
+	C.ChunkCursor_next(cursor.cursor, C.uint(max), C.uint(fields), handle.results, &cErr)
+	if cErr != nil {
+		defer C.free(unsafe.Pointer(cErr))
+		return nil, errors.New(C.GoString(cErr))
+	}
+
+	return convertResults(handle.results, fields), nil
+}
+
+func (cursor *ChunkCursor) Free() {
+	C.ChunkCursor_free(cursor.cursor)
 }
 
 func (ndb *NeuralDB) Save(savePath string) error {
@@ -416,6 +1784,80 @@ func (ndb *NeuralDB) Save(savePath string) error {
 	return nil
 }
 
+// CheckpointManifestFile is the name of the manifest that Save writes into
+// each checkpoint, listing the files of the checkpoint and their hashes.
+const CheckpointManifestFile = "checkpoint_manifest"
+
+type CheckpointManifest struct {
+	// Id is derived from the contents of every file in the checkpoint.
+	Id string
+	// Files are the paths of the files in the checkpoint relative to the
+	// checkpoint directory, excluding the manifest itself.
+	Files []string
+}
+
+func loadCheckpointManifest(manifestPath string) (*C.CheckpointManifest_t, error) {
+	pathCStr := C.CString(manifestPath)
+	defer C.free(unsafe.Pointer(pathCStr))
+
+	var err *C.char
+	manifest := C.CheckpointManifest_load(pathCStr, &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return nil, errors.New(C.GoString(err))
+	}
+	return manifest, nil
+}
+
+func convertStringList(list *C.StringList_t) []string {
+	defer C.StringList_free(list)
+
+	n := C.StringList_len(list)
+	output := make([]string, n)
+	for i := C.uint(0); i < n; i++ {
+		output[i] = C.GoString(C.StringList_get(list, i))
+	}
+	return output
+}
+
+// ReadCheckpointManifest reads a manifest written by Save. The manifest can be
+// copied out of the checkpoint and read after the checkpoint is deleted.
+func ReadCheckpointManifest(manifestPath string) (CheckpointManifest, error) {
+	manifest, err := loadCheckpointManifest(manifestPath)
+	if err != nil {
+		return CheckpointManifest{}, err
+	}
+	defer C.CheckpointManifest_free(manifest)
+
+	return CheckpointManifest{
+		Id:    C.GoString(C.CheckpointManifest_id(manifest)),
+		Files: convertStringList(C.CheckpointManifest_files(manifest)),
+	}, nil
+}
+
+// CheckpointDelta returns the files of the checkpoint described by
+// manifestPath that are not shared with the checkpoint described by
+// baseManifestPath. A copy of the base checkpoint can be turned into a copy of
+// the new checkpoint by transferring only these files and removing the files
+// that are not listed in the new checkpoint's manifest. Since the ndb shares
+// its immutable files between consecutive checkpoints, the delta scales with
+// the changes made between the checkpoints rather than with the ndb's size.
+func CheckpointDelta(manifestPath, baseManifestPath string) ([]string, error) {
+	manifest, err := loadCheckpointManifest(manifestPath)
+	if err != nil {
+		return nil, err
+	}
+	defer C.CheckpointManifest_free(manifest)
+
+	base, err := loadCheckpointManifest(baseManifestPath)
+	if err != nil {
+		return nil, err
+	}
+	defer C.CheckpointManifest_free(base)
+
+	return convertStringList(C.CheckpointManifest_delta(manifest, base)), nil
+}
+
 func SetLicenseKey(key string) error {
 	keyCStr := C.CString(key)
 	defer C.free(unsafe.Pointer(keyCStr))
@@ -443,3 +1885,60 @@ func SetLicensePath(path string) error {
 
 	return nil
 }
+
+// ExecutorOptions control the threads that run engine calls for every ndb in
+// the process. The engine parallelizes calls with OpenMP, which starts a team
+// of threads for each thread that calls it, so without executor threads the
+// threads running goroutines that call the engine can oversubscribe the cpus.
+type ExecutorOptions struct {
+	// Threads that run engine calls, which bounds the number of concurrent
+	// calls. If 0 calls run on the calling thread.
+	Threads int
+	// OpenMP threads used by each query, and by each insert, finetune, or
+	// associate call. If 0 the engine uses one thread per cpu.
+	QueryParallelism  int
+	UpdateParallelism int
+	// Pins the executor threads to these cpus and the cpus of these NUMA
+	// nodes, which requires Threads > 0.
+	CPUs      []int
+	NumaNodes []int
+	// Runs queries on the calling thread with QueryParallelism threads, or a
+	// single thread if it is 0, for low latency under high concurrency.
+	InlineQueries bool
+}
+
+// ConfigureExecutor replaces the executor configuration of the process. Calls
+// in progress finish with the previous configuration.
+func ConfigureExecutor(options ExecutorOptions) error {
+	if options.Threads < 0 || options.QueryParallelism < 0 || options.UpdateParallelism < 0 {
+		return errors.New("executor threads and parallelism must be >= 0")
+	}
+
+	cOptions := C.ExecutorOptions_new()
+	defer C.ExecutorOptions_free(cOptions)
+
+	C.ExecutorOptions_set_threads(cOptions, C.uint(options.Threads))
+	C.ExecutorOptions_set_parallelism(cOptions, C.uint(options.QueryParallelism), C.uint(options.UpdateParallelism))
+	for _, cpu := range options.CPUs {
+		if cpu < 0 {
+			return fmt.Errorf("invalid cpu %d", cpu)
+		}
+		C.ExecutorOptions_add_cpu(cOptions, C.uint(cpu))
+	}
+	for _, node := range options.NumaNodes {
+		if node < 0 {
+			return fmt.Errorf("invalid NUMA node %d", node)
+		}
+		C.ExecutorOptions_add_numa_node(cOptions, C.uint(node))
+	}
+	C.ExecutorOptions_set_inline_queries(cOptions, C.bool(options.InlineQueries))
+
+	var err *C.char
+	C.Executor_configure(cOptions, &err)
+	if err != nil {
+		defer C.free(unsafe.Pointer(err))
+		return errors.New(C.GoString(err))
+	}
+
+	return nil
+}
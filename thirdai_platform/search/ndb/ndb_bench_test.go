@@ -0,0 +1,408 @@
+package ndb_test
+
+import (
+	"bufio"
+	"encoding/json"
+	"flag"
+	"fmt"
+	"math/rand"
+	"os"
+	"path/filepath"
+	"runtime"
+	"sort"
+	"strings"
+	"sync"
+	"testing"
+	"thirdai_platform/search/ndb"
+	"time"
+)
+
+// The benchmarks are run with `go test -run '^$' -bench .`, and their results
+// are also written as JSON to the path given by -ndb.bench_json, along with
+// the version of the bundled library, so that they can be compared across
+// library versions.
+var benchJson = flag.String("ndb.bench_json", "", "write benchmark results as JSON to this path")
+
+const versionFile = "lib/linux_x64/version.yaml"
+
+func TestMain(m *testing.M) {
+	code := m.Run()
+	if *benchJson != "" && code == 0 {
+		if err := benchResults.write(*benchJson); err != nil {
+			fmt.Fprintf(os.Stderr, "failed to write benchmark results: %v\n", err)
+			code = 1
+		}
+	}
+	os.Exit(code)
+}
+
+type benchResult struct {
+	Name       string             `json:"name"`
+	Iterations int                `json:"iterations"`
+	NsPerOp    float64            `json:"ns_per_op"`
+	Metrics    map[string]float64 `json:"metrics,omitempty"`
+}
+
+type benchReport struct {
+	mu      sync.Mutex
+	results map[string]benchResult
+	order   []string
+}
+
+var benchResults = benchReport{results: map[string]benchResult{}}
+
+// record reports the metrics of the benchmark and saves them for the JSON
+// results. A benchmark function is run several times with increasing b.N, so
+// the results of the last run replace the earlier ones.
+func (r *benchReport) record(b *testing.B, metrics map[string]float64) {
+	for unit, value := range metrics {
+		b.ReportMetric(value, unit)
+	}
+
+	r.mu.Lock()
+	defer r.mu.Unlock()
+
+	if _, ok := r.results[b.Name()]; !ok {
+		r.order = append(r.order, b.Name())
+	}
+	r.results[b.Name()] = benchResult{
+		Name:       b.Name(),
+		Iterations: b.N,
+		NsPerOp:    float64(b.Elapsed().Nanoseconds()) / float64(b.N),
+		Metrics:    metrics,
+	}
+}
+
+func (r *benchReport) write(path string) error {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+
+	library, err := readLibraryVersion(versionFile)
+	if err != nil {
+		return err
+	}
+
+	results := make([]benchResult, 0, len(r.order))
+	for _, name := range r.order {
+		results = append(results, r.results[name])
+	}
+
+	data, err := json.MarshalIndent(map[string]interface{}{
+		"library":    library,
+		"go_version": runtime.Version(),
+		"os":         runtime.GOOS,
+		"arch":       runtime.GOARCH,
+		"cpus":       runtime.NumCPU(),
+		"timestamp":  time.Now().UTC().Format(time.RFC3339),
+		"benchmarks": results,
+	}, "", "  ")
+	if err != nil {
+		return err
+	}
+	return os.WriteFile(path, append(data, '\n'), 0644)
+}
+
+// readLibraryVersion reads the flat key: value pairs of the version file of
+// the bundled library.
+func readLibraryVersion(path string) (map[string]string, error) {
+	file, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer file.Close()
+
+	version := map[string]string{}
+	scanner := bufio.NewScanner(file)
+	for scanner.Scan() {
+		if key, value, ok := strings.Cut(scanner.Text(), ":"); ok {
+			version[strings.TrimSpace(key)] = strings.TrimSpace(value)
+		}
+	}
+	return version, scanner.Err()
+}
+
+func latencyMetrics(latencies []time.Duration) map[string]float64 {
+	sort.Slice(latencies, func(i, j int) bool { return latencies[i] < latencies[j] })
+	percentile := func(p float64) float64 {
+		return float64(latencies[int(p*float64(len(latencies)-1))].Nanoseconds()) / 1e3
+	}
+	return map[string]float64{
+		"p50-us": percentile(0.5),
+		"p90-us": percentile(0.9),
+		"p99-us": percentile(0.99),
+	}
+}
+
+const (
+	benchVocabSize     = 20000
+	benchWordsPerChunk = 40
+	benchChunksPerDoc  = 10
+	benchBuckets       = 100
+)
+
+// corpusGenerator generates a deterministic synthetic corpus whose words
+// follow a Zipf distribution, like the words of natural text, so that queries
+// have a mix of common and rare terms.
+type corpusGenerator struct {
+	rng  *rand.Rand
+	zipf *rand.Zipf
+}
+
+func newCorpusGenerator(seed int64) *corpusGenerator {
+	rng := rand.New(rand.NewSource(seed))
+	return &corpusGenerator{rng: rng, zipf: rand.NewZipf(rng, 1.1, 1, benchVocabSize-1)}
+}
+
+func (g *corpusGenerator) text(words int) string {
+	text := make([]string, words)
+	for i := range text {
+		text[i] = fmt.Sprintf("w%d", g.zipf.Uint64())
+	}
+	return strings.Join(text, " ")
+}
+
+// documents returns numChunks chunks split into documents of benchChunksPerDoc
+// chunks. The "bucket" metadata of each chunk is uniform in [0, benchBuckets),
+// so a constraint on it selects a known fraction of the chunks.
+func (g *corpusGenerator) documents(numChunks int, prefix string) []ndb.Document {
+	docs := []ndb.Document{}
+	for start := 0; start < numChunks; start += benchChunksPerDoc {
+		doc := ndb.Document{
+			Document: fmt.Sprintf("%s_%d.txt", prefix, len(docs)),
+			DocId:    fmt.Sprintf("%s_%d", prefix, len(docs)),
+		}
+		for i := start; i < min(start+benchChunksPerDoc, numChunks); i++ {
+			doc.Chunks = append(doc.Chunks, g.text(benchWordsPerChunk))
+			doc.Metadata = append(doc.Metadata, map[string]interface{}{
+				"bucket": g.rng.Intn(benchBuckets),
+			})
+		}
+		docs = append(docs, doc)
+	}
+	return docs
+}
+
+func (g *corpusGenerator) queries(n int) []string {
+	queries := make([]string, n)
+	for i := range queries {
+		queries[i] = g.text(4)
+	}
+	return queries
+}
+
+func newBenchNdb(b *testing.B, path string, options ndb.Options, numChunks int) ndb.NeuralDB {
+	db, err := ndb.NewWithOptions(path, options)
+	if err != nil {
+		b.Fatal(err)
+	}
+	b.Cleanup(db.Free)
+
+	docs := newCorpusGenerator(1).documents(numChunks, "doc")
+	for start := 0; start < len(docs); start += 100 {
+		if err := db.InsertBatch(docs[start:min(start+100, len(docs))]); err != nil {
+			b.Fatal(err)
+		}
+	}
+	return db
+}
+
+func BenchmarkInsert(b *testing.B) {
+	for _, chunks := range []int{10, 100, 1000} {
+		b.Run(fmt.Sprintf("chunks=%d", chunks), func(b *testing.B) {
+			db := newBenchNdb(b, b.TempDir(), ndb.Options{}, 0)
+			gen := newCorpusGenerator(2)
+
+			docs := make([]ndb.Document, b.N)
+			for i := range docs {
+				docs[i] = ndb.Document{
+					Document: "doc.txt",
+					DocId:    fmt.Sprintf("doc_%d", i),
+				}
+				for j := 0; j < chunks; j++ {
+					docs[i].Chunks = append(docs[i].Chunks, gen.text(benchWordsPerChunk))
+					docs[i].Metadata = append(docs[i].Metadata, map[string]interface{}{"bucket": j})
+				}
+			}
+
+			b.ResetTimer()
+			for i := range docs {
+				if err := db.InsertBatch(docs[i : i+1]); err != nil {
+					b.Fatal(err)
+				}
+			}
+			b.StopTimer()
+
+			benchResults.record(b, map[string]float64{
+				"chunks/s": float64(b.N*chunks) / b.Elapsed().Seconds(),
+			})
+		})
+	}
+}
+
+// timeQueries runs b.N queries from the pool and records their latency
+// percentiles, and the mean time spent in the engine per query, so that the
+// remainder is the cost of the platform layer and the binding.
+func timeQueries(b *testing.B, db ndb.NeuralDB, queries []string, constraints ndb.Constraints) {
+	before := db.Stats()
+	latencies := make([]time.Duration, b.N)
+
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		start := time.Now()
+		if _, err := db.Query(queries[i%len(queries)], 10, constraints); err != nil {
+			b.Fatal(err)
+		}
+		latencies[i] = time.Since(start)
+	}
+	b.StopTimer()
+
+	after := db.Stats()
+	engine := time.Duration(0)
+	for _, stage := range []string{"engine_query", "engine_rank"} {
+		engine += after.Stages[stage].Sum - before.Stages[stage].Sum
+	}
+
+	metrics := latencyMetrics(latencies)
+	metrics["engine-us/op"] = float64(engine.Microseconds()) / float64(b.N)
+	benchResults.record(b, metrics)
+}
+
+func BenchmarkQuery(b *testing.B) {
+	queries := newCorpusGenerator(3).queries(256)
+
+	// A benchmark with sub-benchmarks is only run once, so the corpora are
+	// built here rather than in the sub-benchmarks, which are run repeatedly.
+	for _, corpus := range []int{1000, 10000, 50000} {
+		db := newBenchNdb(b, b.TempDir(), ndb.Options{}, corpus)
+		b.Run(fmt.Sprintf("corpus=%d", corpus), func(b *testing.B) {
+			timeQueries(b, db, queries, nil)
+		})
+	}
+}
+
+func BenchmarkRank(b *testing.B) {
+	queries := newCorpusGenerator(3).queries(256)
+
+	for _, index := range []bool{false, true} {
+		options := ndb.Options{}
+		name := "engine"
+		if index {
+			options.MetadataIndexes = []string{"bucket"}
+			name = "index"
+		}
+
+		b.Run(name, func(b *testing.B) {
+			db := newBenchNdb(b, b.TempDir(), options, 10000)
+
+			for _, selectivity := range []float64{0.01, 0.1, 0.5} {
+				constraints := ndb.Constraints{"bucket": ndb.LessThan(int(selectivity * benchBuckets))}
+				b.Run(fmt.Sprintf("selectivity=%g", selectivity), func(b *testing.B) {
+					timeQueries(b, db, queries, constraints)
+				})
+			}
+		})
+	}
+}
+
+func BenchmarkFinetune(b *testing.B) {
+	const batchSize = 16
+
+	db := newBenchNdb(b, b.TempDir(), ndb.Options{}, 10000)
+
+	b.Run(fmt.Sprintf("batch=%d", batchSize), func(b *testing.B) {
+		gen := newCorpusGenerator(4)
+
+		queries := gen.queries(b.N * batchSize)
+		labels := make([]uint64, len(queries))
+		for i := range labels {
+			labels[i] = uint64(gen.rng.Intn(10000))
+		}
+
+		b.ResetTimer()
+		for i := 0; i < b.N; i++ {
+			batch := queries[i*batchSize : (i+1)*batchSize]
+			if err := db.Finetune(batch, labels[i*batchSize:(i+1)*batchSize]); err != nil {
+				b.Fatal(err)
+			}
+		}
+		b.StopTimer()
+
+		benchResults.record(b, map[string]float64{
+			"queries/s": float64(b.N*batchSize) / b.Elapsed().Seconds(),
+		})
+	})
+}
+
+func BenchmarkSaveOpen(b *testing.B) {
+	db := newBenchNdb(b, b.TempDir(), ndb.Options{}, 10000)
+
+	b.Run("save", func(b *testing.B) {
+		for i := 0; i < b.N; i++ {
+			if err := db.Save(filepath.Join(b.TempDir(), "checkpoint")); err != nil {
+				b.Fatal(err)
+			}
+		}
+		b.StopTimer()
+		benchResults.record(b, nil)
+	})
+
+	// The engine does not allow reopening a path within the same process, so
+	// each iteration opens a new checkpoint, which is saved untimed.
+	for _, readOnly := range []bool{false, true} {
+		b.Run(fmt.Sprintf("open/read_only=%t", readOnly), func(b *testing.B) {
+			for i := 0; i < b.N; i++ {
+				b.StopTimer()
+				checkpoint := filepath.Join(b.TempDir(), "checkpoint")
+				if err := db.Save(checkpoint); err != nil {
+					b.Fatal(err)
+				}
+				b.StartTimer()
+
+				opened, err := ndb.NewWithOptions(checkpoint, ndb.Options{ReadOnly: readOnly})
+				if err != nil {
+					b.Fatal(err)
+				}
+
+				b.StopTimer()
+				opened.Free()
+				b.StartTimer()
+			}
+			b.StopTimer()
+			benchResults.record(b, nil)
+		})
+	}
+}
+
+// BenchmarkBinding measures the fixed cost of a call through the binding,
+// and of converting query results to Go, separately from the engine.
+func BenchmarkBinding(b *testing.B) {
+	db := newBenchNdb(b, b.TempDir(), ndb.Options{QueryCacheSize: 16}, 1000)
+
+	b.Run("round_trip", func(b *testing.B) {
+		for i := 0; i < b.N; i++ {
+			db.QueryCacheStats()
+		}
+		b.StopTimer()
+		benchResults.record(b, nil)
+	})
+
+	// The query is cached, so these measure the cost of returning the results.
+	query := newCorpusGenerator(3).queries(1)[0]
+	for _, topk := range []int{1, 10, 100} {
+		for _, fields := range []ndb.Field{ndb.AllFields, ndb.FieldText} {
+			name := "all"
+			if fields == ndb.FieldText {
+				name = "text"
+			}
+			b.Run(fmt.Sprintf("cached_query/topk=%d/fields=%s", topk, name), func(b *testing.B) {
+				for i := 0; i < b.N; i++ {
+					if _, err := db.QueryFields(query, topk, nil, fields); err != nil {
+						b.Fatal(err)
+					}
+				}
+				b.StopTimer()
+				benchResults.record(b, nil)
+			})
+		}
+	}
+}
@@ -1,12 +1,20 @@
 package ndb_test
 
 import (
+	"encoding/binary"
 	"fmt"
+	"io/fs"
+	"math"
+	"os"
+	"path/filepath"
+	"reflect"
 	"slices"
 	"strconv"
 	"strings"
+	"sync"
 	"testing"
 	"thirdai_platform/search/ndb"
+	"time"
 )
 
 func init() {
@@ -188,107 +196,2355 @@ func TestConstrainedSearch(t *testing.T) {
 	checkQuery(t, db, "a b c d e", constraints, []uint64{0})
 }
 
+func TestConstraintTypeMismatch(t *testing.T) {
+	db, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	err = db.Insert(
+		"doc", "id",
+		[]string{"a", "a b", "a b c"},
+		[]map[string]interface{}{{"k": 7}, {"k": 7.0}, {"k": "7"}},
+		nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	checkQuery(t, db, "a b c", ndb.Constraints{"k": ndb.EqualTo(7)}, []uint64{0})
+	checkQuery(t, db, "a b c", ndb.Constraints{"k": ndb.EqualTo(7.0)}, []uint64{1})
+	checkQuery(t, db, "a b c", ndb.Constraints{"k": ndb.EqualTo("7")}, []uint64{2})
+	checkQuery(t, db, "a b c", ndb.Constraints{"k": ndb.GreaterThan(6)}, []uint64{0})
+	checkQuery(t, db, "a b c", ndb.Constraints{"k": ndb.LessThan("8")}, []uint64{2})
+}
+
+func insertIndexTestDocs(t *testing.T, db ndb.NeuralDB, start, end int) {
+	for doc := start; doc < end; doc++ {
+		chunks := []string{}
+		metadata := []map[string]interface{}{}
+		for j := 0; j < 10; j++ {
+			i := doc*10 + j
+			filler := make([]string, i+1)
+			for k := range filler {
+				filler[k] = fmt.Sprintf("f%d_%d", i, k)
+			}
+			chunks = append(chunks, fmt.Sprintf("k%d %s", i%4, strings.Join(filler, " ")))
+			metadata = append(metadata, map[string]interface{}{
+				"n": i, "type": string(rune('a' + i%5)), "flag": i%10 == 0, "other": i % 3,
+			})
+		}
+		if err := db.Insert(fmt.Sprintf("doc_%d", doc), strconv.Itoa(doc), chunks, metadata, nil); err != nil {
+			t.Fatal(err)
+		}
+	}
+}
+
+func checkSameResults(t *testing.T, db, reference ndb.NeuralDB) {
+	constraints := []ndb.Constraints{
+		{"type": ndb.EqualTo("a")},
+		{"n": ndb.GreaterThan(90)},
+		{"flag": ndb.EqualTo(true), "n": ndb.LessThan(50)},
+		{"n": ndb.GreaterThan(10), "other": ndb.EqualTo(1)},
+		{"type": ndb.EqualTo("zzz")},
+		{"n": ndb.EqualTo("10")},
+		{"n": ndb.LessThan(3)},
+		{"n": ndb.Between(20, 35)},
+		{"type": ndb.In("b", "d"), "n": ndb.NotEqual(11)},
+		{"n": ndb.In(1, 5, 9, 13, 200), "other": ndb.In(1, 2)},
+		{"type": ndb.StartsWith("c")},
+		{"n": ndb.All(ndb.GreaterThan(40), ndb.LessThan(60), ndb.NotEqual(50))},
+		{"type": ndb.In()},
+	}
+
+	for _, constraint := range constraints {
+		for _, topk := range []int{1, 5, 20} {
+			expected, err := reference.Query("k0 k1", topk, constraint)
+			if err != nil {
+				t.Fatal(err)
+			}
+			actual, err := db.Query("k0 k1", topk, constraint)
+			if err != nil {
+				t.Fatal(err)
+			}
+
+			expectedIds, actualIds := []uint64{}, []uint64{}
+			for i := range expected {
+				expectedIds = append(expectedIds, expected[i].Id)
+			}
+			for i := range actual {
+				actualIds = append(actualIds, actual[i].Id)
+			}
+			if !slices.Equal(expectedIds, actualIds) {
+				t.Fatalf("constraints %v topk %d: expected %v got %v", constraint, topk, expectedIds, actualIds)
+			}
+		}
+	}
+}
+
+func copyDir(t *testing.T, src, dst string) {
+	err := filepath.WalkDir(src, func(path string, d fs.DirEntry, err error) error {
+		if err != nil {
+			return err
+		}
+		rel, err := filepath.Rel(src, path)
+		if err != nil {
+			return err
+		}
+		if d.IsDir() {
+			return os.MkdirAll(filepath.Join(dst, rel), 0777)
+		}
+		data, err := os.ReadFile(path)
+		if err != nil {
+			return err
+		}
+		return os.WriteFile(filepath.Join(dst, rel), data, 0666)
+	})
+	if err != nil {
+		t.Fatal(err)
+	}
+}
+
+func TestMetadataIndexes(t *testing.T) {
+	dbPath := t.TempDir()
+	options := ndb.Options{MetadataIndexes: []string{"n", "type", "flag"}}
+	db, err := ndb.NewWithOptions(dbPath, options)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	reference, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer reference.Free()
+
+	for _, target := range []ndb.NeuralDB{db, reference} {
+		insertIndexTestDocs(t, target, 0, 10)
+	}
+	checkSameResults(t, db, reference)
+
+	for _, target := range []ndb.NeuralDB{db, reference} {
+		if err := target.Delete("3", false); err != nil {
+			t.Fatal(err)
+		}
+		insertIndexTestDocs(t, target, 10, 12)
+	}
+	checkSameResults(t, db, reference)
+
+	savePath := t.TempDir()
+	if err := db.Save(savePath); err != nil {
+		t.Fatal(err)
+	}
+	db.Free()
+
+	// The engine does not allow reopening a path within the same process, so
+	// this checks that the index is recovered from the original directory by
+	// reopening a copy of it.
+	copyPath := t.TempDir()
+	copyDir(t, dbPath, copyPath)
+
+	for _, path := range []string{copyPath, savePath} {
+		reopened, err := ndb.New(path)
+		if err != nil {
+			t.Fatal(err)
+		}
+		checkSameResults(t, reopened, reference)
+		reopened.Free()
+	}
+
+	if _, err := ndb.NewWithOptions(savePath, ndb.Options{MetadataIndexes: []string{"other"}}); err == nil {
+		t.Fatal("expected error changing the metadata indexes of an existing ndb")
+	}
+
+	existing, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	existingPath := t.TempDir()
+	if err := existing.Save(existingPath); err != nil {
+		t.Fatal(err)
+	}
+	existing.Free()
+	if _, err := ndb.NewWithOptions(existingPath, options); err == nil {
+		t.Fatal("expected error declaring metadata indexes on an existing ndb")
+	}
+}
+
+func TestRangeAndSetConstraints(t *testing.T) {
+	db, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	names := []string{"apple", "apricot", "banana", "app", "cherry"}
+	chunks, metadata := []string{}, []map[string]interface{}{}
+	for i := 0; i < 10; i++ {
+		chunks = append(chunks, "a b c")
+		metadata = append(metadata, map[string]interface{}{
+			"n": i, "x": float32(i) / 2, "name": names[i%5], "flag": i%2 == 0,
+		})
+	}
+	if err := db.Insert("doc", "id", chunks, metadata, nil); err != nil {
+		t.Fatal(err)
+	}
+
+	checkIds := func(constraints ndb.Constraints, expected []uint64) {
+		results, err := db.Query("a b c", 20, constraints)
+		if err != nil {
+			t.Fatal(err)
+		}
+		ids := []uint64{}
+		for _, result := range results {
+			ids = append(ids, result.Id)
+		}
+		slices.Sort(ids)
+		if !slices.Equal(ids, expected) {
+			t.Fatalf("constraints %v: expected %v got %v", constraints, expected, ids)
+		}
+	}
+
+	checkIds(ndb.Constraints{"n": ndb.Between(3, 6)}, []uint64{3, 4, 5, 6})
+	checkIds(ndb.Constraints{"x": ndb.Between(float32(1), float32(2))}, []uint64{2, 3, 4})
+	checkIds(ndb.Constraints{"n": ndb.Between("3", "6")}, []uint64{})
+	checkIds(ndb.Constraints{"n": ndb.In(1, 4, 100)}, []uint64{1, 4})
+	checkIds(ndb.Constraints{"name": ndb.In("banana", "cherry", 3)}, []uint64{2, 4, 7, 9})
+	checkIds(ndb.Constraints{"name": ndb.In()}, []uint64{})
+	checkIds(ndb.Constraints{"flag": ndb.NotEqual(true)}, []uint64{1, 3, 5, 7, 9})
+	checkIds(ndb.Constraints{"n": ndb.NotEqual("1")}, []uint64{0, 1, 2, 3, 4, 5, 6, 7, 8, 9})
+	checkIds(ndb.Constraints{"name": ndb.StartsWith("ap")}, []uint64{0, 1, 3, 5, 6, 8})
+	checkIds(ndb.Constraints{"name": ndb.StartsWith("app")}, []uint64{0, 3, 5, 8})
+	checkIds(ndb.Constraints{"n": ndb.StartsWith("1")}, []uint64{})
+	checkIds(ndb.Constraints{
+		"n":    ndb.All(ndb.GreaterThan(1), ndb.NotEqual(5), ndb.LessThan(8)),
+		"name": ndb.All(ndb.StartsWith("a"), ndb.NotEqual("app")),
+	}, []uint64{6})
+
+	if _, err := db.Query("a b c", 5, ndb.Constraints{"n": ndb.In(1, []int{2})}); err == nil {
+		t.Fatal("expected error for unsupported constraint value type")
+	}
+}
+
 func intString(start, end int) string {
 	ints := make([]string, end-start)
 	for i := range ints {
 		ints[i] = strconv.Itoa(start + i)
 	}
-	return strings.Join(ints, " ")
+	return strings.Join(ints, " ")
+}
+
+func TestSelectiveIndexedConstraints(t *testing.T) {
+	const nChunks = 2000
+
+	db, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{MetadataIndexes: []string{"group", "rare"}})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	doc := ndb.Document{Document: "doc", DocId: "doc"}
+	for i := 0; i < nChunks; i++ {
+		// Each token in t0 to t19 is in 5% of the chunks, and every chunk in a
+		// group has the same token.
+		doc.Chunks = append(doc.Chunks, fmt.Sprintf("t%d w%d", i%20, i))
+		doc.Metadata = append(doc.Metadata, map[string]interface{}{"group": i % 100, "rare": i == 1234})
+	}
+	if err := db.InsertBatch([]ndb.Document{doc}); err != nil {
+		t.Fatal(err)
+	}
+
+	stageCounts := func() (uint64, uint64) {
+		stats := db.Stats()
+		return stats.Stages["engine_query"].Count, stats.Stages["engine_rank"].Count
+	}
+
+	// A filter that keeps 1% of the chunks is answered by filtering the
+	// engine's unconstrained results.
+	queries, ranks := stageCounts()
+	results, err := db.Query("t7", 5, ndb.Constraints{"group": ndb.EqualTo(7)})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(results) != 5 {
+		t.Fatalf("expected 5 results, got %v", results)
+	}
+	for _, result := range results {
+		if result.Metadata["group"] != 7 {
+			t.Fatalf("result %v does not satisfy the constraint", result)
+		}
+	}
+	if q, r := stageCounts(); q == queries || r != ranks {
+		t.Fatalf("expected the query to be answered with the index, got %d engine queries and %d engine ranks", q-queries, r-ranks)
+	}
+
+	// The engine cannot score a given set of chunks, so a filter that only
+	// keeps a single chunk falls back to the engine's rank.
+	queries, ranks = stageCounts()
+	results, err = db.Query("t14", 5, ndb.Constraints{"rare": ndb.EqualTo(true)})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(results) != 1 || results[0].Text != "t14 w1234" {
+		t.Fatalf("expected the rare chunk, got %v", results)
+	}
+	if q, r := stageCounts(); q != queries || r != ranks+1 {
+		t.Fatalf("expected the query to fall back to the engine's rank, got %d engine queries and %d engine ranks", q-queries, r-ranks)
+	}
+}
+
+func TestCheckpointDelta(t *testing.T) {
+	db, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{MetadataIndexes: []string{"n"}})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	insertIndexTestDocs(t, db, 0, 10)
+
+	base := filepath.Join(t.TempDir(), "base")
+	if err := db.Save(base); err != nil {
+		t.Fatal(err)
+	}
+
+	insertIndexTestDocs(t, db, 10, 12)
+
+	latest := filepath.Join(t.TempDir(), "latest")
+	if err := db.Save(latest); err != nil {
+		t.Fatal(err)
+	}
+
+	baseManifestPath := filepath.Join(base, ndb.CheckpointManifestFile)
+	latestManifestPath := filepath.Join(latest, ndb.CheckpointManifestFile)
+
+	baseManifest, err := ndb.ReadCheckpointManifest(baseManifestPath)
+	if err != nil {
+		t.Fatal(err)
+	}
+	latestManifest, err := ndb.ReadCheckpointManifest(latestManifestPath)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if baseManifest.Id == latestManifest.Id {
+		t.Fatal("checkpoints with different contents should have different ids")
+	}
+
+	delta, err := ndb.CheckpointDelta(latestManifestPath, baseManifestPath)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(delta) == 0 || len(delta) >= len(latestManifest.Files) {
+		t.Fatalf("expected the delta to contain some but not all files, got %d of %d", len(delta), len(latestManifest.Files))
+	}
+
+	unchanged, err := ndb.CheckpointDelta(latestManifestPath, latestManifestPath)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(unchanged) != 0 {
+		t.Fatalf("expected empty delta against the same checkpoint, got %v", unchanged)
+	}
+
+	// Rebuild the latest checkpoint from the base checkpoint and the delta.
+	rebuilt := t.TempDir()
+	for _, file := range latestManifest.Files {
+		src := filepath.Join(base, file)
+		if slices.Contains(delta, file) {
+			src = filepath.Join(latest, file)
+		}
+		data, err := os.ReadFile(src)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if err := os.MkdirAll(filepath.Dir(filepath.Join(rebuilt, file)), 0777); err != nil {
+			t.Fatal(err)
+		}
+		if err := os.WriteFile(filepath.Join(rebuilt, file), data, 0666); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	reopened, err := ndb.New(rebuilt)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer reopened.Free()
+	checkSameResults(t, reopened, db)
+}
+
+func readDirFiles(t *testing.T, dir string) map[string]string {
+	files := map[string]string{}
+	err := filepath.WalkDir(dir, func(path string, d fs.DirEntry, err error) error {
+		if err != nil || d.IsDir() {
+			return err
+		}
+		data, err := os.ReadFile(path)
+		files[path] = string(data)
+		return err
+	})
+	if err != nil {
+		t.Fatal(err)
+	}
+	return files
+}
+
+func TestReadOnly(t *testing.T) {
+	db, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{MetadataIndexes: []string{"n"}})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	insertIndexTestDocs(t, db, 0, 10)
+
+	savePath := filepath.Join(t.TempDir(), "ndb")
+	if err := db.Save(savePath); err != nil {
+		t.Fatal(err)
+	}
+	before := readDirFiles(t, savePath)
+
+	// Several read only instances can be opened on the same directory.
+	readers := []ndb.NeuralDB{}
+	for i := 0; i < 2; i++ {
+		reader, err := ndb.NewWithOptions(savePath, ndb.Options{ReadOnly: true})
+		if err != nil {
+			t.Fatal(err)
+		}
+		defer reader.Free()
+		readers = append(readers, reader)
+	}
+
+	for _, reader := range readers {
+		checkSameResults(t, reader, db)
+	}
+
+	reader := readers[0]
+	if err := reader.Insert("doc", "id", []string{"a b c"}, nil, nil); err == nil {
+		t.Fatal("expected error inserting into a read only ndb")
+	}
+	if _, err := reader.InsertAsync([]ndb.Document{{Document: "doc", DocId: "id", Chunks: []string{"a"}}}); err == nil {
+		t.Fatal("expected error inserting into a read only ndb")
+	}
+	if err := reader.Delete("1", false); err == nil {
+		t.Fatal("expected error deleting from a read only ndb")
+	}
+	if err := reader.Finetune([]string{"a"}, []uint64{0}); err == nil {
+		t.Fatal("expected error finetuning a read only ndb")
+	}
+	if err := reader.Prune(); err == nil {
+		t.Fatal("expected error pruning a read only ndb")
+	}
+
+	copyPath := filepath.Join(t.TempDir(), "copy")
+	if err := reader.Save(copyPath); err != nil {
+		t.Fatal(err)
+	}
+	saved, err := ndb.New(copyPath)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer saved.Free()
+	checkSameResults(t, saved, db)
+
+	if !reflect.DeepEqual(readDirFiles(t, savePath), before) {
+		t.Fatal("opening an ndb in read only mode should not modify its files")
+	}
+
+	if _, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{ReadOnly: true}); err == nil {
+		t.Fatal("expected error opening a path without an ndb in read only mode")
+	}
+}
+
+func TestReturnsCorrectChunkData(t *testing.T) {
+	db, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	for i := 0; i < 20; i++ {
+		docId := strconv.Itoa(i)
+		doc := fmt.Sprintf("document_%d", i)
+
+		meta1 := map[string]interface{}{"id": i, "type": "first"}
+		meta2 := map[string]interface{}{"id": i, "type": "second"}
+
+		err := db.Insert(
+			doc, docId,
+			[]string{intString(i*10, (i+1)*10), intString(i*10, i*10+5)},
+			[]map[string]interface{}{meta1, meta2},
+			nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	for i := 0; i < 20; i++ {
+		query := intString(i*10, (i+1)*10)
+
+		results, err := db.Query(query, 5, nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+
+		if len(results) != 2 {
+			t.Fatal("expected 2 results")
+		}
+
+		docId := strconv.Itoa(i)
+		doc := fmt.Sprintf("document_%d", i)
+
+		if results[0].Id != uint64(2*i) || results[1].Id != uint64((2*i)+1) ||
+			results[0].Text != query || results[1].Text != intString(i*10, i*10+5) ||
+			results[0].Document != doc || results[1].Document != doc ||
+			results[0].DocId != docId || results[1].DocId != docId ||
+			results[0].DocVersion != 1 || results[1].DocVersion != 1 {
+			t.Fatal("invalid results")
+		}
+
+		if len(results[0].Metadata) != 2 || len(results[1].Metadata) != 2 ||
+			results[0].Metadata["id"].(int) != i || results[1].Metadata["id"].(int) != i ||
+			results[0].Metadata["type"].(string) != "first" || results[1].Metadata["type"].(string) != "second" {
+			t.Fatal("invalid metadata")
+		}
+
+		constrainedResults, err := db.Query(query, 5, ndb.Constraints{"type": ndb.EqualTo("second")})
+		if err != nil {
+			t.Fatal(err)
+		}
+
+		if len(constrainedResults) != 1 || constrainedResults[0].Id != uint64((2*i)+1) {
+			t.Fatal("incorrect constrained results")
+		}
+	}
+}
+
+func TestMetadataTypesRoundTrip(t *testing.T) {
+	db, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	metadata := map[string]interface{}{
+		"bool": true, "int": -42, "float": float32(2.5), "str": "a string", "empty": "",
+		"false": false, "zero": 0, "max": math.MaxInt32, "min": math.MinInt32,
+		"long": strings.Repeat("x", 300),
+	}
+
+	err = db.Insert("doc", "id", []string{"a b c", "d e f"}, []map[string]interface{}{metadata, {}}, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	results, err := db.Query("a b c d e f", 2, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	if len(results) != 2 || results[0].Id != 0 || results[1].Id != 1 {
+		t.Fatalf("unexpected results %v", results)
+	}
+
+	if !reflect.DeepEqual(results[0].Metadata, metadata) {
+		t.Fatalf("expected metadata %v, got %v", metadata, results[0].Metadata)
+	}
+
+	if len(results[1].Metadata) != 0 || results[1].Text != "d e f" || results[1].Document != "doc" || results[1].DocId != "id" {
+		t.Fatalf("unexpected result %v", results[1])
+	}
+}
+
+func TestQueryResultsReuse(t *testing.T) {
+	db, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	insertIndexTestDocs(t, db, 0, 3)
+	// Chunks with different metadata keys, so that reused results see keys
+	// that their earlier results did not have.
+	if err := db.Insert("extra", "extra", []string{"k0 extra", "extra plain"}, []map[string]interface{}{{"extra": 1.5}, {}}, nil); err != nil {
+		t.Fatal(err)
+	}
+
+	queries := []string{"k0 k1", "extra plain", "k2", "k0 extra", "k3"}
+	expected, err := db.QueryBatch(queries, 10, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	// Queries on the same goroutine reuse the same results handle, so
+	// alternating large, small, and partial results checks that nothing from
+	// earlier results is returned.
+	for round := 0; round < 3; round++ {
+		for i, query := range queries {
+			topk := []int{10, 1, 3}[round]
+			results, err := db.Query(query, topk, nil)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if want := expected[i][:min(topk, len(expected[i]))]; !reflect.DeepEqual(results, want) {
+				t.Fatalf("query %q: expected %v got %v", query, want, results)
+			}
+
+			text, err := db.QueryFields(query, 10, nil, ndb.FieldText)
+			if err != nil {
+				t.Fatal(err)
+			}
+			for j, result := range text {
+				if result.Text != expected[i][j].Text || result.DocId != "" || result.Metadata != nil {
+					t.Fatalf("query %q: unexpected text result %+v", query, result)
+				}
+			}
+		}
+	}
+}
+
+func TestExecutor(t *testing.T) {
+	defer func() {
+		if err := ndb.ConfigureExecutor(ndb.ExecutorOptions{}); err != nil {
+			t.Fatal(err)
+		}
+	}()
+
+	db, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	insertIndexTestDocs(t, db, 0, 3)
+
+	queries := []string{"k0 k1", "k2", "k3 f5_2", "k1 f20_0"}
+
+	configs := []ndb.ExecutorOptions{
+		{Threads: 2, QueryParallelism: 1, UpdateParallelism: 1, NumaNodes: []int{0}},
+		{Threads: 1, InlineQueries: true},
+		{QueryParallelism: 1, UpdateParallelism: 2},
+	}
+	for doc, config := range configs {
+		// The expected results are from the default configuration, which runs
+		// queries on the calling thread.
+		if err := ndb.ConfigureExecutor(ndb.ExecutorOptions{}); err != nil {
+			t.Fatal(err)
+		}
+		expected := [][]ndb.Chunk{}
+		for _, query := range queries {
+			results, err := db.Query(query, 5, ndb.Constraints{"type": ndb.EqualTo("a")})
+			if err != nil {
+				t.Fatal(err)
+			}
+			expected = append(expected, results)
+		}
+
+		if err := ndb.ConfigureExecutor(config); err != nil {
+			t.Fatal(err)
+		}
+
+		var wg sync.WaitGroup
+		errs := make(chan error, 8)
+		for g := 0; g < 8; g++ {
+			wg.Add(1)
+			go func() {
+				defer wg.Done()
+				for i, query := range queries {
+					results, err := db.Query(query, 5, ndb.Constraints{"type": ndb.EqualTo("a")})
+					if err != nil {
+						errs <- err
+						return
+					}
+					if !reflect.DeepEqual(results, expected[i]) {
+						errs <- fmt.Errorf("query %q: expected %v got %v", query, expected[i], results)
+						return
+					}
+				}
+			}()
+		}
+		wg.Wait()
+		close(errs)
+		for err := range errs {
+			t.Fatal(err)
+		}
+
+		// Updates run through the executor too.
+		if err := db.Insert("extra", fmt.Sprintf("extra_%d", doc), []string{"unrelated"}, nil, nil); err != nil {
+			t.Fatal(err)
+		}
+		if err := db.Finetune([]string{"unrelated"}, []uint64{0}); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	invalid := []ndb.ExecutorOptions{
+		{Threads: -1},
+		{CPUs: []int{0}},
+		{Threads: 1, CPUs: []int{1 << 20}},
+		{Threads: 1, NumaNodes: []int{1 << 20}},
+	}
+	for _, config := range invalid {
+		if err := ndb.ConfigureExecutor(config); err == nil {
+			t.Fatalf("expected error configuring executor with %+v", config)
+		}
+	}
+}
+
+func TestQueryAsync(t *testing.T) {
+	db, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{MetadataIndexes: []string{"type"}})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	insertIndexTestDocs(t, db, 0, 3)
+
+	queue := ndb.NewCompletionQueue()
+	defer queue.Close()
+
+	// Queries cannot run asynchronously without executor threads.
+	if _, err := db.QueryAsync(queue, "k0", 5, nil, ndb.QueryLimits{}, ndb.AllFields); err == nil {
+		t.Fatal("expected error for async query without executor threads")
+	}
+
+	if err := ndb.ConfigureExecutor(ndb.ExecutorOptions{Threads: 2, QueryParallelism: 1}); err != nil {
+		t.Fatal(err)
+	}
+	defer func() {
+		if err := ndb.ConfigureExecutor(ndb.ExecutorOptions{}); err != nil {
+			t.Fatal(err)
+		}
+	}()
+
+	queries := []string{"k0 k1", "k2", "k3 f5_2", "k1 f20_0"}
+	constraints := []ndb.Constraints{nil, {"type": ndb.EqualTo("a")}}
+	limits := ndb.QueryLimits{MaxCandidates: 8}
+
+	expected := map[string][]ndb.Chunk{}
+	for _, query := range queries {
+		for i, constraint := range constraints {
+			results, err := db.QueryWithLimits(query, 5, constraint, limits, ndb.AllFields)
+			if err != nil {
+				t.Fatal(err)
+			}
+			expected[fmt.Sprintf("%s/%d", query, i)] = results
+		}
+	}
+
+	// Each goroutine submits all of its queries before waiting for any of them.
+	var wg sync.WaitGroup
+	errs := make(chan error, 16)
+	for g := 0; g < 16; g++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			pending := map[string]*ndb.PendingQuery{}
+			for _, query := range queries {
+				for i, constraint := range constraints {
+					p, err := db.QueryAsync(queue, query, 5, constraint, limits, ndb.AllFields)
+					if err != nil {
+						errs <- err
+						return
+					}
+					pending[fmt.Sprintf("%s/%d", query, i)] = p
+				}
+			}
+			for key, p := range pending {
+				results, err := p.Wait()
+				if err != nil {
+					errs <- err
+					return
+				}
+				if !reflect.DeepEqual(results, expected[key]) {
+					errs <- fmt.Errorf("query %s: expected %v got %v", key, expected[key], results)
+					return
+				}
+			}
+		}()
+	}
+	wg.Wait()
+	close(errs)
+	for err := range errs {
+		t.Fatal(err)
+	}
+
+	// Only the requested fields are returned, and waiting again returns the
+	// same results.
+	pending, err := db.QueryAsync(queue, "k0 k1", 3, nil, ndb.QueryLimits{}, ndb.FieldDocId)
+	if err != nil {
+		t.Fatal(err)
+	}
+	<-pending.Done()
+	first, err := pending.Wait()
+	if err != nil {
+		t.Fatal(err)
+	}
+	second, _ := pending.Wait()
+	if len(first) != 3 || first[0].Text != "" || first[0].DocId == "" || !reflect.DeepEqual(first, second) {
+		t.Fatalf("unexpected results %v then %v", first, second)
+	}
+
+	if _, err := db.QueryAsync(queue, "k0", 0, nil, ndb.QueryLimits{}, ndb.AllFields); err == nil {
+		t.Fatal("expected error for topk 0")
+	}
+
+	// Queries in flight when the queue is closed still complete.
+	inFlight := []*ndb.PendingQuery{}
+	for i := 0; i < 32; i++ {
+		p, err := db.QueryAsync(queue, queries[i%len(queries)], 5, nil, ndb.QueryLimits{}, ndb.AllFields)
+		if err != nil {
+			t.Fatal(err)
+		}
+		inFlight = append(inFlight, p)
+	}
+	queue.Close()
+	for _, p := range inFlight {
+		if _, err := p.Wait(); err != nil {
+			t.Fatal(err)
+		}
+	}
+	if _, err := db.QueryAsync(queue, "k0", 5, nil, ndb.QueryLimits{}, ndb.AllFields); err == nil {
+		t.Fatal("expected error for a closed queue")
+	}
+}
+
+func TestQueryBatch(t *testing.T) {
+	db, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	for i := 0; i < 20; i++ {
+		err := db.Insert(
+			fmt.Sprintf("document_%d", i), strconv.Itoa(i),
+			[]string{intString(i*10, (i+1)*10), intString(i*10, i*10+5)},
+			[]map[string]interface{}{{"type": "first"}, {"type": "second"}},
+			nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	queries := []string{}
+	for i := 0; i < 20; i++ {
+		queries = append(queries, intString(i*10, (i+1)*10))
+	}
+
+	for _, constraints := range []ndb.Constraints{nil, {"type": ndb.EqualTo("second")}} {
+		batch, err := db.QueryBatch(queries, 5, constraints)
+		if err != nil {
+			t.Fatal(err)
+		}
+
+		if len(batch) != len(queries) {
+			t.Fatalf("expected %d result lists, got %d", len(queries), len(batch))
+		}
+
+		for i, query := range queries {
+			expected, err := db.Query(query, 5, constraints)
+			if err != nil {
+				t.Fatal(err)
+			}
+
+			if len(batch[i]) == 0 || !reflect.DeepEqual(batch[i], expected) {
+				t.Fatalf("batch results for query %d do not match single query results", i)
+			}
+		}
+	}
+
+	if _, err := db.QueryBatch(queries, 0, nil); err == nil {
+		t.Fatal("expected error for topk=0")
+	}
+}
+
+func TestQueryFields(t *testing.T) {
+	db, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	for i := 0; i < 10; i++ {
+		err := db.Insert(
+			fmt.Sprintf("document_%d", i), strconv.Itoa(i),
+			[]string{intString(i*10, (i+1)*10)},
+			[]map[string]interface{}{{"type": "first", "n": i}},
+			nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	query := intString(30, 40) + " " + intString(0, 5)
+	constraints := ndb.Constraints{"type": ndb.EqualTo("first")}
+	full, err := db.Query(query, 5, constraints)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	for _, fields := range []ndb.Field{0, ndb.FieldText, ndb.FieldDocId | ndb.FieldMetadata, ndb.AllFields} {
+		results, err := db.QueryFields(query, 5, constraints, fields)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(results) != len(full) {
+			t.Fatalf("fields %d: expected %d results got %d", fields, len(full), len(results))
+		}
+
+		for i, result := range results {
+			expected := ndb.Chunk{Id: full[i].Id, DocVersion: full[i].DocVersion, Score: full[i].Score}
+			if fields&ndb.FieldText != 0 {
+				expected.Text = full[i].Text
+			}
+			if fields&ndb.FieldDocument != 0 {
+				expected.Document = full[i].Document
+			}
+			if fields&ndb.FieldDocId != 0 {
+				expected.DocId = full[i].DocId
+			}
+			if fields&ndb.FieldMetadata != 0 {
+				expected.Metadata = full[i].Metadata
+			}
+			if !reflect.DeepEqual(result, expected) {
+				t.Fatalf("fields %d: expected %v got %v", fields, expected, result)
+			}
+		}
+	}
+}
+
+func TestQueryCache(t *testing.T) {
+	db, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{QueryCacheSize: 2})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	insert := func(i int) {
+		err := db.Insert(
+			fmt.Sprintf("doc_%d", i), strconv.Itoa(i),
+			[]string{intString(i*10, (i+1)*10)}, []map[string]interface{}{{"i": i}}, nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	check := func(db ndb.NeuralDB, query string, constraints ndb.Constraints, expectedIds []uint64) {
+		results, err := db.Query(query, 5, constraints)
+		if err != nil {
+			t.Fatal(err)
+		}
+		ids := []uint64{}
+		for _, result := range results {
+			ids = append(ids, result.Id)
+		}
+		if !slices.Equal(ids, expectedIds) {
+			t.Fatalf("query '%v' failed: expected %v got %v", query, expectedIds, ids)
+		}
+	}
+
+	checkStats := func(hits, misses, entries uint64) {
+		expected := ndb.QueryCacheStats{Hits: hits, Misses: misses, Entries: entries}
+		if stats := db.QueryCacheStats(); stats != expected {
+			t.Fatalf("expected cache stats %v, got %v", expected, stats)
+		}
+	}
+
+	for i := 0; i < 5; i++ {
+		insert(i)
+	}
+
+	query := intString(0, 5) + " " + intString(20, 25)
+	check(db, query, nil, []uint64{0, 2})
+	checkStats(0, 1, 1)
+	check(db, "  "+strings.ReplaceAll(query, " ", "   ")+" ", nil, []uint64{0, 2})
+	checkStats(1, 1, 1)
+
+	constraints := ndb.Constraints{"i": ndb.GreaterThan(1)}
+	check(db, query, constraints, []uint64{2})
+	check(db, query, ndb.Constraints{"i": ndb.All(ndb.GreaterThan(1))}, []uint64{2})
+	checkStats(2, 2, 2)
+
+	// Any update invalidates the cached results.
+	insert(5)
+	check(db, query+" "+intString(50, 52), nil, []uint64{0, 2, 5})
+	check(db, query, constraints, []uint64{2})
+	checkStats(2, 4, 2)
+
+	if err := db.Delete("2", false); err != nil {
+		t.Fatal(err)
+	}
+	check(db, query, constraints, []uint64{})
+	checkStats(2, 5, 2)
+
+	// The least recently used entry is evicted once the cache is full.
+	check(db, query, nil, []uint64{0})
+	check(db, query+" "+intString(50, 52), nil, []uint64{0, 5})
+	checkStats(2, 7, 2)
+	check(db, query, constraints, []uint64{})
+	checkStats(2, 8, 2)
+
+	uncached, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer uncached.Free()
+	check(uncached, query, nil, []uint64{})
+	if stats := uncached.QueryCacheStats(); stats != (ndb.QueryCacheStats{}) {
+		t.Fatalf("expected empty stats for disabled cache, got %v", stats)
+	}
+}
+
+func TestPool(t *testing.T) {
+	db, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	// Each saved ndb has one more document than the previous one.
+	paths := []string{}
+	for i := 0; i < 3; i++ {
+		if err := db.Insert("doc", fmt.Sprintf("id%d", i), []string{fmt.Sprintf("pooled chunk %d", i)}, nil, nil); err != nil {
+			t.Fatal(err)
+		}
+		path := filepath.Join(t.TempDir(), "ndb")
+		if err := db.Save(path); err != nil {
+			t.Fatal(err)
+		}
+		paths = append(paths, path)
+	}
+
+	pool, err := ndb.NewPool(ndb.PoolOptions{MaxOpen: 2, QueryCacheSize: 16})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer func() {
+		if pool != nil {
+			pool.Free()
+		}
+	}()
+
+	query := func(i int) {
+		t.Helper()
+		reader, err := pool.Acquire(paths[i], ndb.Options{ReadOnly: true})
+		if err != nil {
+			t.Fatal(err)
+		}
+		defer reader.Free()
+
+		results, err := reader.Query("pooled chunk", 5, nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(results) != i+1 {
+			t.Fatalf("ndb %d: expected %d results got %d", i, i+1, len(results))
+		}
+	}
+
+	checkStats := func(open, opens, evictions int) {
+		t.Helper()
+		stats := pool.Stats()
+		if stats.Open != open || stats.Opens != uint64(opens) || stats.Evictions != uint64(evictions) {
+			t.Fatalf("expected %d open, %d opens, and %d evictions, got %+v", open, opens, evictions, stats)
+		}
+	}
+
+	query(0)
+	query(1)
+	checkStats(2, 2, 0)
+	if stats := pool.Stats(); stats.OpenBytes <= 0 {
+		t.Fatalf("expected the size of the open ndbs, got %+v", stats)
+	}
+
+	// The least recently used ndb is closed to open another one, and is
+	// opened again when it is needed.
+	query(2)
+	checkStats(2, 3, 1)
+	query(0)
+	checkStats(2, 4, 2)
+
+	// The ndbs share the pool's query cache.
+	query(0)
+	if stats := pool.QueryCacheStats(); stats.Hits != 1 {
+		t.Fatalf("expected a cache hit, got %v", stats)
+	}
+	if stats := pool.Stats(); stats.Hits != 1 {
+		t.Fatalf("expected the open ndb to be reused, got %+v", stats)
+	}
+
+	// Ndbs that are in use are not closed, the pool returns within its limits
+	// once they are released.
+	readers := []ndb.NeuralDB{}
+	for _, path := range paths {
+		reader, err := pool.Acquire(path, ndb.Options{ReadOnly: true})
+		if err != nil {
+			t.Fatal(err)
+		}
+		readers = append(readers, reader)
+	}
+	checkStats(3, 6, 3)
+	for _, reader := range readers {
+		reader.Free()
+	}
+	checkStats(2, 6, 4)
+
+	if _, err := pool.Acquire(paths[0], ndb.Options{ReadOnly: true, QueryCacheSize: 10}); err == nil {
+		t.Fatal("expected an error for a query cache in the options")
+	}
+
+	// Writable ndbs are pinned, and an ndb can only be open one way.
+	writer, err := pool.Acquire(t.TempDir(), ndb.Options{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err := writer.Insert("doc", "id", []string{"pinned chunk"}, nil, nil); err != nil {
+		t.Fatal(err)
+	}
+	writer.Free()
+	query(1)
+	query(2)
+	if stats := pool.Stats(); stats.Open != 2 || stats.Pinned != 1 {
+		t.Fatalf("expected the writable ndb to stay open, got %+v", stats)
+	}
+
+	if _, err := pool.Acquire(paths[2], ndb.Options{}); err == nil {
+		t.Fatal("expected an error for a writable acquire of a read only ndb")
+	}
+
+	// An ndb stays usable after the pool is freed until it is released.
+	reader, err := pool.Acquire(paths[1], ndb.Options{ReadOnly: true})
+	if err != nil {
+		t.Fatal(err)
+	}
+	pool.Free()
+	pool = nil
+	results, err := reader.Query("pooled chunk", 5, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(results) != 2 {
+		t.Fatalf("expected 2 results got %d", len(results))
+	}
+	reader.Free()
+}
+
+func TestPoolIdleTimeout(t *testing.T) {
+	db, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err := db.Insert("doc", "id", []string{"idle chunk"}, nil, nil); err != nil {
+		t.Fatal(err)
+	}
+	readOnlyPath := filepath.Join(t.TempDir(), "ndb")
+	if err := db.Save(readOnlyPath); err != nil {
+		t.Fatal(err)
+	}
+	db.Free()
+
+	pool, err := ndb.NewPool(ndb.PoolOptions{IdleTimeout: 20 * time.Millisecond})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer pool.Free()
+
+	reader, err := pool.Acquire(readOnlyPath, ndb.Options{ReadOnly: true})
+	if err != nil {
+		t.Fatal(err)
+	}
+	time.Sleep(50 * time.Millisecond)
+	if stats := pool.Stats(); stats.Open != 1 {
+		t.Fatalf("expected the ndb in use to stay open, got %+v", stats)
+	}
+	reader.Free()
+
+	deadline := time.Now().Add(5 * time.Second)
+	for pool.Stats().Open != 0 {
+		if time.Now().After(deadline) {
+			t.Fatalf("expected the idle ndb to be closed, got %+v", pool.Stats())
+		}
+		time.Sleep(5 * time.Millisecond)
+	}
+	if stats := pool.Stats(); stats.Evictions != 1 {
+		t.Fatalf("expected 1 eviction, got %+v", stats)
+	}
+}
+
+func TestCompaction(t *testing.T) {
+	db, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{CompactionInterval: 10 * time.Millisecond})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	for version := 0; version < 2; version++ {
+		if err := db.Insert("doc", "a", []string{"apple", "banana"}, nil, nil); err != nil {
+			t.Fatal(err)
+		}
+	}
+	if err := db.Insert("doc", "b", []string{"apple banana"}, nil, nil); err != nil {
+		t.Fatal(err)
+	}
+
+	if err := db.DeleteVersion("a", 1); err != nil {
+		t.Fatal(err)
+	}
+	if err := db.Delete("b", false); err != nil {
+		t.Fatal(err)
+	}
+
+	deadline := time.Now().Add(10 * time.Second)
+	for stats := db.CompactionStats(); stats.Passes == 0 || stats.PendingDeletions > 0; stats = db.CompactionStats() {
+		if time.Now().After(deadline) {
+			t.Fatalf("deletions were not compacted in the background: %+v", stats)
+		}
+		time.Sleep(5 * time.Millisecond)
+	}
+
+	sources, err := db.Sources()
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(sources) != 1 || sources[0].DocId != "a" || sources[0].DocVersion != 2 {
+		t.Fatalf("unexpected sources after compaction: %v", sources)
+	}
+
+	results, err := db.Query("apple banana", 5, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(results) != 2 {
+		t.Fatalf("expected 2 results, got %d", len(results))
+	}
+	for _, result := range results {
+		if result.DocId != "a" || result.DocVersion != 2 {
+			t.Fatalf("deleted chunk returned after compaction: %+v", result)
+		}
+	}
+
+	// Background compaction is disabled unless an interval is set.
+	manual, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer manual.Free()
+
+	if err := manual.Insert("doc", "a", []string{"apple"}, nil, nil); err != nil {
+		t.Fatal(err)
+	}
+	if err := manual.Delete("a", false); err != nil {
+		t.Fatal(err)
+	}
+
+	time.Sleep(20 * time.Millisecond)
+	if stats := manual.CompactionStats(); stats.Passes != 0 || stats.PendingDeletions != 1 {
+		t.Fatalf("expected a pending deletion and no passes, got %+v", stats)
+	}
+
+	if err := manual.Prune(); err != nil {
+		t.Fatal(err)
+	}
+	if stats := manual.CompactionStats(); stats.Passes != 1 || stats.PendingDeletions != 0 {
+		t.Fatalf("expected a single pass, got %+v", stats)
+	}
+}
+
+func TestShardedNeuralDB(t *testing.T) {
+	sharded, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{NumShards: 4, MetadataIndexes: []string{"n", "type"}})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer sharded.Free()
+
+	for i := 0; i < 20; i++ {
+		chunks := []string{intString(i*10, (i+1)*10), intString(i*10, i*10+5)}
+		// Every document shares a value of "type", so the postings of the value
+		// hold ids from every shard, which are not inserted in id order.
+		metadata := []map[string]interface{}{{"n": 2 * i, "type": "a"}, {"n": 2*i + 1, "type": []string{"b", "c"}[i%2]}}
+		if err := sharded.Insert(fmt.Sprintf("doc_%d", i), strconv.Itoa(i), chunks, metadata, nil); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	ids := map[uint64]bool{}
+	// The id of a chunk of each shard.
+	shards := map[uint64]uint64{}
+	for i := 0; i < 20; i++ {
+		results, err := sharded.Query(intString(i*10, (i+1)*10), 5, nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(results) == 0 || results[0].DocId != strconv.Itoa(i) || results[0].Text != intString(i*10, (i+1)*10) {
+			t.Fatalf("query %d: unexpected results %v", i, results)
+		}
+		for j := 1; j < len(results); j++ {
+			if results[j].Score > results[j-1].Score {
+				t.Fatalf("query %d: results are not sorted by score", i)
+			}
+		}
+		ids[results[0].Id] = true
+		shards[results[0].Id>>40] = results[0].Id
+
+		constrained, err := sharded.Query(intString(i*10, (i+1)*10), 5, ndb.Constraints{"n": ndb.EqualTo(2*i + 1)})
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(constrained) != 1 || constrained[0].Text != intString(i*10, i*10+5) {
+			t.Fatalf("query %d: unexpected constrained results %v", i, constrained)
+		}
+
+		shared, err := sharded.Query(intString(i*10, (i+1)*10), 1, ndb.Constraints{"type": ndb.EqualTo("a")})
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(shared) != 1 || shared[0].Id != results[0].Id {
+			t.Fatalf("query %d: expected constrained result %d, got %v", i, results[0].Id, shared)
+		}
+	}
+	if len(ids) != 20 || len(shards) < 2 {
+		t.Fatalf("expected the documents to be spread across shards with distinct ids, got %v", ids)
+	}
+
+	// A single finetune call with labels in several shards updates each of
+	// them.
+	queries := []string{"zzz yyy", "xxx www", "vvv uuu", "ttt sss"}
+	var labels []uint64
+	for _, id := range shards {
+		labels = append(labels, id)
+	}
+	queries = queries[:len(labels)]
+	if err := sharded.Finetune(queries, labels); err != nil {
+		t.Fatal(err)
+	}
+	var results []ndb.Chunk
+	for i, query := range queries {
+		results, err = sharded.Query(query, 1, nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(results) != 1 || results[0].Id != labels[i] {
+			t.Fatalf("expected finetuned chunk %d for %q, got %v", labels[i], query, results)
+		}
+	}
+	if err := sharded.Finetune([]string{"zzz"}, []uint64{1 << 50}); err == nil {
+		t.Fatal("expected error for chunk id in a shard that does not exist")
+	}
+
+	if err := sharded.Delete("3", false); err != nil {
+		t.Fatal(err)
+	}
+	results, err = sharded.Query(intString(30, 40), 5, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, result := range results {
+		if result.DocId == "3" {
+			t.Fatalf("deleted document returned: %v", result)
+		}
+	}
+
+	checkpoint := filepath.Join(t.TempDir(), "checkpoint")
+	if err := sharded.Save(checkpoint); err != nil {
+		t.Fatal(err)
+	}
+
+	if _, err := ndb.NewWithOptions(checkpoint, ndb.Options{NumShards: 2}); err == nil {
+		t.Fatal("expected error opening an ndb with a different number of shards")
+	}
+
+	loaded, err := ndb.New(checkpoint)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer loaded.Free()
+
+	// The shards and the metadata index are opened in parallel, so the total
+	// is at least the time spent opening either of them.
+	timings := loaded.OpenTimings()
+	if timings.Engine <= 0 || timings.MetadataIndex <= 0 || timings.Total < timings.Engine || timings.Total < timings.MetadataIndex {
+		t.Fatalf("unexpected open timings %+v", timings)
+	}
+
+	sources, err := loaded.Sources()
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(sources) != 19 {
+		t.Fatalf("expected 19 sources, got %d", len(sources))
+	}
+	results, err = loaded.Query(intString(110, 120), 1, ndb.Constraints{"n": ndb.EqualTo(22)})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(results) != 1 || results[0].DocId != "11" {
+		t.Fatalf("unexpected results after loading checkpoint: %v", results)
+	}
+
+	// Deleting every document with type "c" removes their ids from the
+	// postings, so the query is answered by the index without retrieving any
+	// candidates.
+	for i := 1; i < 20; i += 2 {
+		if err := loaded.Delete(strconv.Itoa(i), false); err != nil {
+			t.Fatal(err)
+		}
+	}
+	candidates := loaded.Stats().Counters["candidates"]
+	results, err = loaded.Query(intString(10, 20), 5, ndb.Constraints{"type": ndb.EqualTo("c")})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(results) != 0 || loaded.Stats().Counters["candidates"] != candidates {
+		t.Fatalf("expected no indexed chunks with type c after deleting them, got %v", results)
+	}
+	for i := 0; i < 20; i += 2 {
+		results, err := loaded.Query(intString(i*10, i*10+5), 1, ndb.Constraints{"type": ndb.EqualTo("b")})
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(results) != 1 || results[0].DocId != strconv.Itoa(i) || results[0].Text != intString(i*10, i*10+5) {
+			t.Fatalf("query %d: unexpected results after deletes %v", i, results)
+		}
+	}
+}
+
+func TestQueryLimits(t *testing.T) {
+	for _, options := range []ndb.Options{{}, {MetadataIndexes: []string{"type"}, QueryCacheSize: 16}} {
+		db, err := ndb.NewWithOptions(t.TempDir(), options)
+		if err != nil {
+			t.Fatal(err)
+		}
+		defer db.Free()
+
+		insertIndexTestDocs(t, db, 0, 5)
+
+		aboveScore := func(results []ndb.Chunk, minScore float32) []ndb.Chunk {
+			above := []ndb.Chunk{}
+			for _, result := range results {
+				if result.Score >= minScore {
+					above = append(above, result)
+				}
+			}
+			return above
+		}
+
+		for _, constraints := range []ndb.Constraints{nil, {"type": ndb.EqualTo("a")}} {
+			// Both queries are run twice so that cached results are also checked.
+			for round := 0; round < 2; round++ {
+				full, err := db.Query("k0 k1", 10, constraints)
+				if err != nil {
+					t.Fatal(err)
+				}
+				if len(full) < 4 {
+					t.Fatalf("expected at least 4 results, got %d", len(full))
+				}
+				minScore := (full[1].Score + full[len(full)-1].Score) / 2
+
+				limited, err := db.QueryWithLimits("k0 k1", 10, constraints, ndb.QueryLimits{MinScore: minScore}, ndb.AllFields)
+				if err != nil {
+					t.Fatal(err)
+				}
+				if expected := aboveScore(full, minScore); len(limited) == 0 || !reflect.DeepEqual(limited, expected) {
+					t.Fatalf("expected %v got %v", expected, limited)
+				}
+			}
+		}
+
+		candidates, err := db.Query("k0 k1", 5, nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+		// A different topk than above so that the results are not cached.
+		budgeted, err := db.QueryWithLimits("k0 k1", 9, ndb.Constraints{"type": ndb.EqualTo("a")}, ndb.QueryLimits{MaxCandidates: 5}, ndb.AllFields)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(budgeted) > 5 {
+			t.Fatalf("expected at most 5 results, got %d", len(budgeted))
+		}
+		for _, result := range budgeted {
+			if result.Metadata["type"] != "a" || !slices.ContainsFunc(candidates, func(c ndb.Chunk) bool { return c.Id == result.Id }) {
+				t.Fatalf("result is not a matching candidate: %+v", result)
+			}
+		}
+
+		if _, err := db.QueryWithLimits("k0 k1", 10, nil, ndb.QueryLimits{MaxCandidates: -1}, ndb.AllFields); err == nil {
+			t.Fatal("expected error for negative max candidates")
+		}
+	}
+}
+
+func TestStats(t *testing.T) {
+	db, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{MetadataIndexes: []string{"type"}, QueryCacheSize: 16})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	insertIndexTestDocs(t, db, 0, 5)
+
+	results := 0
+	for _, constraints := range []ndb.Constraints{nil, nil, {"type": ndb.EqualTo("a")}} {
+		chunks, err := db.Query("k0 k1", 5, constraints)
+		if err != nil {
+			t.Fatal(err)
+		}
+		results += len(chunks)
+	}
+
+	stats := db.Stats()
+
+	expected := map[string]uint64{
+		"queries":         3,
+		"results":         uint64(results),
+		"cache_hits":      1,
+		"cache_misses":    2,
+		"inserted_chunks": 50,
+	}
+	for name, value := range expected {
+		if stats.Counters[name] != value {
+			t.Fatalf("expected %s to be %d, got %d", name, value, stats.Counters[name])
+		}
+	}
+	if stats.Counters["candidates"] < uint64(results)-5 || stats.Counters["result_bytes"] == 0 {
+		t.Fatalf("unexpected counters %v", stats.Counters)
+	}
+
+	expectedCalls := map[string]uint64{
+		"cache_lookup":  3,
+		"materialize":   3,
+		"engine_insert": 5,
+		"index_update":  5,
+	}
+	for name, calls := range expectedCalls {
+		if stats.Stages[name].Count != calls {
+			t.Fatalf("expected %d calls to %s, got %d", calls, name, stats.Stages[name].Count)
+		}
+	}
+	if stats.Stages["engine_query"].Count+stats.Stages["engine_rank"].Count != 2 {
+		t.Fatalf("expected 2 engine calls, got %+v", stats.Stages)
+	}
+
+	for name, stage := range stats.Stages {
+		total := uint64(0)
+		for _, count := range stage.Buckets {
+			total += count
+		}
+		if total != stage.Count || (stage.Count > 0 && stage.Sum <= 0) {
+			t.Fatalf("inconsistent histogram for %s: %+v", name, stage)
+		}
+	}
+}
+
+func TestConcurrentQueriesDuringUpdates(t *testing.T) {
+	db, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{MetadataIndexes: []string{"n"}, QueryCacheSize: 16})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	insertIndexTestDocs(t, db, 0, 5)
+
+	done := make(chan struct{})
+	errs := make(chan error, 8)
+	var readers sync.WaitGroup
+
+	for r := 0; r < 4; r++ {
+		readers.Add(1)
+		go func() {
+			defer readers.Done()
+			for {
+				select {
+				case <-done:
+					return
+				default:
+				}
+
+				// Chunks with n < 5 are never deleted, so they are always returned.
+				results, err := db.Query("k0 k1", 5, ndb.Constraints{"n": ndb.LessThan(5)})
+				if err != nil {
+					errs <- err
+					return
+				}
+				if len(results) == 0 {
+					errs <- fmt.Errorf("expected results for query")
+					return
+				}
+				if _, err := db.Sources(); err != nil {
+					errs <- err
+					return
+				}
+			}
+		}()
+	}
+
+	for doc := 5; doc < 15; doc++ {
+		insertIndexTestDocs(t, db, doc, doc+1)
+		if err := db.Finetune([]string{"k2 k3"}, []uint64{uint64(doc * 10)}); err != nil {
+			t.Fatal(err)
+		}
+		if err := db.Associate([]string{"x"}, []string{"k0"}, 4); err != nil {
+			t.Fatal(err)
+		}
+		if err := db.Delete(strconv.Itoa(doc-3), false); err != nil {
+			t.Fatal(err)
+		}
+		if err := db.Prune(); err != nil {
+			t.Fatal(err)
+		}
+		if err := db.Save(t.TempDir()); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	close(done)
+	readers.Wait()
+	close(errs)
+	for err := range errs {
+		t.Fatal(err)
+	}
+
+	sources, err := db.Sources()
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(sources) != 5 {
+		t.Fatalf("expected 5 sources after updates, got %d", len(sources))
+	}
+}
+
+func TestInsertBatch(t *testing.T) {
+	docs := []ndb.Document{}
+	for i := 0; i < 20; i++ {
+		doc := ndb.Document{
+			Document: fmt.Sprintf("document_%d", i),
+			DocId:    strconv.Itoa(i % 15),
+			Chunks:   []string{intString(i*10, (i+1)*10), intString(i*10, i*10+5)},
+		}
+		if i%2 == 0 {
+			doc.Metadata = []map[string]interface{}{
+				{"type": "first", "n": -i, "x": float32(i) / 4, "even": true},
+				{"type": "second", "n": i * 1000, "x": float64(i), "even": true},
+			}
+		}
+		if i%3 == 0 {
+			version := uint(7 + i)
+			doc.Version = &version
+		}
+		docs = append(docs, doc)
+	}
+
+	options := ndb.Options{MetadataIndexes: []string{"type"}}
+	batched, err := ndb.NewWithOptions(t.TempDir(), options)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer batched.Free()
+
+	reference, err := ndb.NewWithOptions(t.TempDir(), options)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer reference.Free()
+
+	if err := batched.InsertBatch(docs); err != nil {
+		t.Fatal(err)
+	}
+	for _, doc := range docs {
+		if err := reference.Insert(doc.Document, doc.DocId, doc.Chunks, doc.Metadata, doc.Version); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	for i := 0; i < 20; i++ {
+		for _, constraints := range []ndb.Constraints{nil, {"type": ndb.EqualTo("second")}} {
+			query := intString(i*10, (i+1)*10)
+			expected, err := reference.Query(query, 5, constraints)
+			if err != nil {
+				t.Fatal(err)
+			}
+			actual, err := batched.Query(query, 5, constraints)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if (constraints == nil && len(actual) == 0) || !reflect.DeepEqual(actual, expected) {
+				t.Fatalf("query %d: expected %v got %v", i, expected, actual)
+			}
+		}
+	}
+
+	expectedSources, err := reference.Sources()
+	if err != nil {
+		t.Fatal(err)
+	}
+	actualSources, err := batched.Sources()
+	if err != nil {
+		t.Fatal(err)
+	}
+	sortSources := func(sources []ndb.Source) {
+		slices.SortFunc(sources, func(a, b ndb.Source) int { return strings.Compare(a.Document, b.Document) })
+	}
+	sortSources(expectedSources)
+	sortSources(actualSources)
+	if !reflect.DeepEqual(actualSources, expectedSources) {
+		t.Fatalf("expected sources %v got %v", expectedSources, actualSources)
+	}
+
+	invalid := []ndb.Document{{Document: "doc", DocId: "new", Chunks: []string{"a"}}, {Document: "doc", DocId: ""}}
+	if err := batched.InsertBatch(invalid); err == nil {
+		t.Fatal("expected error for invalid document")
+	}
+	if err := batched.InsertBatch(nil); err != nil {
+		t.Fatal(err)
+	}
+	sources, err := batched.Sources()
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(sources) != len(actualSources) {
+		t.Fatal("no documents should be inserted if the batch is invalid")
+	}
+}
+
+func TestInsertEncoded(t *testing.T) {
+	encoded, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer encoded.Free()
+
+	reference, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer reference.Free()
+
+	for i := 0; i < 10; i++ {
+		version := uint(i + 1)
+		doc := ndb.Document{
+			Document: fmt.Sprintf("document_%d", i),
+			DocId:    strconv.Itoa(i % 7),
+			Chunks:   []string{intString(i*10, (i+1)*10), intString(i*10, i*10+5)},
+			Metadata: []map[string]interface{}{{"n": i, "s": "a"}, {"n": -i, "f": float32(i) / 2}},
+			Version:  &version,
+		}
+		data, err := ndb.EncodeDocuments([]ndb.Document{doc})
+		if err != nil {
+			t.Fatal(err)
+		}
+		if err := encoded.InsertEncoded(data); err != nil {
+			t.Fatal(err)
+		}
+		if err := reference.Insert(doc.Document, doc.DocId, doc.Chunks, doc.Metadata, doc.Version); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	for i := 0; i < 10; i++ {
+		query := intString(i*10, (i+1)*10)
+		expected, err := reference.Query(query, 5, nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+		actual, err := encoded.Query(query, 5, nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(actual) == 0 || !reflect.DeepEqual(actual, expected) {
+			t.Fatalf("query %d: expected %v got %v", i, expected, actual)
+		}
+	}
+
+	if _, err := ndb.EncodeDocuments([]ndb.Document{{Document: "doc", DocId: ""}}); err == nil {
+		t.Fatal("expected error for invalid document")
+	}
+	if err := encoded.InsertEncoded([]byte{1, 2, 3}); err == nil {
+		t.Fatal("expected error for malformed batch")
+	}
+
+	// Counts that are larger than the rest of the batch can hold are rejected
+	// before anything is allocated for them.
+	const huge = 1 << 40
+	// A batch without metadata keys with a document "d" with doc id "i".
+	doc := []byte{0, 1, 1, 'd', 1, 'i', 0}
+	corrupt := map[string][]byte{
+		"documents":        binary.AppendUvarint([]byte{0}, huge),
+		"chunks":           binary.AppendUvarint(slices.Clone(doc), huge),
+		"metadata entry":   binary.AppendUvarint(append(slices.Clone(doc), 1, 1, 'x'), huge),
+		"embeddings":       binary.AppendUvarint(append(slices.Clone(doc), 1, 1, 'x', 0), huge),
+		"embedding values": binary.AppendUvarint(append(slices.Clone(doc), 1, 1, 'x', 0, 1), huge),
+	}
+	for what, data := range corrupt {
+		err := encoded.InsertEncoded(data)
+		if err == nil || !strings.Contains(err.Error(), what) {
+			t.Fatalf("expected an error for a batch with too many %s, got %v", what, err)
+		}
+	}
+}
+
+func TestInsertAsync(t *testing.T) {
+	docs := []ndb.Document{}
+	for i := 0; i < 20; i++ {
+		docs = append(docs, ndb.Document{
+			Document: fmt.Sprintf("document_%d", i),
+			DocId:    strconv.Itoa(i),
+			Chunks:   []string{intString(i*10, (i+1)*10), intString(i*10, i*10+5)},
+			Metadata: []map[string]interface{}{{"n": i}, {"n": -i}},
+		})
+	}
+
+	options := ndb.Options{MetadataIndexes: []string{"n"}}
+	staged, err := ndb.NewWithOptions(t.TempDir(), options)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer staged.Free()
+
+	reference, err := ndb.NewWithOptions(t.TempDir(), options)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer reference.Free()
+
+	if err := reference.InsertBatch(docs); err != nil {
+		t.Fatal(err)
+	}
+
+	var lastSeq uint64
+	for start := 0; start < len(docs); start += 5 {
+		seq, err := staged.InsertAsync(docs[start : start+5])
+		if err != nil {
+			t.Fatal(err)
+		}
+		if seq <= lastSeq {
+			t.Fatalf("expected increasing sequence numbers, got %d after %d", seq, lastSeq)
+		}
+		lastSeq = seq
+	}
+	if err := staged.WaitForIndexed(lastSeq); err != nil {
+		t.Fatal(err)
+	}
+
+	for i := 0; i < 20; i++ {
+		for _, constraints := range []ndb.Constraints{nil, {"n": ndb.GreaterThan(3)}} {
+			query := intString(i*10, (i+1)*10)
+			expected, err := reference.Query(query, 5, constraints)
+			if err != nil {
+				t.Fatal(err)
+			}
+			actual, err := staged.Query(query, 5, constraints)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if (constraints == nil && len(actual) == 0) || !reflect.DeepEqual(actual, expected) {
+				t.Fatalf("query %d: expected %v got %v", i, expected, actual)
+			}
+		}
+	}
+
+	if err := staged.WaitForIndexed(lastSeq + 100); err == nil {
+		t.Fatal("expected error waiting for a batch that was not staged")
+	}
+	if _, err := staged.InsertAsync([]ndb.Document{{Document: "doc", DocId: ""}}); err == nil {
+		t.Fatal("expected error for invalid document")
+	}
+
+	// Updates made after InsertAsync returns are applied after the staged
+	// documents, even if they have not been indexed yet.
+	if _, err := staged.InsertAsync([]ndb.Document{{Document: "late", DocId: "late", Chunks: []string{"a b c"}}}); err != nil {
+		t.Fatal(err)
+	}
+	if err := staged.Delete("late", false); err != nil {
+		t.Fatal(err)
+	}
+	if err := staged.Flush(); err != nil {
+		t.Fatal(err)
+	}
+	sources, err := staged.Sources()
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(sources) != len(docs) {
+		t.Fatalf("expected %d sources got %d", len(docs), len(sources))
+	}
+}
+
+// hybridTestEmbedding returns a pseudo random embedding for chunk i.
+func hybridTestEmbedding(i int) []float32 {
+	embedding := make([]float32, 16)
+	for j := range embedding {
+		// splitmix64
+		hash := uint64(i*len(embedding)+j+1) * 0x9e3779b97f4a7c15
+		hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9
+		hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb
+		hash ^= hash >> 31
+		embedding[j] = float32(hash>>40)/(1<<24) - 0.5
+	}
+	return embedding
+}
+
+func TestHybridQuery(t *testing.T) {
+	const nChunks = 300
+
+	savePath := t.TempDir()
+	db, err := ndb.NewWithOptions(savePath, ndb.Options{EmbeddingDim: 16, MetadataIndexes: []string{"group"}})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	docs := []ndb.Document{}
+	for d := 0; d < nChunks/10; d++ {
+		doc := ndb.Document{Document: fmt.Sprintf("doc_%d", d), DocId: strconv.Itoa(d)}
+		for i := d * 10; i < (d+1)*10; i++ {
+			doc.Chunks = append(doc.Chunks, fmt.Sprintf("chunk w%d", i))
+			doc.Metadata = append(doc.Metadata, map[string]interface{}{"group": i % 4, "parity": i % 2})
+			doc.Embeddings = append(doc.Embeddings, hybridTestEmbedding(i))
+		}
+		docs = append(docs, doc)
+	}
+	// A document without embeddings, which only the lexical retrieval finds.
+	docs = append(docs, ndb.Document{Document: "plain", DocId: "plain", Chunks: []string{"apple banana"}})
+	if err := db.InsertBatch(docs); err != nil {
+		t.Fatal(err)
+	}
+
+	vectorOnly := ndb.DefaultHybridOptions()
+	vectorOnly.LexicalWeight = 0
+
+	// checkNearest checks that chunk i is the nearest chunk to its embedding,
+	// with the results constrained to chunks with the same value of key if
+	// key is not empty.
+	checkNearest := func(db ndb.NeuralDB, i int, key string) {
+		values := map[string]int{"group": i % 4, "parity": i % 2}
+		var constraints ndb.Constraints
+		if key != "" {
+			constraints = ndb.Constraints{key: ndb.EqualTo(values[key])}
+		}
+		results, err := db.HybridQuery("", hybridTestEmbedding(i), 5, constraints, vectorOnly, ndb.AllFields)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(results) != 5 || results[0].Text != fmt.Sprintf("chunk w%d", i) {
+			t.Fatalf("expected chunk %d to be nearest to its embedding, got %v", i, results)
+		}
+		for _, result := range results {
+			if key != "" && result.Metadata[key] != values[key] {
+				t.Fatalf("result %v does not satisfy the constraint on %s", result, key)
+			}
+		}
+	}
+
+	for i := 0; i < nChunks; i += 7 {
+		checkNearest(db, i, "")
+		// Constraints on the indexed key restrict the search with the index,
+		// constraints on other keys are checked on the stored chunks.
+		checkNearest(db, i, "group")
+		checkNearest(db, i, "parity")
+	}
+
+	fused, err := db.HybridQuery("apple", hybridTestEmbedding(42), 3, nil, ndb.DefaultHybridOptions(), ndb.AllFields)
+	if err != nil {
+		t.Fatal(err)
+	}
+	texts := []string{}
+	for _, result := range fused {
+		texts = append(texts, result.Text)
+	}
+	if len(fused) != 3 || !slices.Contains(texts, "apple banana") || !slices.Contains(texts, "chunk w42") {
+		t.Fatalf("expected both retrievals in the fused results, got %v", fused)
+	}
+	if fused[0].Score != fused[1].Score || fused[0].Score != float32(1.0/61) {
+		t.Fatalf("expected the top result of each retrieval to score 1/61, got %v", fused)
+	}
+
+	if _, err := db.HybridQuery("", hybridTestEmbedding(1)[:8], 5, nil, vectorOnly, ndb.AllFields); err == nil {
+		t.Fatal("expected an error for an embedding of the wrong dimension")
+	}
+
+	if err := db.Delete("4", false); err != nil {
+		t.Fatal(err)
+	}
+	results, err := db.HybridQuery("", hybridTestEmbedding(42), 5, nil, vectorOnly, ndb.AllFields)
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, result := range results {
+		if result.DocId == "4" {
+			t.Fatalf("deleted chunk %v was returned", result)
+		}
+	}
+
+	checkpoint := filepath.Join(t.TempDir(), "checkpoint")
+	if err := db.Save(checkpoint); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := ndb.NewWithOptions(checkpoint, ndb.Options{EmbeddingDim: 8, ReadOnly: true}); err == nil {
+		t.Fatal("expected an error for a mismatched embedding dimension")
+	}
+	loaded, err := ndb.NewWithOptions(checkpoint, ndb.Options{ReadOnly: true})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer loaded.Free()
+	for i := 0; i < nChunks; i += 11 {
+		if i/10 != 4 {
+			checkNearest(loaded, i, "")
+		}
+	}
+}
+
+func TestShardedHybridQuery(t *testing.T) {
+	// Each group has more chunks than a vector search scores exactly, so the
+	// constrained vector search checks the ids it visits against the index.
+	const nChunks = 10000
+	const nGroups = 2
+
+	db, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{NumShards: 4, EmbeddingDim: 16, MetadataIndexes: []string{"group"}})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	// The documents are inserted one at a time so that the ids of each group
+	// are inserted into the index out of order as the documents move between
+	// shards.
+	for d := 0; d < nChunks/200; d++ {
+		doc := ndb.Document{Document: fmt.Sprintf("doc_%d", d), DocId: strconv.Itoa(d)}
+		for i := d * 200; i < (d+1)*200; i++ {
+			doc.Chunks = append(doc.Chunks, fmt.Sprintf("chunk w%d", i))
+			doc.Metadata = append(doc.Metadata, map[string]interface{}{"group": i % nGroups})
+			doc.Embeddings = append(doc.Embeddings, hybridTestEmbedding(i))
+		}
+		if err := db.InsertBatch([]ndb.Document{doc}); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	lexicalOnly := ndb.DefaultHybridOptions()
+	lexicalOnly.VectorWeight = 0
+	vectorOnly := ndb.DefaultHybridOptions()
+	vectorOnly.LexicalWeight = 0
+
+	for i := 0; i < nChunks; i += 97 {
+		constraints := ndb.Constraints{"group": ndb.EqualTo(i % nGroups)}
+		text := fmt.Sprintf("chunk w%d", i)
+		for _, options := range []ndb.HybridOptions{lexicalOnly, vectorOnly, ndb.DefaultHybridOptions()} {
+			results, err := db.HybridQuery(fmt.Sprintf("w%d", i), hybridTestEmbedding(i), 5, constraints, options, ndb.AllFields)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if len(results) == 0 || results[0].Text != text {
+				t.Fatalf("chunk %d: expected it to be the top result with options %+v, got %v", i, options, results)
+			}
+			for _, result := range results {
+				if result.Metadata["group"] != i%nGroups {
+					t.Fatalf("result %v does not satisfy the constraint on group", result)
+				}
+			}
+		}
+	}
+}
+
+func TestHybridQueryReadsChunkStore(t *testing.T) {
+	const nChunks = 200
+
+	savePath := t.TempDir()
+	db, err := ndb.NewWithOptions(savePath, ndb.Options{NumShards: 2, EmbeddingDim: 16, StoreChunks: true})
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	docs := []ndb.Document{}
+	for d := 0; d < nChunks/10; d++ {
+		doc := ndb.Document{Document: fmt.Sprintf("doc_%d", d), DocId: strconv.Itoa(d)}
+		for i := d * 10; i < (d+1)*10; i++ {
+			doc.Chunks = append(doc.Chunks, fmt.Sprintf("chunk w%d", i))
+			doc.Metadata = append(doc.Metadata, map[string]interface{}{"parity": i % 2})
+			doc.Embeddings = append(doc.Embeddings, hybridTestEmbedding(i))
+		}
+		docs = append(docs, doc)
+	}
+	if err := db.InsertBatch(docs); err != nil {
+		t.Fatal(err)
+	}
+
+	vectorOnly := ndb.DefaultHybridOptions()
+	vectorOnly.LexicalWeight = 0
+
+	deleted := ""
+	checkNearest := func(db ndb.NeuralDB, i int) {
+		results, err := db.HybridQuery("", hybridTestEmbedding(i), 5, nil, vectorOnly, ndb.AllFields)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(results) != 5 {
+			t.Fatalf("expected 5 results for chunk %d, got %v", i, results)
+		}
+		top := results[0]
+		if top.Text != fmt.Sprintf("chunk w%d", i) || top.DocId != strconv.Itoa(i/10) ||
+			top.Document != fmt.Sprintf("doc_%d", i/10) || top.Metadata["parity"] != i%2 {
+			t.Fatalf("expected chunk %d to be nearest to its embedding, got %v", i, top)
+		}
+		for _, result := range results {
+			if result.DocId == deleted {
+				t.Fatalf("deleted chunk %v was returned", result)
+			}
+		}
+	}
+
+	// checkNoCopies checks that the vector index did not store its own copy of
+	// the chunks in the ndb directory.
+	checkNoCopies := func(path string) {
+		copies, err := filepath.Glob(filepath.Join(path, "vector_index.chunks.*"))
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(copies) != 0 {
+			t.Fatalf("expected the vector index to read the chunk store, found %v", copies)
+		}
+	}
+
+	for i := 0; i < nChunks; i += 7 {
+		checkNearest(db, i)
+	}
+	checkNoCopies(savePath)
+
+	deleted = "3"
+	if err := db.Delete(deleted, false); err != nil {
+		t.Fatal(err)
+	}
+	checkpoint := filepath.Join(t.TempDir(), "checkpoint")
+	if err := db.Save(checkpoint); err != nil {
+		t.Fatal(err)
+	}
+	db.Free()
+
+	loaded, err := ndb.New(checkpoint)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer loaded.Free()
+	for i := 0; i < nChunks; i += 11 {
+		if i/10 != 3 {
+			checkNearest(loaded, i)
+		}
+	}
+	checkNoCopies(checkpoint)
+}
+
+func TestHybridQueryWithoutEmbeddings(t *testing.T) {
+	db, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	doc := ndb.Document{Document: "a", DocId: "a", Chunks: []string{"x"}, Embeddings: [][]float32{{1, 2}}}
+	if err := db.InsertBatch([]ndb.Document{doc}); err == nil {
+		t.Fatal("expected an error inserting embeddings without an embedding dimension")
+	}
+	if _, err := db.HybridQuery("x", []float32{1, 2}, 5, nil, ndb.DefaultHybridOptions(), ndb.AllFields); err == nil {
+		t.Fatal("expected an error for a hybrid query without an embedding dimension")
+	}
 }
 
-func TestReturnsCorrectChunkData(t *testing.T) {
+func TestFinetuning(t *testing.T) {
 	db, err := ndb.New(t.TempDir())
 	if err != nil {
 		t.Fatal(err)
 	}
 
-	for i := 0; i < 20; i++ {
-		docId := strconv.Itoa(i)
-		doc := fmt.Sprintf("document_%d", i)
+	constraint := map[string]interface{}{"key": true}
+	err = db.Insert(
+		"doc", "id",
+		[]string{intString(0, 10), intString(0, 9), intString(0, 8),
+			intString(10, 20), intString(20, 30), intString(30, 40)},
+		[]map[string]interface{}{{}, constraint, constraint, {}, {}, {}},
+		nil)
+	if err != nil {
+		t.Fatal(err)
+	}
 
-		meta1 := map[string]interface{}{"id": i, "type": "first"}
-		meta2 := map[string]interface{}{"id": i, "type": "second"}
+	constraints := ndb.Constraints{"key": ndb.EqualTo(true)}
+	query := intString(0, 10) + " x y z"
+
+	checkQuery(t, db, query, nil, []uint64{0, 1, 2})
+	checkQuery(t, db, query, constraints, []uint64{1, 2})
+
+	err = db.Finetune([]string{"o p", "x y z", "t q v"}, []uint64{4, 2, 3})
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	checkQuery(t, db, query, nil, []uint64{2, 0, 1})
+	checkQuery(t, db, query, constraints, []uint64{2, 1})
+}
 
+func TestBufferedFeedback(t *testing.T) {
+	query := intString(0, 10) + " x y z"
+	open := func(path string, options ndb.Options) ndb.NeuralDB {
+		db, err := ndb.NewWithOptions(path, options)
+		if err != nil {
+			t.Fatal(err)
+		}
+		return db
+	}
+	newDb := func(options ndb.Options) ndb.NeuralDB {
+		db := open(t.TempDir(), options)
 		err := db.Insert(
-			doc, docId,
-			[]string{intString(i*10, (i+1)*10), intString(i*10, i*10+5)},
-			[]map[string]interface{}{meta1, meta2},
-			nil)
+			"doc", "id",
+			[]string{intString(0, 10), intString(0, 9), intString(0, 8),
+				intString(10, 20), intString(20, 30), intString(30, 40)},
+			nil, nil)
 		if err != nil {
 			t.Fatal(err)
 		}
+		return db
 	}
-
-	for i := 0; i < 20; i++ {
-		query := intString(i*10, (i+1)*10)
-
-		results, err := db.Query(query, 5, nil)
+	finetune := func(db ndb.NeuralDB) {
+		// The repeated feedback is only applied once.
+		err := db.Finetune([]string{"o p", "x y z", "x y z", "t q v"}, []uint64{4, 2, 2, 3})
 		if err != nil {
 			t.Fatal(err)
 		}
-
-		if len(results) != 2 {
-			t.Fatal("expected 2 results")
+	}
+	checkPending := func(db ndb.NeuralDB, expected int) {
+		if pending := db.PendingFeedback(); pending != expected {
+			t.Fatalf("expected %d pending feedback got %d", expected, pending)
 		}
+	}
 
-		docId := strconv.Itoa(i)
-		doc := fmt.Sprintf("document_%d", i)
+	db := newDb(ndb.Options{BufferFeedback: true})
+	defer db.Free()
 
-		if results[0].Id != uint64(2*i) || results[1].Id != uint64((2*i)+1) ||
-			results[0].Text != query || results[1].Text != intString(i*10, i*10+5) ||
-			results[0].Document != doc || results[1].Document != doc ||
-			results[0].DocId != docId || results[1].DocId != docId ||
-			results[0].DocVersion != 1 || results[1].DocVersion != 1 {
-			t.Fatal("invalid results")
-		}
+	finetune(db)
+	checkPending(db, 4)
+	checkQuery(t, db, query, nil, []uint64{0, 1, 2})
 
-		if len(results[0].Metadata) != 2 || len(results[1].Metadata) != 2 ||
-			results[0].Metadata["id"].(int) != i || results[1].Metadata["id"].(int) != i ||
-			results[0].Metadata["type"].(string) != "first" || results[1].Metadata["type"].(string) != "second" {
-			t.Fatal("invalid metadata")
+	// Pending feedback is saved with checkpoints, and applied when they are
+	// opened without buffering.
+	buffered, unbuffered := filepath.Join(t.TempDir(), "buffered"), filepath.Join(t.TempDir(), "unbuffered")
+	for _, path := range []string{buffered, unbuffered} {
+		if err := db.Save(path); err != nil {
+			t.Fatal(err)
 		}
+	}
 
-		constrainedResults, err := db.Query(query, 5, ndb.Constraints{"type": ndb.EqualTo("second")})
-		if err != nil {
-			t.Fatal(err)
+	if err := db.ApplyPendingFeedback(); err != nil {
+		t.Fatal(err)
+	}
+	checkPending(db, 0)
+	checkQuery(t, db, query, nil, []uint64{2, 0, 1})
+	if err := db.ApplyPendingFeedback(); err != nil {
+		t.Fatal(err)
+	}
+
+	reopened := open(buffered, ndb.Options{BufferFeedback: true})
+	defer reopened.Free()
+	checkPending(reopened, 4)
+	checkQuery(t, reopened, query, nil, []uint64{0, 1, 2})
+	if err := reopened.ApplyPendingFeedback(); err != nil {
+		t.Fatal(err)
+	}
+	checkQuery(t, reopened, query, nil, []uint64{2, 0, 1})
+
+	applied := open(unbuffered, ndb.Options{})
+	defer applied.Free()
+	checkPending(applied, 0)
+	checkQuery(t, applied, query, nil, []uint64{2, 0, 1})
+	if err := applied.ApplyPendingFeedback(); err != nil {
+		t.Fatal(err)
+	}
+
+	// An ndb without buffering only keeps a feedback log while it replays the
+	// feedback left pending by an earlier open.
+	checkNoFeedbackLog := func(path string) {
+		if info, err := os.Stat(filepath.Join(path, "feedback.log")); err == nil && info.Size() > 0 {
+			t.Fatalf("expected no pending feedback log in %s, it has %d bytes", path, info.Size())
 		}
+	}
+	checkNoFeedbackLog(unbuffered)
+	plainPath := t.TempDir()
+	plain := open(plainPath, ndb.Options{})
+	defer plain.Free()
+	if _, err := os.Stat(filepath.Join(plainPath, "feedback.log")); !os.IsNotExist(err) {
+		t.Fatalf("expected an ndb without buffering not to create a feedback log, got %v", err)
+	}
+	plainCheckpoint := filepath.Join(t.TempDir(), "plain")
+	if err := plain.Save(plainCheckpoint); err != nil {
+		t.Fatal(err)
+	}
+	checkNoFeedbackLog(plainCheckpoint)
 
-		if len(constrainedResults) != 1 || constrainedResults[0].Id != uint64((2*i)+1) {
-			t.Fatal("incorrect constrained results")
+	sized := newDb(ndb.Options{BufferFeedback: true, FeedbackBatchSize: 6})
+	defer sized.Free()
+	finetune(sized)
+	checkQuery(t, sized, query, nil, []uint64{0, 1, 2})
+	if err := sized.Associate([]string{"a"}, []string{"b"}, 0); err != nil {
+		t.Fatal(err)
+	}
+	checkPending(sized, 5)
+	if err := sized.Associate([]string{"c"}, []string{"d"}, 0); err != nil {
+		t.Fatal(err)
+	}
+	checkPending(sized, 0)
+	checkQuery(t, sized, query, nil, []uint64{2, 0, 1})
+
+	timed := newDb(ndb.Options{BufferFeedback: true, FeedbackInterval: 10 * time.Millisecond})
+	defer timed.Free()
+	finetune(timed)
+	for deadline := time.Now().Add(10 * time.Second); timed.PendingFeedback() > 0; {
+		if time.Now().After(deadline) {
+			t.Fatal("buffered feedback was not applied in the background")
 		}
+		time.Sleep(5 * time.Millisecond)
+	}
+	checkQuery(t, timed, query, nil, []uint64{2, 0, 1})
+
+	if _, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{FeedbackBatchSize: 10}); err == nil {
+		t.Fatal("expected error for a feedback batch size without buffering")
 	}
 }
 
-func TestFinetuning(t *testing.T) {
+func TestFinetuneMultiLabel(t *testing.T) {
 	db, err := ndb.New(t.TempDir())
 	if err != nil {
 		t.Fatal(err)
 	}
+	defer db.Free()
 
-	constraint := map[string]interface{}{"key": true}
 	err = db.Insert(
 		"doc", "id",
-		[]string{intString(0, 10), intString(0, 9), intString(0, 8),
-			intString(10, 20), intString(20, 30), intString(30, 40)},
-		[]map[string]interface{}{{}, constraint, constraint, {}, {}, {}},
-		nil)
+		[]string{intString(0, 10), intString(10, 20), intString(20, 30), intString(30, 40)},
+		nil, nil)
 	if err != nil {
 		t.Fatal(err)
 	}
 
-	constraints := ndb.Constraints{"key": ndb.EqualTo(true)}
 	query := intString(0, 10) + " x y z"
+	checkQuery(t, db, query, nil, []uint64{0})
 
-	checkQuery(t, db, query, nil, []uint64{0, 1, 2})
-	checkQuery(t, db, query, constraints, []uint64{1, 2})
+	err = db.FinetuneMultiLabel([]string{"x y z", "o p"}, [][]uint64{{3, 2}, {1}})
+	if err != nil {
+		t.Fatal(err)
+	}
 
-	err = db.Finetune([]string{"o p", "x y z", "t q v"}, []uint64{4, 2, 3})
+	results, err := db.Query(query, 3, nil)
 	if err != nil {
 		t.Fatal(err)
 	}
+	ids := []uint64{}
+	for _, result := range results {
+		ids = append(ids, result.Id)
+	}
+	slices.Sort(ids)
+	if !reflect.DeepEqual(ids, []uint64{0, 2, 3}) {
+		t.Fatalf("expected both labels to be returned, got %v", ids)
+	}
 
-	checkQuery(t, db, query, nil, []uint64{2, 0, 1})
-	checkQuery(t, db, query, constraints, []uint64{2, 1})
+	if err := db.FinetuneMultiLabel([]string{"a"}, [][]uint64{{}}); err == nil {
+		t.Fatal("expected error for query without labels")
+	}
+	if err := db.FinetuneMultiLabel([]string{"a"}, nil); err == nil {
+		t.Fatal("expected error for mismatched lengths")
+	}
 }
 
 func TestDeletionWithFinetuning(t *testing.T) {
@@ -468,3 +2724,296 @@ func TestDocVersioning(t *testing.T) {
 		}
 	}
 }
+
+func TestDocCatalog(t *testing.T) {
+	db, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{MetadataIndexes: []string{"n"}, QueryCacheSize: 16})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	expected := []ndb.Source{}
+	for i := 0; i < 5; i++ {
+		for v := 1; v <= 3; v++ {
+			doc, docId := fmt.Sprintf("%d_%d", i, v), fmt.Sprintf("%d", i)
+			if err := db.Insert(doc, docId, []string{"a shared chunk"}, []map[string]interface{}{{"n": i}}, nil); err != nil {
+				t.Fatal(err)
+			}
+			expected = append(expected, ndb.Source{Document: doc, DocId: docId, DocVersion: uint32(v)})
+		}
+	}
+
+	allPages := func(db ndb.NeuralDB) []ndb.Source {
+		sources := []ndb.Source{}
+		for offset := 0; ; offset += 4 {
+			page, err := db.SourcesPage(offset, 4)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if len(page) == 0 {
+				return sources
+			}
+			sources = append(sources, page...)
+		}
+	}
+
+	// Pages after the last source of the previous page, starting after a
+	// source that sorts before every doc id.
+	allPagesAfter := func(db ndb.NeuralDB) []ndb.Source {
+		sources := []ndb.Source{}
+		after := ndb.Source{}
+		for {
+			page, err := db.SourcesAfter(after, 4)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if len(page) == 0 {
+				return sources
+			}
+			sources = append(sources, page...)
+			after = page[len(page)-1]
+		}
+	}
+
+	if sources := allPages(db); !reflect.DeepEqual(sources, expected) || db.NumSources() != len(expected) {
+		t.Fatalf("expected %v got %v (%d sources)", expected, sources, db.NumSources())
+	}
+	if sources := allPagesAfter(db); !reflect.DeepEqual(sources, expected) {
+		t.Fatalf("expected %v got %v", expected, sources)
+	}
+	if _, err := db.SourcesPage(-1, 4); err == nil {
+		t.Fatal("expected error for negative offset")
+	}
+	if _, err := db.SourcesAfter(ndb.Source{}, -1); err == nil {
+		t.Fatal("expected error for negative limit")
+	}
+
+	if err := db.DeleteVersion("1", 3); err != nil {
+		t.Fatal(err)
+	}
+	if err := db.Delete("2", false); err != nil {
+		t.Fatal(err)
+	}
+	if err := db.Delete("3", true); err != nil {
+		t.Fatal(err)
+	}
+
+	latest := map[string]uint32{"0": 3, "1": 2, "3": 3, "4": 3}
+	for _, docId := range []string{"0", "1", "2", "3", "4", "missing"} {
+		version, ok := db.LatestVersion(docId)
+		if expected, exists := latest[docId]; ok != exists || version != expected {
+			t.Fatalf("doc %s: expected latest version %d (%v) got %d (%v)", docId, expected, exists, version, ok)
+		}
+	}
+	if db.NumSources() != 9 {
+		t.Fatalf("expected 9 sources, got %d", db.NumSources())
+	}
+	if sources, pages := allPagesAfter(db), allPages(db); !reflect.DeepEqual(sources, pages) {
+		t.Fatalf("expected %v got %v", pages, sources)
+	}
+	// The source a page starts after does not have to exist.
+	page, err := db.SourcesAfter(ndb.Source{DocId: "2", DocVersion: 1}, 2)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(page) != 2 || page[0].DocId != "3" || page[0].DocVersion != 3 || page[1].DocId != "4" || page[1].DocVersion != 1 {
+		t.Fatalf("expected the sources after a deleted document, got %v", page)
+	}
+
+	for _, constraints := range []ndb.Constraints{nil, {"n": ndb.EqualTo(0)}} {
+		all, err := db.Query("shared chunk", 20, constraints)
+		if err != nil {
+			t.Fatal(err)
+		}
+
+		// Both queries are run twice so that cached results are also checked.
+		for round := 0; round < 2; round++ {
+			for _, topk := range []int{1, 20} {
+				results, err := db.QueryWithLimits("shared chunk", topk, constraints, ndb.QueryLimits{LatestVersionsOnly: true}, ndb.AllFields)
+				if err != nil {
+					t.Fatal(err)
+				}
+
+				expected := []ndb.Chunk{}
+				for _, result := range all {
+					if len(expected) < topk && result.DocVersion == latest[result.DocId] {
+						expected = append(expected, result)
+					}
+				}
+				if len(expected) == 0 || !reflect.DeepEqual(results, expected) {
+					t.Fatalf("topk %d constraints %v: expected %v got %v", topk, constraints, expected, results)
+				}
+			}
+		}
+	}
+
+	checkpoint := t.TempDir()
+	if err := db.Save(checkpoint); err != nil {
+		t.Fatal(err)
+	}
+	expected = allPages(db)
+
+	checkLoaded := func() {
+		loaded, err := ndb.NewWithOptions(checkpoint, ndb.Options{ReadOnly: true})
+		if err != nil {
+			t.Fatal(err)
+		}
+		defer loaded.Free()
+
+		if sources := allPages(loaded); !reflect.DeepEqual(sources, expected) {
+			t.Fatalf("expected %v got %v", expected, sources)
+		}
+		if version, ok := loaded.LatestVersion("1"); !ok || version != 2 {
+			t.Fatalf("expected latest version 2 got %d (%v)", version, ok)
+		}
+	}
+	checkLoaded()
+
+	// Checkpoints without a catalog have it built from the engine's sources.
+	if err := os.Remove(filepath.Join(checkpoint, "doc_catalog")); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.Remove(filepath.Join(checkpoint, "doc_catalog.log")); err != nil && !os.IsNotExist(err) {
+		t.Fatal(err)
+	}
+	checkLoaded()
+}
+
+func TestChunkCursor(t *testing.T) {
+	db, err := ndb.NewWithOptions(t.TempDir(), ndb.Options{StoreChunks: true, NumShards: 2})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer db.Free()
+
+	insert := func(docId string, n int) {
+		chunks := []string{}
+		metadata := []map[string]interface{}{}
+		for c := 0; c < 3; c++ {
+			chunks = append(chunks, fmt.Sprintf("chunk %d of %s", c, docId))
+			metadata = append(metadata, map[string]interface{}{"n": n})
+		}
+		if err := db.Insert("doc "+docId, docId, chunks, metadata, nil); err != nil {
+			t.Fatal(err)
+		}
+	}
+	for i := 0; i < 4; i++ {
+		insert(fmt.Sprintf("%d", i), i)
+	}
+	insert("0", 10)
+
+	readAll := func(db ndb.NeuralDB, options ndb.ChunkCursorOptions) []ndb.Chunk {
+		cursor, err := db.ChunkCursor(options)
+		if err != nil {
+			t.Fatal(err)
+		}
+		defer cursor.Free()
+
+		chunks := []ndb.Chunk{}
+		for {
+			page, err := cursor.Next(2, ndb.AllFields)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if len(page) == 0 {
+				return chunks
+			}
+			chunks = append(chunks, page...)
+		}
+	}
+
+	all := readAll(db, ndb.ChunkCursorOptions{})
+	if len(all) != 15 {
+		t.Fatalf("expected 15 chunks got %d", len(all))
+	}
+	for i, chunk := range all {
+		if i > 0 && chunk.Id <= all[i-1].Id {
+			t.Fatalf("chunks are not in order of id: %v", all)
+		}
+		if chunk.Document != "doc "+chunk.DocId || !strings.HasSuffix(chunk.Text, " of "+chunk.DocId) || chunk.Score != 0 {
+			t.Fatalf("unexpected chunk %v", chunk)
+		}
+		if n := chunk.Metadata["n"].(int); (chunk.DocId == "0" && n != 10*int(chunk.DocVersion-1)) ||
+			(chunk.DocId != "0" && fmt.Sprintf("%d", n) != chunk.DocId) {
+			t.Fatalf("unexpected metadata for chunk %v", chunk)
+		}
+	}
+
+	filter := func(keep func(ndb.Chunk) bool) []ndb.Chunk {
+		return slices.DeleteFunc(slices.Clone(all), func(chunk ndb.Chunk) bool { return !keep(chunk) })
+	}
+
+	if chunks := readAll(db, ndb.ChunkCursorOptions{DocId: "0"}); !reflect.DeepEqual(chunks, filter(func(c ndb.Chunk) bool { return c.DocId == "0" })) || len(chunks) != 6 {
+		t.Fatalf("unexpected chunks for doc 0: %v", chunks)
+	}
+	if chunks := readAll(db, ndb.ChunkCursorOptions{DocId: "missing"}); len(chunks) != 0 {
+		t.Fatalf("expected no chunks got %v", chunks)
+	}
+	constraints := ndb.Constraints{"n": ndb.GreaterThan(1)}
+	if chunks := readAll(db, ndb.ChunkCursorOptions{Constraints: constraints}); !reflect.DeepEqual(chunks, filter(func(c ndb.Chunk) bool { return c.Metadata["n"].(int) > 1 })) || len(chunks) != 9 {
+		t.Fatalf("unexpected chunks for constraints: %v", chunks)
+	}
+	if chunks := readAll(db, ndb.ChunkCursorOptions{StartId: all[7].Id}); !reflect.DeepEqual(chunks, all[7:]) {
+		t.Fatalf("expected %v got %v", all[7:], chunks)
+	}
+
+	// A cursor keeps reading the chunks as they were when it was created.
+	cursor, err := db.ChunkCursor(ndb.ChunkCursorOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	first, err := cursor.Next(4, ndb.AllFields)
+	if err != nil {
+		t.Fatal(err)
+	}
+	insert("4", 4)
+	if err := db.Delete("1", false); err != nil {
+		t.Fatal(err)
+	}
+	if err := db.DeleteVersion("0", 1); err != nil {
+		t.Fatal(err)
+	}
+	for {
+		page, err := cursor.Next(4, ndb.AllFields)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(page) == 0 {
+			break
+		}
+		first = append(first, page...)
+	}
+	cursor.Free()
+	if !reflect.DeepEqual(first, all) {
+		t.Fatalf("expected %v got %v", all, first)
+	}
+
+	updated := readAll(db, ndb.ChunkCursorOptions{})
+	if len(updated) != 12 || slices.ContainsFunc(updated, func(c ndb.Chunk) bool {
+		return c.DocId == "1" || (c.DocId == "0" && c.DocVersion == 1)
+	}) || !slices.ContainsFunc(updated, func(c ndb.Chunk) bool { return c.DocId == "4" }) {
+		t.Fatalf("unexpected chunks after updates: %v", updated)
+	}
+
+	checkpoint := t.TempDir()
+	if err := db.Save(checkpoint); err != nil {
+		t.Fatal(err)
+	}
+	loaded, err := ndb.NewWithOptions(checkpoint, ndb.Options{ReadOnly: true})
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer loaded.Free()
+	if chunks := readAll(loaded, ndb.ChunkCursorOptions{}); !reflect.DeepEqual(chunks, updated) {
+		t.Fatalf("expected %v got %v", updated, chunks)
+	}
+
+	plain, err := ndb.New(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer plain.Free()
+	if _, err := plain.ChunkCursor(ndb.ChunkCursorOptions{}); err == nil {
+		t.Fatal("expected error for ndb without stored chunks")
+	}
+}